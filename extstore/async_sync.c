@@ -0,0 +1,98 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* async_sync.c
+ * KVSNS/extstore: asynchronous I/O for the backends without native support,
+ * the requests are run synchronously by the caller
+ */
+
+#include <stdlib.h>
+#include <kvsns/extstore.h>
+
+int extstore_async_read(kvsns_ino_t *ino,
+			off_t offset,
+			size_t buffer_size,
+			void *buffer,
+			extstore_cb_t cb,
+			void *arg)
+{
+	struct stat stat;
+	bool eof;
+	ssize_t rc;
+
+	if (!ino || !cb)
+		return -EINVAL;
+
+	memset(&stat, 0, sizeof(stat));
+	rc = extstore_read(ino, offset, buffer_size, buffer, &eof, &stat);
+	cb(arg, rc);
+
+	return 0;
+}
+
+int extstore_async_write(kvsns_ino_t *ino,
+			 off_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 kvsns_durability_t how,
+			 extstore_cb_t cb,
+			 void *arg)
+{
+	struct stat stat;
+	bool stable;
+	ssize_t rc;
+
+	if (!ino || !cb)
+		return -EINVAL;
+
+	memset(&stat, 0, sizeof(stat));
+	rc = extstore_write(ino, offset, buffer_size, buffer, how,
+			    &stable, &stat);
+	cb(arg, rc);
+
+	return 0;
+}
+
+void extstore_async_plug(void)
+{
+}
+
+int extstore_async_unplug(void)
+{
+	return 0;
+}
+
+void *extstore_buffer_alloc(size_t size)
+{
+	return malloc(size);
+}
+
+void extstore_buffer_free(void *buffer)
+{
+	free(buffer);
+}
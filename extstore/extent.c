@@ -0,0 +1,181 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* extent.c
+ * KVSNS/extstore: helpers for vectored I/O shared by the backends
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "extent.h"
+
+#define EXTENT_IOV_MAX 64
+
+int extent_check(const struct iovec *iov, int iovcnt,
+		 const kvsns_extent_t *ext, int extcnt, size_t *total)
+{
+	size_t mem = 0;
+	size_t file = 0;
+	int i;
+
+	if (!iov || !ext || iovcnt < 0 || extcnt < 0)
+		return -EINVAL;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > SSIZE_MAX - mem)
+			return -EINVAL;
+		mem += iov[i].iov_len;
+	}
+
+	for (i = 0; i < extcnt; i++) {
+		if (ext[i].offset < 0 || ext[i].len > SSIZE_MAX - file)
+			return -EINVAL;
+		file += ext[i].len;
+	}
+
+	if (mem != file)
+		return -EINVAL;
+
+	*total = mem;
+	return 0;
+}
+
+void extent_cursor_init(struct extent_cursor *cur,
+			const struct iovec *iov, int iovcnt)
+{
+	cur->iov = iov;
+	cur->iovcnt = iovcnt;
+	cur->idx = 0;
+	cur->skip = 0;
+}
+
+size_t extent_slice(struct extent_cursor *cur, size_t len,
+		    struct iovec *out, int outmax, int *outcnt)
+{
+	size_t done = 0;
+	size_t n;
+	int cnt = 0;
+
+	while (done < len && cnt < outmax && cur->idx < cur->iovcnt) {
+		n = cur->iov[cur->idx].iov_len - cur->skip;
+		if (n > len - done)
+			n = len - done;
+
+		if (n > 0) {
+			out[cnt].iov_base =
+				(char *)cur->iov[cur->idx].iov_base + cur->skip;
+			out[cnt].iov_len = n;
+			cnt += 1;
+		}
+
+		done += n;
+		cur->skip += n;
+		if (cur->skip == cur->iov[cur->idx].iov_len) {
+			cur->idx += 1;
+			cur->skip = 0;
+		}
+	}
+
+	*outcnt = cnt;
+	return done;
+}
+
+ssize_t extent_preadv(int fd, const struct iovec *iov, int iovcnt,
+		      const kvsns_extent_t *ext, int extcnt, bool *eof)
+{
+	struct iovec vec[EXTENT_IOV_MAX];
+	struct extent_cursor cur;
+	size_t total, len, n;
+	ssize_t done = 0;
+	ssize_t rc;
+	off_t offset;
+	int i, cnt;
+
+	rc = extent_check(iov, iovcnt, ext, extcnt, &total);
+	if (rc < 0)
+		return rc;
+
+	*eof = false;
+	extent_cursor_init(&cur, iov, iovcnt);
+	for (i = 0; i < extcnt; i++) {
+		offset = ext[i].offset;
+		for (len = ext[i].len; len > 0; len -= n) {
+			n = extent_slice(&cur, len, vec, EXTENT_IOV_MAX, &cnt);
+			rc = preadv(fd, vec, cnt, offset);
+			if (rc < 0)
+				return -errno;
+
+			done += rc;
+			if ((size_t)rc < n) {
+				*eof = true;
+				return done;
+			}
+			offset += n;
+		}
+	}
+
+	return done;
+}
+
+ssize_t extent_pwritev(int fd, const struct iovec *iov, int iovcnt,
+		       const kvsns_extent_t *ext, int extcnt, off_t *end)
+{
+	struct iovec vec[EXTENT_IOV_MAX];
+	struct extent_cursor cur;
+	size_t total, len, n;
+	ssize_t done = 0;
+	ssize_t rc;
+	off_t offset;
+	int i, cnt;
+
+	rc = extent_check(iov, iovcnt, ext, extcnt, &total);
+	if (rc < 0)
+		return rc;
+
+	*end = 0;
+	extent_cursor_init(&cur, iov, iovcnt);
+	for (i = 0; i < extcnt; i++) {
+		offset = ext[i].offset;
+		for (len = ext[i].len; len > 0; len -= n) {
+			n = extent_slice(&cur, len, vec, EXTENT_IOV_MAX, &cnt);
+			rc = pwritev(fd, vec, cnt, offset);
+			if (rc < 0)
+				return -errno;
+
+			done += rc;
+			if (offset + rc > *end)
+				*end = offset + rc;
+			if ((size_t)rc < n) /* Disk full */
+				return done;
+			offset += n;
+		}
+	}
+
+	return done;
+}
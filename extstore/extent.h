@@ -0,0 +1,68 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* extent.h
+ * KVSNS/extstore: helpers for vectored I/O shared by the backends
+ */
+
+#ifndef _EXTSTORE_EXTENT_H
+#define _EXTSTORE_EXTENT_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <kvsns/kvsns.h>
+
+/* Position in an array of memory buffers */
+struct extent_cursor {
+	const struct iovec *iov;
+	int iovcnt;
+	int idx;
+	size_t skip;	/* bytes of iov[idx] already consumed */
+};
+
+/* Checks that buffers and extents are valid and of the same size */
+int extent_check(const struct iovec *iov, int iovcnt,
+		 const kvsns_extent_t *ext, int extcnt, size_t *total);
+
+void extent_cursor_init(struct extent_cursor *cur,
+			const struct iovec *iov, int iovcnt);
+
+/* Fills out with at most outmax slices of the next len bytes of buffers.
+ * Returns the number of bytes covered, less than len if outmax is too
+ * small, and the cursor moves past them */
+size_t extent_slice(struct extent_cursor *cur, size_t len,
+		    struct iovec *out, int outmax, int *outcnt);
+
+/* preadv/pwritev of every extent on a descriptor. The read stops at the
+ * end of file, end is set to the end of the last extent written */
+ssize_t extent_preadv(int fd, const struct iovec *iov, int iovcnt,
+		      const kvsns_extent_t *ext, int extcnt, bool *eof);
+ssize_t extent_pwritev(int fd, const struct iovec *iov, int iovcnt,
+		       const kvsns_extent_t *ext, int extcnt, off_t *end);
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* fdcache.c
+ * KVSNS/extstore: cache of open file descriptors shared by POSIX backends
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "fdcache.h"
+
+/* Descriptors are kept open across I/Os, keyed by inode. An entry is
+ * busy while an I/O uses its descriptor and pinned while the file is
+ * open at kvsns level. Only idle entries (neither busy nor pinned) can
+ * be evicted, the least recently used first. When the budget is spent
+ * and nothing is idle, the I/O gets a transient descriptor that is
+ * closed as soon as it is released. Pins are counted by inode, apart
+ * from the entries: a pin taken while the entry was transient is
+ * released by the matching unpin and never by another opener's. */
+#define FDCACHE_DEFAULT_SIZE 1024
+
+struct fdcache_entry {
+	kvsns_ino_t ino;
+	int fd;
+	unsigned int busy;		/* I/Os in flight */
+	bool cached;			/* false once out of the hash table */
+	struct fdcache_entry *hnext;	/* hash chain */
+	struct fdcache_entry *prev;	/* LRU list, head is MRU */
+	struct fdcache_entry *next;
+};
+
+/* kvsns_open without kvsns_close of an inode */
+struct fdcache_pin {
+	kvsns_ino_t ino;
+	unsigned int count;
+	struct fdcache_pin *next;
+};
+
+static struct fdcache {
+	pthread_mutex_t lock;
+	struct fdcache_entry **buckets;
+	struct fdcache_pin **pins;	/* as many buckets as entries */
+	unsigned int nbuckets;
+	unsigned int size;
+	unsigned int count;
+	struct fdcache_entry *head;
+	struct fdcache_entry *tail;
+	fdcache_open_t open_fn;
+	fdcache_close_t close_fn;
+	bool enabled;
+} fdcache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline unsigned int fdcache_hash(kvsns_ino_t ino)
+{
+	return (unsigned int)((ino * 11400714819323198485ULL) >> 32);
+}
+
+static void lru_unlink(struct fdcache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		fdcache.head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		fdcache.tail = e->prev;
+
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+static void lru_push_head(struct fdcache_entry *e)
+{
+	e->prev = NULL;
+	e->next = fdcache.head;
+	if (fdcache.head)
+		fdcache.head->prev = e;
+	fdcache.head = e;
+	if (!fdcache.tail)
+		fdcache.tail = e;
+}
+
+static struct fdcache_entry **hash_slot(kvsns_ino_t ino)
+{
+	struct fdcache_entry **slot;
+
+	slot = &fdcache.buckets[fdcache_hash(ino) & (fdcache.nbuckets - 1)];
+	while (*slot && (*slot)->ino != ino)
+		slot = &(*slot)->hnext;
+
+	return slot;
+}
+
+static struct fdcache_pin **pin_slot(kvsns_ino_t ino)
+{
+	struct fdcache_pin **slot;
+
+	slot = &fdcache.pins[fdcache_hash(ino) & (fdcache.nbuckets - 1)];
+	while (*slot && (*slot)->ino != ino)
+		slot = &(*slot)->next;
+
+	return slot;
+}
+
+/* Takes the entry out of the cache. Lock is held */
+static void fdcache_remove(struct fdcache_entry **slot)
+{
+	struct fdcache_entry *e = *slot;
+
+	*slot = e->hnext;
+	e->hnext = NULL;
+	lru_unlink(e);
+	e->cached = false;
+	fdcache.count -= 1;
+}
+
+/* Returns an idle entry taken out of the cache, or NULL. Lock is held */
+static struct fdcache_entry *fdcache_evict(void)
+{
+	struct fdcache_entry *e;
+
+	for (e = fdcache.tail; e != NULL; e = e->prev)
+		if (e->busy == 0 && *pin_slot(e->ino) == NULL) {
+			fdcache_remove(hash_slot(e->ino));
+			return e;
+		}
+
+	return NULL;
+}
+
+static void fdcache_close_fd(int fd)
+{
+	if (fdcache.close_fn)
+		fdcache.close_fn(fd);
+	else
+		close(fd);
+}
+
+static void fdcache_release(struct fdcache_entry *e)
+{
+	fdcache_close_fd(e->fd);
+	free(e);
+}
+
+int fdcache_init(struct collection_item *cfg_items, char *section,
+		 fdcache_open_t open_fn, fdcache_close_t close_fn)
+{
+	struct collection_item *item;
+	struct rlimit rl;
+	unsigned int size = FDCACHE_DEFAULT_SIZE;
+	int rc = 0;
+
+	pthread_mutex_lock(&fdcache.lock);
+
+	/* posix_obj may run extstore_init once per thread */
+	if (fdcache.open_fn)
+		goto out;
+
+	fdcache.open_fn = open_fn;
+	fdcache.close_fn = close_fn;
+
+	item = NULL;
+	rc = get_config_item(section, "fd_cache_size", cfg_items, &item);
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
+	if (item != NULL)
+		size = get_unsigned_config_value(item, 0, 0, NULL);
+
+	/* Never hold more than half of the descriptors the process
+	 * is allowed, the rest is left to the application and to the
+	 * transient descriptors */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+	    size > rl.rlim_cur / 2)
+		size = rl.rlim_cur / 2;
+
+	if (size == 0)
+		goto out;
+
+	for (fdcache.nbuckets = 1; fdcache.nbuckets < size;
+	     fdcache.nbuckets <<= 1)
+		;
+
+	fdcache.buckets = calloc(fdcache.nbuckets, sizeof(*fdcache.buckets));
+	fdcache.pins = calloc(fdcache.nbuckets, sizeof(*fdcache.pins));
+	if (!fdcache.buckets || !fdcache.pins) {
+		free(fdcache.buckets);
+		free(fdcache.pins);
+		fdcache.buckets = NULL;
+		fdcache.pins = NULL;
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	fdcache.size = size;
+	fdcache.enabled = true;
+
+out:
+	pthread_mutex_unlock(&fdcache.lock);
+	return rc;
+}
+
+int fdcache_get(kvsns_ino_t ino, struct fdcache_entry **entry)
+{
+	struct fdcache_entry *e;
+	struct fdcache_entry *victim = NULL;
+	struct fdcache_entry **slot;
+	int fd;
+
+	if (fdcache.enabled) {
+		pthread_mutex_lock(&fdcache.lock);
+		e = *hash_slot(ino);
+		if (e) {
+			e->busy += 1;
+			lru_unlink(e);
+			lru_push_head(e);
+			pthread_mutex_unlock(&fdcache.lock);
+			*entry = e;
+			return 0;
+		}
+		pthread_mutex_unlock(&fdcache.lock);
+	}
+
+	/* Opening may involve a KVS lookup, do it unlocked */
+	fd = fdcache.open_fn(ino);
+	if (fd < 0)
+		return fd;
+
+	e = calloc(1, sizeof(*e));
+	if (!e) {
+		fdcache_close_fd(fd);
+		return -ENOMEM;
+	}
+	e->ino = ino;
+	e->fd = fd;
+	e->busy = 1;
+	*entry = e;
+
+	if (!fdcache.enabled)
+		return 0;
+
+	pthread_mutex_lock(&fdcache.lock);
+	slot = hash_slot(ino);
+	if (*slot) {
+		/* Lost the race against another opener */
+		fdcache_release(e);
+		e = *slot;
+		e->busy += 1;
+		lru_unlink(e);
+		lru_push_head(e);
+		*entry = e;
+	} else {
+		if (fdcache.count >= fdcache.size) {
+			victim = fdcache_evict();
+			if (!victim) { /* Budget spent, stay transient */
+				pthread_mutex_unlock(&fdcache.lock);
+				return 0;
+			}
+			slot = hash_slot(ino);
+		}
+
+		e->cached = true;
+		e->hnext = *slot;
+		*slot = e;
+		lru_push_head(e);
+		fdcache.count += 1;
+	}
+	pthread_mutex_unlock(&fdcache.lock);
+
+	if (victim)
+		fdcache_release(victim);
+
+	return 0;
+}
+
+int fdcache_fd(struct fdcache_entry *entry)
+{
+	return entry->fd;
+}
+
+void fdcache_put(struct fdcache_entry *entry)
+{
+	bool last;
+
+	pthread_mutex_lock(&fdcache.lock);
+	entry->busy -= 1;
+	last = !entry->cached && entry->busy == 0;
+	pthread_mutex_unlock(&fdcache.lock);
+
+	if (last)
+		fdcache_release(entry);
+}
+
+int fdcache_sync(struct fdcache_entry *entry, kvsns_durability_t how)
+{
+	int rc = 0;
+
+	switch (how) {
+	case KVSNS_SYNC:
+		rc = fsync(entry->fd);
+		break;
+
+	case KVSNS_DATASYNC:
+		rc = fdatasync(entry->fd);
+		break;
+
+	case KVSNS_UNSTABLE:
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	if (rc < 0)
+		return -errno;
+
+	return 0;
+}
+
+int fdcache_pin(kvsns_ino_t ino)
+{
+	struct fdcache_entry *e;
+	struct fdcache_pin *new;
+	struct fdcache_pin **slot;
+	int rc;
+
+	if (!fdcache.enabled)
+		return 0;
+
+	/* Opens the descriptor, and caches it if the budget allows */
+	rc = fdcache_get(ino, &e);
+	if (rc < 0)
+		return rc;
+
+	new = calloc(1, sizeof(*new));
+	if (!new) {
+		fdcache_put(e);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&fdcache.lock);
+	slot = pin_slot(ino);
+	if (!*slot) {
+		new->ino = ino;
+		*slot = new;
+		new = NULL;
+	}
+	(*slot)->count += 1;
+	pthread_mutex_unlock(&fdcache.lock);
+
+	free(new);
+	fdcache_put(e);
+	return 0;
+}
+
+void fdcache_unpin(kvsns_ino_t ino)
+{
+	struct fdcache_pin **slot;
+	struct fdcache_pin *pin = NULL;
+
+	if (!fdcache.enabled)
+		return;
+
+	/* An unpinned entry stays cached until evicted, so that
+	 * reopening a file does not cost an open() */
+	pthread_mutex_lock(&fdcache.lock);
+	slot = pin_slot(ino);
+	if (*slot && --(*slot)->count == 0) {
+		pin = *slot;
+		*slot = pin->next;
+	}
+	pthread_mutex_unlock(&fdcache.lock);
+
+	free(pin);
+}
+
+void fdcache_forget(kvsns_ino_t ino)
+{
+	struct fdcache_entry **slot;
+	struct fdcache_entry *e;
+	struct fdcache_pin **pslot;
+	struct fdcache_pin *pin;
+	bool idle = false;
+
+	if (!fdcache.enabled)
+		return;
+
+	pthread_mutex_lock(&fdcache.lock);
+	pslot = pin_slot(ino);
+	pin = *pslot;
+	if (pin)
+		*pslot = pin->next;
+
+	slot = hash_slot(ino);
+	e = *slot;
+	if (e) {
+		fdcache_remove(slot);
+		idle = (e->busy == 0);
+	}
+	pthread_mutex_unlock(&fdcache.lock);
+
+	free(pin);
+
+	/* Otherwise the last fdcache_put closes it */
+	if (idle)
+		fdcache_release(e);
+}
@@ -0,0 +1,67 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* fdcache.h
+ * KVSNS/extstore: cache of open file descriptors shared by POSIX backends
+ */
+
+#ifndef _EXTSTORE_FDCACHE_H
+#define _EXTSTORE_FDCACHE_H
+
+#include <stdbool.h>
+#include <ini_config.h>
+#include <kvsns/kvsns.h>
+
+/* Opens the object backing an inode, returns a file descriptor or -errno */
+typedef int (*fdcache_open_t)(kvsns_ino_t ino);
+
+/* Closes a descriptor returned by fdcache_open_t, NULL means close(2) */
+typedef void (*fdcache_close_t)(int fd);
+
+struct fdcache_entry;
+
+int fdcache_init(struct collection_item *cfg_items, char *section,
+		 fdcache_open_t open_fn, fdcache_close_t close_fn);
+
+/* Takes a reference on the descriptor for an I/O, to be released
+ * with fdcache_put once the I/O is done */
+int fdcache_get(kvsns_ino_t ino, struct fdcache_entry **entry);
+int fdcache_fd(struct fdcache_entry *entry);
+void fdcache_put(struct fdcache_entry *entry);
+
+/* Makes a write done through the descriptor as durable as requested */
+int fdcache_sync(struct fdcache_entry *entry, kvsns_durability_t how);
+
+/* Keep the descriptor cached while the file is open at kvsns level */
+int fdcache_pin(kvsns_ino_t ino);
+void fdcache_unpin(kvsns_ino_t ino);
+
+/* The object is gone, close its descriptor once no I/O uses it */
+void fdcache_forget(kvsns_ino_t ino);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* fdcopy.c
+ * KVSNS/extstore: in-kernel copies between file descriptors
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "fdcopy.h"
+
+/* One pipe per thread for splice, kept open for the next copies */
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+
+struct fdcopy_pipe {
+	int fds[2];
+};
+
+static void fdcopy_pipe_destroy(void *arg)
+{
+	struct fdcopy_pipe *p = arg;
+
+	close(p->fds[0]);
+	close(p->fds[1]);
+	free(p);
+}
+
+static void fdcopy_pipe_key(void)
+{
+	pthread_key_create(&pipe_key, fdcopy_pipe_destroy);
+}
+
+static struct fdcopy_pipe *fdcopy_pipe(void)
+{
+	struct fdcopy_pipe *p;
+
+	pthread_once(&pipe_once, fdcopy_pipe_key);
+
+	p = pthread_getspecific(pipe_key);
+	if (p)
+		return p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return NULL;
+
+	if (pipe2(p->fds, O_CLOEXEC) < 0) {
+		free(p);
+		return NULL;
+	}
+
+	pthread_setspecific(pipe_key, p);
+	return p;
+}
+
+static ssize_t fdcopy_splice(int fd_in, off_t off_in, int fd_out,
+			     off_t off_out, size_t len)
+{
+	struct fdcopy_pipe *p;
+	ssize_t in, out, n;
+
+	p = fdcopy_pipe();
+	if (!p)
+		return -ENOMEM;
+
+	in = splice(fd_in, &off_in, p->fds[1], NULL, len, SPLICE_F_MOVE);
+	if (in <= 0)
+		return (in < 0) ? -errno : 0;
+
+	/* The pipe must be drained whatever happens, or the data it holds
+	 * would end in the next copy */
+	for (out = 0; out < in; out += n) {
+		n = splice(p->fds[0], NULL, fd_out, &off_out, in - out,
+			   SPLICE_F_MOVE);
+		if (n <= 0) {
+			int rc = (n < 0) ? -errno : -EIO;
+
+			fdcopy_pipe_destroy(p);
+			pthread_setspecific(pipe_key, NULL);
+			return rc;
+		}
+	}
+
+	return in;
+}
+
+ssize_t fdcopy(int fd_in, off_t off_in, int fd_out, off_t off_out,
+	       size_t len)
+{
+	ssize_t rc;
+
+	rc = copy_file_range(fd_in, &off_in, fd_out, &off_out, len, 0);
+	if (rc >= 0)
+		return rc;
+
+	switch (errno) {
+	case EXDEV:	/* different file systems before Linux 5.3 */
+	case EINVAL:
+	case ENOSYS:
+	case EOPNOTSUPP:
+		break;
+
+	default:
+		return -errno;
+	}
+
+	rc = fdcopy_splice(fd_in, off_in, fd_out, off_out, len);
+	if (rc == -EINVAL)
+		return -ENOTSUP;
+
+	return rc;
+}
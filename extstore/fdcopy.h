@@ -0,0 +1,45 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* fdcopy.h
+ * KVSNS/extstore: in-kernel copies between file descriptors
+ */
+
+#ifndef _EXTSTORE_FDCOPY_H
+#define _EXTSTORE_FDCOPY_H
+
+#include <sys/types.h>
+
+/* Copies up to len bytes without going through user space, with
+ * copy_file_range, or splice through a pipe when the file systems do not
+ * support it. Returns the copied size, 0 at end of source, or -ENOTSUP
+ * if the descriptors allow no in-kernel copy */
+ssize_t fdcopy(int fd_in, off_t off_in, int fd_out, off_t off_out,
+	       size_t len);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* getattr_sync.c
+ * KVSNS/extstore: batched getattr for the backends where a getattr is a
+ * local system call, the batch is a loop
+ */
+
+#include <kvsns/extstore.h>
+
+int extstore_getattr_many(int nb, kvsns_ino_t *inos, struct stat *stats,
+			  int *rcs)
+{
+	int i;
+
+	if (nb < 0 || !inos || !stats || !rcs)
+		return -EINVAL;
+
+	for (i = 0; i < nb; i++)
+		rcs[i] = extstore_getattr(&inos[i], &stats[i]);
+
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* posix_dir.c
+ * KVSNS/extstore: the functions shared by the backends keeping objects as
+ * files of a POSIX directory. Descriptors come from the fdcache.
+ */
+
+#include <sys/time.h> /* for gettimeofday */
+#include <pthread.h>
+#include <kvsns/extstore.h>
+#include "posix_dir.h"
+#include "fdcache.h"
+#include "extent.h"
+#include "fdcopy.h"
+
+static char store_root[MAXPATHLEN];
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int posix_dir_init(struct collection_item *cfg_items, char *section)
+{
+	struct collection_item *item;
+	int rc = 0;
+
+	pthread_mutex_lock(&store_lock);
+
+	/* extstore_init may run once per thread */
+	if (store_root[0] != '\0')
+		goto out;
+
+	item = NULL;
+	rc = get_config_item(section, "root_path", cfg_items, &item);
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
+
+	if (item == NULL) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	strncpy(store_root, get_string_config_value(item, NULL),
+		MAXPATHLEN - 1);
+
+out:
+	pthread_mutex_unlock(&store_lock);
+	return rc;
+}
+
+int posix_dir_path(kvsns_ino_t ino, char *path, size_t pathlen)
+{
+	int rc;
+
+	if (!path)
+		return -EINVAL;
+
+	rc = snprintf(path, pathlen, "%s/inum=%llu",
+		      store_root, (unsigned long long)ino);
+	if (rc < 0 || (size_t)rc >= pathlen)
+		return -ENAMETOOLONG;
+
+	return rc;
+}
+
+int posix_dir_open(kvsns_ino_t ino)
+{
+	char storepath[MAXPATHLEN];
+	int rc;
+	int fd;
+
+	rc = posix_dir_path(ino, storepath, MAXPATHLEN);
+	if (rc < 0)
+		return rc;
+
+	fd = open(storepath, O_CREAT|O_RDWR, 0755);
+	if (fd < 0)
+		return -errno;
+
+	return fd;
+}
+
+int posix_dir_fstat(int fd, struct stat *stat)
+{
+	struct stat storestat;
+
+	if (fstat(fd, &storestat) < 0)
+		return -errno;
+
+	stat->st_mtime = storestat.st_mtime;
+	stat->st_size = storestat.st_size;
+	stat->st_blocks = storestat.st_blocks;
+	stat->st_blksize = storestat.st_blksize;
+
+	return 0;
+}
+
+static int posix_dir_consolidate_attrs(kvsns_ino_t *ino,
+				       struct stat *filestat)
+{
+	struct stat extstat;
+	char storepath[MAXPATHLEN];
+	int rc;
+
+	rc = posix_dir_path(*ino, storepath, MAXPATHLEN);
+	if (rc < 0)
+		return rc;
+
+	rc = lstat(storepath, &extstat);
+	if (rc < 0) {
+		if (errno == ENOENT)
+			return 0; /* No data written yet */
+		else
+			return -errno;
+	}
+
+	filestat->st_mtime = extstat.st_mtime;
+	filestat->st_atime = extstat.st_atime;
+	filestat->st_size = extstat.st_size;
+	filestat->st_blksize = extstat.st_blksize;
+	filestat->st_blocks = extstat.st_blocks;
+
+	return 0;
+}
+
+/* Descriptors stay in the fdcache for the life of the process */
+int extstore_fini(void)
+{
+	return 0;
+}
+
+/* The atime of the files is the one the file system keeps */
+void extstore_set_atime_policy(kvsns_atime_policy_t policy)
+{
+}
+
+int extstore_attach(kvsns_ino_t *ino, char *objid, int objid_len)
+{
+	return -ENOTSUP;
+}
+
+int extstore_create(kvsns_ino_t object)
+{
+	return 0;
+}
+
+int extstore_open(kvsns_ino_t *ino)
+{
+	return fdcache_pin(*ino);
+}
+
+int extstore_close(kvsns_ino_t *ino)
+{
+	fdcache_unpin(*ino);
+	return 0;
+}
+
+int extstore_commit(kvsns_ino_t *ino)
+{
+	struct fdcache_entry *entry;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	/* mtime and size are read from the object, sync them as well */
+	rc = fdcache_sync(entry, KVSNS_SYNC);
+	fdcache_put(entry);
+
+	return rc;
+}
+
+int extstore_del(kvsns_ino_t *ino)
+{
+	char storepath[MAXPATHLEN];
+	int rc;
+
+	rc = posix_dir_path(*ino, storepath, MAXPATHLEN);
+	if (rc < 0)
+		return rc;
+
+	fdcache_forget(*ino);
+
+	rc = unlink(storepath);
+	if (rc) {
+		if (errno == ENOENT)
+			return 0;
+
+		return -errno;
+	}
+
+	return 0;
+}
+
+int extstore_readv(kvsns_ino_t *ino,
+		   const struct iovec *iov,
+		   int iovcnt,
+		   const kvsns_extent_t *ext,
+		   int extcnt,
+		   bool *end_of_file,
+		   struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t read_bytes;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	read_bytes = extent_preadv(fdcache_fd(entry), iov, iovcnt, ext, extcnt,
+				   end_of_file);
+	if (read_bytes < 0) {
+		rc = read_bytes;
+		goto out;
+	}
+
+	rc = posix_dir_fstat(fdcache_fd(entry), stat);
+	if (rc < 0)
+		goto out;
+
+	rc = read_bytes;
+out:
+	fdcache_put(entry);
+	return rc;
+}
+
+int extstore_writev(kvsns_ino_t *ino,
+		    const struct iovec *iov,
+		    int iovcnt,
+		    const kvsns_extent_t *ext,
+		    int extcnt,
+		    kvsns_durability_t how,
+		    bool *fsal_stable,
+		    struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t written_bytes;
+	off_t end;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	written_bytes = extent_pwritev(fdcache_fd(entry), iov, iovcnt, ext,
+				       extcnt, &end);
+	if (written_bytes < 0) {
+		rc = written_bytes;
+		goto out;
+	}
+
+	/* A single sync for all the extents */
+	rc = fdcache_sync(entry, how);
+	if (rc < 0)
+		goto out;
+
+	rc = posix_dir_fstat(fdcache_fd(entry), stat);
+	if (rc < 0)
+		goto out;
+
+	*fsal_stable = (how != KVSNS_UNSTABLE);
+	rc = written_bytes;
+out:
+	fdcache_put(entry);
+	return rc;
+}
+
+/* Data goes from the descriptor to the object in the kernel */
+ssize_t extstore_copy_from_fd(kvsns_ino_t *ino,
+			      off_t offset,
+			      int fd,
+			      off_t fd_offset,
+			      size_t len,
+			      struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t copied;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	copied = fdcopy(fd, fd_offset, fdcache_fd(entry), offset, len);
+	if (copied < 0) {
+		rc = copied;
+		goto out;
+	}
+
+	rc = posix_dir_fstat(fdcache_fd(entry), stat);
+	if (rc < 0)
+		goto out;
+
+	rc = copied;
+out:
+	fdcache_put(entry);
+	return rc;
+}
+
+ssize_t extstore_copy_to_fd(kvsns_ino_t *ino,
+			    off_t offset,
+			    int fd,
+			    off_t fd_offset,
+			    size_t len)
+{
+	struct fdcache_entry *entry;
+	ssize_t copied;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	copied = fdcopy(fdcache_fd(entry), offset, fd, fd_offset, len);
+	fdcache_put(entry);
+
+	return copied;
+}
+
+int extstore_truncate(kvsns_ino_t *ino,
+		      off_t filesize,
+		      bool on_obj_store,
+		      struct stat *stat)
+{
+	int rc;
+	char storepath[MAXPATHLEN];
+	struct timeval t;
+
+	if (!ino || !stat)
+		return -EINVAL;
+
+	rc = posix_dir_path(*ino, storepath, MAXPATHLEN);
+	if (rc < 0)
+		return rc;
+
+	rc = truncate(storepath, filesize);
+	if (rc == -1) {
+		if (errno == ENOENT) {
+			/* File does not exist in data store
+			 * it is a mere MD creature */
+			stat->st_size = filesize;
+
+			if (gettimeofday(&t, NULL) != 0)
+				return -errno;
+
+			stat->st_ctim.tv_sec = t.tv_sec;
+			stat->st_ctim.tv_nsec = 1000 * t.tv_usec;
+			stat->st_mtim.tv_sec = stat->st_ctim.tv_sec;
+			stat->st_mtim.tv_nsec = stat->st_ctim.tv_nsec;
+
+			return 0;
+		} else
+			return -errno;
+	}
+
+	rc = posix_dir_consolidate_attrs(ino, stat);
+	if (rc < 0)
+		return rc;
+
+	return 0;
+}
+
+int extstore_getattr(kvsns_ino_t *ino,
+		     struct stat *stat)
+{
+	int rc;
+	char storepath[MAXPATHLEN];
+
+	rc = posix_dir_path(*ino, storepath, MAXPATHLEN);
+	if (rc < 0)
+		return rc;
+
+	rc = lstat(storepath, stat);
+	if (rc < 0)
+		return -errno;
+
+	return 0;
+}
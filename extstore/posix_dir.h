@@ -0,0 +1,55 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* posix_dir.h
+ * KVSNS/extstore: objects kept as files of a POSIX directory, named after
+ * their inode. The backends of this kind share the extstore functions
+ * defined in posix_dir.c and provide init, read and write.
+ */
+
+#ifndef _EXTSTORE_POSIX_DIR_H
+#define _EXTSTORE_POSIX_DIR_H
+
+#include <sys/stat.h>
+#include <ini_config.h>
+#include <kvsns/kvsns.h>
+
+/* Reads root_path in the section of the backend, once */
+int posix_dir_init(struct collection_item *cfg_items, char *section);
+
+/* Path of the object of an inode, returns the length or -errno */
+int posix_dir_path(kvsns_ino_t ino, char *path, size_t pathlen);
+
+/* Opens the object of an inode, creating it, returns a descriptor or
+ * -errno. Suitable as fdcache_open_t */
+int posix_dir_open(kvsns_ino_t ino);
+
+/* Fills the data attributes of stat from the object open as fd */
+int posix_dir_fstat(int fd, struct stat *stat);
+
+#endif
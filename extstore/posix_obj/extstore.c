@@ -30,8 +30,12 @@
  */
 
 
+#include <pthread.h>
 #include <hiredis/hiredis.h>
 #include <kvsns/extstore.h>
+#include "fdcache.h"
+#include "extent.h"
+#include "fdcopy.h"
 
 #define RC_WRAP(__function, ...) ({\
 	int __rc = __function(__VA_ARGS__);\
@@ -51,11 +55,94 @@ static char store_root[MAXPATHLEN];
 
 static struct collection_item *conf = NULL;
 
+/* Everything about an object is in the hash "<inode>.data_obj": the
+ * path of its file, its attributes and its extended attributes */
+#define OBJ_KEY "%llu.data_obj"
+#define OBJ_PATH "path"
+#define OBJ_ATTR "attr"
+#define OBJ_EXT "ext"
+
+/* Older stores had one key for each */
+#define LEGACY_PATH_KEY "%llu.data"
+#define LEGACY_ATTR_KEY "%llu.data_attr"
+#define LEGACY_EXT_KEY "%llu.data_ext"
+
 static void extstore_reinit(void)
 {
 	extstore_init(conf);
 }
 
+/* Moves the keys of an older store into the object's hash */
+static int convert_legacy_keys(kvsns_ino_t object, char *extstore_path,
+			       size_t pathlen)
+{
+	char k[KLEN];
+	char kpath[KLEN];
+	char kattr[KLEN];
+	char kext[KLEN];
+	redisReply *path = NULL;
+	redisReply *attr = NULL;
+	redisReply *reply;
+	int rc = 0;
+
+	snprintf(k, KLEN, OBJ_KEY, object);
+	snprintf(kpath, KLEN, LEGACY_PATH_KEY, object);
+	snprintf(kattr, KLEN, LEGACY_ATTR_KEY, object);
+	snprintf(kext, KLEN, LEGACY_EXT_KEY, object);
+
+	redisAppendCommand(rediscontext, "GET %s", kpath);
+	redisAppendCommand(rediscontext, "GET %s", kattr);
+	if (redisGetReply(rediscontext, (void **)&path) != REDIS_OK ||
+	    redisGetReply(rediscontext, (void **)&attr) != REDIS_OK) {
+		rc = -EIO;
+		goto out;
+	}
+
+	if (path->type != REDIS_REPLY_STRING || path->len == 0) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	if (path->len >= pathlen) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+
+	if (attr->type == REDIS_REPLY_STRING &&
+	    attr->len == sizeof(struct stat))
+		reply = redisCommand(rediscontext,
+				     "HMSET %s " OBJ_PATH " %b " OBJ_ATTR
+				     " %b " OBJ_EXT " %s", k, path->str,
+				     path->len, attr->str, attr->len, "");
+	else
+		reply = redisCommand(rediscontext,
+				     "HMSET %s " OBJ_PATH " %b " OBJ_EXT
+				     " %s", k, path->str, path->len, "");
+	if (!reply) {
+		rc = -EIO;
+		goto out;
+	}
+	freeReplyObject(reply);
+
+	reply = redisCommand(rediscontext, "DEL %s %s %s", kpath, kattr,
+			     kext);
+	if (!reply) {
+		rc = -EIO;
+		goto out;
+	}
+	freeReplyObject(reply);
+
+	memcpy(extstore_path, path->str, path->len);
+	extstore_path[path->len] = '\0';
+
+out:
+	if (path)
+		freeReplyObject(path);
+	if (attr)
+		freeReplyObject(attr);
+	return rc;
+}
+
 static int build_extstore_path(kvsns_ino_t object,
 			       char *extstore_path,
 			       size_t pathlen)
@@ -69,20 +156,41 @@ static int build_extstore_path(kvsns_ino_t object,
 	if (!rediscontext)
 		extstore_reinit();
 
-	snprintf(k, KLEN, "%llu.data", object);	
+	snprintf(k, KLEN, OBJ_KEY, object);
 	reply = NULL;
-	reply = redisCommand(rediscontext, "GET %s", k);
+	reply = redisCommand(rediscontext, "HGET %s " OBJ_PATH, k);
 	if (!reply)
 		return -1;
 
-	if(reply->len == 0)
-		return -ENOENT;
+	if (reply->type != REDIS_REPLY_STRING || reply->len == 0) {
+		freeReplyObject(reply);
+		return convert_legacy_keys(object, extstore_path, pathlen);
+	}
+
+	if (reply->len >= pathlen) {
+		freeReplyObject(reply);
+		return -ENAMETOOLONG;
+	}
 
 	strcpy(extstore_path, reply->str);
 	freeReplyObject(reply);
 	return 0;
 }
 
+static int extstore_open_fd(kvsns_ino_t ino)
+{
+	char storepath[MAXPATHLEN];
+	int fd;
+
+	RC_WRAP(build_extstore_path, ino, storepath, MAXPATHLEN);
+
+	fd = open(storepath, O_CREAT|O_RDWR, 0755);
+	if (fd < 0)
+		return -errno;
+
+	return fd;
+}
+
 enum update_stat_how {
 	UP_ST_WRITE = 1,
 	UP_ST_READ = 2,
@@ -132,49 +240,50 @@ static int update_stat(struct stat *stat, enum update_stat_how how,
 	return 0;
 }
 
-int extstore_create(kvsns_ino_t object)
+static int set_objects_keys(kvsns_ino_t object, const char *path,
+			    size_t pathlen)
 {
 	char k[KLEN];
-	char v[VLEN];
-	char path[VLEN];
+	struct stat objstat;
 	redisReply *reply;
-	int fd;
-	size_t size;
-
-	if (!rediscontext)
-		extstore_reinit();
 
 	if (!rediscontext)
 		extstore_reinit();
 
-	snprintf(k, KLEN, "%llu.data", object);
-	snprintf(path, VLEN, "%s/inum=%llu",
-		store_root, (unsigned long long)object);
-	strncpy(v, path, VLEN);
+	memset(&objstat, 0, sizeof(objstat));
+	RC_WRAP(update_stat, &objstat, UP_ST_TRUNCATE, 0);
+	objstat.st_atim = objstat.st_mtim;
 
+	/* A single command, the object appears at once */
+	snprintf(k, KLEN, OBJ_KEY, object);
 	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %s", k, v);
+	reply = redisCommand(rediscontext,
+			     "HMSET %s " OBJ_PATH " %b " OBJ_ATTR " %b "
+			     OBJ_EXT " %s", k, path, pathlen, &objstat,
+			     sizeof(objstat), "");
 	if (!reply)
 		return -1;
+
 	freeReplyObject(reply);
+	return 0;
+}
 
-	snprintf(k, KLEN, "%llu.data_attr", object);
-	size = sizeof(struct stat);
+/* The REDIS connection and the descriptors live as long as the process */
+int extstore_fini(void)
+{
+	return 0;
+}
 
-	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %b", k, stat, size);
-	if (!reply)
-		return -1;
-	freeReplyObject(reply);
+int extstore_create(kvsns_ino_t object)
+{
+	char path[VLEN];
+	int fd;
 
-	snprintf(k, KLEN, "%llu.data_ext", object);
-	v[0] = '\0'; /* snprintf(v, VLEN, ""); */
-	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %s", k, v);
-	if (!reply)
-		return -1;
+	snprintf(path, VLEN, "%s/inum=%llu",
+		store_root, (unsigned long long)object);
+
+	RC_WRAP(set_objects_keys, object, path, strnlen(path, VLEN));
 
-	freeReplyObject(reply);
 	fd = creat(path, 0777);
 	if (fd == -1)
 		return -errno;
@@ -185,45 +294,8 @@ int extstore_create(kvsns_ino_t object)
 
 int extstore_attach(kvsns_ino_t *ino, char *objid, int objid_len)
 {
-	char k[KLEN];
-	char v[VLEN];
-	redisReply *reply;
-	size_t size;
-
-	if (!rediscontext)
-		extstore_reinit();
-
-	if (!rediscontext)
-		extstore_reinit();
-
-	snprintf(k, KLEN, "%llu.data", *ino);
-	strncpy(v, objid, (objid_len > VLEN)?VLEN:objid_len);
-
-	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %s", k, v);
-	if (!reply)
-		return -1;
-	freeReplyObject(reply);
-
-
-	snprintf(k, KLEN, "%llu.data_attr", *ino);
-	size = sizeof(struct stat);
-
-	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %b", k, stat, size);
-	if (!reply)
-		return -1;
-	freeReplyObject(reply);
-
-	snprintf(k, KLEN, "%llu.data_ext", *ino);
-	v[0] = '\0'; /* snprintf(v, VLEN, ""); */
-	reply = NULL;
-	reply = redisCommand(rediscontext, "SET %s %s", k, v);
-	if (!reply)
-		return -1;
-
-	freeReplyObject(reply);
-	return 0;
+	return set_objects_keys(*ino, objid,
+				(objid_len > VLEN) ? VLEN : objid_len);
 }
 
 static int set_stat(kvsns_ino_t *ino, struct stat *buf)
@@ -236,8 +308,12 @@ static int set_stat(kvsns_ino_t *ino, struct stat *buf)
 	if (!ino || !buf)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.data_attr", *ino);
-	reply = redisCommand(rediscontext, "SET %s %b", k, buf, size);
+	if (!rediscontext)
+		extstore_reinit();
+
+	snprintf(k, KLEN, OBJ_KEY, *ino);
+	reply = redisCommand(rediscontext, "HSET %s " OBJ_ATTR " %b", k,
+			     buf, size);
 	if (!reply)
 		return -1;
 
@@ -249,28 +325,297 @@ static int get_stat(kvsns_ino_t *ino, struct stat *buf)
 {
 	redisReply *reply;
 	char k[KLEN];
+	int rc = 0;
 
 	if (!ino || !buf)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.data_attr", *ino);
-	reply = redisCommand(rediscontext, "GET %s", k);
+	if (!rediscontext)
+		extstore_reinit();
+
+	snprintf(k, KLEN, OBJ_KEY, *ino);
+	reply = redisCommand(rediscontext, "HGET %s " OBJ_ATTR, k);
 	if (!reply)
 		return -1;
 
-	if (reply->type != REDIS_REPLY_STRING)
-		return -1;
+	if (reply->type != REDIS_REPLY_STRING ||
+	    reply->len != sizeof(struct stat))
+		rc = -1;
+	else
+		memcpy((char *)buf, reply->str, reply->len);
 
-	if (reply->len != sizeof(struct stat))
-		return -1;
+	freeReplyObject(reply);
 
-	memcpy((char *)buf, reply->str, reply->len);
+	return rc;
+}
 
-	freeReplyObject(reply);
+/* The attributes of the open objects are kept here. Writes update them
+ * in memory, they go to the KVS on commit and on the last close. The
+ * table and the references are protected by attr_lock, the attributes
+ * of an object by its own lock, which is held across the KVS round trips
+ * so that the updates of an object are serialized */
+#define ATTR_BUCKETS 256
+
+struct obj_attr {
+	kvsns_ino_t ino;
+	struct stat stat;
+	bool loaded;
+	bool dirty;
+	unsigned int refs;		/* opens and users, under attr_lock */
+	pthread_mutex_t lock;
+	struct obj_attr *next;
+};
+
+static struct obj_attr *attr_table[ATTR_BUCKETS];
+static pthread_mutex_t attr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with attr_lock held */
+static struct obj_attr **attr_lookup(kvsns_ino_t ino)
+{
+	struct obj_attr **pattr;
+
+	pattr = &attr_table[ino % ATTR_BUCKETS];
+	while (*pattr && (*pattr)->ino != ino)
+		pattr = &(*pattr)->next;
+
+	return pattr;
+}
+
+static int attr_hold(kvsns_ino_t ino)
+{
+	struct obj_attr **pattr;
+	struct obj_attr *attr;
+
+	pthread_mutex_lock(&attr_lock);
+	pattr = attr_lookup(ino);
+	if (!*pattr) {
+		attr = calloc(1, sizeof(*attr));
+		if (!attr) {
+			pthread_mutex_unlock(&attr_lock);
+			return -ENOMEM;
+		}
+		attr->ino = ino;
+		pthread_mutex_init(&attr->lock, NULL);
+		*pattr = attr;
+	}
+	(*pattr)->refs++;
+	pthread_mutex_unlock(&attr_lock);
 
 	return 0;
 }
 
+/* Returns the attributes of an open object with a reference and their
+ * lock, NULL if it is not open. attr_put gives both back */
+static struct obj_attr *attr_get(kvsns_ino_t ino)
+{
+	struct obj_attr *attr;
+
+	pthread_mutex_lock(&attr_lock);
+	attr = *attr_lookup(ino);
+	if (attr)
+		attr->refs++;
+	pthread_mutex_unlock(&attr_lock);
+
+	if (attr)
+		pthread_mutex_lock(&attr->lock);
+
+	return attr;
+}
+
+/* Writes the attributes if they changed. The object's lock is held */
+static int attr_flush_locked(struct obj_attr *attr)
+{
+	int rc;
+
+	if (!attr->dirty)
+		return 0;
+
+	rc = set_stat(&attr->ino, &attr->stat);
+	if (rc == 0)
+		attr->dirty = false;
+
+	return rc;
+}
+
+/* Drops a reference and the lock. The last reference writes the
+ * attributes while they can still be found, so that an open racing with
+ * the last close reads them once written */
+static int attr_put(struct obj_attr *attr)
+{
+	struct obj_attr **pattr;
+	bool last;
+	int rc = 0;
+
+	pthread_mutex_lock(&attr_lock);
+	last = (attr->refs == 1);
+	pthread_mutex_unlock(&attr_lock);
+
+	if (last)
+		rc = attr_flush_locked(attr);
+
+	pthread_mutex_lock(&attr_lock);
+	last = (--attr->refs == 0);
+	if (last) {
+		pattr = attr_lookup(attr->ino);
+		*pattr = attr->next;
+	}
+	pthread_mutex_unlock(&attr_lock);
+	pthread_mutex_unlock(&attr->lock);
+
+	if (last) {
+		pthread_mutex_destroy(&attr->lock);
+		free(attr);
+	}
+
+	return rc;
+}
+
+static int attr_release(kvsns_ino_t ino)
+{
+	struct obj_attr *attr;
+
+	attr = attr_get(ino);
+	if (!attr)
+		return 0;
+
+	/* Drops the reference of the open, then ours */
+	pthread_mutex_lock(&attr_lock);
+	attr->refs--;
+	pthread_mutex_unlock(&attr_lock);
+
+	return attr_put(attr);
+}
+
+static int attr_flush(kvsns_ino_t ino)
+{
+	struct obj_attr *attr;
+	int rc;
+
+	attr = attr_get(ino);
+	if (!attr)
+		return 0;
+
+	rc = attr_flush_locked(attr);
+	attr_put(attr);
+
+	return rc;
+}
+
+/* The object is gone, there is nothing left to write */
+static void attr_forget(kvsns_ino_t ino)
+{
+	struct obj_attr *attr;
+
+	attr = attr_get(ino);
+	if (!attr)
+		return;
+
+	attr->dirty = false;
+	attr->loaded = false;
+	attr_put(attr);
+}
+
+/* Applies an update to the object's attributes and returns them. It is
+ * done in memory if the object is open, in the KVS otherwise */
+static int attr_update(kvsns_ino_t ino, enum update_stat_how how,
+		       off_t size, bool write_through, struct stat *out)
+{
+	struct obj_attr *attr;
+	struct stat objstat;
+	int rc = 0;
+
+	attr = attr_get(ino);
+	if (!attr) {
+		RC_WRAP(get_stat, &ino, &objstat);
+		RC_WRAP(update_stat, &objstat, how, size);
+		RC_WRAP(set_stat, &ino, &objstat);
+		*out = objstat;
+		return 0;
+	}
+
+	if (!attr->loaded) {
+		rc = get_stat(&ino, &attr->stat);
+		if (rc < 0)
+			goto out;
+		attr->loaded = true;
+	}
+
+	rc = update_stat(&attr->stat, how, size);
+	if (rc < 0)
+		goto out;
+	attr->dirty = true;
+
+	if (write_through)
+		rc = attr_flush_locked(attr);
+
+	*out = attr->stat;
+
+out:
+	attr_put(attr);
+	return rc;
+}
+
+/* Access time policy, given by kvsns_start. Deferred or not, the atime
+ * of an object is only written at its close, so lazytime is strict here */
+#define ATIME_RELATIME_DELAY 86400	/* seconds */
+
+static kvsns_atime_policy_t atime_policy = KVSNS_ATIME_STRICT;
+
+void extstore_set_atime_policy(kvsns_atime_policy_t policy)
+{
+	atime_policy = policy;
+}
+
+/* relatime: the atime is not after the mtime or the ctime, or is more
+ * than a day old */
+static bool atime_stale(struct stat *stat)
+{
+	struct timeval t;
+
+	if (stat->st_atim.tv_sec < stat->st_mtim.tv_sec ||
+	    (stat->st_atim.tv_sec == stat->st_mtim.tv_sec &&
+	     stat->st_atim.tv_nsec <= stat->st_mtim.tv_nsec))
+		return true;
+
+	if (stat->st_atim.tv_sec < stat->st_ctim.tv_sec ||
+	    (stat->st_atim.tv_sec == stat->st_ctim.tv_sec &&
+	     stat->st_atim.tv_nsec <= stat->st_ctim.tv_nsec))
+		return true;
+
+	if (gettimeofday(&t, NULL) != 0)
+		return true;
+
+	return t.tv_sec - stat->st_atim.tv_sec >= ATIME_RELATIME_DELAY;
+}
+
+/* Reads only change the atime of open objects, kept until the close. The
+ * file's own atime, which extstore_getattr returns, is up to date anyway */
+static int attr_read(kvsns_ino_t ino, struct stat *stat)
+{
+	struct obj_attr *attr;
+	int rc = 0;
+
+	if (atime_policy == KVSNS_ATIME_NOATIME)
+		return 0;
+
+	attr = attr_get(ino);
+	if (attr && (attr->loaded || get_stat(&ino, &attr->stat) == 0)) {
+		attr->loaded = true;
+		if (atime_policy != KVSNS_ATIME_RELATIME ||
+		    atime_stale(&attr->stat)) {
+			rc = update_stat(&attr->stat, UP_ST_READ, 0);
+			attr->dirty = true;
+		}
+	}
+	if (attr)
+		attr_put(attr);
+
+	if (rc < 0)
+		return rc;
+
+	return update_stat(stat, UP_ST_READ, 0);
+}
+
 int extstore_init(struct collection_item *cfg_items)
 {
 	redisReply *reply;
@@ -329,12 +674,59 @@ int extstore_init(struct collection_item *cfg_items)
 	strncpy(store_root, get_string_config_value(item, NULL),
 		MAXPATHLEN);
 
-	return 0;
+	return fdcache_init(cfg_items, "posix_obj", extstore_open_fd,
+			    NULL);
+}
+
+int extstore_open(kvsns_ino_t *ino)
+{
+	int rc;
+
+	rc = fdcache_pin(*ino);
+	if (rc == -ENOENT) /* No data created */
+		return 0;
+	if (rc < 0)
+		return rc;
+
+	rc = attr_hold(*ino);
+	if (rc < 0)
+		fdcache_unpin(*ino);
+
+	return rc;
+}
+
+int extstore_close(kvsns_ino_t *ino)
+{
+	fdcache_unpin(*ino);
+	return attr_release(*ino);
+}
+
+int extstore_commit(kvsns_ino_t *ino)
+{
+	struct fdcache_entry *entry;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc == -ENOENT) /* No data created */
+		return 0;
+	if (rc < 0)
+		return rc;
+
+	/* The attributes kept since the open go to the KVS */
+	rc = fdcache_sync(entry, KVSNS_DATASYNC);
+	fdcache_put(entry);
+	if (rc < 0)
+		return rc;
+
+	return attr_flush(*ino);
 }
 
 int extstore_del(kvsns_ino_t *ino)
 {
 	char k[KLEN];
+	char kpath[KLEN];
+	char kattr[KLEN];
+	char kext[KLEN];
 	char storepath[MAXPATHLEN];
 	int rc;
 	redisReply *reply;
@@ -347,6 +739,8 @@ int extstore_del(kvsns_ino_t *ino)
 		return rc;
 	}
 
+	fdcache_forget(*ino);
+
 	rc = unlink(storepath);
 	if (rc) {
 		if (errno == ENOENT)
@@ -355,26 +749,16 @@ int extstore_del(kvsns_ino_t *ino)
 		return -errno;
 	}
 
-	/* delete <inode>.data */
-	snprintf(k, KLEN, "%llu.data", *ino);	
-	reply = NULL;
-	reply = redisCommand(rediscontext, "DEL %s", k);
-	if (!reply)
-		return -1;
-	freeReplyObject(reply);
+	attr_forget(*ino);
 
-	/* delete <inode>.data_attr */	
-	snprintf(k, KLEN, "%llu.data_attr", *ino);	
+	/* The object's hash, and the keys of an older store */
+	snprintf(k, KLEN, OBJ_KEY, *ino);
+	snprintf(kpath, KLEN, LEGACY_PATH_KEY, *ino);
+	snprintf(kattr, KLEN, LEGACY_ATTR_KEY, *ino);
+	snprintf(kext, KLEN, LEGACY_EXT_KEY, *ino);
 	reply = NULL;
-	reply = redisCommand(rediscontext, "DEL %s", k);
-	if (!reply)
-		return -1;
-	freeReplyObject(reply);
-
-	/* delete <inode>.data_ext */	
-	snprintf(k, KLEN, "%llu.data_ext", *ino);	
-	reply = NULL;
-	reply = redisCommand(rediscontext, "DEL %s", k);
+	reply = redisCommand(rediscontext, "DEL %s %s %s %s", k, kpath,
+			     kattr, kext);
 	if (!reply)
 		return -1;
 	freeReplyObject(reply);
@@ -389,35 +773,25 @@ int extstore_read(kvsns_ino_t *ino,
 		  bool *end_of_file,
 		  struct stat *stat)
 {
-	char storepath[MAXPATHLEN];
+	struct fdcache_entry *entry;
 	int rc = 0;
-	int fd = 0;
 	ssize_t read_bytes;
 
-	RC_WRAP(build_extstore_path, *ino, storepath, MAXPATHLEN);
+	RC_WRAP(fdcache_get, *ino, &entry);
 
-	fd = open(storepath, O_CREAT|O_RDONLY|O_SYNC, 0755);
-	if (fd < 0) {
-		return -errno;
-	}
-
-	read_bytes = pread(fd, buffer, buffer_size, offset);
+	read_bytes = pread(fdcache_fd(entry), buffer, buffer_size, offset);
 	if (read_bytes < 0) {
-		close(fd);
-		return -errno;
+		rc = -errno;
+		goto errout;
 	}
 
-	RC_WRAP_LABEL(rc, errout, update_stat, stat, UP_ST_READ, 0);
-	RC_WRAP_LABEL(rc, errout, set_stat, ino, stat);
-
-	rc = close(fd);
-	if (rc < 0)
-		return -errno;
+	RC_WRAP_LABEL(rc, errout, attr_read, *ino, stat);
 
+	fdcache_put(entry);
 	return read_bytes;
 
 errout:
-	close(fd);
+	fdcache_put(entry);
 
 	return rc;
 }
@@ -426,46 +800,160 @@ int extstore_write(kvsns_ino_t *ino,
 		   off_t offset,
 		   size_t buffer_size,
 		   void *buffer,
+		   kvsns_durability_t how,
 		   bool *fsal_stable,
 		   struct stat *stat)
 {
-	char storepath[MAXPATHLEN];
-	int rc;
-	int fd;
+	struct fdcache_entry *entry;
 	ssize_t written_bytes;
 	struct stat objstat;
+	int rc;
 
-	RC_WRAP(build_extstore_path, *ino, storepath, MAXPATHLEN);
+	RC_WRAP(fdcache_get, *ino, &entry);
 
-	fd = open(storepath, O_CREAT|O_WRONLY|O_SYNC, 0755);
-	if (fd < 0)
-		return -errno;
+	written_bytes = pwrite(fdcache_fd(entry), buffer, buffer_size, offset);
+	if (written_bytes < 0)
+		rc = -errno;
+	else
+		rc = fdcache_sync(entry, how);
+	fdcache_put(entry);
+	if (rc < 0)
+		return rc;
 
-	written_bytes = pwrite(fd, buffer, buffer_size, offset);
-	if (written_bytes < 0) {
-		close(fd);
-		return -errno;
+	/* Kept in memory until the close. The size a reader sees is the
+	 * file's, made durable by the sync above */
+	RC_WRAP(attr_update, *ino, UP_ST_WRITE, offset+written_bytes,
+		false, &objstat);
+
+	stat->st_size = objstat.st_size;
+	stat->st_blocks = objstat.st_blocks;
+	stat->st_mtim = objstat.st_mtim;
+	stat->st_ctim = objstat.st_ctim;
+
+	*fsal_stable = (how != KVSNS_UNSTABLE);
+	return written_bytes;
+}
+
+
+int extstore_readv(kvsns_ino_t *ino,
+		   const struct iovec *iov,
+		   int iovcnt,
+		   const kvsns_extent_t *ext,
+		   int extcnt,
+		   bool *end_of_file,
+		   struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	int rc = 0;
+	ssize_t read_bytes;
+
+	RC_WRAP(fdcache_get, *ino, &entry);
+
+	read_bytes = extent_preadv(fdcache_fd(entry), iov, iovcnt, ext, extcnt,
+				   end_of_file);
+	if (read_bytes < 0) {
+		rc = read_bytes;
+		goto errout;
 	}
 
-	rc = close(fd);
+	RC_WRAP_LABEL(rc, errout, attr_read, *ino, stat);
+
+	fdcache_put(entry);
+	return read_bytes;
+
+errout:
+	fdcache_put(entry);
+
+	return rc;
+}
+
+int extstore_writev(kvsns_ino_t *ino,
+		    const struct iovec *iov,
+		    int iovcnt,
+		    const kvsns_extent_t *ext,
+		    int extcnt,
+		    kvsns_durability_t how,
+		    bool *fsal_stable,
+		    struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t written_bytes;
+	struct stat objstat;
+	off_t end;
+	int rc;
+
+	RC_WRAP(fdcache_get, *ino, &entry);
+
+	written_bytes = extent_pwritev(fdcache_fd(entry), iov, iovcnt, ext,
+				       extcnt, &end);
+	if (written_bytes < 0)
+		rc = written_bytes;
+	else
+		rc = fdcache_sync(entry, how);
+	fdcache_put(entry);
 	if (rc < 0)
-		return -errno;
+		return rc;
 
-	RC_WRAP(get_stat, ino, &objstat);
-	RC_WRAP(update_stat, &objstat, UP_ST_WRITE,
-		offset+written_bytes);
-	RC_WRAP(set_stat, ino, &objstat);
+	/* One update of the attributes for all the extents */
+	RC_WRAP(attr_update, *ino, UP_ST_WRITE, end, false, &objstat);
 
 	stat->st_size = objstat.st_size;
 	stat->st_blocks = objstat.st_blocks;
 	stat->st_mtim = objstat.st_mtim;
 	stat->st_ctim = objstat.st_ctim;
 
-	*fsal_stable = true;
+	*fsal_stable = (how != KVSNS_UNSTABLE);
 	return written_bytes;
 }
 
 
+/* Data goes from the descriptor to the object in the kernel */
+ssize_t extstore_copy_from_fd(kvsns_ino_t *ino,
+			      off_t offset,
+			      int fd,
+			      off_t fd_offset,
+			      size_t len,
+			      struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t copied;
+	struct stat objstat;
+
+	RC_WRAP(fdcache_get, *ino, &entry);
+
+	copied = fdcopy(fd, fd_offset, fdcache_fd(entry), offset, len);
+	fdcache_put(entry);
+	if (copied < 0)
+		return copied;
+
+	RC_WRAP(attr_update, *ino, UP_ST_WRITE, offset + copied, false,
+		&objstat);
+
+	stat->st_size = objstat.st_size;
+	stat->st_blocks = objstat.st_blocks;
+	stat->st_mtim = objstat.st_mtim;
+	stat->st_ctim = objstat.st_ctim;
+
+	return copied;
+}
+
+ssize_t extstore_copy_to_fd(kvsns_ino_t *ino,
+			    off_t offset,
+			    int fd,
+			    off_t fd_offset,
+			    size_t len)
+{
+	struct fdcache_entry *entry;
+	ssize_t copied;
+
+	RC_WRAP(fdcache_get, *ino, &entry);
+
+	copied = fdcopy(fdcache_fd(entry), offset, fd, fd_offset, len);
+	fdcache_put(entry);
+
+	return copied;
+}
+
 int extstore_truncate(kvsns_ino_t *ino,
 		      off_t filesize,
 		      bool on_obj_store,
@@ -482,24 +970,19 @@ int extstore_truncate(kvsns_ino_t *ino,
 	if (rc < 0)
 		return rc;
 
-	RC_WRAP(get_stat, ino, &objstat);
-
 	if (on_obj_store) {
 		rc = truncate(storepath, filesize);
 		if (rc < 0)
 			return -errno;
 	}
 
-	stat->st_size = filesize;
-	objstat.st_size = filesize;
-
-	RC_WRAP(update_stat, &objstat, UP_ST_TRUNCATE, filesize);
+	RC_WRAP(attr_update, *ino, UP_ST_TRUNCATE, filesize, true,
+		&objstat);
 
+	stat->st_size = filesize;
 	stat->st_ctim = objstat.st_ctim;
 	stat->st_mtim = objstat.st_mtim;
 
-	RC_WRAP(set_stat, ino, &objstat);
-
 	return 0;
 }
 
@@ -519,3 +1002,50 @@ int extstore_getattr(kvsns_ino_t *ino,
 	RC_WRAP(lstat, storepath, stat);
 	return 0;
 }
+
+/* The paths of all the objects are asked in a single round trip */
+int extstore_getattr_many(int nb, kvsns_ino_t *inos, struct stat *stats,
+			  int *rcs)
+{
+	char k[KLEN];
+	redisReply *reply;
+	int i;
+
+	if (nb < 0 || !inos || !stats || !rcs)
+		return -EINVAL;
+
+	if (!rediscontext)
+		extstore_reinit();
+
+	for (i = 0; i < nb; i++) {
+		snprintf(k, KLEN, OBJ_KEY, inos[i]);
+		redisAppendCommand(rediscontext, "HGET %s " OBJ_PATH, k);
+	}
+
+	for (i = 0; i < nb; i++) {
+		reply = NULL;
+		if (redisGetReply(rediscontext, (void **)&reply) != REDIS_OK) {
+			/* The connection is lost with the remaining replies */
+			for (; i < nb; i++)
+				rcs[i] = -EIO;
+			redisFree(rediscontext);
+			rediscontext = NULL;
+			return 0;
+		}
+
+		if (reply->type != REDIS_REPLY_STRING || reply->len == 0 ||
+		    reply->len >= MAXPATHLEN)
+			rcs[i] = 1; /* older store, see below */
+		else if (lstat(reply->str, &stats[i]) < 0)
+			rcs[i] = -errno;
+		else
+			rcs[i] = 0;
+		freeReplyObject(reply);
+	}
+
+	for (i = 0; i < nb; i++)
+		if (rcs[i] == 1)
+			rcs[i] = extstore_getattr(&inos[i], &stats[i]);
+
+	return 0;
+}
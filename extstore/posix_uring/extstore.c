@@ -0,0 +1,712 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* extstore.c
+ * KVSNS: implement a dummy object store inside a POSIX directory, with I/O
+ * submitted through io_uring
+ */
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <liburing.h>
+#include <ini_config.h>
+#include <kvsns/extstore.h>
+#include "posix_dir.h"
+#include "fdcache.h"
+
+/* A single ring is shared by all threads. Submission is serialized by
+ * sq_lock, completions are reaped in batches by a dedicated thread that
+ * runs the callbacks. Object descriptors come from the fdcache and are
+ * registered in the ring at the index of their descriptor number. I/O
+ * buffers taken from extstore_buffer_alloc are registered too.
+ * Everything but read and write, done through the ring, is shared with
+ * posix_store in posix_dir.c */
+#define URING_DEFAULT_DEPTH 256
+#define URING_DEFAULT_BUFFERS 64
+#define URING_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define URING_MAX_FILES 32768
+#define URING_REAP_BATCH 64
+
+struct uring_req {
+	extstore_cb_t cb;
+	void *arg;
+	ssize_t res;
+	int pending;			/* CQEs still to come */
+	bool first_done;
+	struct fdcache_entry *entry;	/* released at completion if set */
+	struct uring_req *prev;		/* in flight list, under sq_lock */
+	struct uring_req *next;
+};
+
+struct uring_wait {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	ssize_t res;
+};
+
+static struct {
+	struct io_uring ring;
+	pthread_mutex_t sq_lock;
+	pthread_t reaper;
+	unsigned int nfiles;		/* size of the registered files table */
+	unsigned char *fixed;		/* fixed[fd] != 0 if fd is registered */
+	pthread_mutex_t files_lock;
+	char *buffers;			/* registered buffers region */
+	unsigned int nbuffers;
+	size_t buffer_size;
+	pthread_mutex_t buffers_lock;
+	unsigned int *free_buffers;	/* stack of free buffer indexes */
+	unsigned int nfree;
+	struct uring_req *inflight;	/* submitted, under sq_lock */
+	bool dead;			/* the reaper failed, under sq_lock */
+	pthread_mutex_t init_lock;
+	bool started;
+} uring = {
+	.sq_lock = PTHREAD_MUTEX_INITIALIZER,
+	.init_lock = PTHREAD_MUTEX_INITIALIZER,
+	.files_lock = PTHREAD_MUTEX_INITIALIZER,
+	.buffers_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread bool plugged;
+
+static int extstore_open_fd(kvsns_ino_t ino)
+{
+	int fd;
+
+	fd = posix_dir_open(ino);
+	if (fd < 0)
+		return fd;
+
+	if (fd < uring.nfiles) {
+		pthread_mutex_lock(&uring.files_lock);
+		if (io_uring_register_files_update(&uring.ring, fd,
+						   &fd, 1) == 1)
+			uring.fixed[fd] = 1;
+		pthread_mutex_unlock(&uring.files_lock);
+	}
+
+	return fd;
+}
+
+static void extstore_close_fd(int fd)
+{
+	int none = -1;
+
+	/* The slot is emptied before the descriptor number can be reused */
+	if (fd < uring.nfiles) {
+		pthread_mutex_lock(&uring.files_lock);
+		if (uring.fixed[fd]) {
+			io_uring_register_files_update(&uring.ring, fd,
+						       &none, 1);
+			uring.fixed[fd] = 0;
+		}
+		pthread_mutex_unlock(&uring.files_lock);
+	}
+
+	close(fd);
+}
+
+/* Index of the registered buffer holding [buffer, buffer+len[, or -1 */
+static int uring_buffer_index(void *buffer, size_t len)
+{
+	char *p = buffer;
+	size_t idx;
+
+	if (!uring.buffers || p < uring.buffers ||
+	    p >= uring.buffers + uring.nbuffers * uring.buffer_size)
+		return -1;
+
+	idx = (p - uring.buffers) / uring.buffer_size;
+	if (p + len > uring.buffers + (idx + 1) * uring.buffer_size)
+		return -1;
+
+	return idx;
+}
+
+static void uring_complete(struct uring_req *req)
+{
+	if (req->entry)
+		fdcache_put(req->entry);
+
+	req->cb(req->arg, req->res);
+	free(req);
+}
+
+/* sq_lock is held */
+static void uring_inflight_del(struct uring_req *req)
+{
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		uring.inflight = req->next;
+	if (req->next)
+		req->next->prev = req->prev;
+}
+
+/* The ring can not be reaped any more: the requests in flight will never
+ * complete, they fail, and so will the next ones */
+static void uring_fail_all(void)
+{
+	struct uring_req *req;
+	struct uring_req *next;
+
+	pthread_mutex_lock(&uring.sq_lock);
+	uring.dead = true;
+	req = uring.inflight;
+	uring.inflight = NULL;
+	pthread_mutex_unlock(&uring.sq_lock);
+
+	for (; req; req = next) {
+		next = req->next;
+		req->res = -EIO;
+		uring_complete(req);
+	}
+}
+
+static void *uring_reaper(void *arg)
+{
+	struct io_uring_cqe *cqes[URING_REAP_BATCH];
+	struct io_uring_cqe *cqe;
+	struct uring_req *done[URING_REAP_BATCH];
+	struct uring_req *req;
+	unsigned int n, i, ndone;
+	int rc;
+
+	for (;;) {
+		rc = io_uring_wait_cqe(&uring.ring, &cqe);
+		if (rc < 0) {
+			if (rc == -EINTR || rc == -EAGAIN)
+				continue;
+			uring_fail_all();
+			return NULL;
+		}
+
+		ndone = 0;
+		n = io_uring_peek_batch_cqe(&uring.ring, cqes,
+					    URING_REAP_BATCH);
+		for (i = 0; i < n; i++) {
+			req = io_uring_cqe_get_data(cqes[i]);
+			rc = cqes[i]->res;
+
+			if (!req->first_done) {
+				/* The read or write itself */
+				req->res = rc;
+				req->first_done = true;
+			} else if (rc < 0 && req->res >= 0) {
+				/* The linked fsync, cancelled after a short
+				 * write that left unsynced data */
+				req->res = (rc == -ECANCELED) ? -EIO : rc;
+			}
+
+			req->pending -= 1;
+			if (req->pending == 0)
+				done[ndone++] = req;
+		}
+		io_uring_cq_advance(&uring.ring, n);
+
+		/* Requests left in the SQ by a failed submit go as well */
+		pthread_mutex_lock(&uring.sq_lock);
+		for (i = 0; i < ndone; i++)
+			uring_inflight_del(done[i]);
+		if (io_uring_sq_ready(&uring.ring) > 0)
+			io_uring_submit(&uring.ring);
+		pthread_mutex_unlock(&uring.sq_lock);
+
+		/* Callbacks may submit again, they run without the lock */
+		for (i = 0; i < ndone; i++)
+			uring_complete(done[i]);
+	}
+
+	return NULL;
+}
+
+static int uring_submit_rw(struct fdcache_entry *entry, bool write,
+			   off_t offset, size_t buffer_size, void *buffer,
+			   kvsns_durability_t how, bool owns_entry,
+			   bool batch, extstore_cb_t cb, void *arg)
+{
+	struct io_uring_sqe *sqe;
+	struct uring_req *req;
+	unsigned int needed;
+	int fd = fdcache_fd(entry);
+	int buf_index;
+	unsigned int flags = 0;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+
+	req->cb = cb;
+	req->arg = arg;
+	req->entry = owns_entry ? entry : NULL;
+
+	needed = (write && how != KVSNS_UNSTABLE) ? 2 : 1;
+	req->pending = needed;
+
+	if (fd < uring.nfiles && uring.fixed[fd])
+		flags |= IOSQE_FIXED_FILE;
+
+	buf_index = uring_buffer_index(buffer, buffer_size);
+
+	pthread_mutex_lock(&uring.sq_lock);
+
+	if (uring.dead) {
+		pthread_mutex_unlock(&uring.sq_lock);
+		free(req);
+		return -EIO;
+	}
+
+	/* A write and its fsync go in the same submission */
+	if (io_uring_sq_space_left(&uring.ring) < needed)
+		io_uring_submit(&uring.ring);
+	if (io_uring_sq_space_left(&uring.ring) < needed) {
+		pthread_mutex_unlock(&uring.sq_lock);
+		free(req);
+		return -EAGAIN;
+	}
+
+	sqe = io_uring_get_sqe(&uring.ring);
+	if (write && buf_index >= 0)
+		io_uring_prep_write_fixed(sqe, fd, buffer, buffer_size,
+					  offset, buf_index);
+	else if (write)
+		io_uring_prep_write(sqe, fd, buffer, buffer_size, offset);
+	else if (buf_index >= 0)
+		io_uring_prep_read_fixed(sqe, fd, buffer, buffer_size,
+					 offset, buf_index);
+	else
+		io_uring_prep_read(sqe, fd, buffer, buffer_size, offset);
+	io_uring_sqe_set_data(sqe, req);
+	io_uring_sqe_set_flags(sqe, flags | ((needed == 2) ? IOSQE_IO_LINK : 0));
+
+	if (needed == 2) {
+		sqe = io_uring_get_sqe(&uring.ring);
+		io_uring_prep_fsync(sqe, fd, (how == KVSNS_DATASYNC) ?
+					     IORING_FSYNC_DATASYNC : 0);
+		io_uring_sqe_set_data(sqe, req);
+		io_uring_sqe_set_flags(sqe, flags);
+	}
+
+	req->next = uring.inflight;
+	if (uring.inflight)
+		uring.inflight->prev = req;
+	uring.inflight = req;
+
+	/* If submission fails, the requests stay in the SQ and go with the
+	 * next submit, the reaper's one at the latest */
+	if (!batch)
+		io_uring_submit(&uring.ring);
+
+	pthread_mutex_unlock(&uring.sq_lock);
+
+	return 0;
+}
+
+static void uring_wakeup(void *arg, ssize_t rc)
+{
+	struct uring_wait *wait = arg;
+
+	pthread_mutex_lock(&wait->lock);
+	wait->res = rc;
+	wait->done = true;
+	pthread_cond_signal(&wait->cond);
+	pthread_mutex_unlock(&wait->lock);
+}
+
+/* Submits a request for the caller and waits for its completion */
+static ssize_t uring_rw_wait(struct fdcache_entry *entry, bool write,
+			     off_t offset, size_t buffer_size, void *buffer,
+			     kvsns_durability_t how)
+{
+	struct uring_wait wait = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.done = false,
+	};
+	int rc;
+
+	rc = uring_submit_rw(entry, write, offset, buffer_size, buffer,
+			     how, false, false, uring_wakeup, &wait);
+	if (rc < 0)
+		return rc;
+
+	pthread_mutex_lock(&wait.lock);
+	while (!wait.done)
+		pthread_cond_wait(&wait.cond, &wait.lock);
+	pthread_mutex_unlock(&wait.lock);
+
+	pthread_cond_destroy(&wait.cond);
+	pthread_mutex_destroy(&wait.lock);
+
+	return wait.res;
+}
+
+static int uring_buffers_init(unsigned int count, size_t size)
+{
+	struct iovec *iov;
+	unsigned int i;
+	int rc;
+
+	if (count == 0 || size == 0)
+		return 0;
+
+	uring.buffers = mmap(NULL, count * size, PROT_READ|PROT_WRITE,
+			     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (uring.buffers == MAP_FAILED) {
+		uring.buffers = NULL;
+		return -errno;
+	}
+
+	iov = calloc(count, sizeof(*iov));
+	uring.free_buffers = calloc(count, sizeof(*uring.free_buffers));
+	if (!iov || !uring.free_buffers) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = uring.buffers + i * size;
+		iov[i].iov_len = size;
+		uring.free_buffers[i] = count - 1 - i;
+	}
+
+	/* Pinned memory is bounded by RLIMIT_MEMLOCK */
+	rc = io_uring_register_buffers(&uring.ring, iov, count);
+	if (rc < 0)
+		goto err;
+
+	free(iov);
+	uring.nbuffers = count;
+	uring.nfree = count;
+	uring.buffer_size = size;
+	return 0;
+
+err:
+	free(iov);
+	free(uring.free_buffers);
+	uring.free_buffers = NULL;
+	munmap(uring.buffers, count * size);
+	uring.buffers = NULL;
+	return rc;
+}
+
+static void uring_buffers_fini(void)
+{
+	if (!uring.buffers)
+		return;
+
+	munmap(uring.buffers, uring.nbuffers * uring.buffer_size);
+	free(uring.free_buffers);
+	uring.buffers = NULL;
+	uring.free_buffers = NULL;
+	uring.nbuffers = 0;
+	uring.nfree = 0;
+	uring.buffer_size = 0;
+}
+
+static int uring_files_init(void)
+{
+	struct rlimit rl;
+	unsigned int nfiles = URING_MAX_FILES;
+	int rc;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < nfiles)
+		nfiles = rl.rlim_cur;
+
+	uring.fixed = calloc(nfiles, sizeof(*uring.fixed));
+	if (!uring.fixed)
+		return -ENOMEM;
+
+	rc = io_uring_register_files_sparse(&uring.ring, nfiles);
+	if (rc < 0) {
+		free(uring.fixed);
+		uring.fixed = NULL;
+		return rc;
+	}
+
+	uring.nfiles = nfiles;
+	return 0;
+}
+
+static unsigned int uring_config(struct collection_item *cfg_items,
+				 char *key, unsigned int dflt)
+{
+	struct collection_item *item = NULL;
+
+	if (get_config_item("posix_uring", key, cfg_items, &item) != 0 ||
+	    item == NULL)
+		return dflt;
+
+	return get_unsigned_config_value(item, 0, dflt, NULL);
+}
+
+static int uring_init(struct collection_item *cfg_items)
+{
+	struct io_uring_params params;
+	unsigned int depth;
+	int rc;
+
+	depth = uring_config(cfg_items, "queue_depth", URING_DEFAULT_DEPTH);
+
+	memset(&params, 0, sizeof(params));
+	params.sq_thread_idle = uring_config(cfg_items, "sq_poll", 0);
+	if (params.sq_thread_idle != 0)
+		params.flags |= IORING_SETUP_SQPOLL;
+
+	rc = io_uring_queue_init_params(depth, &uring.ring, &params);
+	if (rc < 0)
+		return rc;
+
+	/* Registered files and buffers are optimizations, go without
+	 * them if the kernel or the limits do not allow them */
+	if (uring_config(cfg_items, "register_files", 1) != 0)
+		uring_files_init();
+
+	uring_buffers_init(uring_config(cfg_items, "fixed_buffers",
+					URING_DEFAULT_BUFFERS),
+			   uring_config(cfg_items, "fixed_buffer_size",
+					URING_DEFAULT_BUFFER_SIZE));
+
+	rc = pthread_create(&uring.reaper, NULL, uring_reaper, NULL);
+	if (rc != 0) {
+		/* Exiting the ring unregisters the files and the buffers */
+		io_uring_queue_exit(&uring.ring);
+		uring_buffers_fini();
+		free(uring.fixed);
+		uring.fixed = NULL;
+		uring.nfiles = 0;
+		return -rc;
+	}
+	pthread_detach(uring.reaper);
+
+	uring.started = true;
+	return 0;
+}
+
+int extstore_init(struct collection_item *cfg_items)
+{
+	int rc;
+
+	rc = posix_dir_init(cfg_items, "posix_uring");
+	if (rc != 0)
+		return rc;
+
+	/* extstore_init may run once per thread, the ring is set up once */
+	pthread_mutex_lock(&uring.init_lock);
+	if (!uring.started)
+		rc = uring_init(cfg_items);
+	pthread_mutex_unlock(&uring.init_lock);
+	if (rc < 0)
+		return rc;
+
+	return fdcache_init(cfg_items, "posix_uring", extstore_open_fd,
+			    extstore_close_fd);
+}
+
+int extstore_read(kvsns_ino_t *ino,
+		  off_t offset,
+		  size_t buffer_size,
+		  void *buffer,
+		  bool *end_of_file,
+		  struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t read_bytes;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	read_bytes = uring_rw_wait(entry, false, offset, buffer_size, buffer,
+				   KVSNS_UNSTABLE);
+	if (read_bytes < 0) {
+		rc = read_bytes;
+		goto out;
+	}
+
+	rc = posix_dir_fstat(fdcache_fd(entry), stat);
+	if (rc < 0)
+		goto out;
+
+	rc = read_bytes;
+out:
+	fdcache_put(entry);
+	return rc;
+}
+
+int extstore_write(kvsns_ino_t *ino,
+		   off_t offset,
+		   size_t buffer_size,
+		   void *buffer,
+		   kvsns_durability_t how,
+		   bool *fsal_stable,
+		   struct stat *stat)
+{
+	struct fdcache_entry *entry;
+	ssize_t written_bytes;
+	int rc;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	written_bytes = uring_rw_wait(entry, true, offset, buffer_size,
+				      buffer, how);
+	if (written_bytes < 0) {
+		rc = written_bytes;
+		goto out;
+	}
+
+	rc = posix_dir_fstat(fdcache_fd(entry), stat);
+	if (rc < 0)
+		goto out;
+
+	*fsal_stable = (how != KVSNS_UNSTABLE);
+	rc = written_bytes;
+out:
+	fdcache_put(entry);
+	return rc;
+}
+
+int extstore_async_read(kvsns_ino_t *ino,
+			off_t offset,
+			size_t buffer_size,
+			void *buffer,
+			extstore_cb_t cb,
+			void *arg)
+{
+	struct fdcache_entry *entry;
+	int rc;
+
+	if (!ino || !cb)
+		return -EINVAL;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	/* The descriptor is released by the completion */
+	rc = uring_submit_rw(entry, false, offset, buffer_size, buffer,
+			     KVSNS_UNSTABLE, true, plugged, cb, arg);
+	if (rc < 0)
+		fdcache_put(entry);
+
+	return rc;
+}
+
+int extstore_async_write(kvsns_ino_t *ino,
+			 off_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 kvsns_durability_t how,
+			 extstore_cb_t cb,
+			 void *arg)
+{
+	struct fdcache_entry *entry;
+	int rc;
+
+	if (!ino || !cb)
+		return -EINVAL;
+
+	rc = fdcache_get(*ino, &entry);
+	if (rc < 0)
+		return rc;
+
+	rc = uring_submit_rw(entry, true, offset, buffer_size, buffer,
+			     how, true, plugged, cb, arg);
+	if (rc < 0)
+		fdcache_put(entry);
+
+	return rc;
+}
+
+void extstore_async_plug(void)
+{
+	plugged = true;
+}
+
+int extstore_async_unplug(void)
+{
+	int rc;
+
+	plugged = false;
+
+	pthread_mutex_lock(&uring.sq_lock);
+	rc = uring.dead ? -EIO : io_uring_submit(&uring.ring);
+	pthread_mutex_unlock(&uring.sq_lock);
+
+	return (rc < 0) ? rc : 0;
+}
+
+void *extstore_buffer_alloc(size_t size)
+{
+	void *buffer = NULL;
+
+	if (size <= uring.buffer_size) {
+		pthread_mutex_lock(&uring.buffers_lock);
+		if (uring.nfree > 0) {
+			uring.nfree -= 1;
+			buffer = uring.buffers +
+				uring.free_buffers[uring.nfree] *
+				uring.buffer_size;
+		}
+		pthread_mutex_unlock(&uring.buffers_lock);
+		if (buffer)
+			return buffer;
+	}
+
+	/* Not registered, the I/O is done without IORING_OP_*_FIXED */
+	if (posix_memalign(&buffer, 4096, size) != 0)
+		return NULL;
+
+	return buffer;
+}
+
+void extstore_buffer_free(void *buffer)
+{
+	int idx;
+
+	if (!buffer)
+		return;
+
+	idx = uring_buffer_index(buffer, 1);
+	if (idx < 0) {
+		free(buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&uring.buffers_lock);
+	uring.free_buffers[uring.nfree] = idx;
+	uring.nfree += 1;
+	pthread_mutex_unlock(&uring.buffers_lock);
+}
@@ -32,6 +32,10 @@
 
 #include <kvsns/extstore.h>
 #include <rados/librados.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include "extent.h"
+#include "striping.h"
 
 #define RC_WRAP(__function, ...) ({\
 	int __rc = __function(__VA_ARGS__);\
@@ -45,35 +49,756 @@
 
 #define CEPH_CONFIG_DEFAULT "/etc/ceph/ceph.conf"
 
+/* Striped files keep their layout, size and mtime in xattrs of their
+ * first object. Files without a layout xattr live in a single object */
+#define LAYOUT_XATTR "kvsns.layout"
+#define SIZE_XATTR "kvsns.size"
+#define MTIME_XATTR "kvsns.mtime"
+
+/* Sizes are zero-padded so that comparing them as strings, as
+ * rados_write_op_cmpxattr does, compares them as numbers */
+#define SIZE_XATTR_LEN 20
+
+#define LAYOUT_CACHE_SIZE 1024
+
 static char pool[MAXNAMLEN];
 static rados_t cluster;
 
-static void build_objid(kvsns_ino_t ino, char *objid, int objidlen)
+/* I/O contexts are thread safe, a single one serves all the requests */
+static rados_ioctx_t ioctx;
+
+/* extstore_init runs at every thread's kvsns_start: the first one
+ * connects, the last extstore_fini disconnects */
+static unsigned int rados_users;
+static pthread_mutex_t rados_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Layout given to new files */
+static struct stripe_layout default_layout;
+
+/* A layout never changes once the file is created, they are kept in a
+ * direct mapped cache to save a round trip per I/O */
+static struct layout_cache_entry {
+	kvsns_ino_t ino;
+	struct stripe_layout layout;
+} layout_cache[LAYOUT_CACHE_SIZE];
+static pthread_mutex_t layout_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void build_objid(kvsns_ino_t ino, uint64_t objno, char *objid,
+			int objidlen)
 {
 	if (!ino)
 		return;
 
 	memset(objid, 0, objidlen);
-	snprintf(objid, objidlen, "kvsns.%llu", ino);
+	if (objno == 0)
+		snprintf(objid, objidlen, "kvsns.%llu", ino);
+	else
+		snprintf(objid, objidlen, "kvsns.%llu.%llu", ino,
+			 (unsigned long long)objno);
 }
 
-int extstore_create(kvsns_ino_t object)
+static void layout_cache_set(kvsns_ino_t ino,
+			     const struct stripe_layout *layout)
 {
-	int rc;
-	rados_ioctx_t io;
+	struct layout_cache_entry *entry;
+
+	entry = &layout_cache[ino % LAYOUT_CACHE_SIZE];
+
+	pthread_mutex_lock(&layout_cache_lock);
+	entry->ino = ino;
+	entry->layout = *layout;
+	pthread_mutex_unlock(&layout_cache_lock);
+}
+
+static void layout_cache_forget(kvsns_ino_t ino)
+{
+	struct layout_cache_entry *entry;
+
+	entry = &layout_cache[ino % LAYOUT_CACHE_SIZE];
+
+	pthread_mutex_lock(&layout_cache_lock);
+	if (entry->ino == ino)
+		entry->ino = 0;
+	pthread_mutex_unlock(&layout_cache_lock);
+}
+
+static int get_layout(kvsns_ino_t ino, struct stripe_layout *layout)
+{
+	struct layout_cache_entry *entry;
 	char objid[MAXNAMLEN];
+	char buf[64];
+	bool found = false;
+	int rc;
+
+	entry = &layout_cache[ino % LAYOUT_CACHE_SIZE];
+
+	pthread_mutex_lock(&layout_cache_lock);
+	if (entry->ino == ino) {
+		*layout = entry->layout;
+		found = true;
+	}
+	pthread_mutex_unlock(&layout_cache_lock);
+
+	if (found)
+		return 0;
 
-	build_objid(object, objid, MAXNAMLEN);
+	build_objid(ino, 0, objid, MAXNAMLEN);
+
+	memset(layout, 0, sizeof(*layout));
+	rc = rados_getxattr(ioctx, objid, LAYOUT_XATTR, buf, sizeof(buf));
+	if (rc == -ENOENT)
+		return 0; /* No data yet, don't cache it */
+
+	if (rc == -ENODATA) {
+		layout_cache_set(ino, layout);
+		return 0;
+	}
 
-	rc = rados_ioctx_create(cluster, pool, &io);
 	if (rc < 0)
 		return rc;
 
-	rc = rados_write(io, objid, "", 0, 0);
+	RC_WRAP(stripe_layout_parse, buf, rc, layout);
+	layout_cache_set(ino, layout);
+	return 0;
+}
+
+static void parse_attrs(rados_xattrs_iter_t iter, uint64_t *size,
+			time_t *mtime)
+{
+	const char *name, *val;
+	char str[32];
+	size_t len;
+
+	while (rados_getxattrs_next(iter, &name, &val, &len) == 0 && name) {
+		if (len >= sizeof(str))
+			continue;
+
+		memcpy(str, val, len);
+		str[len] = '\0';
+		if (!strcmp(name, SIZE_XATTR))
+			*size = strtoull(str, NULL, 10);
+		else if (!strcmp(name, MTIME_XATTR))
+			*mtime = strtoll(str, NULL, 10);
+	}
+	rados_getxattrs_end(iter);
+}
+
+static void fill_stat(struct stat *stat, bool exists, uint64_t size,
+		      time_t mtime)
+{
+	stat->st_mtim.tv_nsec = 0;
+	stat->st_atim.tv_nsec = 0;
+
+	if (!exists) {
+		/* The file is empty, it has no object attached to it */
+		stat->st_size = 0;
+		stat->st_blocks = 0;
+		stat->st_mtime = time(NULL);
+		stat->st_atime = stat->st_mtime;
+		return;
+	}
+
+	stat->st_size = size;
+	stat->st_blocks = (size + DEV_BSIZE - 1) / DEV_BSIZE;
+	stat->st_mtime = mtime;
+	stat->st_atime = mtime; /* @todo bug ?*/
+}
+
+/* Size and mtime come from the first object's xattrs for striped files,
+ * from the object itself otherwise */
+static void attrs_read_op(rados_read_op_t op,
+			  const struct stripe_layout *layout,
+			  rados_xattrs_iter_t *iter, uint64_t *size,
+			  time_t *mtime, int *prval)
+{
+	if (stripe_is_striped(layout))
+		rados_read_op_getxattrs(op, iter, prval);
+	else
+		rados_read_op_stat(op, size, mtime, prval);
+}
+
+static int get_attrs(kvsns_ino_t ino, const struct stripe_layout *layout,
+		     struct stat *stat)
+{
+	rados_read_op_t op;
+	rados_xattrs_iter_t iter;
+	char objid[MAXNAMLEN];
+	uint64_t size = 0;
+	time_t mtime = 0;
+	int prval = 0;
+	int rc;
+
+	build_objid(ino, 0, objid, MAXNAMLEN);
+
+	op = rados_create_read_op();
+	attrs_read_op(op, layout, &iter, &size, &mtime, &prval);
+	rc = rados_read_op_operate(op, ioctx, objid,
+				   LIBRADOS_OPERATION_NOFLAG);
+	if (rc == 0)
+		rc = prval;
+	if (rc == 0 && stripe_is_striped(layout))
+		parse_attrs(iter, &size, &mtime);
+	rados_release_read_op(op);
+
+	if (rc < 0 && rc != -ENOENT)
+		return rc;
+
+	fill_stat(stat, rc == 0, size, mtime);
+	return 0;
+}
+
+/* An I/O is cut along the stripe units. The pieces going to the same
+ * object are sent in one operation and all the objects are accessed in
+ * parallel. A request goes through up to two phases, each one a set of
+ * operations in flight: the data (and the attributes for reads and
+ * single object files), then the size and mtime for striped writes */
+struct io_piece {
+	char *buf;
+	uint64_t offset;	/* in the file */
+	struct stripe_piece where;
+	size_t bytes;
+	int prval;
+};
+
+enum req_op_kind {
+	OP_READ,
+	OP_WRITE,
+	OP_ATTRS,
+	OP_SIZE,
+	OP_MTIME,
+};
+
+struct stripe_req;
+
+struct req_op {
+	struct stripe_req *req;
+	enum req_op_kind kind;
+	rados_read_op_t rop;
+	rados_write_op_t wop;
+};
+
+enum req_phase {
+	PHASE_DATA,
+	PHASE_ATTRS,
+};
+
+struct stripe_req {
+	kvsns_ino_t ino;
+	struct stripe_layout layout;
+	bool write;
+	enum req_phase phase;
+
+	const struct iovec *vec;
+	const uint64_t *off;
+	int nslices;
+	struct iovec vec1;	/* single buffer requests */
+	uint64_t off1;
+
+	struct io_piece *pieces;
+	size_t npieces;
+	struct req_op *objs;
+	uint64_t firstobj;
+	uint64_t nobjs;
+	uint64_t end;
+
+	struct req_op attrs;
+	rados_xattrs_iter_t attr_iter;
+	uint64_t attr_size;
+	time_t attr_mtime;
+	int attr_prval;
+	bool attr_exists;
+	struct req_op size;
+	struct req_op mtime;
+	char size_str[SIZE_XATTR_LEN + 1];
+	char mtime_str[32];
+
+	pthread_mutex_t lock;
+	unsigned int pending;
+	int rc;
+
+	/* Asynchronous requests call cb, the others are waited for */
+	extstore_cb_t cb;
+	void *arg;
+	pthread_cond_t cond;
+	bool finished;
+	ssize_t result;
+	bool eof;
+	struct stat stat;
+};
+
+static int stripe_req_init(struct stripe_req *req, kvsns_ino_t ino,
+			   bool write)
+{
+	memset(req, 0, sizeof(*req));
+	req->ino = ino;
+	req->write = write;
+	pthread_mutex_init(&req->lock, NULL);
+	pthread_cond_init(&req->cond, NULL);
+
+	return get_layout(ino, &req->layout);
+}
+
+/* Cuts the slices in pieces and finds the objects they go to */
+static int stripe_req_map(struct stripe_req *req, const struct iovec *vec,
+			  const uint64_t *off, int nslices)
+{
+	struct io_piece *piece;
+	uint64_t lastobj = 0;
+	size_t done;
+	int k;
+
+	req->vec = vec;
+	req->off = off;
+	req->nslices = nslices;
+
+	for (k = 0; k < nslices; k++) {
+		req->npieces += stripe_count_pieces(&req->layout, off[k],
+						    vec[k].iov_len);
+		if (off[k] + vec[k].iov_len > req->end)
+			req->end = off[k] + vec[k].iov_len;
+	}
+
+	req->pieces = calloc(req->npieces ? req->npieces : 1,
+			     sizeof(*req->pieces));
+	if (!req->pieces)
+		return -ENOMEM;
+
+	piece = req->pieces;
+	req->firstobj = UINT64_MAX;
+	for (k = 0; k < nslices; k++) {
+		for (done = 0; done < vec[k].iov_len; piece++) {
+			piece->buf = (char *)vec[k].iov_base + done;
+			piece->offset = off[k] + done;
+			stripe_map(&req->layout, piece->offset,
+				   vec[k].iov_len - done, &piece->where);
+			done += piece->where.len;
+
+			if (piece->where.objno < req->firstobj)
+				req->firstobj = piece->where.objno;
+			if (piece->where.objno > lastobj)
+				lastobj = piece->where.objno;
+		}
+	}
+
+	if (req->npieces == 0)
+		return 0;
+
+	req->nobjs = lastobj - req->firstobj + 1;
+	req->objs = calloc(req->nobjs, sizeof(*req->objs));
+	if (!req->objs)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void release_op(struct req_op *op)
+{
+	if (op->rop)
+		rados_release_read_op(op->rop);
+	if (op->wop)
+		rados_release_write_op(op->wop);
+	op->rop = NULL;
+	op->wop = NULL;
+}
+
+static void stripe_req_release(struct stripe_req *req)
+{
+	uint64_t o;
+
+	for (o = 0; o < req->nobjs; o++)
+		release_op(&req->objs[o]);
+	release_op(&req->attrs);
+	release_op(&req->size);
+	release_op(&req->mtime);
+
+	free(req->pieces);
+	free(req->objs);
+	req->pieces = NULL;
+	req->npieces = 0;
+	req->objs = NULL;
+	req->nobjs = 0;
+}
+
+static void stripe_req_destroy(struct stripe_req *req)
+{
+	stripe_req_release(req);
+	pthread_cond_destroy(&req->cond);
+	pthread_mutex_destroy(&req->lock);
+}
+
+/* Zeroes what the objects did not have below the end of file, returns
+ * the bytes read */
+static ssize_t stripe_req_read_done(struct stripe_req *req)
+{
+	struct io_piece *piece;
+	uint64_t size = req->stat.st_size;
+	uint64_t valid;
+	ssize_t done = 0;
+	size_t i;
+	int k;
+
+	for (i = 0; i < req->npieces; i++) {
+		piece = &req->pieces[i];
+		if (piece->prval < 0 && piece->prval != -ENOENT)
+			return piece->prval;
+
+		valid = (piece->offset >= size) ? 0 : size - piece->offset;
+		if (valid > piece->where.len)
+			valid = piece->where.len;
+		if (piece->bytes < valid)
+			memset(piece->buf + piece->bytes, 0,
+			       valid - piece->bytes);
+	}
+
+	req->eof = false;
+	for (k = 0; k < req->nslices; k++) {
+		valid = (req->off[k] >= size) ? 0 : size - req->off[k];
+		if (valid >= req->vec[k].iov_len) {
+			done += req->vec[k].iov_len;
+			continue;
+		}
+
+		done += valid;
+		req->eof = true;
+		break;
+	}
+
+	return done;
+}
+
+static void stripe_req_finish(struct stripe_req *req)
+{
+	extstore_cb_t cb = req->cb;
+	void *arg = req->arg;
+	ssize_t result;
+	int k;
+
+	if (req->rc == 0)
+		fill_stat(&req->stat, req->attr_exists, req->attr_size,
+			  req->attr_mtime);
+
+	if (req->rc < 0) {
+		result = req->rc;
+	} else if (req->write) {
+		for (result = 0, k = 0; k < req->nslices; k++)
+			result += req->vec[k].iov_len;
+	} else {
+		result = stripe_req_read_done(req);
+	}
+
+	if (cb) {
+		stripe_req_destroy(req);
+		free(req);
+		cb(arg, result);
+		return;
+	}
+
+	stripe_req_release(req);
+
+	/* The waiter owns the request once finished is set */
+	pthread_mutex_lock(&req->lock);
+	req->result = result;
+	req->finished = true;
+	pthread_cond_signal(&req->cond);
+	pthread_mutex_unlock(&req->lock);
+}
+
+static void stripe_req_start_attrs(struct stripe_req *req);
+
+/* Drops a reference on the current phase, the last one moves to the
+ * next phase or ends the request */
+static void stripe_req_put(struct stripe_req *req, int rc)
+{
+	bool last;
+
+	pthread_mutex_lock(&req->lock);
+	if (rc < 0 && req->rc == 0)
+		req->rc = rc;
+	last = (--req->pending == 0);
+	pthread_mutex_unlock(&req->lock);
+
+	if (!last)
+		return;
+
+	if (req->phase == PHASE_DATA && req->write && req->rc == 0 &&
+	    stripe_is_striped(&req->layout)) {
+		stripe_req_start_attrs(req);
+		return;
+	}
+
+	stripe_req_finish(req);
+}
+
+static void stripe_req_get(struct stripe_req *req)
+{
+	pthread_mutex_lock(&req->lock);
+	req->pending++;
+	pthread_mutex_unlock(&req->lock);
+}
+
+static void req_op_done(struct req_op *op, int rc)
+{
+	struct stripe_req *req = op->req;
+
+	switch (op->kind) {
+	case OP_READ:
+		/* Holes have no object */
+		if (rc == -ENOENT)
+			rc = 0;
+		break;
+	case OP_ATTRS:
+		if (rc == 0)
+			rc = req->attr_prval;
+		if (rc == 0) {
+			req->attr_exists = true;
+			if (stripe_is_striped(&req->layout))
+				parse_attrs(req->attr_iter, &req->attr_size,
+					    &req->attr_mtime);
+		}
+		if (rc == -ENOENT)
+			rc = 0;
+		break;
+	case OP_SIZE:
+		/* The size is bigger already */
+		if (rc == -ECANCELED)
+			rc = 0;
+		break;
+	default:
+		break;
+	}
+
+	stripe_req_put(req, rc);
+}
+
+static void req_op_complete(rados_completion_t comp, void *arg)
+{
+	int rc;
+
+	rc = rados_aio_get_return_value(comp);
+	rados_aio_release(comp);
+	req_op_done(arg, rc);
+}
+
+/* The operations sent to one object are run in order, so an operation
+ * sent after a write sees its result without waiting for it */
+static void stripe_req_submit(struct stripe_req *req, struct req_op *op,
+			      enum req_op_kind kind, uint64_t objno)
+{
+	rados_completion_t comp;
+	char objid[MAXNAMLEN];
+	int rc;
+
+	op->req = req;
+	op->kind = kind;
+	build_objid(req->ino, objno, objid, MAXNAMLEN);
+
+	stripe_req_get(req);
+
+	rc = rados_aio_create_completion(op, req_op_complete, NULL, &comp);
+	if (rc < 0) {
+		stripe_req_put(req, rc);
+		return;
+	}
+
+	if (op->wop)
+		rc = rados_aio_write_op_operate(op->wop, ioctx, comp, objid,
+						NULL,
+						LIBRADOS_OPERATION_NOFLAG);
+	else
+		rc = rados_aio_read_op_operate(op->rop, ioctx, comp, objid,
+					       LIBRADOS_OPERATION_NOFLAG);
+	if (rc < 0) {
+		rados_aio_release(comp);
+		stripe_req_put(req, rc);
+	}
+}
+
+static void stripe_req_submit_attrs(struct stripe_req *req)
+{
+	req->attrs.rop = rados_create_read_op();
+	attrs_read_op(req->attrs.rop, &req->layout, &req->attr_iter,
+		      &req->attr_size, &req->attr_mtime, &req->attr_prval);
+	stripe_req_submit(req, &req->attrs, OP_ATTRS, 0);
+}
+
+/* The size of a striped file moves once the data is there. It only moves
+ * forward so that concurrent writers can't shrink it: the operation is
+ * canceled if the size is bigger already */
+static void stripe_req_start_attrs(struct stripe_req *req)
+{
+	req->phase = PHASE_ATTRS;
+	stripe_req_get(req);
+
+	snprintf(req->size_str, sizeof(req->size_str), "%0*llu",
+		 SIZE_XATTR_LEN, (unsigned long long)req->end);
+	req->size.wop = rados_create_write_op();
+	rados_write_op_cmpxattr(req->size.wop, SIZE_XATTR,
+				LIBRADOS_CMPXATTR_OP_GT, req->size_str,
+				SIZE_XATTR_LEN);
+	rados_write_op_setxattr(req->size.wop, SIZE_XATTR, req->size_str,
+				SIZE_XATTR_LEN);
+	stripe_req_submit(req, &req->size, OP_SIZE, 0);
+
+	snprintf(req->mtime_str, sizeof(req->mtime_str), "%lld",
+		 (long long)time(NULL));
+	req->mtime.wop = rados_create_write_op();
+	rados_write_op_setxattr(req->mtime.wop, MTIME_XATTR, req->mtime_str,
+				strlen(req->mtime_str));
+	stripe_req_submit(req, &req->mtime, OP_MTIME, 0);
+
+	stripe_req_submit_attrs(req);
+
+	stripe_req_put(req, 0);
+}
+
+static void stripe_req_start(struct stripe_req *req)
+{
+	struct io_piece *piece;
+	struct req_op *obj;
+	size_t i;
+	uint64_t o;
+
+	req->phase = PHASE_DATA;
+	stripe_req_get(req);
+
+	for (i = 0; i < req->npieces; i++) {
+		piece = &req->pieces[i];
+		obj = &req->objs[piece->where.objno - req->firstobj];
+
+		if (req->write) {
+			if (!obj->wop)
+				obj->wop = rados_create_write_op();
+			rados_write_op_write(obj->wop, piece->buf,
+					     piece->where.len,
+					     piece->where.objoff);
+		} else {
+			if (!obj->rop)
+				obj->rop = rados_create_read_op();
+			rados_read_op_read(obj->rop, piece->where.objoff,
+					   piece->where.len, piece->buf,
+					   &piece->bytes, &piece->prval);
+		}
+	}
+
+	for (o = 0; o < req->nobjs; o++) {
+		obj = &req->objs[o];
+		if (obj->rop || obj->wop)
+			stripe_req_submit(req, obj,
+					  req->write ? OP_WRITE : OP_READ,
+					  req->firstobj + o);
+	}
+
+	/* Reads need the size to tell holes from the end of file */
+	if (!req->write || !stripe_is_striped(&req->layout))
+		stripe_req_submit_attrs(req);
+
+	stripe_req_put(req, 0);
+}
+
+static ssize_t stripe_io(kvsns_ino_t ino, bool write,
+			 const struct iovec *vec, const uint64_t *off,
+			 int nslices, bool *end_of_file, struct stat *stat)
+{
+	struct stripe_req req;
+	ssize_t rc;
+
+	rc = stripe_req_init(&req, ino, write);
+	if (rc == 0)
+		rc = stripe_req_map(&req, vec, off, nslices);
+	if (rc < 0) {
+		stripe_req_destroy(&req);
+		return rc;
+	}
+
+	stripe_req_start(&req);
+
+	pthread_mutex_lock(&req.lock);
+	while (!req.finished)
+		pthread_cond_wait(&req.cond, &req.lock);
+	pthread_mutex_unlock(&req.lock);
+
+	rc = req.result;
+	if (rc >= 0) {
+		stat->st_size = req.stat.st_size;
+		stat->st_mtime = req.stat.st_mtime;
+		stat->st_atime = req.stat.st_atime;
+		if (end_of_file)
+			*end_of_file = req.eof;
+	}
+
+	stripe_req_destroy(&req);
+	return rc;
+}
+
+static int stripe_io_async(kvsns_ino_t *ino, bool write, off_t offset,
+			   size_t buffer_size, void *buffer,
+			   extstore_cb_t cb, void *arg)
+{
+	struct stripe_req *req;
+	int rc;
+
+	if (!ino || !cb)
+		return -EINVAL;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+
+	rc = stripe_req_init(req, *ino, write);
+	if (rc == 0) {
+		req->vec1.iov_base = buffer;
+		req->vec1.iov_len = buffer_size;
+		req->off1 = offset;
+		rc = stripe_req_map(req, &req->vec1, &req->off1, 1);
+	}
+	if (rc < 0) {
+		stripe_req_destroy(req);
+		free(req);
+		return rc;
+	}
+
+	req->cb = cb;
+	req->arg = arg;
+	stripe_req_start(req);
+	return 0;
+}
+
+/* RADOS objects have no atime of their own, the one of the namespace is
+ * used */
+void extstore_set_atime_policy(kvsns_atime_policy_t policy)
+{
+}
+
+int extstore_create(kvsns_ino_t object)
+{
+	int rc;
+	rados_write_op_t op;
+	char objid[MAXNAMLEN];
+	char layout[64];
+	char size[SIZE_XATTR_LEN + 1];
+	int len;
+
+	build_objid(object, 0, objid, MAXNAMLEN);
+
+	/* The first object holds the layout, the file is empty */
+	op = rados_create_write_op();
+	rados_write_op_create(op, LIBRADOS_CREATE_IDEMPOTENT, NULL);
+	if (stripe_is_striped(&default_layout)) {
+		len = stripe_layout_print(&default_layout, layout,
+					  sizeof(layout));
+		rados_write_op_setxattr(op, LAYOUT_XATTR, layout, len);
+		snprintf(size, sizeof(size), "%0*llu", SIZE_XATTR_LEN, 0ULL);
+		rados_write_op_setxattr(op, SIZE_XATTR, size,
+					SIZE_XATTR_LEN);
+	}
+
+	rc = rados_write_op_operate(op, ioctx, objid, NULL,
+				    LIBRADOS_OPERATION_NOFLAG);
+	rados_release_write_op(op);
 	if (rc < 0)
 		return rc;
 
-	rados_ioctx_destroy(io);
+	layout_cache_set(object, &default_layout);
 	return 0;
 }
 
@@ -84,10 +809,45 @@ int extstore_attach(kvsns_ino_t *ino, char *objid, int objid_len)
 	return 0;
 }
 
-int extstore_init(struct collection_item *cfg_items)
+static int get_layout_config(struct collection_item *cfg_items)
 {
 	struct collection_item *item;
 	int rc;
+
+	memset(&default_layout, 0, sizeof(default_layout));
+
+	item = NULL;
+	rc = get_config_item("rados", "stripe_unit", cfg_items, &item);
+	if (rc != 0)
+		return -rc;
+	if (item == NULL)
+		return 0; /* Files are not striped */
+
+	default_layout.stripe_unit = get_unsigned_config_value(item, 0, 0,
+							       NULL);
+
+	item = NULL;
+	rc = get_config_item("rados", "stripe_count", cfg_items, &item);
+	if (rc != 0)
+		return -rc;
+	default_layout.stripe_count = (item == NULL) ? 1 :
+		get_unsigned_config_value(item, 0, 1, NULL);
+
+	item = NULL;
+	rc = get_config_item("rados", "object_size", cfg_items, &item);
+	if (rc != 0)
+		return -rc;
+	default_layout.object_size = (item == NULL) ?
+		default_layout.stripe_unit :
+		get_unsigned_config_value(item, 0, 0, NULL);
+
+	return stripe_check(&default_layout);
+}
+
+int extstore_init(struct collection_item *cfg_items)
+{
+	struct collection_item *item;
+	int rc = 0;
 	char clustername[MAXNAMLEN];
 	char user[MAXNAMLEN];
 	char ceph_conf[MAXPATHLEN];
@@ -95,14 +855,22 @@ int extstore_init(struct collection_item *cfg_items)
 	if (cfg_items == NULL)
 		return -EINVAL;
 
+	pthread_mutex_lock(&rados_lock);
+	if (rados_users > 0)
+		goto out;
+
 	/* Get config from ini file */
 	item = NULL;
 	rc = get_config_item("rados", "pool",
 			      cfg_items, &item);
-	if (rc != 0)
-		return -rc;
-	if (item == NULL)
-		return -EINVAL;
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
+	if (item == NULL) {
+		rc = -EINVAL;
+		goto out;
+	}
 
 	strncpy(pool, get_string_config_value(item, NULL),
 		MAXNAMLEN);
@@ -110,47 +878,85 @@ int extstore_init(struct collection_item *cfg_items)
 	item = NULL;
 	rc = get_config_item("rados", "cluster",
 			      cfg_items, &item);
-	if (rc != 0)
-		return -rc;
-	if (item == NULL)
-		return -EINVAL;
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
+	if (item == NULL) {
+		rc = -EINVAL;
+		goto out;
+	}
 	strncpy(clustername, get_string_config_value(item, NULL),
 		MAXNAMLEN);
 
 	item = NULL;
 	rc = get_config_item("rados", "user",
 			      cfg_items, &item);
-	if (rc != 0)
-		return -rc;
-	if (item == NULL)
-		return -EINVAL;
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
+	if (item == NULL) {
+		rc = -EINVAL;
+		goto out;
+	}
 	strncpy(user, get_string_config_value(item, NULL),
 		MAXNAMLEN);
 
 	item = NULL;
 	rc = get_config_item("rados", "config",
 			      cfg_items, &item);
-	if (rc != 0)
-		return -rc;
+	if (rc != 0) {
+		rc = -rc;
+		goto out;
+	}
 	if (item == NULL)
 		strncpy(ceph_conf, CEPH_CONFIG_DEFAULT, MAXPATHLEN);
 	else
 		strncpy(ceph_conf, get_string_config_value(item, NULL),
 			MAXPATHLEN);
 
+	RC_WRAP_LABEL(rc, out, get_layout_config, cfg_items);
+
 	/* Rados init */
 	rc = rados_create2(&cluster, clustername, user, 0LL);
 	if (rc < 0)
-		return rc;
+		goto out;
 
 	rc = rados_conf_read_file(cluster, ceph_conf);
 	if (rc < 0)
-		return rc;
+		goto shutdown;
 
 	/* Connect to the cluster */
 	rc = rados_connect(cluster);
 	if (rc < 0)
-		return rc;
+		goto shutdown;
+
+	rc = rados_ioctx_create(cluster, pool, &ioctx);
+	if (rc < 0)
+		goto shutdown;
+
+	goto out;
+
+shutdown:
+	rados_shutdown(cluster);
+out:
+	if (rc == 0)
+		rados_users += 1;
+	pthread_mutex_unlock(&rados_lock);
+	return rc;
+}
+
+int extstore_fini(void)
+{
+	pthread_mutex_lock(&rados_lock);
+	if (rados_users > 0 && --rados_users == 0) {
+		/* Asynchronous requests still running complete first */
+		rados_aio_flush(ioctx);
+		rados_ioctx_destroy(ioctx);
+		rados_shutdown(cluster);
+	}
+	pthread_mutex_unlock(&rados_lock);
 
 	return 0;
 }
@@ -158,19 +964,58 @@ int extstore_init(struct collection_item *cfg_items)
 int extstore_del(kvsns_ino_t *ino)
 {
 	int rc;
-	rados_ioctx_t io;
+	struct stripe_layout layout;
+	struct stat stat;
+	rados_completion_t *comps;
 	char objid[MAXNAMLEN];
+	uint64_t nobjs, o;
+	int ret;
 
 	if (!ino)
 		return -EINVAL;
 
-	build_objid(*ino, objid, MAXNAMLEN);
+	RC_WRAP(get_layout, *ino, &layout);
+	RC_WRAP(get_attrs, *ino, &layout, &stat);
+
+	nobjs = stripe_object_count(&layout, stat.st_size);
+	comps = calloc(nobjs, sizeof(*comps));
+	if (!comps)
+		return -ENOMEM;
+
+	/* The first object goes last, it holds the layout */
+	rc = 0;
+	for (o = nobjs; o-- > 1; ) {
+		build_objid(*ino, o, objid, MAXNAMLEN);
+		rc = rados_aio_create_completion(NULL, NULL, NULL, &comps[o]);
+		if (rc < 0)
+			break;
+
+		rc = rados_aio_remove(ioctx, objid, comps[o]);
+		if (rc < 0) {
+			rados_aio_release(comps[o]);
+			comps[o] = NULL;
+			break;
+		}
+	}
+
+	for (o = 1; o < nobjs; o++) {
+		if (!comps[o])
+			continue;
 
-	rc = rados_ioctx_create(cluster, pool, &io);
+		rados_aio_wait_for_complete(comps[o]);
+		ret = rados_aio_get_return_value(comps[o]);
+		rados_aio_release(comps[o]);
+
+		/* Holes have no object */
+		if (ret < 0 && ret != -ENOENT && rc == 0)
+			rc = ret;
+	}
+	free(comps);
 	if (rc < 0)
 		return rc;
 
-	rc = rados_remove(io, objid);
+	build_objid(*ino, 0, objid, MAXNAMLEN);
+	rc = rados_remove(ioctx, objid);
 
 	/* ENOENT case :The inode exist for kvsns saw it
 	 * but the file is empty and has no
@@ -179,7 +1024,7 @@ int extstore_del(kvsns_ino_t *ino)
 		if (rc != -ENOENT)
 			return rc;
 
-	rados_ioctx_destroy(io);
+	layout_cache_forget(*ino);
 	return 0;
 }
 
@@ -190,80 +1035,240 @@ int extstore_read(kvsns_ino_t *ino,
 		  bool *end_of_file,
 		  struct stat *stat)
 {
-	int rc;
-	rados_ioctx_t io;
-	char objid[MAXNAMLEN];
-	uint64_t size;
-	time_t mtime;
-	int read;
+	struct iovec vec = { .iov_base = buffer, .iov_len = buffer_size };
+	uint64_t off = offset;
 
 	if (!ino)
 		return -EINVAL;
 
-	build_objid(*ino, objid, MAXNAMLEN);
+	return stripe_io(*ino, false, &vec, &off, 1, end_of_file, stat);
+}
+
+int extstore_write(kvsns_ino_t *ino,
+		   off_t offset,
+		   size_t buffer_size,
+		   void *buffer,
+		   kvsns_durability_t how,
+		   bool *fsal_stable,
+		   struct stat *stat)
+{
+	struct iovec vec = { .iov_base = buffer, .iov_len = buffer_size };
+	uint64_t off = offset;
+	ssize_t rc;
+
+	if (!ino)
+		return -EINVAL;
 
-	rc = rados_ioctx_create(cluster, pool, &io);
+	rc = stripe_io(*ino, true, &vec, &off, 1, NULL, stat);
 	if (rc < 0)
 		return rc;
 
-	read = rados_read(io, objid, buffer, buffer_size, offset);
-	if (read < 0)
-		return read;
+	/* RADOS acknowledges writes once they are on all the replicas */
+	*fsal_stable = true;
+	return rc;
+}
+
+
+/* Cuts the buffers along the extents, one slice never spans two extents
+ * nor two buffers, so there are at most iovcnt + extcnt of them */
+static int build_slices(const struct iovec *iov, int iovcnt,
+			const kvsns_extent_t *ext, int extcnt,
+			struct iovec **vec, uint64_t **off, int *nslices)
+{
+	struct extent_cursor cur;
+	size_t total, n;
+	int max = iovcnt + extcnt;
+	int i, cnt, k;
+	int rc;
 
-	rc = rados_stat(io, objid, &size, &mtime);
+	rc = extent_check(iov, iovcnt, ext, extcnt, &total);
 	if (rc < 0)
 		return rc;
 
-	rados_ioctx_destroy(io);
+	*vec = calloc(max, sizeof(**vec));
+	*off = calloc(max, sizeof(**off));
+	if (!*vec || !*off) {
+		free(*vec);
+		free(*off);
+		return -ENOMEM;
+	}
 
-	stat->st_size = size;
-	stat->st_mtime = mtime;
-	stat->st_atime = mtime; /* @todo bug ?*/
+	k = 0;
+	extent_cursor_init(&cur, iov, iovcnt);
+	for (i = 0; i < extcnt; i++) {
+		n = extent_slice(&cur, ext[i].len, &(*vec)[k], max - k, &cnt);
+		(*off)[k] = ext[i].offset;
+		for (; cnt > 1; cnt--, k++)
+			(*off)[k + 1] = (*off)[k] + (*vec)[k].iov_len;
+		k += cnt;
+		if (n != ext[i].len) { /* Can't happen if check passed */
+			free(*vec);
+			free(*off);
+			return -EINVAL;
+		}
+	}
 
-	return read;
+	*nslices = k;
+	return 0;
 }
 
-int extstore_write(kvsns_ino_t *ino,
-		   off_t offset,
-		   size_t buffer_size,
-		   void *buffer,
-		   bool *fsal_stable,
+int extstore_readv(kvsns_ino_t *ino,
+		   const struct iovec *iov,
+		   int iovcnt,
+		   const kvsns_extent_t *ext,
+		   int extcnt,
+		   bool *end_of_file,
 		   struct stat *stat)
 {
-	int rc;
-	rados_ioctx_t io;
-	char objid[MAXNAMLEN];
-	uint64_t size;
-	time_t mtime;
+	struct iovec *vec;
+	uint64_t *off;
+	int nslices;
+	ssize_t rc;
 
 	if (!ino)
 		return -EINVAL;
 
-	build_objid(*ino, objid, MAXNAMLEN);
+	RC_WRAP(build_slices, iov, iovcnt, ext, extcnt, &vec, &off, &nslices);
 
-	rc = rados_ioctx_create(cluster, pool, &io);
-	if (rc < 0)
-		return rc;
+	/* All the objects and the stat are read in parallel */
+	rc = stripe_io(*ino, false, vec, off, nslices, end_of_file, stat);
 
-	rc = rados_write(io, objid, buffer, buffer_size, offset);
-	if (rc < 0)
-		return rc;
+	free(vec);
+	free(off);
+	return rc;
+}
 
-	/* If write succeeded, then all data are written */
+int extstore_writev(kvsns_ino_t *ino,
+		    const struct iovec *iov,
+		    int iovcnt,
+		    const kvsns_extent_t *ext,
+		    int extcnt,
+		    kvsns_durability_t how,
+		    bool *fsal_stable,
+		    struct stat *stat)
+{
+	struct iovec *vec;
+	uint64_t *off;
+	int nslices;
+	ssize_t rc;
 
-	rc = rados_stat(io, objid, &size, &mtime);
-	if (rc < 0)
-		return rc;
+	if (!ino)
+		return -EINVAL;
 
-	rados_ioctx_destroy(io);
+	RC_WRAP(build_slices, iov, iovcnt, ext, extcnt, &vec, &off, &nslices);
+
+	/* The extents going to one object are written atomically, in a
+	 * single operation */
+	rc = stripe_io(*ino, true, vec, off, nslices, NULL, stat);
+	if (rc >= 0)
+		*fsal_stable = true;
+
+	free(vec);
+	free(off);
+	return rc;
+}
 
-	stat->st_size = size;
-	stat->st_mtime = mtime;
-	stat->st_atime = mtime; /* @todo bug ?*/
 
-	return buffer_size;
+ssize_t extstore_copy_from_fd(kvsns_ino_t *ino,
+			      off_t offset,
+			      int fd,
+			      off_t fd_offset,
+			      size_t len,
+			      struct stat *stat)
+{
+	/* Objects are not files, data has to go through user space */
+	return -ENOTSUP;
+}
+
+ssize_t extstore_copy_to_fd(kvsns_ino_t *ino,
+			    off_t offset,
+			    int fd,
+			    off_t fd_offset,
+			    size_t len)
+{
+	return -ENOTSUP;
 }
 
+/* Cuts every object of a striped file to what it holds of the new size,
+ * the objects past it are removed */
+static int truncate_striped(kvsns_ino_t ino,
+			    const struct stripe_layout *layout,
+			    uint64_t oldsize, uint64_t newsize)
+{
+	rados_completion_t *comps;
+	rados_write_op_t *ops;
+	char objid[MAXNAMLEN];
+	char size[SIZE_XATTR_LEN + 1];
+	char mtime[32];
+	uint64_t nobjs, o, len;
+	int rc = 0;
+	int ret;
+
+	nobjs = stripe_object_count(layout, oldsize);
+	comps = calloc(nobjs, sizeof(*comps));
+	ops = calloc(nobjs, sizeof(*ops));
+	if (!comps || !ops) {
+		free(comps);
+		free(ops);
+		return -ENOMEM;
+	}
+
+	snprintf(size, sizeof(size), "%0*llu", SIZE_XATTR_LEN,
+		 (unsigned long long)newsize);
+	snprintf(mtime, sizeof(mtime), "%lld", (long long)time(NULL));
+
+	for (o = 0; o < nobjs; o++) {
+		len = stripe_object_len(layout, o, newsize);
+		ops[o] = rados_create_write_op();
+
+		if (o > 0 && len == 0) {
+			rados_write_op_remove(ops[o]);
+			continue;
+		}
+
+		rados_write_op_truncate(ops[o], len);
+		if (o == 0) {
+			/* The size may go down, no need to compare */
+			rados_write_op_setxattr(ops[o], SIZE_XATTR, size,
+						SIZE_XATTR_LEN);
+			rados_write_op_setxattr(ops[o], MTIME_XATTR, mtime,
+						strlen(mtime));
+		}
+	}
+
+	for (o = 0; o < nobjs; o++) {
+		build_objid(ino, o, objid, MAXNAMLEN);
+
+		rc = rados_aio_create_completion(NULL, NULL, NULL, &comps[o]);
+		if (rc < 0)
+			break;
+
+		rc = rados_aio_write_op_operate(ops[o], ioctx, comps[o],
+						objid, NULL,
+						LIBRADOS_OPERATION_NOFLAG);
+		if (rc < 0) {
+			rados_aio_release(comps[o]);
+			comps[o] = NULL;
+			break;
+		}
+	}
+
+	for (o = 0; o < nobjs; o++) {
+		if (comps[o]) {
+			rados_aio_wait_for_complete(comps[o]);
+			ret = rados_aio_get_return_value(comps[o]);
+			rados_aio_release(comps[o]);
+
+			if (ret < 0 && ret != -ENOENT && rc == 0)
+				rc = ret;
+		}
+		rados_release_write_op(ops[o]);
+	}
+
+	free(comps);
+	free(ops);
+	return rc;
+}
 
 int extstore_truncate(kvsns_ino_t *ino,
 		      off_t filesize,
@@ -271,21 +1276,25 @@ int extstore_truncate(kvsns_ino_t *ino,
 		      struct stat *stat)
 {
 	int rc;
-	rados_ioctx_t io;
+	struct stripe_layout layout;
+	struct stat oldstat;
 	char objid[MAXNAMLEN];
-	uint64_t size;
-	time_t mtime;
 
 	if (!ino || !stat)
 		return -EINVAL;
 
-	build_objid(*ino, objid, MAXNAMLEN);
+	RC_WRAP(get_layout, *ino, &layout);
 
-	rc = rados_ioctx_create(cluster, pool, &io);
-	if (rc < 0)
-		return rc;
+	if (stripe_is_striped(&layout)) {
+		RC_WRAP(get_attrs, *ino, &layout, &oldstat);
+		RC_WRAP(truncate_striped, *ino, &layout, oldstat.st_size,
+			filesize);
+		return get_attrs(*ino, &layout, stat);
+	}
 
-	rc = rados_trunc(io, objid, (uint64_t)filesize);
+	build_objid(*ino, 0, objid, MAXNAMLEN);
+
+	rc = rados_trunc(ioctx, objid, (uint64_t)filesize);
 	if (rc < 0) {
 		if (rc == -ENOENT) {
 			/* The file is empty, it has
@@ -294,60 +1303,170 @@ int extstore_truncate(kvsns_ino_t *ino,
 			stat->st_size = 0;
 			stat->st_mtime = time(NULL);
 			stat->st_atime = time(NULL); /* @todo bug ?*/
-			goto exit;
+			return 0;
 		} else
 			return rc;
 	}
 
-	rc = rados_stat(io, objid, &size, &mtime);
-	if (rc < 0)
-		return rc;
+	return get_attrs(*ino, &layout, stat);
+}
 
-	stat->st_size = size;
-	stat->st_mtime = mtime;
-	stat->st_atime = mtime; /* @todo bug ?*/
+int extstore_getattr(kvsns_ino_t *ino,
+		     struct stat *stat)
+{
+	struct stripe_layout layout;
 
-exit:
-	rados_ioctx_destroy(io);
+	if (!ino || !stat)
+		return -EINVAL;
 
-	return 0;
+	RC_WRAP(get_layout, *ino, &layout);
+	return get_attrs(*ino, &layout, stat);
 }
 
-int extstore_getattr(kvsns_ino_t *ino,
-		     struct stat *stat)
+/* One operation per file, all of them in flight at once. Each one gets
+ * both the xattrs and the stat of the first object, which serves striped
+ * and single object files without knowing the layout first */
+struct attrs_batch {
+	rados_read_op_t op;
+	rados_completion_t comp;
+	rados_xattrs_iter_t iter;
+	uint64_t size;
+	time_t mtime;
+	int xattrs_prval;
+	int stat_prval;
+};
+
+int extstore_getattr_many(int nb, kvsns_ino_t *inos, struct stat *stats,
+			  int *rcs)
 {
-	int rc;
-	rados_ioctx_t io;
+	struct attrs_batch *batch;
 	char objid[MAXNAMLEN];
 	uint64_t size;
 	time_t mtime;
+	int i;
+	int rc;
 
-	if (!ino || !stat)
+	if (nb < 0 || !inos || !stats || !rcs)
 		return -EINVAL;
 
-	build_objid(*ino, objid, MAXNAMLEN);
-
-	rc = rados_ioctx_create(cluster, pool, &io);
-	if (rc < 0)
-		return rc;
+	if (nb == 0)
+		return 0;
+
+	batch = calloc(nb, sizeof(*batch));
+	if (!batch)
+		return -ENOMEM;
+
+	for (i = 0; i < nb; i++) {
+		build_objid(inos[i], 0, objid, MAXNAMLEN);
+
+		batch[i].op = rados_create_read_op();
+		rados_read_op_getxattrs(batch[i].op, &batch[i].iter,
+					&batch[i].xattrs_prval);
+		rados_read_op_stat(batch[i].op, &batch[i].size,
+				   &batch[i].mtime, &batch[i].stat_prval);
+
+		rc = rados_aio_create_completion(NULL, NULL, NULL,
+						 &batch[i].comp);
+		if (rc < 0) {
+			batch[i].comp = NULL;
+		} else {
+			rc = rados_aio_read_op_operate(batch[i].op, ioctx,
+						       batch[i].comp, objid,
+						       LIBRADOS_OPERATION_NOFLAG);
+			if (rc < 0) {
+				rados_aio_release(batch[i].comp);
+				batch[i].comp = NULL;
+			}
+		}
+		rcs[i] = rc;
+	}
 
-	rc = rados_stat(io, objid, &size, &mtime);
-	if (rc < 0) {
-		if (rc == -ENOENT) {
-			stat->st_size = 0;
-			stat->st_mtime = time(NULL);
-			stat->st_atime = time(NULL);
-			goto exitok;
-		} else
-			return rc;
+	for (i = 0; i < nb; i++) {
+		if (batch[i].comp) {
+			rados_aio_wait_for_complete(batch[i].comp);
+			rc = rados_aio_get_return_value(batch[i].comp);
+			rados_aio_release(batch[i].comp);
+			if (rc == 0)
+				rc = batch[i].xattrs_prval;
+			if (rc == 0)
+				rc = batch[i].stat_prval;
+
+			if (rc == 0) {
+				/* The xattrs of a striped file win */
+				size = batch[i].size;
+				mtime = batch[i].mtime;
+				parse_attrs(batch[i].iter, &size, &mtime);
+				fill_stat(&stats[i], true, size, mtime);
+			} else if (rc == -ENOENT) {
+				fill_stat(&stats[i], false, 0, 0);
+				rc = 0;
+			}
+			rcs[i] = rc;
+		}
+		rados_release_read_op(batch[i].op);
 	}
 
-	stat->st_size = size;
-	stat->st_mtime = mtime;
-	stat->st_atime = mtime; /* @todo bug ?*/
+	free(batch);
+	return 0;
+}
+
+int extstore_open(kvsns_ino_t *ino)
+{
+	/* Objects are addressed by name, there is nothing to keep open */
+	return 0;
+}
+
+int extstore_close(kvsns_ino_t *ino)
+{
+	return 0;
+}
+
+int extstore_commit(kvsns_ino_t *ino)
+{
+	/* Every write is stable already */
+	return 0;
+}
+
+int extstore_async_read(kvsns_ino_t *ino,
+			off_t offset,
+			size_t buffer_size,
+			void *buffer,
+			extstore_cb_t cb,
+			void *arg)
+{
+	return stripe_io_async(ino, false, offset, buffer_size, buffer,
+			       cb, arg);
+}
 
-exitok:
-	rados_ioctx_destroy(io);
+int extstore_async_write(kvsns_ino_t *ino,
+			 off_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 kvsns_durability_t how,
+			 extstore_cb_t cb,
+			 void *arg)
+{
+	/* RADOS writes are always stable */
+	return stripe_io_async(ino, true, offset, buffer_size, buffer,
+			       cb, arg);
+}
+
+/* Requests go to RADOS as soon as they are made */
+void extstore_async_plug(void)
+{
+}
 
+int extstore_async_unplug(void)
+{
 	return 0;
 }
+
+void *extstore_buffer_alloc(size_t size)
+{
+	return malloc(size);
+}
+
+void extstore_buffer_free(void *buffer)
+{
+	free(buffer);
+}
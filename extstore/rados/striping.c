@@ -0,0 +1,166 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* striping.c
+ * KVSNS/extstore: layout of a file striped over several RADOS objects
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "striping.h"
+
+int stripe_check(const struct stripe_layout *layout)
+{
+	if (!stripe_is_striped(layout))
+		return 0;
+
+	if (layout->stripe_count == 0 || layout->object_size == 0 ||
+	    layout->object_size % layout->stripe_unit != 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+void stripe_map(const struct stripe_layout *layout, uint64_t offset,
+		size_t len, struct stripe_piece *piece)
+{
+	uint64_t su = layout->stripe_unit;
+	uint64_t sc = layout->stripe_count;
+	uint64_t units_per_obj;
+	uint64_t blockno, stripeno, objsetno;
+	uint64_t inunit;
+
+	if (!stripe_is_striped(layout)) {
+		piece->objno = 0;
+		piece->objoff = offset;
+		piece->len = len;
+		return;
+	}
+
+	units_per_obj = layout->object_size / su;
+	blockno = offset / su;
+	inunit = offset % su;
+	stripeno = blockno / sc;
+	objsetno = stripeno / units_per_obj;
+
+	piece->objno = objsetno * sc + blockno % sc;
+	piece->objoff = (stripeno % units_per_obj) * su + inunit;
+	piece->len = (len > su - inunit) ? su - inunit : len;
+}
+
+size_t stripe_count_pieces(const struct stripe_layout *layout,
+			   uint64_t offset, size_t len)
+{
+	uint64_t su = layout->stripe_unit;
+
+	if (len == 0)
+		return 0;
+
+	if (!stripe_is_striped(layout))
+		return 1;
+
+	return (offset + len - 1) / su - offset / su + 1;
+}
+
+uint64_t stripe_object_len(const struct stripe_layout *layout,
+			   uint64_t objno, uint64_t filesize)
+{
+	uint64_t su = layout->stripe_unit;
+	uint64_t sc = layout->stripe_count;
+	uint64_t setlen, setstart, rel, rem, len;
+
+	if (!stripe_is_striped(layout))
+		return (objno == 0) ? filesize : 0;
+
+	setlen = layout->object_size * sc;
+	setstart = (objno / sc) * setlen;
+	if (filesize <= setstart)
+		return 0;
+	if (filesize >= setstart + setlen)
+		return layout->object_size;
+
+	/* The set is partially filled: full stripes, then a part of the
+	 * last one up to this object's position */
+	rel = filesize - setstart;
+	len = (rel / (su * sc)) * su;
+	rem = rel % (su * sc);
+	if (rem > (objno % sc) * su) {
+		rem -= (objno % sc) * su;
+		len += (rem > su) ? su : rem;
+	}
+
+	return len;
+}
+
+uint64_t stripe_object_count(const struct stripe_layout *layout,
+			     uint64_t filesize)
+{
+	struct stripe_piece piece;
+
+	if (!stripe_is_striped(layout) || filesize == 0)
+		return 1;
+
+	/* Every object of the last set may hold data from earlier stripes */
+	stripe_map(layout, filesize - 1, 1, &piece);
+	return (piece.objno / layout->stripe_count + 1) *
+		layout->stripe_count;
+}
+
+int stripe_layout_print(const struct stripe_layout *layout, char *buf,
+			size_t len)
+{
+	int n;
+
+	n = snprintf(buf, len, "%u %u %llu", layout->stripe_unit,
+		     layout->stripe_count,
+		     (unsigned long long)layout->object_size);
+	if (n < 0 || n >= len)
+		return -ERANGE;
+
+	return n;
+}
+
+int stripe_layout_parse(const char *buf, size_t len,
+			struct stripe_layout *layout)
+{
+	char str[64];
+	unsigned long long object_size;
+
+	if (len >= sizeof(str))
+		return -EINVAL;
+
+	memcpy(str, buf, len);
+	str[len] = '\0';
+
+	if (sscanf(str, "%u %u %llu", &layout->stripe_unit,
+		   &layout->stripe_count, &object_size) != 3)
+		return -EINVAL;
+
+	layout->object_size = object_size;
+	return stripe_check(layout);
+}
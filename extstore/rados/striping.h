@@ -0,0 +1,85 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* striping.h
+ * KVSNS/extstore: layout of a file striped over several RADOS objects
+ */
+
+#ifndef _EXTSTORE_STRIPING_H
+#define _EXTSTORE_STRIPING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Stripe units are dealt round robin to stripe_count objects, until they
+ * are object_size bytes long, then the next set of objects is used. A
+ * null stripe_unit means the whole file is in a single object */
+struct stripe_layout {
+	uint32_t stripe_unit;
+	uint32_t stripe_count;
+	uint64_t object_size;
+};
+
+/* Where a piece of a file lies, the piece never spans two stripe units */
+struct stripe_piece {
+	uint64_t objno;
+	uint64_t objoff;
+	size_t len;
+};
+
+static inline bool stripe_is_striped(const struct stripe_layout *layout)
+{
+	return layout->stripe_unit != 0;
+}
+
+/* Checks the layout, returns -EINVAL if it is not usable */
+int stripe_check(const struct stripe_layout *layout);
+
+/* Maps the first bytes of [offset, offset + len[ */
+void stripe_map(const struct stripe_layout *layout, uint64_t offset,
+		size_t len, struct stripe_piece *piece);
+
+/* Number of pieces [offset, offset + len[ is cut in */
+size_t stripe_count_pieces(const struct stripe_layout *layout,
+			   uint64_t offset, size_t len);
+
+/* Size of object objno in a file of filesize bytes */
+uint64_t stripe_object_len(const struct stripe_layout *layout,
+			   uint64_t objno, uint64_t filesize);
+
+/* Number of objects a file of filesize bytes may use */
+uint64_t stripe_object_count(const struct stripe_layout *layout,
+			     uint64_t filesize);
+
+/* Text form of the layout, as kept in the first object's xattr */
+int stripe_layout_print(const struct stripe_layout *layout, char *buf,
+			size_t len);
+int stripe_layout_parse(const char *buf, size_t len,
+			struct stripe_layout *layout);
+
+#endif
@@ -45,6 +45,12 @@
 #include <kvsns/kvsns.h>
 
 int extstore_init(struct collection_item *cfg_items);
+/* Undoes extstore_init, the last call releases the backend */
+int extstore_fini(void);
+/* The atime policy of the namespace, given by kvsns_start once the
+ * configuration is read, for the backends that keep the atime of the
+ * objects themselves */
+void extstore_set_atime_policy(kvsns_atime_policy_t policy);
 int extstore_create(kvsns_ino_t object);
 int extstore_read(kvsns_ino_t *ino,
 		  off_t offset,
@@ -56,8 +62,35 @@ int extstore_write(kvsns_ino_t *ino,
 		   off_t offset,
 		   size_t buffer_size,
 		   void *buffer,
+		   kvsns_durability_t how,
 		   bool *fsal_stable,
 		   struct stat *stat);
+int extstore_readv(kvsns_ino_t *ino,
+		   const struct iovec *iov,
+		   int iovcnt,
+		   const kvsns_extent_t *ext,
+		   int extcnt,
+		   bool *end_of_file,
+		   struct stat *stat);
+int extstore_writev(kvsns_ino_t *ino,
+		    const struct iovec *iov,
+		    int iovcnt,
+		    const kvsns_extent_t *ext,
+		    int extcnt,
+		    kvsns_durability_t how,
+		    bool *fsal_stable,
+		    struct stat *stat);
+ssize_t extstore_copy_from_fd(kvsns_ino_t *ino,
+			      off_t offset,
+			      int fd,
+			      off_t fd_offset,
+			      size_t len,
+			      struct stat *stat);
+ssize_t extstore_copy_to_fd(kvsns_ino_t *ino,
+			    off_t offset,
+			    int fd,
+			    off_t fd_offset,
+			    size_t len);
 int extstore_del(kvsns_ino_t *ino);
 int extstore_truncate(kvsns_ino_t *ino,
 		      off_t filesize,
@@ -67,4 +100,40 @@ int extstore_attach(kvsns_ino_t *ino,
 		    char *objid, int objid_len);
 int extstore_getattr(kvsns_ino_t *ino,
 		     struct stat *stat);
+/* Batch version: nb objects in as few round trips as the backend
+ * allows, rcs[i] receives the status for inos[i] */
+int extstore_getattr_many(int nb,
+			  kvsns_ino_t *inos,
+			  struct stat *stats,
+			  int *rcs);
+int extstore_open(kvsns_ino_t *ino);
+int extstore_close(kvsns_ino_t *ino);
+int extstore_commit(kvsns_ino_t *ino);
+
+/* Asynchronous I/O. The callback is called once with what extstore_read
+ * or extstore_write would have returned, from the backend's completion
+ * thread when it has one. Between extstore_async_plug and
+ * extstore_async_unplug, the requests of the calling thread are queued
+ * and submitted as a batch */
+typedef void (*extstore_cb_t)(void *arg, ssize_t rc);
+
+int extstore_async_read(kvsns_ino_t *ino,
+			off_t offset,
+			size_t buffer_size,
+			void *buffer,
+			extstore_cb_t cb,
+			void *arg);
+int extstore_async_write(kvsns_ino_t *ino,
+			 off_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 kvsns_durability_t how,
+			 extstore_cb_t cb,
+			 void *arg);
+void extstore_async_plug(void);
+int extstore_async_unplug(void);
+
+/* I/O buffers, preregistered with the backend when it supports it */
+void *extstore_buffer_alloc(size_t size);
+void extstore_buffer_free(void *buffer);
 #endif
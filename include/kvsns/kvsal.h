@@ -60,14 +60,51 @@
 typedef struct kvsal_item {
 	int offset;
 	char str[KLEN];
+	unsigned long long value;
 } kvsal_item_t;
 
+enum kvsal_list_type {
+	KVSAL_LIST_PATTERN = 0,	/* keys matching a pattern */
+	KVSAL_LIST_ENTRIES = 1	/* entries stored inside a single key */
+};
+
 typedef struct kvsal_list {
 	char pattern[KLEN];
+	enum kvsal_list_type type;
 	kvsal_item_t *content;
 	size_t size;
 } kvsal_list_t;
 
+/* Inode attributes are stored as a versioned record, all fields little
+ * endian (times are a 64 bits tv_sec followed by a 32 bits tv_nsec):
+ *	0	version (8 bits, then 3 bytes reserved)
+ *	4	mode	8	nlink	12	uid	16	gid (32 bits)
+ *	20	ino	28	size (64 bits)
+ *	36	atime	48	mtime	60	ctime
+ *	72	blocks (64 bits)
+ * The size and blocks of a file are kept up to date from version 2. A
+ * version 1 record is shorter, it is read with st_blocks set to
+ * KVSAL_BLOCKS_UNKNOWN */
+#define KVSAL_RECORD_VERSION 2
+#define KVSAL_RECORD_MODE 4
+#define KVSAL_RECORD_NLINK 8
+#define KVSAL_RECORD_UID 12
+#define KVSAL_RECORD_GID 16
+#define KVSAL_RECORD_INO 20
+#define KVSAL_RECORD_SIZE 28
+#define KVSAL_RECORD_ATIME 36
+#define KVSAL_RECORD_MTIME 48
+#define KVSAL_RECORD_CTIME 60
+#define KVSAL_RECORD_BLOCKS 72
+#define KVSAL_RECORD_TIME_LEN 12
+#define KVSAL_RECORD_LEN 80
+#define KVSAL_RECORD_V1_LEN 72
+#define KVSAL_BLOCKS_UNKNOWN ((blkcnt_t)-1)
+
+void kvsal_stat2record(struct stat *buf, char *record);
+int kvsal_record2stat(const char *record, size_t len, struct stat *buf);
+void kvsal_encode_time(struct timespec *ts, char *p);
+
 int kvsal_init(struct collection_item *cfg_items);
 int kvsal_fini(void);
 int kvsal_begin_transaction(void);
@@ -81,8 +118,15 @@ int kvsal_get_binary(char *k, char *buf, size_t *size);
 int kvsal_set_stat(char *k, struct stat *buf);
 int kvsal_get_stat(char *k, struct stat *buf);
 int kvsal_get_list_size(char *pattern);
+
+/* Batch versions: nb keys are fetched in a single round trip, rcs[i]
+ * receives the status for k[i] (0 or -ENOENT) */
+int kvsal_mget_char(int nb, char k[][KLEN], char v[][VLEN], int *rcs);
+int kvsal_get_stat_many(int nb, char k[][KLEN], struct stat *buf, int *rcs);
 int kvsal_del(char *k);
 int kvsal_incr_counter(char *k, unsigned long long *v);
+int kvsal_incrby_counter(char *k, unsigned long long incr,
+			 unsigned long long *v);
 
 int kvsal_get_list_pattern(char *pattern, int start, int *end,
 			   kvsal_item_t *items);
@@ -91,4 +135,82 @@ int kvsal_fetch_list(char *pattern, kvsal_list_t *list);
 int kvsal_dispose_list(kvsal_list_t *list);
 int kvsal_init_list(kvsal_list_t *list);
 
+/* Entries: named values (typically dentries) grouped inside one key and
+ * listed in a stable order, independently of the size of the KVS */
+int kvsal_add_entry(char *k, char *name, unsigned long long v);
+int kvsal_get_entry(char *k, char *name, unsigned long long *v);
+int kvsal_del_entry(char *k, char *name);
+int kvsal_count_entries(char *k);
+int kvsal_fetch_entries(char *k, kvsal_list_t *list);
+int kvsal_get_entries_from(char *k, unsigned long long v, int skip,
+			   int *size, kvsal_item_t *items);
+
+/* Sets: unordered collections of distinct members inside one key, each
+ * update is a single atomic operation. The key vanishes with its last
+ * member. kvsal_get_member() returns any member. */
+int kvsal_add_member(char *k, char *member);
+int kvsal_del_member(char *k, char *member);
+int kvsal_count_members(char *k);
+int kvsal_get_member(char *k, char *member);
+
+/* Asynchronous calls: the request is queued and sent by an event loop
+ * thread, many requests can be in flight. The callback is called from the
+ * event loop thread with 0 or a negative errno once the reply is received,
+ * it must not block. Buffers to be filled must remain valid until then.
+ * If the call itself fails, the callback is not called. */
+typedef void (*kvsal_callback_t)(int rc, void *arg);
+
+int kvsal_async_set_char(char *k, char *v, kvsal_callback_t cb, void *arg);
+int kvsal_async_get_char(char *k, char *v, kvsal_callback_t cb, void *arg);
+int kvsal_async_set_stat(char *k, struct stat *buf,
+			 kvsal_callback_t cb, void *arg);
+int kvsal_async_get_stat(char *k, struct stat *buf,
+			 kvsal_callback_t cb, void *arg);
+int kvsal_async_del(char *k, kvsal_callback_t cb, void *arg);
+int kvsal_async_add_entry(char *k, char *name, unsigned long long v,
+			  kvsal_callback_t cb, void *arg);
+int kvsal_async_get_entry(char *k, char *name, unsigned long long *v,
+			  kvsal_callback_t cb, void *arg);
+int kvsal_async_del_entry(char *k, char *name, kvsal_callback_t cb, void *arg);
+
+/* Waits for a group of asynchronous calls: kvsal_batch_add() before each
+ * call, with kvsal_batch_done() as callback and the batch as argument.
+ * kvsal_batch_wait() returns the first error. */
+typedef struct kvsal_batch {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending;
+	int running;		/* callbacks not returned yet, atomic */
+	int rc;
+} kvsal_batch_t;
+
+void kvsal_batch_init(kvsal_batch_t *batch);
+void kvsal_batch_add(kvsal_batch_t *batch);
+void kvsal_batch_done(int rc, void *arg);
+int kvsal_batch_wait(kvsal_batch_t *batch);
+
+/* Connection pool statistics */
+typedef struct kvsal_pool_stats {
+	unsigned long long connections;	/* opened, idle or in use */
+	unsigned long long idle;
+	unsigned long long in_use;
+	unsigned long long created;	/* connections established */
+	unsigned long long reused;	/* taken from the idle list */
+	unsigned long long reconnects;	/* broken or stale connections */
+	unsigned long long failures;	/* connect failures after retries */
+	unsigned long long waits;	/* waits for a free connection */
+} kvsal_pool_stats_t;
+
+int kvsal_get_pool_stats(kvsal_pool_stats_t *stats);
+
+/* Server side scripts: a script is loaded once and then executed as a
+ * single atomic operation. It returns an array of integers, the first one
+ * being 0 or a negative errno. */
+#define KVSAL_MAX_SCRIPTS 16
+
+int kvsal_load_script(char *script, int *id);
+int kvsal_exec_script(int id, int nkeys, char **keys,
+		      int nargs, char **args, size_t *argslen,
+		      long long *res, int *nres);
+
 #endif
@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -112,12 +113,105 @@ typedef struct kvsns_dentry_ {
 typedef struct kvsns_open_owner_ {
 	int pid;
 	int tid;
+	unsigned int seq; /* tells apart the opens of the same thread */
 } kvsns_open_owner_t;
 
+/* Tuning of kvsns_cp_from_parallel/kvsns_cp_to_parallel */
+typedef struct kvsns_cp_params_ {
+	unsigned int workers;	/* threads copying stripes concurrently */
+	size_t chunk_size;	/* size of a stripe */
+	size_t iolen;		/* size of an I/O inside a stripe */
+	unsigned int depth;	/* I/Os in flight per worker */
+} kvsns_cp_params_t;
+
+typedef struct kvsns_cp_stats_ {
+	unsigned long long bytes;
+	double seconds;
+} kvsns_cp_stats_t;
+
+/* kvsns_walk filters, a criterion applies when its bit is in the mask */
+#define KVSNS_FILTER_TYPE	0x01
+#define KVSNS_FILTER_SIZE	0x02
+#define KVSNS_FILTER_MTIME	0x04
+#define KVSNS_FILTER_UID	0x08
+#define KVSNS_FILTER_GID	0x10
+#define KVSNS_FILTER_NAME	0x20
+
+typedef struct kvsns_walk_filter_ {
+	unsigned int mask;
+	mode_t type;		/* S_IFREG, S_IFDIR or S_IFLNK */
+	off_t size_min;		/* st_size in [size_min, size_max] */
+	off_t size_max;
+	time_t mtime_min;	/* st_mtime in [mtime_min, mtime_max] */
+	time_t mtime_max;
+	uid_t uid;
+	gid_t gid;
+	const char *name;	/* fnmatch(3) pattern on the entry's name */
+} kvsns_walk_filter_t;
+
+/* Tuning of kvsns_walk */
+typedef struct kvsns_walk_params_ {
+	unsigned int workers;	/* threads listing directories */
+	unsigned int queue_max;	/* directories waiting for a worker */
+	int batch;		/* entries per kvsns_readdirplus call */
+	int maxdepth;		/* deepest level reported, -1 for no limit */
+} kvsns_walk_params_t;
+
+typedef struct kvsns_walk_stats_ {
+	unsigned long long dirs;	/* directories listed */
+	unsigned long long entries;	/* entries seen */
+	unsigned long long matched;	/* entries given to the callback */
+	unsigned long long errors;	/* entries or directories skipped */
+	double seconds;
+} kvsns_walk_stats_t;
+
+/* A kvsns_walk callback returning this on a directory skips its content */
+#define KVSNS_WALK_PRUNE 1
+
+typedef int (*kvsns_walk_cb_t)(void *arg, const char *path,
+			       kvsns_dentry_t *dentry);
+
+/* Secondary indexes, kept when listed in the "indexes" key of [kvsns] */
+enum kvsns_index {
+	KVSNS_INDEX_MTIME = 0,	/* inodes by mtime, in seconds */
+	KVSNS_INDEX_SIZE = 1,	/* inodes by size */
+	KVSNS_INDEX_UID = 2,	/* inodes of a uid */
+	KVSNS_INDEX_GID = 3,	/* inodes of a gid */
+	KVSNS_INDEX_MAX = 4,
+};
+
+/* Where kvsns_index_query resumes, zeroed for the first call */
+typedef struct kvsns_index_cursor_ {
+	unsigned long long value;	/* last value returned */
+	unsigned long long skip;	/* inodes of that value returned */
+} kvsns_index_cursor_t;
+
+/* A range of a file, for vectored I/O */
+typedef struct kvsns_extent_ {
+	off_t offset;
+	size_t len;
+} kvsns_extent_t;
+
+/* How far a write goes before kvsns_write returns */
+typedef enum kvsns_durability_ {
+	KVSNS_UNSTABLE = 0,	/* page cache, made stable by kvsns_fsync */
+	KVSNS_DATASYNC = 1,	/* data and size on disk (fdatasync) */
+	KVSNS_SYNC = 2,		/* data and all metadata on disk (fsync) */
+} kvsns_durability_t;
+
+/* When an access updates the atime, the "atime" key of [kvsns] */
+typedef enum kvsns_atime_policy_ {
+	KVSNS_ATIME_STRICT = 0,		/* at every access */
+	KVSNS_ATIME_RELATIME = 1,	/* when older than mtime, ctime or a day */
+	KVSNS_ATIME_NOATIME = 2,	/* never */
+	KVSNS_ATIME_LAZYTIME = 3,	/* at every access, written later */
+} kvsns_atime_policy_t;
+
 typedef struct kvsns_file_open_ {
 	kvsns_ino_t ino;
 	kvsns_open_owner_t owner;
 	int flags;
+	kvsns_durability_t durability;
 } kvsns_file_open_t;
 
 typedef struct kvsns_dir {
@@ -125,6 +219,13 @@ typedef struct kvsns_dir {
 	kvsal_list_t list;
 } kvsns_dir_t;
 
+/* Where kvsns_readdirplus resumes, 0 is the start of the directory */
+typedef unsigned long long kvsns_cookie_t;
+
+/* kvsns_readdirplus flags */
+#define KVSNS_READDIR_ATTRS 0x1	/* fill the stats of the entries */
+#define KVSNS_READDIR_ATIME 0x2	/* a listing updates the dir's atime */
+
 enum kvsns_type {
 	KVSNS_DIR = 1,
 	KVSNS_FILE = 2,
@@ -135,6 +236,18 @@ typedef struct kvsns_xattr__ {
 	char name[NAME_MAX];
 } kvsns_xattr_t;
 
+typedef struct kvsns_cache_stats_ {
+	unsigned long long stat_hits;
+	unsigned long long stat_misses;
+	unsigned long long dentry_hits;
+	unsigned long long dentry_negative_hits;
+	unsigned long long dentry_misses;
+	unsigned long long page_hits;
+	unsigned long long page_misses;
+	unsigned long long page_readahead;
+	unsigned long long page_flushes;
+} kvsns_cache_stats_t;
+
 /**
  * Start the kvsns library. This should be done by every thread using the library
  *
@@ -336,6 +449,8 @@ int kvsns_get_root(kvsns_ino_t *ino);
  *
  * @note: the call is similar to stat() call in libc. It uses the structure
  * "struct stat" defined in the libC.
+ * The size of a file is the one stored by its writers at fsync and close,
+ * the data store is only asked while the file is open for write.
  *
  * @param cred - pointer to user's credentials
  * @param ino - pointer to current inode
@@ -378,6 +493,18 @@ int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino, struct stat *setstat,
  */
 int kvsns_fsstat(kvsns_fsstat_t *stat);
 
+/**
+ * Gets the hit/miss counters of the in-process attributes, dentry and
+ * data page caches (see the [kvsns] section of the configuration file).
+ * page_readahead counts the pages loaded ahead of sequential reads and
+ * page_flushes the writes of the dirty data of a file
+ *
+ * @param stats - [OUT] counters since kvsns_start()
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_get_cache_stats(kvsns_cache_stats_t *stats);
+
 /**
  * Open a directory to be accessed by kvsns_readdir
  *
@@ -390,7 +517,11 @@ int kvsns_fsstat(kvsns_fsstat_t *stat);
 int kvsns_opendir(kvsns_cred_t *cred, kvsns_ino_t *dir, kvsns_dir_t *ddir);
 
 /**
- * Reads the content of a directory
+ * Reads the content of a directory. Reading from offset 0 accesses the
+ * directory's atime, as the "atime" policy of the configuration says.
+ * The offset is a rank in the directory: entries removed or added with a
+ * lower inode number between two calls may make it skip or repeat
+ * entries. kvsns_readdirplus() has stable cookies.
  *
  * @param cred - pointer to user's credentials
  * @param dir - handle (return by kvsns_opendir) to the directory to be read
@@ -404,6 +535,32 @@ int kvsns_opendir(kvsns_cred_t *cred, kvsns_ino_t *dir, kvsns_dir_t *ddir);
 int kvsns_readdir(kvsns_cred_t *cred, kvsns_dir_t *dir, off_t offset,
 		 kvsns_dentry_t *dirent, int *size);
 
+/**
+ * Reads the content of a directory from a cookie. A cookie is stable:
+ * entries created or removed while the directory is read do not move
+ * the other ones, each entry being returned once. The attributes of the
+ * whole page are fetched in one round trip to the KVS and one batch to
+ * the extstore.
+ *
+ * @param cred - pointer to user's credentials
+ * @param dir - handle (return by kvsns_opendir) to the directory to be read
+ * @param cookie - 0 or a cookie returned by a previous call
+ * @param flags - KVSNS_READDIR_ATTRS to fill dirent[i].stats,
+ * KVSNS_READDIR_ATIME to update the directory's atime (once, on the first
+ * page, as the "atime" policy of the configuration says)
+ * @param dirent - [OUT] array of kvsns_dentry for reading
+ * @param cookies - [OUT] cookie to resume after each entry, may be NULL
+ * @param size - [INOUT] as input, allocated size of dirent and cookies, as
+ * output read size.
+ * @param eof - [OUT] true if the last entry was read
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_readdirplus(kvsns_cred_t *cred, kvsns_dir_t *dir,
+		      kvsns_cookie_t cookie, int flags,
+		      kvsns_dentry_t *dirent, kvsns_cookie_t *cookies,
+		      int *size, bool *eof);
+
 /**
  * Closes a directory opened by kvsns_opendir
  *
@@ -419,6 +576,9 @@ int kvsns_closedir(kvsns_dir_t *ddir);
  * @note: this call use the same flags as LibC's open() call. You must know
  * the inode to call this function so you can't use it for creating a file.
  * In this case, kvsns_create() is to be invoked.
+ * O_SYNC and O_DSYNC select the durability of the writes made through the
+ * handle, otherwise the "durability" value of the [kvsns] section of the
+ * configuration is used. fd->durability can be changed after the call.
  *
  * @todo: mode parameter is unused. Remove it.
  *
@@ -455,7 +615,8 @@ int kvsns_openat(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name,
 		 int flags, mode_t mode, kvsns_file_open_t *fd);
 
 /**
- * Closes a file descriptor
+ * Closes a file descriptor. Unstable writes made through the handle are
+ * committed first.
  *
  * @param fd - handle to opened file
  *
@@ -491,6 +652,53 @@ ssize_t kvsns_write(kvsns_cred_t *cred, kvsns_file_open_t *fd,
 ssize_t kvsns_read(kvsns_cred_t *cred, kvsns_file_open_t *fd,
 		  void *buf, size_t count, off_t offset);
 
+/**
+ * Writes data gathered from several buffers to several ranges of a file.
+ * The buffers are taken in order to fill the extents in order, both must
+ * have the same total size.
+ *
+ * @param cred - pointer to user's credentials
+ * @param fd - handle to opened file
+ * @param iov - buffers to be written
+ * @param iovcnt - number of buffers
+ * @param ext - file ranges to be written
+ * @param extcnt - number of file ranges
+ *
+ * @return written size or a negative "-errno" in case of failure
+ */
+ssize_t kvsns_writev(kvsns_cred_t *cred, kvsns_file_open_t *fd,
+		     const struct iovec *iov, int iovcnt,
+		     const kvsns_extent_t *ext, int extcnt);
+
+/**
+ * Reads several ranges of a file and scatters the data in several buffers.
+ * The extents are read in order to fill the buffers in order, both must
+ * have the same total size. The read stops at the end of the file.
+ *
+ * @param cred - pointer to user's credentials
+ * @param fd - handle to opened file
+ * @param iov - [OUT] buffers for the read data
+ * @param iovcnt - number of buffers
+ * @param ext - file ranges to be read
+ * @param extcnt - number of file ranges
+ *
+ * @return read size or a negative "-errno" in case of failure
+ */
+ssize_t kvsns_readv(kvsns_cred_t *cred, kvsns_file_open_t *fd,
+		    const struct iovec *iov, int iovcnt,
+		    const kvsns_extent_t *ext, int extcnt);
+
+/**
+ * Commits to stable storage the data written to a file, in particular
+ * the writes made with the KVSNS_UNSTABLE durability
+ *
+ * @param cred - pointer to user's credentials
+ * @param fd - handle to opened file
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_fsync(kvsns_cred_t *cred, kvsns_file_open_t *fd);
+
 /* Xattr */
 
 /**
@@ -584,6 +792,9 @@ int kvsns_mr_proper(void);
 /**
  *  High level API: copy a file from the KVSNS to a POSIX fd
  *
+ * @note: data is copied in the kernel when the extstore keeps it in a
+ * file, otherwise several chunks of iolen bytes are read ahead.
+ *
  * @param cred - pointer to user's credentials
  * @param kfd  - pointer to kvsns's open fd
  * @param fd_dest - POSIX fd to copy file into
@@ -597,6 +808,11 @@ int kvsns_cp_from(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
 /**
  *  High level API: copy a file to the KVSNS from a POSIX fd
  *
+ * @note: data is copied in the kernel when the extstore keeps it in a
+ * file, otherwise several chunks of iolen bytes are written at once. The
+ * file is committed once at the end, unless kfd's durability is
+ * KVSNS_UNSTABLE.
+ *
  * @param cred - pointer to user's credentials
  * @param fd_dest - POSIX fd to retrieve data from
  * @param kfd  - pointer to kvsns's open fd
@@ -607,6 +823,99 @@ int kvsns_cp_from(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
 int kvsns_cp_to(kvsns_cred_t *cred, int fd_source,
 		kvsns_file_open_t *kfd, int iolen);
 
+/**
+ *  High level API: copy a file from the KVSNS to a POSIX fd, with several
+ *  workers copying stripes of the file concurrently. Mode, ownership (if
+ *  allowed) and times are preserved.
+ *
+ * @param cred - pointer to user's credentials
+ * @param kfd  - pointer to kvsns's open fd
+ * @param fd_dest - POSIX fd to copy file into
+ * @param params - workers, stripe size, I/O size and queue depth
+ * @param stats - [OUT] copied size and duration, may be NULL
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_cp_from_parallel(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
+			   int fd_dest, kvsns_cp_params_t *params,
+			   kvsns_cp_stats_t *stats);
+
+/**
+ *  High level API: copy a file to the KVSNS from a POSIX fd, with several
+ *  workers copying stripes of the file concurrently. Mode, times and, for
+ *  root, ownership are preserved.
+ *
+ * @param cred - pointer to user's credentials
+ * @param fd_source - POSIX fd to retrieve data from
+ * @param kfd  - pointer to kvsns's open fd
+ * @param params - workers, stripe size, I/O size and queue depth
+ * @param stats - [OUT] copied size and duration, may be NULL
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_cp_to_parallel(kvsns_cred_t *cred, int fd_source,
+			 kvsns_file_open_t *kfd, kvsns_cp_params_t *params,
+			 kvsns_cp_stats_t *stats);
+
+/**
+ *  High level API: walk a tree of the namespace with several workers
+ *
+ * @note: the callback is called for the root and every entry below it
+ * that matches the filter, with the entry's path and stats, by several
+ * workers at once and in no given order. Symlinks are not followed and
+ * atimes are not updated. A directory that cannot be read is skipped and
+ * counted in stats->errors, a negative value returned by the callback
+ * stops the walk and is returned.
+ *
+ * @param cred - pointer to user's credentials
+ * @param root - inode the walk starts from
+ * @param path - path of root, prefix of the reported paths
+ * @param filter - criteria of the reported entries, NULL for all
+ * @param params - workers, queue and batch sizes, depth, NULL for defaults
+ * @param cb - called for each matching entry
+ * @param arg - passed to cb
+ * @param stats - [OUT] counters and duration of the walk, may be NULL
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_walk(kvsns_cred_t *cred, kvsns_ino_t *root, const char *path,
+	       kvsns_walk_filter_t *filter, kvsns_walk_params_t *params,
+	       kvsns_walk_cb_t cb, void *arg, kvsns_walk_stats_t *stats);
+
+/**
+ *  High level API: list the inodes matching a secondary index
+ *
+ * @note: the inodes come by increasing value of the indexed attribute,
+ * in pages. Inodes updated between two calls may be missed or returned
+ * twice, as in a readdir.
+ *
+ * @param index - index to be read, it must be enabled in the configuration
+ * @param min - lowest mtime or size, or the uid or gid to look for
+ * @param max - highest mtime or size, unused for uid and gid
+ * @param cursor - where to resume, zeroed for the first call
+ * @param inos - [OUT] array of found inodes
+ * @param size - [IN] size of inos, [OUT] number of inodes returned
+ * @param eof - [OUT] true if the last inode was returned
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure,
+ * -EOPNOTSUPP if the index is not enabled
+ */
+int kvsns_index_query(enum kvsns_index index, unsigned long long min,
+		      unsigned long long max, kvsns_index_cursor_t *cursor,
+		      kvsns_ino_t *inos, int *size, bool *eof);
+
+/**
+ *  High level API: build the enabled secondary indexes from scratch
+ *
+ * @note: to be run after enabling an index on an existing namespace or
+ * after kvsns_migrate. The namespace is walked from the root.
+ *
+ * @param (node) - void function.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int kvsns_index_rebuild(void);
+
 /**
  *  High level API: do a "lookup by path" operation
  *
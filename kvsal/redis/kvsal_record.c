@@ -0,0 +1,142 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsal_record.c
+ * KVS Abstraction Layer: encoding of the inode records
+ *
+ * Inode attributes are stored as a fixed size record, little endian
+ * whatever the host is, so that a KVS can be shared by clients of any
+ * architecture. See the KVSAL_RECORD_* offsets in kvsal.h.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <kvsns/kvsal.h>
+
+static void put_u32(char *p, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4 ; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static void put_u64(char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8 ; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint32_t get_u32(const char *p)
+{
+	uint32_t v = 0;
+	int i;
+
+	for (i = 0; i < 4 ; i++)
+		v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+
+	return v;
+}
+
+static uint64_t get_u64(const char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < 8 ; i++)
+		v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+
+	return v;
+}
+
+void kvsal_encode_time(struct timespec *ts, char *p)
+{
+	put_u64(p, (uint64_t)ts->tv_sec);
+	put_u32(p + 8, (uint32_t)ts->tv_nsec);
+}
+
+static void kvsal_decode_time(const char *p, struct timespec *ts)
+{
+	ts->tv_sec = (int64_t)get_u64(p);
+	ts->tv_nsec = get_u32(p + 8);
+}
+
+void kvsal_stat2record(struct stat *buf, char *record)
+{
+	memset(record, 0, KVSAL_RECORD_LEN);
+
+	record[0] = KVSAL_RECORD_VERSION;
+	put_u32(record + KVSAL_RECORD_MODE, buf->st_mode);
+	put_u32(record + KVSAL_RECORD_NLINK, buf->st_nlink);
+	put_u32(record + KVSAL_RECORD_UID, buf->st_uid);
+	put_u32(record + KVSAL_RECORD_GID, buf->st_gid);
+	put_u64(record + KVSAL_RECORD_INO, buf->st_ino);
+	put_u64(record + KVSAL_RECORD_SIZE, buf->st_size);
+	kvsal_encode_time(&buf->st_atim, record + KVSAL_RECORD_ATIME);
+	kvsal_encode_time(&buf->st_mtim, record + KVSAL_RECORD_MTIME);
+	kvsal_encode_time(&buf->st_ctim, record + KVSAL_RECORD_CTIME);
+	put_u64(record + KVSAL_RECORD_BLOCKS, buf->st_blocks);
+}
+
+int kvsal_record2stat(const char *record, size_t len, struct stat *buf)
+{
+	if (len < KVSAL_RECORD_V1_LEN)
+		return -EPROTO;
+
+	if (record[0] == 1 && len != KVSAL_RECORD_V1_LEN)
+		return -EPROTO;
+
+	if (record[0] == KVSAL_RECORD_VERSION && len != KVSAL_RECORD_LEN)
+		return -EPROTO;
+
+	if (record[0] != 1 && record[0] != KVSAL_RECORD_VERSION)
+		return -EPROTO;
+
+	memset(buf, 0, sizeof(struct stat));
+
+	buf->st_mode = get_u32(record + KVSAL_RECORD_MODE);
+	buf->st_nlink = get_u32(record + KVSAL_RECORD_NLINK);
+	buf->st_uid = get_u32(record + KVSAL_RECORD_UID);
+	buf->st_gid = get_u32(record + KVSAL_RECORD_GID);
+	buf->st_ino = get_u64(record + KVSAL_RECORD_INO);
+	buf->st_size = get_u64(record + KVSAL_RECORD_SIZE);
+	kvsal_decode_time(record + KVSAL_RECORD_ATIME, &buf->st_atim);
+	kvsal_decode_time(record + KVSAL_RECORD_MTIME, &buf->st_mtim);
+	kvsal_decode_time(record + KVSAL_RECORD_CTIME, &buf->st_ctim);
+
+	/* Before version 2, the size of a file was only in the extstore */
+	if (record[0] == 1)
+		buf->st_blocks = KVSAL_BLOCKS_UNKNOWN;
+	else
+		buf->st_blocks = (int64_t)get_u64(record +
+						  KVSAL_RECORD_BLOCKS);
+
+	return 0;
+}
@@ -30,6 +30,7 @@
  */
 
 #include <errno.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,76 +39,460 @@
 #include <time.h>
 #include <ini_config.h>
 #include <kvsns/kvsal.h>
+#include "kvsal_redis.h"
 
 #define RC_WRAP(__function, ...) ({\
         int __rc = __function(__VA_ARGS__);\
         if (__rc != 0)        \
                 return __rc; })
 
-/* The REDIS context exists in the TLS, for MT-Safety */
-__thread redisContext *rediscontext = NULL;
-
-static struct collection_item *conf = NULL;
-
-int kvsal_init(struct collection_item *cfg_items)
+/* Connections come from a bounded pool. A connection is taken for one
+ * command and given back once its reply is read, so the pool bounds the
+ * commands in flight, not the threads. A transaction keeps its connection
+ * from MULTI to EXEC or DISCARD (the MULTI state is bound to it), or until
+ * its thread exits. A broken connection is dropped and replaced at the
+ * next call, with an exponential backoff between connect attempts */
+static __thread redisContext *rediscontext = NULL;
+static __thread bool in_transaction;
+
+#define KVSAL_HOSTNAME_LEN 256
+#define KVSAL_POOL_SIZE_DEFAULT 64
+#define KVSAL_CONNECT_TIMEOUT_DEFAULT 1500
+#define KVSAL_RETRIES_DEFAULT 5
+#define KVSAL_BACKOFF_MIN_DEFAULT 10
+#define KVSAL_BACKOFF_MAX_DEFAULT 1000
+#define KVSAL_HEALTH_CHECK_DEFAULT 30
+
+struct kvsal_conn {
+	redisContext *ctx;
+	time_t last_used;
+	struct kvsal_conn *next;
+};
+
+static struct kvsal_pool {
+	char hostname[KVSAL_HOSTNAME_LEN];
+	int port;
+	unsigned int size;		/* max number of connections */
+	unsigned int connect_timeout;	/* in ms */
+	unsigned int command_timeout;	/* in ms, 0 is no timeout */
+	unsigned int retries;
+	unsigned int backoff_min;	/* in ms */
+	unsigned int backoff_max;	/* in ms */
+	unsigned int health_check;	/* in s, idle time before a PING */
+	struct kvsal_conn *idle;
+	kvsal_pool_stats_t stats;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_key_t key;
+	bool configured;
+	unsigned int users;		/* kvsal_init not yet finished */
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned int kvsal_config_uint(struct collection_item *cfg_items,
+				      char *name, unsigned int def)
 {
-	redisReply *reply;
-	char *hostname = NULL;
-	char hostname_default[] = "127.0.0.1";
-	struct timeval timeout = { 1, 500000 }; /* 1.5 seconds */
-	int port = 6379; /* REDIS default */
 	struct collection_item *item = NULL;
 
 	if (cfg_items == NULL)
-		return -EINVAL;
+		return def;
 
-	if (conf == NULL)
-		conf = cfg_items;
+	if (get_config_item("kvsal_redis", name, cfg_items, &item) != 0 ||
+	    item == NULL)
+		return def;
 
-	/* Get config from ini file */
-	item = NULL;
-	RC_WRAP(get_config_item, "kvsal_redis", "server", cfg_items, &item);
-	if (item == NULL)
-		hostname = hostname_default;
-	else
-		hostname = get_string_config_value(item, NULL);
+	return get_unsigned_config_value(item, 0, def, NULL);
+}
 
-	item = NULL;
-	RC_WRAP(get_config_item, "kvsal_redis", "port", cfg_items, &item);
-	if (item != NULL)
-		port = (int)get_int_config_value(item, 0, 0, NULL);
+static void kvsal_ms2tv(unsigned int ms, struct timeval *tv)
+{
+	tv->tv_sec = ms / 1000;
+	tv->tv_usec = 1000 * (ms % 1000);
+}
 
-	/* Start REDIS */
-	rediscontext = redisConnectWithTimeout(hostname, port, timeout);
-	if (rediscontext == NULL || rediscontext->err) {
-		if (rediscontext) {
+static redisContext *kvsal_connect(void)
+{
+	redisContext *ctx;
+	struct timeval timeout;
+	unsigned int backoff = pool.backoff_min;
+	unsigned int i;
+
+	kvsal_ms2tv(pool.connect_timeout, &timeout);
+
+	for (i = 0; i <= pool.retries ; i++) {
+		if (i > 0) {
+			usleep(1000 * backoff);
+			backoff = (2 * backoff < pool.backoff_max) ?
+				  2 * backoff : pool.backoff_max;
+		}
+
+		ctx = redisConnectWithTimeout(pool.hostname, pool.port,
+					      timeout);
+		if (ctx != NULL && ctx->err == 0) {
+			if (pool.command_timeout != 0) {
+				kvsal_ms2tv(pool.command_timeout, &timeout);
+				redisSetTimeout(ctx, timeout);
+			}
+			return ctx;
+		}
+
+		if (ctx) {
 			fprintf(stderr,
-				"Connection error: %s\n", rediscontext->errstr);
-			redisFree(rediscontext);
+				"Connection error: %s\n", ctx->errstr);
+			redisFree(ctx);
 		} else {
 			fprintf(stderr,
 				"Connection error: can't get redis context\n");
 		}
-		exit(1);
 	}
 
-	/* PING server */
-	reply = redisCommand(rediscontext, "PING");
+	return NULL;
+}
+
+static bool kvsal_ping(redisContext *ctx)
+{
+	redisReply *reply;
+	bool ok;
+
+	reply = redisCommand(ctx, "PING");
 	if (!reply)
-		return -1;
+		return false;
 
+	ok = (reply->type == REDIS_REPLY_STATUS);
 	freeReplyObject(reply);
 
+	return ok;
+}
+
+/* Gives back a connection to the pool, a connection in error or in the
+ * middle of a transaction can't be reused */
+static void kvsal_pool_put(redisContext *ctx, bool reusable)
+{
+	struct kvsal_conn *conn = NULL;
+
+	if (reusable && ctx->err == 0)
+		conn = malloc(sizeof(struct kvsal_conn));
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stats.in_use -= 1;
+	if (conn) {
+		conn->ctx = ctx;
+		conn->last_used = time(NULL);
+		conn->next = pool.idle;
+		pool.idle = conn;
+		pool.stats.idle += 1;
+	} else {
+		pool.stats.connections -= 1;
+	}
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	if (!conn)
+		redisFree(ctx);
+}
+
+static void kvsal_thread_release(void *arg)
+{
+	kvsal_pool_put((redisContext *)arg, !in_transaction);
+}
+
+static int kvsal_pool_get(redisContext **pctx)
+{
+	struct kvsal_conn *conn;
+	struct timespec deadline;
+	redisContext *ctx;
+	bool stale;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += pool.connect_timeout / 1000;
+	deadline.tv_nsec += 1000000 * (pool.connect_timeout % 1000);
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.idle == NULL && pool.stats.connections >= pool.size) {
+		pool.stats.waits += 1;
+		if (pthread_cond_timedwait(&pool.cond, &pool.lock,
+					   &deadline) == ETIMEDOUT) {
+			pthread_mutex_unlock(&pool.lock);
+			return -EBUSY;
+		}
+	}
+
+	conn = pool.idle;
+	if (conn) {
+		pool.idle = conn->next;
+		pool.stats.idle -= 1;
+		pool.stats.reused += 1;
+	} else {
+		pool.stats.connections += 1;
+	}
+	pool.stats.in_use += 1;
+	pthread_mutex_unlock(&pool.lock);
+
+	if (conn) {
+		ctx = conn->ctx;
+		stale = (pool.health_check == 0 ||
+			 time(NULL) - conn->last_used >= pool.health_check);
+		free(conn);
+
+		/* Health check of a connection that was idle for long */
+		if (!stale || kvsal_ping(ctx)) {
+			*pctx = ctx;
+			return 0;
+		}
+
+		/* The slot is kept, connect again in it */
+		redisFree(ctx);
+		pthread_mutex_lock(&pool.lock);
+		pool.stats.reconnects += 1;
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	ctx = kvsal_connect();
+
+	pthread_mutex_lock(&pool.lock);
+	if (ctx) {
+		pool.stats.created += 1;
+	} else {
+		pool.stats.failures += 1;
+		pool.stats.connections -= 1;
+		pool.stats.in_use -= 1;
+		pthread_cond_signal(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	if (!ctx)
+		return -ECONNREFUSED;
+
+	*pctx = ctx;
+	return 0;
+}
+
+/* Makes sure the calling thread has a usable connection */
+static int kvsal_context(void)
+{
+	if (rediscontext && rediscontext->err == 0)
+		return 0;
+
+	if (!pool.configured)
+		return -EINVAL;
+
+	/* Commands of a transaction can't go to another connection */
+	if (in_transaction)
+		return -EIO;
+
+	if (rediscontext) {
+		/* I/O error on this connection, replace it */
+		kvsal_pool_put(rediscontext, false);
+		rediscontext = NULL;
+		pthread_setspecific(pool.key, NULL);
+
+		pthread_mutex_lock(&pool.lock);
+		pool.stats.reconnects += 1;
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	RC_WRAP(kvsal_pool_get, &rediscontext);
+	pthread_setspecific(pool.key, rediscontext);
+
 	return 0;
 }
 
-static int kvsal_reinit()
+/* Gives back the connection of the calling thread, unless a transaction
+ * holds it */
+static void kvsal_release(void)
 {
-	return kvsal_init(conf);
+	if (!rediscontext || in_transaction)
+		return;
+
+	pthread_setspecific(pool.key, NULL);
+	kvsal_pool_put(rediscontext, true);
+	rediscontext = NULL;
+}
+
+static redisReply *kvsal_command(const char *format, ...)
+{
+	redisReply *reply;
+	va_list ap;
+
+	if (kvsal_context() != 0)
+		return NULL;
+
+	va_start(ap, format);
+	reply = redisvCommand(rediscontext, format, ap);
+	va_end(ap);
+
+	kvsal_release();
+
+	return reply;
+}
+
+static redisReply *kvsal_command_argv(int argc, const char **argv,
+				      const size_t *argvlen)
+{
+	redisReply *reply;
+
+	if (kvsal_context() != 0)
+		return NULL;
+
+	reply = redisCommandArgv(rediscontext, argc, argv, argvlen);
+
+	kvsal_release();
+
+	return reply;
+}
+
+static int kvsal_end_of_transaction(void)
+{
+	bool lost = in_transaction &&
+		    (rediscontext == NULL || rediscontext->err != 0);
+
+	in_transaction = false;
+
+	return lost ? -EIO : 0;
+}
+
+/* Scripts are loaded once for all threads, their source is kept to
+ * reload them if the server lost its script cache (restart) */
+struct kvsal_script {
+	char sha[41];
+	char *source;
+};
+
+static struct kvsal_script scripts[KVSAL_MAX_SCRIPTS];
+static int nb_scripts;
+static pthread_mutex_t scripts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int kvsal_configure(struct collection_item *cfg_items)
+{
+	struct collection_item *item = NULL;
+	char *hostname = "127.0.0.1";
+
+	/* Get config from ini file, a NULL config means default values */
+	if (cfg_items != NULL) {
+		RC_WRAP(get_config_item, "kvsal_redis", "server",
+			cfg_items, &item);
+		if (item != NULL)
+			hostname = get_string_config_value(item, NULL);
+	}
+	strncpy(pool.hostname, hostname, KVSAL_HOSTNAME_LEN - 1);
+
+	pool.port = kvsal_config_uint(cfg_items, "port", 6379);
+	pool.size = kvsal_config_uint(cfg_items, "pool_size",
+				      KVSAL_POOL_SIZE_DEFAULT);
+	pool.connect_timeout = kvsal_config_uint(cfg_items, "connect_timeout",
+						KVSAL_CONNECT_TIMEOUT_DEFAULT);
+	pool.command_timeout = kvsal_config_uint(cfg_items, "command_timeout",
+						0);
+	pool.retries = kvsal_config_uint(cfg_items, "retries",
+					 KVSAL_RETRIES_DEFAULT);
+	pool.backoff_min = kvsal_config_uint(cfg_items, "backoff_min",
+					     KVSAL_BACKOFF_MIN_DEFAULT);
+	pool.backoff_max = kvsal_config_uint(cfg_items, "backoff_max",
+					     KVSAL_BACKOFF_MAX_DEFAULT);
+	pool.health_check = kvsal_config_uint(cfg_items, "health_check",
+					      KVSAL_HEALTH_CHECK_DEFAULT);
+
+	if (pool.size == 0)
+		pool.size = 1;
+	if (pool.backoff_min == 0)
+		pool.backoff_min = 1;
+	if (pool.backoff_max < pool.backoff_min)
+		pool.backoff_max = pool.backoff_min;
+
+	if (pthread_key_create(&pool.key, kvsal_thread_release) != 0)
+		return -ENOMEM;
+
+	pool.configured = true;
+	return 0;
+}
+
+int kvsal_init(struct collection_item *cfg_items)
+{
+	bool ok;
+	int rc = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.configured)
+		rc = kvsal_configure(cfg_items);
+	pthread_mutex_unlock(&pool.lock);
+
+	if (rc != 0)
+		return rc;
+
+	/* Get a connection and PING server */
+	RC_WRAP(kvsal_context);
+	ok = kvsal_ping(rediscontext);
+	kvsal_release();
+	if (!ok)
+		return -1;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.users += 1;
+	pthread_mutex_unlock(&pool.lock);
+
+	return 0;
+}
+
+void kvsal_redis_server(char **hostname, int *port)
+{
+	*hostname = pool.hostname;
+	*port = pool.port;
 }
 
 int kvsal_fini(void)
 {
+	struct kvsal_conn *conn;
+	bool last;
+
+	if (rediscontext) {
+		pthread_setspecific(pool.key, NULL);
+		kvsal_pool_put(rediscontext, !in_transaction);
+		rediscontext = NULL;
+		in_transaction = false;
+	}
+
+	/* Every thread that started the library stops it, the last one
+	 * closes the connections */
+	pthread_mutex_lock(&pool.lock);
+	if (pool.users > 0)
+		pool.users -= 1;
+	last = (pool.users == 0);
+	pthread_mutex_unlock(&pool.lock);
+
+	if (!last)
+		return 0;
+
+	kvsal_async_fini();
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.idle) {
+		conn = pool.idle;
+		pool.idle = conn->next;
+		redisFree(conn->ctx);
+		free(conn);
+		pool.stats.idle -= 1;
+		pool.stats.connections -= 1;
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return 0;
+}
+
+int kvsal_get_pool_stats(kvsal_pool_stats_t *stats)
+{
+	if (!stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pool.lock);
+	*stats = pool.stats;
+	pthread_mutex_unlock(&pool.lock);
+
 	return 0;
 }
 
@@ -115,25 +500,23 @@ int kvsal_begin_transaction(void)
 {
 	redisReply *reply;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	bool ok;
 
-	reply = redisCommand(rediscontext, "MULTI");
-	if (!reply)
-		return -1;
+	RC_WRAP(kvsal_context);
 
-	if (reply->type != REDIS_REPLY_STATUS) {
+	/* The connection is kept until EXEC or DISCARD */
+	reply = redisCommand(rediscontext, "MULTI");
+	ok = (reply && reply->type == REDIS_REPLY_STATUS &&
+	      !strncmp(reply->str, "OK", reply->len));
+	if (reply)
 		freeReplyObject(reply);
-		return -1;
-	}
 
-	if (strncmp(reply->str, "OK", reply->len)) {
-		freeReplyObject(reply);
+	if (!ok) {
+		kvsal_release();
 		return -1;
 	}
 
-	freeReplyObject(reply);
+	in_transaction = true;
 	return 0;
 }
 
@@ -142,11 +525,13 @@ int kvsal_end_transaction(void)
 	redisReply *reply;
 	int i;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	/* The transaction was lost with its connection */
+	if (kvsal_end_of_transaction() != 0)
+		return -EIO;
+
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "EXEC");
+	reply = kvsal_command("EXEC");
 	if (!reply)
 		return -1;
 
@@ -155,9 +540,10 @@ int kvsal_end_transaction(void)
 		return -1;
 	}
 
+	/* Commands in the transaction may return status or integer
+	 * replies, only errors are to be considered as failures */
 	for (i = 0; i < reply->elements ; i++)
-		if (strncmp(reply->element[i]->str, "OK",
-			    reply->element[i]->len)) {
+		if (reply->element[i]->type == REDIS_REPLY_ERROR) {
 			freeReplyObject(reply);
 			return -1;
 		}
@@ -170,11 +556,13 @@ int kvsal_discard_transaction(void)
 {
 	redisReply *reply;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	/* The transaction was lost with its connection */
+	if (kvsal_end_of_transaction() != 0)
+		return -EIO;
+
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "DISCARD");
+	reply = kvsal_command("DISCARD");
 	if (!reply)
 		return -1;
 
@@ -199,12 +587,10 @@ int kvsal_exists(char *k)
 	if (!k)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
 	/* Set a key */
-	reply = redisCommand(rediscontext, "EXISTS %s", k);
+	reply = kvsal_command("EXISTS %s", k);
 	if (!reply)
 		return -1;
 
@@ -226,12 +612,10 @@ int kvsal_set_char(char *k, char *v)
 	if (!k || !v)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
 	/* Set a key */
-	reply = redisCommand(rediscontext, "SET %s %s", k, v);
+	reply = kvsal_command("SET %s %s", k, v);
 	if (!reply)
 		return -1;
 
@@ -247,18 +631,23 @@ int kvsal_get_char(char *k, char *v)
 	if (!k || !v)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
 	/* Try a GET and two INCR */
 	reply = NULL;
-	reply = redisCommand(rediscontext, "GET %s", k);
+	reply = kvsal_command("GET %s", k);
 	if (!reply)
 		return -1;
 
-	if (reply->len == 0)
+	if (reply->type == REDIS_REPLY_NIL) {
+		freeReplyObject(reply);
 		return -ENOENT;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		freeReplyObject(reply);
+		return -1;
+	}
 
 	strcpy(v, reply->str);
 	freeReplyObject(reply);
@@ -269,18 +658,18 @@ int kvsal_get_char(char *k, char *v)
 int kvsal_set_stat(char *k, struct stat *buf)
 {
 	redisReply *reply;
-
-	size_t size = sizeof(struct stat);
+	char record[KVSAL_RECORD_LEN];
 
 	if (!k || !buf)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
+
+	kvsal_stat2record(buf, record);
 
 	/* Set a key */
-	reply = redisCommand(rediscontext, "SET %s %b", k, buf, size);
+	reply = kvsal_command("SET %s %b", k, record,
+			     (size_t)KVSAL_RECORD_LEN);
 	if (!reply)
 		return -1;
 
@@ -292,28 +681,119 @@ int kvsal_set_stat(char *k, struct stat *buf)
 int kvsal_get_stat(char *k, struct stat *buf)
 {
 	redisReply *reply;
+	int rc;
 
 	if (!k || !buf)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "GET %s", k);
+	reply = kvsal_command("GET %s", k);
 	if (!reply)
 		return -1;
 
-	if (reply->type != REDIS_REPLY_STRING)
+	if (reply->type != REDIS_REPLY_STRING) {
+		freeReplyObject(reply);
 		return -1;
+	}
 
-	if (reply->len != sizeof(struct stat))
+	rc = kvsal_record2stat(reply->str, reply->len, buf);
+
+	freeReplyObject(reply);
+
+	return rc;
+}
+
+/* Issues a MGET for nb keys. The caller owns (and frees) the reply */
+static redisReply *kvsal_mget(int nb, char k[][KLEN])
+{
+	redisReply *reply;
+	const char **argv;
+	int i;
+
+	argv = malloc((nb + 1) * sizeof(char *));
+	if (argv == NULL)
+		return NULL;
+
+	argv[0] = "MGET";
+	for (i = 0; i < nb ; i++)
+		argv[i+1] = k[i];
+
+	reply = kvsal_command_argv(nb + 1, argv, NULL);
+	free(argv);
+	if (!reply)
+		return NULL;
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != nb) {
+		freeReplyObject(reply);
+		return NULL;
+	}
+
+	return reply;
+}
+
+int kvsal_mget_char(int nb, char k[][KLEN], char v[][VLEN], int *rcs)
+{
+	redisReply *reply;
+	redisReply *elt;
+	int i;
+
+	if (!k || !v || !rcs || nb < 0)
+		return -EINVAL;
+
+	if (nb == 0)
+		return 0;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_mget(nb, k);
+	if (!reply)
 		return -1;
 
-	memcpy((char *)buf, reply->str, reply->len);
+	for (i = 0; i < nb ; i++) {
+		elt = reply->element[i];
+		if (elt->type != REDIS_REPLY_STRING) {
+			rcs[i] = -ENOENT;
+			continue;
+		}
+
+		strncpy(v[i], elt->str, VLEN);
+		rcs[i] = 0;
+	}
 
 	freeReplyObject(reply);
+	return 0;
+}
+
+int kvsal_get_stat_many(int nb, char k[][KLEN], struct stat *buf, int *rcs)
+{
+	redisReply *reply;
+	redisReply *elt;
+	int i;
 
+	if (!k || !buf || !rcs || nb < 0)
+		return -EINVAL;
+
+	if (nb == 0)
+		return 0;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_mget(nb, k);
+	if (!reply)
+		return -1;
+
+	for (i = 0; i < nb ; i++) {
+		elt = reply->element[i];
+		if (elt->type != REDIS_REPLY_STRING) {
+			rcs[i] = -ENOENT;
+			continue;
+		}
+
+		rcs[i] = kvsal_record2stat(elt->str, elt->len, &buf[i]);
+	}
+
+	freeReplyObject(reply);
 	return 0;
 }
 
@@ -324,12 +804,10 @@ int kvsal_set_binary(char *k, char *buf, size_t size)
 	if (!k || !buf)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
 	/* Set a key */
-	reply = redisCommand(rediscontext, "SET %s %b", k, buf, size);
+	reply = kvsal_command("SET %s %b", k, buf, size);
 	if (!reply)
 		return -1;
 
@@ -343,11 +821,9 @@ int kvsal_get_binary(char *k, char *buf, size_t *size)
 	if (!k || !buf || !size)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "GET %s", k);
+	reply = kvsal_command("GET %s", k);
 	if (!reply)
 		return -1;
 
@@ -366,21 +842,31 @@ int kvsal_get_binary(char *k, char *buf, size_t *size)
 }
 
 int kvsal_incr_counter(char *k, unsigned long long *v)
+{
+	return kvsal_incrby_counter(k, 1, v);
+}
+
+int kvsal_incrby_counter(char *k, unsigned long long incr,
+			 unsigned long long *v)
 {
 	redisReply *reply;
 
 	if (!k || !v)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "INCR %s", k);
+	reply = kvsal_command("INCRBY %s %llu", k, incr);
 	if (!reply)
 		return -1;
 
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
 	*v = (unsigned long long)reply->integer;
+	freeReplyObject(reply);
 
 	return 0;
 }
@@ -392,12 +878,10 @@ int kvsal_del(char *k)
 	if (!k)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
 	/* Try a GET and two INCR */
-	reply = redisCommand(rediscontext, "DEL %s", k);
+	reply = kvsal_command("DEL %s", k);
 	if (!reply)
 		return -1;
 	freeReplyObject(reply);
@@ -413,11 +897,9 @@ int kvsal_get_list_pattern(char *pattern, int start, int *size,
 	if (!pattern || !size || !items)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "KEYS %s", pattern);
+	reply = kvsal_command("KEYS %s", pattern);
 	if (!reply)
 		return -1;
 	if (reply->type != REDIS_REPLY_ARRAY)
@@ -443,11 +925,9 @@ int kvsal_get_list_size(char *pattern)
 	if (!pattern)
 		return -EINVAL;
 
-	if (!rediscontext)
-		if (kvsal_reinit() != 0)
-			return -1;
+	RC_WRAP(kvsal_context);
 
-	reply = redisCommand(rediscontext, "KEYS %s", pattern);
+	reply = kvsal_command("KEYS %s", pattern);
 	if (!reply)
 		return -1;
 	if (reply->type != REDIS_REPLY_ARRAY)
@@ -465,6 +945,7 @@ int kvsal_init_list(kvsal_list_t *list)
 
 	list->size = 0;
 	list->content = NULL;
+	list->type = KVSAL_LIST_PATTERN;
 
 	return 0;
 }
@@ -476,6 +957,7 @@ int kvsal_fetch_list(char *pattern, kvsal_list_t *list)
 
 	/* REDIS manages KVS in RAM. Nothing to do */
 	strncpy(list->pattern , pattern, KLEN);
+	list->type = KVSAL_LIST_PATTERN;
 
 	return 0;
 }
@@ -489,14 +971,469 @@ int kvsal_dispose_list(kvsal_list_t *list)
 	return 0;
 }
 
+/* Entries are stored as members of a sorted set whose score is the
+ * value. ZRANGE by rank is O(log(N) + M) so paging through a list only
+ * costs the size of the page. Members are ordered by value (then
+ * lexicographically), but a rank is not stable: deleting an entry, or
+ * adding one with a lower value than the last one read, moves the ones
+ * after it. kvsal_get_entries_from resumes by value instead. Values must
+ * fit in 53 bits to be stored exactly as a score. */
+int kvsal_add_entry(char *k, char *name, unsigned long long v)
+{
+	redisReply *reply;
+
+	if (!k || !name)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZADD %s %llu %s", k, v, name);
+	if (!reply)
+		return -1;
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+int kvsal_get_entry(char *k, char *name, unsigned long long *v)
+{
+	redisReply *reply;
+
+	if (!k || !name || !v)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZSCORE %s %s", k, name);
+	if (!reply)
+		return -1;
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		freeReplyObject(reply);
+		return -ENOENT;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	*v = (unsigned long long)strtod(reply->str, NULL);
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+int kvsal_del_entry(char *k, char *name)
+{
+	redisReply *reply;
+
+	if (!k || !name)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZREM %s %s", k, name);
+	if (!reply)
+		return -1;
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+int kvsal_count_entries(char *k)
+{
+	redisReply *reply;
+	int rc;
+
+	if (!k)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZCARD %s", k);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	rc = (int)reply->integer;
+
+	freeReplyObject(reply);
+	return rc;
+}
+
+int kvsal_fetch_entries(char *k, kvsal_list_t *list)
+{
+	if (!k || !list)
+		return -EINVAL;
+
+	/* Nothing is fetched, pages are read by rank in kvsal_get_list */
+	strncpy(list->pattern, k, KLEN);
+	list->type = KVSAL_LIST_ENTRIES;
+
+	return 0;
+}
+
+int kvsal_add_member(char *k, char *member)
+{
+	redisReply *reply;
+
+	if (!k || !member)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("SADD %s %s", k, member);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+int kvsal_del_member(char *k, char *member)
+{
+	redisReply *reply;
+	int rc;
+
+	if (!k || !member)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("SREM %s %s", k, member);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	rc = (reply->integer == 0) ? -ENOENT : 0;
+
+	freeReplyObject(reply);
+	return rc;
+}
+
+int kvsal_count_members(char *k)
+{
+	redisReply *reply;
+	int rc;
+
+	if (!k)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("SCARD %s", k);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	rc = (int)reply->integer;
+
+	freeReplyObject(reply);
+	return rc;
+}
+
+int kvsal_get_member(char *k, char *member)
+{
+	redisReply *reply;
+
+	if (!k || !member)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("SRANDMEMBER %s", k);
+	if (!reply)
+		return -1;
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		freeReplyObject(reply);
+		return -ENOENT;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING || reply->len >= VLEN) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	memcpy(member, reply->str, reply->len);
+	member[reply->len] = '\0';
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+static int kvsal_get_list_entries(char *k, int start, int *size,
+				  kvsal_item_t *items)
+{
+	redisReply *reply;
+	int i;
+
+	if (!k || !size || !items)
+		return -EINVAL;
+
+	if (*size <= 0) {
+		*size = 0;
+		return 0;
+	}
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZRANGE %s %d %d WITHSCORES",
+			     k, start, start + *size - 1);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	/* Reply is member1, score1, member2, score2... */
+	*size = reply->elements / 2;
+	for (i = 0; i < *size ; i++) {
+		items[i].offset = start + i;
+		strncpy(items[i].str, reply->element[2*i]->str, KLEN);
+		items[i].value = (unsigned long long)
+			strtod(reply->element[2*i+1]->str, NULL);
+	}
+
+	freeReplyObject(reply);
+	return 0;
+}
+
+/* Entries are ordered by value, so a listing can resume from the value
+ * of the last entry it returned: adding or removing other entries does
+ * not move it. skip tells how many entries with the value v were already
+ * returned, they only differ by name */
+int kvsal_get_entries_from(char *k, unsigned long long v, int skip,
+			   int *size, kvsal_item_t *items)
+{
+	redisReply *reply;
+	int i;
+
+	if (!k || !size || !items || skip < 0)
+		return -EINVAL;
+
+	if (*size <= 0) {
+		*size = 0;
+		return 0;
+	}
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_command("ZRANGEBYSCORE %s %llu +inf WITHSCORES LIMIT %d %d",
+			      k, v, skip, *size);
+	if (!reply)
+		return -1;
+
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	/* Reply is member1, score1, member2, score2... */
+	*size = reply->elements / 2;
+	for (i = 0; i < *size ; i++) {
+		items[i].offset = i;
+		strncpy(items[i].str, reply->element[2*i]->str, KLEN);
+		items[i].value = (unsigned long long)
+			strtod(reply->element[2*i+1]->str, NULL);
+	}
+
+	freeReplyObject(reply);
+	return 0;
+}
+
 int kvsal_get_list(kvsal_list_t *list, int start, int *end,
 		    kvsal_item_t *items)
 {
 	if (!list)
 		return -EINVAL;
-	
-	return kvsal_get_list_pattern(list->pattern, 
-				      start, 
+
+	if (list->type == KVSAL_LIST_ENTRIES)
+		return kvsal_get_list_entries(list->pattern,
+					      start,
+					      end,
+					      items);
+
+	return kvsal_get_list_pattern(list->pattern,
+				      start,
 				      end,
 				      items);
 }
+
+int kvsal_load_script(char *script, int *id)
+{
+	redisReply *reply;
+	int rc = 0;
+	int i;
+
+	if (!script || !id)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	pthread_mutex_lock(&scripts_lock);
+
+	/* A script loaded again, by a kvsns_start following a stop, keeps
+	 * its id */
+	for (i = 0; i < nb_scripts; i++)
+		if (!strcmp(scripts[i].source, script)) {
+			*id = i;
+			goto out;
+		}
+
+	if (nb_scripts == KVSAL_MAX_SCRIPTS) {
+		rc = -ENOSPC;
+		goto out;
+	}
+
+	reply = kvsal_command("SCRIPT LOAD %s", script);
+	if (!reply) {
+		rc = -1;
+		goto out;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING ||
+	    reply->len >= sizeof(scripts[0].sha)) {
+		freeReplyObject(reply);
+		rc = -1;
+		goto out;
+	}
+
+	scripts[nb_scripts].source = strdup(script);
+	if (!scripts[nb_scripts].source) {
+		freeReplyObject(reply);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	strncpy(scripts[nb_scripts].sha, reply->str, reply->len);
+	scripts[nb_scripts].sha[reply->len] = '\0';
+	freeReplyObject(reply);
+
+	*id = nb_scripts;
+	nb_scripts += 1;
+
+out:
+	pthread_mutex_unlock(&scripts_lock);
+	return rc;
+}
+
+static redisReply *kvsal_eval(bool by_sha, int id, int nkeys, char **keys,
+			      int nargs, char **args, size_t *argslen)
+{
+	redisReply *reply;
+	const char **argv;
+	size_t *argvlen;
+	char nk[16];
+	int argc = 3 + nkeys + nargs;
+	int i;
+
+	argv = malloc(argc * sizeof(char *));
+	argvlen = malloc(argc * sizeof(size_t));
+	if (!argv || !argvlen) {
+		free(argv);
+		free(argvlen);
+		return NULL;
+	}
+
+	snprintf(nk, sizeof(nk), "%d", nkeys);
+
+	argv[0] = by_sha ? "EVALSHA" : "EVAL";
+	argv[1] = by_sha ? scripts[id].sha : scripts[id].source;
+	argv[2] = nk;
+
+	for (i = 0; i < nkeys ; i++)
+		argv[3+i] = keys[i];
+
+	for (i = 0; i < nargs ; i++) {
+		argv[3+nkeys+i] = args[i];
+		argvlen[3+nkeys+i] = argslen ? argslen[i] : strlen(args[i]);
+	}
+
+	for (i = 0; i < 3 + nkeys ; i++)
+		argvlen[i] = strlen(argv[i]);
+
+	reply = kvsal_command_argv(argc, argv, argvlen);
+
+	free(argv);
+	free(argvlen);
+
+	return reply;
+}
+
+int kvsal_exec_script(int id, int nkeys, char **keys,
+		      int nargs, char **args, size_t *argslen,
+		      long long *res, int *nres)
+{
+	redisReply *reply;
+	int i;
+
+	if (id < 0 || id >= nb_scripts || !res || !nres || *nres < 1)
+		return -EINVAL;
+
+	RC_WRAP(kvsal_context);
+
+	reply = kvsal_eval(true, id, nkeys, keys, nargs, args, argslen);
+	if (reply && reply->type == REDIS_REPLY_ERROR &&
+	    !strncmp(reply->str, "NOSCRIPT", 8)) {
+		/* EVAL loads the script again in the server's cache */
+		freeReplyObject(reply);
+		reply = kvsal_eval(false, id, nkeys, keys,
+				   nargs, args, argslen);
+	}
+
+	if (!reply)
+		return -1;
+
+	switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+		res[0] = reply->integer;
+		*nres = 1;
+		break;
+
+	case REDIS_REPLY_ARRAY:
+		if (reply->elements < *nres)
+			*nres = reply->elements;
+
+		for (i = 0; i < *nres ; i++) {
+			if (reply->element[i]->type != REDIS_REPLY_INTEGER) {
+				freeReplyObject(reply);
+				return -1;
+			}
+			res[i] = reply->element[i]->integer;
+		}
+		break;
+
+	default:
+		freeReplyObject(reply);
+		return -1;
+	}
+
+	freeReplyObject(reply);
+	return 0;
+}
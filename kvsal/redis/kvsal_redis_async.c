@@ -0,0 +1,569 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsal_redis_async.c
+ * KVS Abstraction Layer: asynchronous interface for REDIS
+ */
+
+/* Requests from any thread are queued, then sent by a single event loop
+ * thread on its own asynchronous REDIS connection. Many requests can be in
+ * flight at once; each one completes through its callback, called from the
+ * event loop thread.
+ *
+ * The event loop is a plain poll() on the connection and on a pipe used to
+ * wake the loop up when requests are queued, hooked in hiredis through the
+ * ev.addRead/delRead/addWrite/delWrite adapter callbacks. */
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <kvsns/kvsal.h>
+#include "kvsal_redis.h"
+
+enum kvsal_async_type {
+	ASYNC_STATUS = 0,	/* no value expected */
+	ASYNC_STRING = 1,	/* NUL terminated string, at most VLEN */
+	ASYNC_STAT = 2,		/* struct stat */
+	ASYNC_SCORE = 3,	/* unsigned long long from a score */
+};
+
+struct kvsal_async_req {
+	enum kvsal_async_type type;
+	void *buf;
+	kvsal_callback_t cb;
+	void *arg;
+	int argc;
+	char **argv;
+	size_t *argvlen;
+	struct kvsal_async_req *next;
+};
+
+static struct kvsal_async_loop {
+	redisAsyncContext *ac;
+	bool reading;
+	bool writing;
+	bool running;		/* owned by the event loop thread */
+	bool stopped;		/* protected by lock */
+	int wakeup[2];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct kvsal_async_req *head;
+	struct kvsal_async_req *tail;
+} loop = {
+	.wakeup = { -1, -1 },
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void kvsal_ev_add_read(void *privdata)
+{
+	loop.reading = true;
+}
+
+static void kvsal_ev_del_read(void *privdata)
+{
+	loop.reading = false;
+}
+
+static void kvsal_ev_add_write(void *privdata)
+{
+	loop.writing = true;
+}
+
+static void kvsal_ev_del_write(void *privdata)
+{
+	loop.writing = false;
+}
+
+static void kvsal_ev_cleanup(void *privdata)
+{
+	loop.reading = false;
+	loop.writing = false;
+}
+
+static void kvsal_async_disconnected(const redisAsyncContext *ac, int status)
+{
+	/* hiredis frees the context after this callback */
+	loop.ac = NULL;
+}
+
+static int kvsal_async_connect(void)
+{
+	redisAsyncContext *ac;
+	char *hostname;
+	int port;
+
+	kvsal_redis_server(&hostname, &port);
+
+	ac = redisAsyncConnect(hostname, port);
+	if (!ac)
+		return -ENOMEM;
+
+	if (ac->err) {
+		redisAsyncFree(ac);
+		return -ECONNREFUSED;
+	}
+
+	ac->ev.addRead = kvsal_ev_add_read;
+	ac->ev.delRead = kvsal_ev_del_read;
+	ac->ev.addWrite = kvsal_ev_add_write;
+	ac->ev.delWrite = kvsal_ev_del_write;
+	ac->ev.cleanup = kvsal_ev_cleanup;
+	ac->ev.data = &loop;
+	redisAsyncSetDisconnectCallback(ac, kvsal_async_disconnected);
+
+	/* The connection is pending, its completion is notified as
+	 * the socket becomes writable */
+	loop.reading = true;
+	loop.writing = true;
+	loop.ac = ac;
+
+	return 0;
+}
+
+static int kvsal_async_reply(struct kvsal_async_req *req, redisReply *reply)
+{
+	if (!reply)
+		return -EIO;
+
+	if (reply->type == REDIS_REPLY_ERROR)
+		return -1;
+
+	switch (req->type) {
+	case ASYNC_STATUS:
+		return 0;
+
+	case ASYNC_STRING:
+		if (reply->type == REDIS_REPLY_NIL)
+			return -ENOENT;
+		if (reply->type != REDIS_REPLY_STRING)
+			return -1;
+		if (reply->len >= VLEN)
+			return -ENAMETOOLONG;
+		memcpy(req->buf, reply->str, reply->len);
+		((char *)req->buf)[reply->len] = '\0';
+		return 0;
+
+	case ASYNC_STAT:
+		if (reply->type == REDIS_REPLY_NIL)
+			return -ENOENT;
+		if (reply->type != REDIS_REPLY_STRING)
+			return -1;
+		return kvsal_record2stat(reply->str, reply->len, req->buf);
+
+	case ASYNC_SCORE:
+		if (reply->type == REDIS_REPLY_NIL)
+			return -ENOENT;
+		if (reply->type != REDIS_REPLY_STRING)
+			return -1;
+		*(unsigned long long *)req->buf = strtod(reply->str, NULL);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void kvsal_async_complete(struct kvsal_async_req *req, int rc)
+{
+	req->cb(rc, req->arg);
+	free(req);
+}
+
+static void kvsal_async_callback(redisAsyncContext *ac, void *r,
+				 void *privdata)
+{
+	struct kvsal_async_req *req = privdata;
+
+	kvsal_async_complete(req, kvsal_async_reply(req, r));
+}
+
+/* Sends the queued requests, fails them if there is no connection */
+static void kvsal_async_send(void)
+{
+	struct kvsal_async_req *req;
+	struct kvsal_async_req *next;
+	int rc = 0;
+
+	pthread_mutex_lock(&loop.lock);
+	req = loop.head;
+	loop.head = NULL;
+	loop.tail = NULL;
+	pthread_mutex_unlock(&loop.lock);
+
+	if (req && !loop.ac)
+		rc = kvsal_async_connect();
+
+	for (; req != NULL ; req = next) {
+		next = req->next;
+
+		if (rc != 0 || !loop.ac) {
+			kvsal_async_complete(req, rc ? rc : -EIO);
+			continue;
+		}
+
+		if (redisAsyncCommandArgv(loop.ac, kvsal_async_callback, req,
+					  req->argc,
+					  (const char **)req->argv,
+					  req->argvlen) != REDIS_OK)
+			kvsal_async_complete(req, -EIO);
+	}
+}
+
+static void *kvsal_async_thread(void *arg)
+{
+	struct pollfd fds[2];
+	char drain[64];
+	int nfds;
+	int len;
+	int i;
+
+	while (loop.running) {
+		fds[0].fd = loop.wakeup[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		nfds = 1;
+
+		if (loop.ac && (loop.reading || loop.writing)) {
+			fds[1].fd = loop.ac->c.fd;
+			fds[1].events = (loop.reading ? POLLIN : 0) |
+					(loop.writing ? POLLOUT : 0);
+			fds[1].revents = 0;
+			nfds = 2;
+		}
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (nfds == 2 && loop.ac) {
+			if (fds[1].revents & (POLLIN|POLLERR|POLLHUP))
+				redisAsyncHandleRead(loop.ac);
+			/* The context may be gone after a read error */
+			if (loop.ac && (fds[1].revents & POLLOUT))
+				redisAsyncHandleWrite(loop.ac);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			while ((len = read(loop.wakeup[0], drain,
+					   sizeof(drain))) > 0)
+				for (i = 0; i < len ; i++)
+					if (drain[i] == 'q')
+						loop.running = false;
+			kvsal_async_send();
+		}
+	}
+
+	if (loop.ac) {
+		/* Pending requests are completed with an error */
+		redisAsyncFree(loop.ac);
+		loop.ac = NULL;
+	}
+
+	/* Requests queued after the last wake up */
+	kvsal_async_send();
+
+	return NULL;
+}
+
+/* Starts the event loop thread, at the first request after kvsal_init or
+ * after a kvsal_async_fini. loop.lock is held */
+static int kvsal_async_start(void)
+{
+	if (pipe(loop.wakeup) != 0)
+		return -errno;
+
+	fcntl(loop.wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(loop.wakeup[1], F_SETFL, O_NONBLOCK);
+
+	loop.running = true;
+	if (pthread_create(&loop.thread, NULL, kvsal_async_thread, NULL)) {
+		close(loop.wakeup[0]);
+		close(loop.wakeup[1]);
+		loop.wakeup[0] = -1;
+		loop.wakeup[1] = -1;
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Stops the event loop, the next request starts it again */
+void kvsal_async_fini(void)
+{
+	bool started;
+
+	pthread_mutex_lock(&loop.lock);
+	started = (loop.wakeup[1] != -1 && !loop.stopped);
+	if (started) {
+		loop.stopped = true;
+		/* The pipe is never full for long, the loop drains it */
+		while (write(loop.wakeup[1], "q", 1) < 0 && errno == EAGAIN)
+			usleep(1000);
+	}
+	pthread_mutex_unlock(&loop.lock);
+
+	if (!started)
+		return;
+
+	pthread_join(loop.thread, NULL);
+
+	pthread_mutex_lock(&loop.lock);
+	close(loop.wakeup[0]);
+	close(loop.wakeup[1]);
+	loop.wakeup[0] = -1;
+	loop.wakeup[1] = -1;
+	loop.stopped = false;
+	pthread_mutex_unlock(&loop.lock);
+}
+
+/* Builds a request, with copies of the arguments, and queues it */
+static int kvsal_async_submit(enum kvsal_async_type type, void *buf,
+			      kvsal_callback_t cb, void *arg,
+			      int argc, const char **argv,
+			      const size_t *argvlen)
+{
+	struct kvsal_async_req *req;
+	size_t size;
+	char *data;
+	int rc;
+	int i;
+
+	if (!cb)
+		return -EINVAL;
+
+	size = sizeof(struct kvsal_async_req) +
+	       argc * (sizeof(char *) + sizeof(size_t));
+	for (i = 0; i < argc ; i++)
+		size += argvlen[i];
+
+	req = malloc(size);
+	if (!req)
+		return -ENOMEM;
+
+	req->type = type;
+	req->buf = buf;
+	req->cb = cb;
+	req->arg = arg;
+	req->argc = argc;
+	req->argv = (char **)(req + 1);
+	req->argvlen = (size_t *)(req->argv + argc);
+	req->next = NULL;
+
+	data = (char *)(req->argvlen + argc);
+	for (i = 0; i < argc ; i++) {
+		memcpy(data, argv[i], argvlen[i]);
+		req->argv[i] = data;
+		req->argvlen[i] = argvlen[i];
+		data += argvlen[i];
+	}
+
+	pthread_mutex_lock(&loop.lock);
+	rc = 0;
+	if (loop.stopped)
+		rc = -ESHUTDOWN;	/* kvsal_async_fini in progress */
+	else if (loop.wakeup[1] == -1)
+		rc = kvsal_async_start();
+	if (rc != 0) {
+		pthread_mutex_unlock(&loop.lock);
+		free(req);
+		return rc;
+	}
+
+	if (loop.tail)
+		loop.tail->next = req;
+	else
+		loop.head = req;
+	loop.tail = req;
+
+	/* A full pipe already means a pending wake up. The pipe is not
+	 * closed while the lock is held */
+	if (write(loop.wakeup[1], "w", 1) < 0 && errno != EAGAIN)
+		rc = -errno;
+	pthread_mutex_unlock(&loop.lock);
+
+	return rc;
+}
+
+static int kvsal_async_cmd(enum kvsal_async_type type, void *buf,
+			   kvsal_callback_t cb, void *arg, int argc,
+			   const char *cmd, char *a1, size_t l1,
+			   char *a2, size_t l2, char *a3, size_t l3)
+{
+	const char *argv[4] = { cmd, a1, a2, a3 };
+	size_t argvlen[4] = { strlen(cmd), l1, l2, l3 };
+
+	return kvsal_async_submit(type, buf, cb, arg, argc, argv, argvlen);
+}
+
+int kvsal_async_set_char(char *k, char *v, kvsal_callback_t cb, void *arg)
+{
+	if (!k || !v)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_STATUS, NULL, cb, arg, 3, "SET",
+			       k, strlen(k), v, strlen(v), NULL, 0);
+}
+
+int kvsal_async_get_char(char *k, char *v, kvsal_callback_t cb, void *arg)
+{
+	if (!k || !v)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_STRING, v, cb, arg, 2, "GET",
+			       k, strlen(k), NULL, 0, NULL, 0);
+}
+
+int kvsal_async_set_stat(char *k, struct stat *buf,
+			 kvsal_callback_t cb, void *arg)
+{
+	char record[KVSAL_RECORD_LEN];
+
+	if (!k || !buf)
+		return -EINVAL;
+
+	kvsal_stat2record(buf, record);
+
+	/* The record is copied in the request */
+	return kvsal_async_cmd(ASYNC_STATUS, NULL, cb, arg, 3, "SET",
+			       k, strlen(k), record, KVSAL_RECORD_LEN,
+			       NULL, 0);
+}
+
+int kvsal_async_get_stat(char *k, struct stat *buf,
+			 kvsal_callback_t cb, void *arg)
+{
+	if (!k || !buf)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_STAT, buf, cb, arg, 2, "GET",
+			       k, strlen(k), NULL, 0, NULL, 0);
+}
+
+int kvsal_async_del(char *k, kvsal_callback_t cb, void *arg)
+{
+	if (!k)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_STATUS, NULL, cb, arg, 2, "DEL",
+			       k, strlen(k), NULL, 0, NULL, 0);
+}
+
+int kvsal_async_add_entry(char *k, char *name, unsigned long long v,
+			  kvsal_callback_t cb, void *arg)
+{
+	char score[32];
+
+	if (!k || !name)
+		return -EINVAL;
+
+	snprintf(score, sizeof(score), "%llu", v);
+
+	return kvsal_async_cmd(ASYNC_STATUS, NULL, cb, arg, 4, "ZADD",
+			       k, strlen(k), score, strlen(score),
+			       name, strlen(name));
+}
+
+int kvsal_async_get_entry(char *k, char *name, unsigned long long *v,
+			  kvsal_callback_t cb, void *arg)
+{
+	if (!k || !name || !v)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_SCORE, v, cb, arg, 3, "ZSCORE",
+			       k, strlen(k), name, strlen(name), NULL, 0);
+}
+
+int kvsal_async_del_entry(char *k, char *name, kvsal_callback_t cb, void *arg)
+{
+	if (!k || !name)
+		return -EINVAL;
+
+	return kvsal_async_cmd(ASYNC_STATUS, NULL, cb, arg, 3, "ZREM",
+			       k, strlen(k), name, strlen(name), NULL, 0);
+}
+
+void kvsal_batch_init(kvsal_batch_t *batch)
+{
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+	batch->pending = 0;
+	batch->running = 0;
+	batch->rc = 0;
+}
+
+void kvsal_batch_add(kvsal_batch_t *batch)
+{
+	pthread_mutex_lock(&batch->lock);
+	batch->pending += 1;
+	pthread_mutex_unlock(&batch->lock);
+	__sync_fetch_and_add(&batch->running, 1);
+}
+
+void kvsal_batch_done(int rc, void *arg)
+{
+	kvsal_batch_t *batch = arg;
+
+	pthread_mutex_lock(&batch->lock);
+	if (rc != 0 && batch->rc == 0)
+		batch->rc = rc;
+	batch->pending -= 1;
+	if (batch->pending == 0)
+		pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->lock);
+
+	/* Last access to the batch, the waiter may destroy it after this */
+	__sync_fetch_and_sub(&batch->running, 1);
+}
+
+int kvsal_batch_wait(kvsal_batch_t *batch)
+{
+	int rc;
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->pending > 0)
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	rc = batch->rc;
+	pthread_mutex_unlock(&batch->lock);
+
+	/* The last callback may still be unlocking the mutex */
+	while (__sync_fetch_and_add(&batch->running, 0) > 0)
+		sched_yield();
+
+	pthread_mutex_destroy(&batch->lock);
+	pthread_cond_destroy(&batch->cond);
+
+	return rc;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <kvsns/kvsal.h>
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int i;
+	int howmany;
+	char k[KLEN];
+	char (*v)[VLEN];
+	kvsal_batch_t batch;
+
+	if (argc != 3) {
+		fprintf(stderr, "key_prefix how_many args\n");
+		exit(1);
+	}
+
+	howmany = atoi(argv[2]);
+	v = malloc(howmany * VLEN);
+	if (!v)
+		exit(1);
+
+	rc = kvsal_init(NULL);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_init: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	/* All the SET are in flight at once */
+	kvsal_batch_init(&batch);
+	for (i = 0; i < howmany; i++) {
+		snprintf(k, KLEN, "%s.%d", argv[1], i);
+		snprintf(v[i], VLEN, "%d", i);
+		kvsal_batch_add(&batch);
+		rc = kvsal_async_set_char(k, v[i], kvsal_batch_done, &batch);
+		if (rc != 0) {
+			kvsal_batch_done(rc, &batch);
+			break;
+		}
+	}
+	rc = kvsal_batch_wait(&batch);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_async_set_char: err=%d\n", rc);
+		exit(1);
+	}
+
+	kvsal_batch_init(&batch);
+	for (i = 0; i < howmany; i++) {
+		snprintf(k, KLEN, "%s.%d", argv[1], i);
+		v[i][0] = '\0';
+		kvsal_batch_add(&batch);
+		rc = kvsal_async_get_char(k, v[i], kvsal_batch_done, &batch);
+		if (rc != 0) {
+			kvsal_batch_done(rc, &batch);
+			break;
+		}
+	}
+	rc = kvsal_batch_wait(&batch);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_async_get_char: err=%d\n", rc);
+		exit(1);
+	}
+
+	for (i = 0; i < howmany; i++)
+		printf("==> %s.%d = %s\n", argv[1], i, v[i]);
+
+	kvsal_batch_init(&batch);
+	for (i = 0; i < howmany; i++) {
+		snprintf(k, KLEN, "%s.%d", argv[1], i);
+		kvsal_batch_add(&batch);
+		rc = kvsal_async_del(k, kvsal_batch_done, &batch);
+		if (rc != 0) {
+			kvsal_batch_done(rc, &batch);
+			break;
+		}
+	}
+	rc = kvsal_batch_wait(&batch);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_async_del: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsal_fini();
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fini: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	free(v);
+	printf("+++++++++++++++\n");
+
+	exit(0);
+	return 0;
+}
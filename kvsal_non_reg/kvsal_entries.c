@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <kvsns/kvsal.h>
+
+#define LIST_TRUNK 10
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int i;
+	int howmany;
+	int offset = 0;
+	int size = LIST_TRUNK;
+	char name[KLEN];
+	unsigned long long v;
+	kvsal_item_t items[LIST_TRUNK];
+	kvsal_list_t list;
+
+	if (argc != 3) {
+		fprintf(stderr, "key how_many args\n");
+		exit(1);
+	}
+
+	howmany = atoi(argv[2]);
+
+	rc = kvsal_init(NULL);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_init: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	for (i = 0; i < howmany; i++) {
+		snprintf(name, KLEN, "entry%d", i);
+		rc = kvsal_add_entry(argv[1], name, 1000 + i);
+		if (rc != 0) {
+			fprintf(stderr, "kvsal_add_entry: err=%d\n", rc);
+			exit(-rc);
+		}
+	}
+
+	rc = kvsal_count_entries(argv[1]);
+	if (rc != howmany) {
+		fprintf(stderr, "kvsal_count_entries: %d != %d\n",
+			rc, howmany);
+		exit(1);
+	}
+
+	rc = kvsal_get_entry(argv[1], "entry0", &v);
+	if (rc != 0 || v != 1000) {
+		fprintf(stderr, "kvsal_get_entry: err=%d v=%llu\n", rc, v);
+		exit(1);
+	}
+
+	rc = kvsal_fetch_entries(argv[1], &list);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fetch_entries: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	do {
+		size = LIST_TRUNK;
+		rc = kvsal_get_list(&list, offset, &size, items);
+		if (rc < 0) {
+			fprintf(stderr, "kvsal_get_list: err=%d\n", rc);
+			exit(-rc);
+		}
+		for (i = 0; i < size ; i++)
+			printf("==> %d %s = %llu\n", offset+i,
+			       items[i].str, items[i].value);
+
+		offset += size;
+	} while (size > 0);
+
+	rc = kvsal_dispose_list(&list);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_dispose_list: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	for (i = 0; i < howmany; i++) {
+		snprintf(name, KLEN, "entry%d", i);
+		rc = kvsal_del_entry(argv[1], name);
+		if (rc != 0) {
+			fprintf(stderr, "kvsal_del_entry: err=%d\n", rc);
+			exit(-rc);
+		}
+	}
+
+	rc = kvsal_get_entry(argv[1], "entry0", &v);
+	if (rc != -ENOENT) {
+		fprintf(stderr, "kvsal_get_entry after del: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsal_fini();
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fini: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	printf("+++++++++++++++\n");
+
+	exit(0);
+	return 0;
+}
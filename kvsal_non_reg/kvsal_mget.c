@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <kvsns/kvsal.h>
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int i;
+	int nb;
+	char (*keys)[KLEN];
+	char (*vals)[VLEN];
+	int *rcs;
+
+	if (argc < 2) {
+		fprintf(stderr, "key1 [key2 ...] args\n");
+		exit(1);
+	}
+
+	nb = argc - 1;
+	keys = malloc(nb * sizeof(*keys));
+	vals = malloc(nb * sizeof(*vals));
+	rcs = malloc(nb * sizeof(int));
+	if (!keys || !vals || !rcs) {
+		fprintf(stderr, "malloc failed\n");
+		exit(1);
+	}
+
+	rc = kvsal_init(NULL);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_init: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	for (i = 0; i < nb ; i++)
+		strncpy(keys[i], argv[i+1], KLEN);
+
+	rc = kvsal_mget_char(nb, keys, vals, rcs);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_mget_char: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	for (i = 0; i < nb ; i++)
+		if (rcs[i] == 0)
+			printf("key=%s val=%s\n", keys[i], vals[i]);
+		else
+			printf("key=%s err=%d\n", keys[i], rcs[i]);
+
+	rc = kvsal_fini();
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fini: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	free(keys);
+	free(vals);
+	free(rcs);
+
+	printf("+++++++++++++++\n");
+	exit(0);
+	return 0;
+}
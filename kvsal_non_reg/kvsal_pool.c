@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <kvsns/kvsal.h>
+
+#define NB_ROUNDS 4
+
+static int howmany;
+
+static void *worker(void *arg)
+{
+	char k[KLEN];
+	char v[VLEN];
+	long i = (long)arg;
+	int rc;
+
+	snprintf(k, KLEN, "kvsal_pool.%ld", i);
+	snprintf(v, VLEN, "%ld", i);
+
+	rc = kvsal_set_char(k, v);
+	if (rc == 0)
+		rc = kvsal_get_char(k, v);
+	if (rc == 0)
+		rc = kvsal_del(k);
+
+	return (void *)(long)rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int round;
+	long i;
+	void *res;
+	pthread_t *threads;
+	kvsal_pool_stats_t stats;
+
+	if (argc != 2) {
+		fprintf(stderr, "how_many_threads\n");
+		exit(1);
+	}
+
+	howmany = atoi(argv[1]);
+	threads = malloc(howmany * sizeof(pthread_t));
+	if (!threads)
+		exit(1);
+
+	rc = kvsal_init(NULL);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_init: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	/* Threads come and go, the connections should be reused */
+	for (round = 0; round < NB_ROUNDS; round++) {
+		for (i = 0; i < howmany; i++)
+			pthread_create(&threads[i], NULL, worker, (void *)i);
+
+		for (i = 0; i < howmany; i++) {
+			pthread_join(threads[i], &res);
+			if (res != NULL) {
+				fprintf(stderr, "worker %ld: err=%ld\n",
+					i, (long)res);
+				exit(1);
+			}
+		}
+	}
+
+	rc = kvsal_get_pool_stats(&stats);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_get_pool_stats: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	printf("connections=%llu idle=%llu in_use=%llu created=%llu\n",
+	       stats.connections, stats.idle, stats.in_use, stats.created);
+	printf("reused=%llu reconnects=%llu failures=%llu waits=%llu\n",
+	       stats.reused, stats.reconnects, stats.failures, stats.waits);
+
+	if (stats.created > howmany + 1) {
+		fprintf(stderr, "connections were not reused\n");
+		exit(1);
+	}
+
+	rc = kvsal_fini();
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fini: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	free(threads);
+	printf("+++++++++++++++\n");
+
+	exit(0);
+	return 0;
+}
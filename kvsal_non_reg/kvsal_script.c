@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <kvsns/kvsal.h>
+
+/* Increments a counter and returns {0, new value}, or {-EEXIST} if the
+ * key given as second argument exists */
+static char *script =
+	"if redis.call('EXISTS', KEYS[2]) == 1 then return {-17} end\n"
+	"return {0, redis.call('INCRBY', KEYS[1], ARGV[1])}\n";
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int id;
+	int nres;
+	long long res[2];
+	char *keys[2];
+	char *args[1];
+
+	if (argc != 3) {
+		fprintf(stderr, "counter_key guard_key\n");
+		exit(1);
+	}
+
+	rc = kvsal_init(NULL);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_init: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	rc = kvsal_load_script(script, &id);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_load_script: err=%d\n", rc);
+		exit(1);
+	}
+
+	keys[0] = argv[1];
+	keys[1] = argv[2];
+	args[0] = "3";
+
+	kvsal_del(argv[1]);
+	kvsal_del(argv[2]);
+
+	nres = 2;
+	rc = kvsal_exec_script(id, 2, keys, 1, args, NULL, res, &nres);
+	if (rc != 0 || nres != 2 || res[0] != 0 || res[1] != 3) {
+		fprintf(stderr, "kvsal_exec_script: err=%d nres=%d\n",
+			rc, nres);
+		exit(1);
+	}
+
+	rc = kvsal_set_char(argv[2], "1");
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_set_char: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	nres = 2;
+	rc = kvsal_exec_script(id, 2, keys, 1, args, NULL, res, &nres);
+	if (rc != 0 || nres != 1 || res[0] != -EEXIST) {
+		fprintf(stderr, "kvsal_exec_script guarded: err=%d res=%lld\n",
+			rc, res[0]);
+		exit(1);
+	}
+
+	kvsal_del(argv[1]);
+	kvsal_del(argv[2]);
+
+	rc = kvsal_fini();
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_fini: err=%d\n", rc);
+		exit(-rc);
+	}
+
+	printf("+++++++++++++++\n");
+
+	exit(0);
+	return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_atime.c
+ * KVSNS: access time policies
+ *
+ * The "atime" key of the [kvsns] section tells when listing a directory
+ * or reading a symlink updates its atime:
+ *	strict   : at every access
+ *	relatime : when the atime is not after the mtime or the ctime, or is
+ *		   more than a day old
+ *	noatime  : never
+ *	lazytime : at every access, kept in memory and written for all the
+ *		   inodes at once every atime_flush_interval seconds
+ * Updates are written by a server side script that only moves an atime
+ * forward, one call for a whole batch. The atime of the data of the files
+ * is kept by the extstore, which is given the same policy.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <ini_config.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include <kvsns/extstore.h>
+#include "kvsns_internal.h"
+
+#define ATIME_RELATIME_DELAY 86400	/* seconds */
+#define ATIME_FLUSH_INTERVAL 60		/* seconds */
+#define ATIME_FLUSH_BATCH 256		/* inodes per script call */
+#define ATIME_PENDING_MAX 4096		/* flushed before the interval */
+#define ATIME_BUCKETS 1024
+
+/* An atime not written yet (lazytime) */
+struct atime_entry {
+	kvsns_ino_t ino;
+	struct timespec atime;
+	struct atime_entry *next;
+};
+
+static struct {
+	kvsns_atime_policy_t policy;
+	unsigned int interval;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t flusher;
+	unsigned int users;		/* kvsns_start not yet stopped */
+	bool running;
+	bool stop;
+	struct atime_entry *buckets[ATIME_BUCKETS];
+	unsigned int pending;
+} atimes = {
+	.policy = KVSNS_ATIME_STRICT,
+	.interval = ATIME_FLUSH_INTERVAL,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int atime_now(struct timespec *now)
+{
+	struct timeval t;
+
+	if (gettimeofday(&t, NULL) != 0)
+		return -errno;
+
+	now->tv_sec = t.tv_sec;
+	now->tv_nsec = 1000 * t.tv_usec;
+
+	return 0;
+}
+
+static bool atime_after(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec > b->tv_sec;
+
+	return a->tv_nsec > b->tv_nsec;
+}
+
+static bool atime_relatime(struct stat *stat, struct timespec *now)
+{
+	if (!atime_after(&stat->st_atim, &stat->st_mtim) ||
+	    !atime_after(&stat->st_atim, &stat->st_ctim))
+		return true;
+
+	return now->tv_sec - stat->st_atim.tv_sec >= ATIME_RELATIME_DELAY;
+}
+
+static struct atime_entry **atime_lookup(kvsns_ino_t ino)
+{
+	struct atime_entry **slot;
+
+	slot = &atimes.buckets[ino % ATIME_BUCKETS];
+	while (*slot && (*slot)->ino != ino)
+		slot = &(*slot)->next;
+
+	return slot;
+}
+
+static int atime_defer(kvsns_ino_t ino, struct timespec *atime)
+{
+	struct atime_entry **slot;
+	struct atime_entry *e;
+
+	pthread_mutex_lock(&atimes.lock);
+	slot = atime_lookup(ino);
+	e = *slot;
+	if (!e) {
+		e = malloc(sizeof(struct atime_entry));
+		if (!e) {
+			pthread_mutex_unlock(&atimes.lock);
+			return -ENOMEM;
+		}
+		e->ino = ino;
+		e->atime = *atime;
+		e->next = NULL;
+		*slot = e;
+		atimes.pending += 1;
+		if (atimes.pending == ATIME_PENDING_MAX)
+			pthread_cond_signal(&atimes.cond);
+	} else if (atime_after(atime, &e->atime)) {
+		e->atime = *atime;
+	}
+	pthread_mutex_unlock(&atimes.lock);
+
+	return 0;
+}
+
+/* Writes nb atimes in one call and keeps the cached attributes in line */
+static int atime_write(int nb, kvsns_ino_t *inos, struct timespec *atime)
+{
+	struct stat stat;
+	int updated;
+	int i;
+
+	RC_WRAP(kvsns_script_atime, nb, inos, atime, &updated);
+
+	for (i = 0; i < nb ; i++) {
+		if (kvsns_stat_cache_get(&inos[i], &stat) != 0)
+			continue;
+
+		if (atime_after(&atime[i], &stat.st_atim)) {
+			stat.st_atim = atime[i];
+			kvsns_stat_cache_set(&inos[i], &stat);
+		}
+	}
+
+	return 0;
+}
+
+int kvsns_atime_update(kvsns_ino_t *ino)
+{
+	struct timespec now;
+	struct stat stat;
+
+	if (!ino)
+		return -EINVAL;
+
+	if (atimes.policy == KVSNS_ATIME_NOATIME)
+		return 0;
+
+	RC_WRAP(atime_now, &now);
+
+	switch (atimes.policy) {
+	case KVSNS_ATIME_LAZYTIME:
+		return atime_defer(*ino, &now);
+
+	case KVSNS_ATIME_RELATIME:
+		/* The cached attributes are enough to tell, the script
+		 * does not go back in time anyway */
+		RC_WRAP(kvsns_get_stat_cached, ino, &stat);
+		if (!atime_relatime(&stat, &now))
+			return 0;
+		break;
+
+	default:
+		break;
+	}
+
+	return atime_write(1, ino, &now);
+}
+
+int kvsns_atime_flush(void)
+{
+	kvsns_ino_t inos[ATIME_FLUSH_BATCH];
+	struct timespec atime[ATIME_FLUSH_BATCH];
+	struct atime_entry *list = NULL;
+	struct atime_entry *e;
+	int rc = 0;
+	int nb;
+	int i;
+
+	/* The pending atimes are taken at once, accesses done during the
+	 * flush are for the next one */
+	pthread_mutex_lock(&atimes.lock);
+	for (i = 0; i < ATIME_BUCKETS ; i++) {
+		while (atimes.buckets[i]) {
+			e = atimes.buckets[i];
+			atimes.buckets[i] = e->next;
+			e->next = list;
+			list = e;
+		}
+	}
+	atimes.pending = 0;
+	pthread_mutex_unlock(&atimes.lock);
+
+	while (list) {
+		nb = 0;
+		for (e = list; e && nb < ATIME_FLUSH_BATCH ; e = e->next) {
+			inos[nb] = e->ino;
+			atime[nb] = e->atime;
+			nb += 1;
+		}
+
+		/* Kept for the next flush if the KVS failed */
+		if (rc == 0)
+			rc = atime_write(nb, inos, atime);
+		if (rc != 0)
+			for (i = 0; i < nb ; i++)
+				atime_defer(inos[i], &atime[i]);
+
+		for (i = 0; i < nb ; i++) {
+			e = list;
+			list = e->next;
+			free(e);
+		}
+	}
+
+	return rc;
+}
+
+static void *atime_flusher(void *arg)
+{
+	struct timespec deadline;
+	int rc;
+
+	pthread_mutex_lock(&atimes.lock);
+	while (!atimes.stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += atimes.interval;
+
+		rc = 0;
+		while (!atimes.stop && atimes.pending < ATIME_PENDING_MAX &&
+		       rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&atimes.cond, &atimes.lock,
+						    &deadline);
+		pthread_mutex_unlock(&atimes.lock);
+
+		/* Failed entries are deferred again and retried, the last
+		 * kvsns_atime_fini returns the error */
+		kvsns_atime_flush();
+
+		pthread_mutex_lock(&atimes.lock);
+	}
+	pthread_mutex_unlock(&atimes.lock);
+
+	return NULL;
+}
+
+void kvsns_atime_getattr(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	struct atime_entry *e;
+
+	if (atimes.policy != KVSNS_ATIME_LAZYTIME)
+		return;
+
+	pthread_mutex_lock(&atimes.lock);
+	e = *atime_lookup(*ino);
+	if (e && atime_after(&e->atime, &bufstat->st_atim))
+		bufstat->st_atim = e->atime;
+	pthread_mutex_unlock(&atimes.lock);
+}
+
+void kvsns_atime_forget(kvsns_ino_t *ino)
+{
+	struct atime_entry **slot;
+	struct atime_entry *e;
+
+	if (atimes.policy != KVSNS_ATIME_LAZYTIME)
+		return;
+
+	pthread_mutex_lock(&atimes.lock);
+	slot = atime_lookup(*ino);
+	e = *slot;
+	if (e) {
+		*slot = e->next;
+		atimes.pending -= 1;
+		free(e);
+	}
+	pthread_mutex_unlock(&atimes.lock);
+}
+
+int kvsns_atime_init(struct collection_item *cfg_items)
+{
+	struct collection_item *item;
+	kvsns_atime_policy_t policy = KVSNS_ATIME_STRICT;
+	unsigned int interval = ATIME_FLUSH_INTERVAL;
+	const char *str;
+	int rc = 0;
+
+	pthread_mutex_lock(&atimes.lock);
+
+	/* kvsns_start is done by every thread, the first one reads the
+	 * policy and starts the flusher */
+	if (atimes.users > 0)
+		goto out;
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "atime", cfg_items,
+		      &item);
+	if (item != NULL) {
+		str = get_const_string_config_value(item, NULL);
+		if (!str)
+			rc = -EINVAL;
+		else if (!strcmp(str, "strict"))
+			policy = KVSNS_ATIME_STRICT;
+		else if (!strcmp(str, "relatime"))
+			policy = KVSNS_ATIME_RELATIME;
+		else if (!strcmp(str, "noatime"))
+			policy = KVSNS_ATIME_NOATIME;
+		else if (!strcmp(str, "lazytime"))
+			policy = KVSNS_ATIME_LAZYTIME;
+		else
+			rc = -EINVAL;
+		if (rc != 0)
+			goto out;
+	}
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns",
+		      "atime_flush_interval", cfg_items, &item);
+	if (item != NULL)
+		interval = get_unsigned_config_value(item, 0, 0, NULL);
+	if (interval == 0)
+		interval = ATIME_FLUSH_INTERVAL;
+
+	atimes.policy = policy;
+	atimes.interval = interval;
+	extstore_set_atime_policy(policy);
+
+	if (policy == KVSNS_ATIME_LAZYTIME) {
+		atimes.stop = false;
+		rc = pthread_create(&atimes.flusher, NULL, atime_flusher,
+				    NULL);
+		if (rc != 0) {
+			rc = -rc;
+			goto out;
+		}
+		atimes.running = true;
+	}
+
+out:
+	if (rc == 0)
+		atimes.users += 1;
+	pthread_mutex_unlock(&atimes.lock);
+	return rc;
+}
+
+/* The last kvsns_stop stops the flusher and writes what is left */
+int kvsns_atime_fini(void)
+{
+	pthread_t flusher;
+	bool last;
+
+	pthread_mutex_lock(&atimes.lock);
+	if (atimes.users > 0)
+		atimes.users -= 1;
+	last = (atimes.users == 0 && atimes.running);
+	if (last) {
+		flusher = atimes.flusher;
+		atimes.running = false;
+		atimes.stop = true;
+		pthread_cond_signal(&atimes.cond);
+	}
+	pthread_mutex_unlock(&atimes.lock);
+
+	if (!last)
+		return 0;
+
+	pthread_join(flusher, NULL);
+
+	return kvsns_atime_flush();
+}
@@ -0,0 +1,561 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_cache.c
+ * KVSNS: in-process caches of inode attributes and directory entries
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <ini_config.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include "kvsns_internal.h"
+
+/* A cache is split in shards, each one with its own lock, hash table
+ * and LRU list. Entries are preallocated so that memory is bounded by
+ * the configured size. The same structure is used for the attributes
+ * cache (key is an inode) and the dentry cache (key is a parent inode
+ * plus a name, value is an inode or 0 for a negative entry). */
+#define KVSNS_CACHE_SHARDS 16
+
+struct cache_entry {
+	kvsns_ino_t ino;		/* inode, or parent for a dentry */
+	char *name;			/* NULL in the attributes cache */
+	unsigned int hash;
+	union {
+		struct stat stat;
+		kvsns_ino_t ino;
+	} value;
+	struct timespec expire;
+	struct cache_entry *hnext;	/* hash chain */
+	struct cache_entry *prev;	/* LRU list, head is MRU */
+	struct cache_entry *next;
+};
+
+struct cache_shard {
+	pthread_mutex_t lock;
+	struct cache_entry **buckets;
+	unsigned int nbuckets;
+	struct cache_entry *pool;
+	char *names;
+	struct cache_entry *free;
+	struct cache_entry *head;
+	struct cache_entry *tail;
+	unsigned long long hits;
+	unsigned long long neg_hits;
+	unsigned long long misses;
+};
+
+struct kvsns_cache {
+	struct cache_shard shards[KVSNS_CACHE_SHARDS];
+	unsigned int ttl;
+	bool enabled;
+};
+
+static struct kvsns_cache stat_cache;
+static struct kvsns_cache dentry_cache;
+
+/* kvsns_start is done by every thread: the first one sets the caches up,
+ * the last kvsns_stop tears them down */
+static unsigned int cache_users;
+static pthread_mutex_t cache_users_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned int cache_hash(kvsns_ino_t ino, char *name)
+{
+	/* Fibonacci hashing spreads consecutive inodes, then FNV-1a */
+	unsigned int h = (unsigned int)((ino * 11400714819323198485ULL) >> 32);
+
+	if (name)
+		for (; *name; name++)
+			h = (h ^ (unsigned char)*name) * 16777619;
+
+	return h;
+}
+
+static inline struct cache_shard *cache_shard(struct kvsns_cache *cache,
+					      unsigned int hash)
+{
+	return &cache->shards[hash % KVSNS_CACHE_SHARDS];
+}
+
+static void cache_expire_time(struct timespec *ts, unsigned int ttl)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ttl;
+}
+
+static bool cache_expired(struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != ts->tv_sec)
+		return now.tv_sec > ts->tv_sec;
+
+	return now.tv_nsec > ts->tv_nsec;
+}
+
+static void lru_unlink(struct cache_shard *shard, struct cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		shard->head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		shard->tail = e->prev;
+
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+static void lru_push_head(struct cache_shard *shard, struct cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = shard->head;
+	if (shard->head)
+		shard->head->prev = e;
+	shard->head = e;
+	if (!shard->tail)
+		shard->tail = e;
+}
+
+static struct cache_entry **hash_slot(struct cache_shard *shard,
+				      unsigned int hash,
+				      kvsns_ino_t ino, char *name)
+{
+	struct cache_entry **slot;
+
+	/* The low bits chose the shard, all the entries of a shard share
+	 * them: the bucket comes from the next ones */
+	slot = &shard->buckets[(hash / KVSNS_CACHE_SHARDS) &
+			       (shard->nbuckets - 1)];
+	while (*slot) {
+		if ((*slot)->ino == ino &&
+		    (!name || !strcmp((*slot)->name, name)))
+			break;
+		slot = &(*slot)->hnext;
+	}
+
+	return slot;
+}
+
+static void shard_remove(struct cache_shard *shard, struct cache_entry **slot)
+{
+	struct cache_entry *e = *slot;
+
+	*slot = e->hnext;
+	lru_unlink(shard, e);
+	e->hnext = shard->free;
+	shard->free = e;
+}
+
+static void shard_evict(struct cache_shard *shard, struct cache_entry *e)
+{
+	shard_remove(shard, hash_slot(shard, e->hash, e->ino, e->name));
+}
+
+static void cache_teardown(struct kvsns_cache *cache)
+{
+	int i;
+
+	cache->enabled = false;
+	for (i = 0; i < KVSNS_CACHE_SHARDS; i++) {
+		if (cache->shards[i].pool)
+			pthread_mutex_destroy(&cache->shards[i].lock);
+		free(cache->shards[i].buckets);
+		free(cache->shards[i].pool);
+		free(cache->shards[i].names);
+		memset(&cache->shards[i], 0, sizeof(cache->shards[i]));
+	}
+}
+
+static int cache_setup(struct kvsns_cache *cache, unsigned int size,
+		       unsigned int ttl, bool with_names)
+{
+	unsigned int per_shard;
+	unsigned int nbuckets;
+	int i, j;
+
+	memset(cache, 0, sizeof(*cache));
+
+	/* No size or no TTL means no cache */
+	if (size == 0 || ttl == 0)
+		return 0;
+
+	per_shard = (size + KVSNS_CACHE_SHARDS - 1) / KVSNS_CACHE_SHARDS;
+	for (nbuckets = 1; nbuckets < per_shard; nbuckets <<= 1)
+		;
+
+	for (i = 0; i < KVSNS_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+
+		shard->nbuckets = nbuckets;
+		shard->buckets = calloc(nbuckets, sizeof(*shard->buckets));
+		shard->pool = calloc(per_shard, sizeof(*shard->pool));
+		if (with_names)
+			shard->names = calloc(per_shard, NAME_MAX + 1);
+		if (!shard->buckets || !shard->pool ||
+		    (with_names && !shard->names)) {
+			cache_teardown(cache);
+			return -ENOMEM;
+		}
+
+		pthread_mutex_init(&shard->lock, NULL);
+		for (j = 0; j < per_shard; j++) {
+			if (with_names)
+				shard->pool[j].name =
+					&shard->names[j * (NAME_MAX + 1)];
+			shard->pool[j].hnext = shard->free;
+			shard->free = &shard->pool[j];
+		}
+	}
+
+	cache->ttl = ttl;
+	cache->enabled = true;
+	return 0;
+}
+
+/* Returns the entry for the key, NULL on miss. Shard's lock is held */
+static struct cache_entry *cache_get(struct kvsns_cache *cache,
+				     struct cache_shard *shard,
+				     unsigned int hash,
+				     kvsns_ino_t ino, char *name)
+{
+	struct cache_entry **slot;
+	struct cache_entry *e;
+
+	slot = hash_slot(shard, hash, ino, name);
+	e = *slot;
+	if (e && cache_expired(&e->expire)) {
+		shard_remove(shard, slot);
+		e = NULL;
+	}
+
+	if (!e) {
+		shard->misses += 1;
+		return NULL;
+	}
+
+	lru_unlink(shard, e);
+	lru_push_head(shard, e);
+	return e;
+}
+
+/* Returns the entry to be filled for the key. Shard's lock is held */
+static struct cache_entry *cache_put(struct kvsns_cache *cache,
+				     struct cache_shard *shard,
+				     unsigned int hash,
+				     kvsns_ino_t ino, char *name)
+{
+	struct cache_entry **slot;
+	struct cache_entry *e;
+
+	slot = hash_slot(shard, hash, ino, name);
+	e = *slot;
+	if (e) {
+		lru_unlink(shard, e);
+	} else {
+		if (!shard->free) { /* Evict the least recently used */
+			shard_evict(shard, shard->tail);
+			slot = hash_slot(shard, hash, ino, name);
+		}
+
+		e = shard->free;
+		shard->free = e->hnext;
+		e->ino = ino;
+		e->hash = hash;
+		if (name)
+			strncpy(e->name, name, NAME_MAX);
+		e->hnext = *slot;
+		*slot = e;
+	}
+
+	cache_expire_time(&e->expire, cache->ttl);
+	lru_push_head(shard, e);
+	return e;
+}
+
+static void cache_del(struct kvsns_cache *cache, kvsns_ino_t ino, char *name)
+{
+	struct cache_shard *shard;
+	struct cache_entry **slot;
+	unsigned int hash;
+
+	if (!cache->enabled)
+		return;
+
+	hash = cache_hash(ino, name);
+	shard = cache_shard(cache, hash);
+	pthread_mutex_lock(&shard->lock);
+
+	slot = hash_slot(shard, hash, ino, name);
+	if (*slot)
+		shard_remove(shard, slot);
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void cache_flush(struct kvsns_cache *cache)
+{
+	int i;
+
+	if (!cache->enabled)
+		return;
+
+	for (i = 0; i < KVSNS_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		while (shard->head)
+			shard_evict(shard, shard->head);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+static void cache_counters(struct kvsns_cache *cache,
+			   unsigned long long *hits,
+			   unsigned long long *neg_hits,
+			   unsigned long long *misses)
+{
+	int i;
+
+	*hits = 0;
+	*misses = 0;
+	if (neg_hits)
+		*neg_hits = 0;
+
+	if (!cache->enabled)
+		return;
+
+	for (i = 0; i < KVSNS_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		*hits += shard->hits;
+		*misses += shard->misses;
+		if (neg_hits)
+			*neg_hits += shard->neg_hits;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+static int cache_config(struct collection_item *cfg_items, char *size_key,
+			char *ttl_key, unsigned int *size, unsigned int *ttl)
+{
+	struct collection_item *item;
+
+	*size = 0;
+	*ttl = 0;
+
+	item = NULL;
+	RC_WRAP(get_config_item, "kvsns", size_key, cfg_items, &item);
+	if (item != NULL)
+		*size = get_unsigned_config_value(item, 0, 0, NULL);
+
+	item = NULL;
+	RC_WRAP(get_config_item, "kvsns", ttl_key, cfg_items, &item);
+	if (item != NULL)
+		*ttl = get_unsigned_config_value(item, 0, 0, NULL);
+
+	return 0;
+}
+
+int kvsns_cache_init(struct collection_item *cfg_items)
+{
+	unsigned int size;
+	unsigned int ttl;
+	int rc = 0;
+
+	pthread_mutex_lock(&cache_users_lock);
+	if (cache_users > 0)
+		goto out;
+
+	RC_WRAP_LABEL(rc, out, cache_config, cfg_items, "stat_cache_size",
+		      "stat_cache_ttl", &size, &ttl);
+	RC_WRAP_LABEL(rc, out, cache_setup, &stat_cache, size, ttl, false);
+
+	RC_WRAP_LABEL(rc, err, cache_config, cfg_items, "dentry_cache_size",
+		      "dentry_cache_ttl", &size, &ttl);
+	RC_WRAP_LABEL(rc, err, cache_setup, &dentry_cache, size, ttl, true);
+	goto out;
+
+err:
+	cache_teardown(&stat_cache);
+out:
+	if (rc == 0)
+		cache_users += 1;
+	pthread_mutex_unlock(&cache_users_lock);
+	return rc;
+}
+
+int kvsns_cache_fini(void)
+{
+	pthread_mutex_lock(&cache_users_lock);
+	if (cache_users > 0 && --cache_users == 0) {
+		cache_teardown(&stat_cache);
+		cache_teardown(&dentry_cache);
+	}
+	pthread_mutex_unlock(&cache_users_lock);
+
+	return 0;
+}
+
+void kvsns_cache_flush(void)
+{
+	cache_flush(&stat_cache);
+	cache_flush(&dentry_cache);
+}
+
+int kvsns_stat_cache_get(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	struct cache_shard *shard;
+	struct cache_entry *e;
+	unsigned int hash;
+
+	if (!stat_cache.enabled)
+		return -ENOENT;
+
+	hash = cache_hash(*ino, NULL);
+	shard = cache_shard(&stat_cache, hash);
+	pthread_mutex_lock(&shard->lock);
+
+	e = cache_get(&stat_cache, shard, hash, *ino, NULL);
+	if (e) {
+		memcpy(bufstat, &e->value.stat, sizeof(struct stat));
+		shard->hits += 1;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+	return e ? 0 : -ENOENT;
+}
+
+void kvsns_stat_cache_set(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	struct cache_shard *shard;
+	struct cache_entry *e;
+	unsigned int hash;
+
+	if (!stat_cache.enabled)
+		return;
+
+	hash = cache_hash(*ino, NULL);
+	shard = cache_shard(&stat_cache, hash);
+	pthread_mutex_lock(&shard->lock);
+
+	e = cache_put(&stat_cache, shard, hash, *ino, NULL);
+	memcpy(&e->value.stat, bufstat, sizeof(struct stat));
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void kvsns_stat_cache_del(kvsns_ino_t *ino)
+{
+	cache_del(&stat_cache, *ino, NULL);
+}
+
+/* Returns 0 and sets ino if found, -ENOENT for a cached negative entry
+ * and -EAGAIN if the dentry is not in cache */
+int kvsns_dentry_cache_get(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino)
+{
+	struct cache_shard *shard;
+	struct cache_entry *e;
+	unsigned int hash;
+	int rc = -EAGAIN;
+
+	if (!dentry_cache.enabled || strlen(name) > NAME_MAX)
+		return -EAGAIN;
+
+	hash = cache_hash(*parent, name);
+	shard = cache_shard(&dentry_cache, hash);
+	pthread_mutex_lock(&shard->lock);
+
+	e = cache_get(&dentry_cache, shard, hash, *parent, name);
+	if (e) {
+		if (e->value.ino == 0LL) {
+			shard->neg_hits += 1;
+			rc = -ENOENT;
+		} else {
+			shard->hits += 1;
+			*ino = e->value.ino;
+			rc = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+	return rc;
+}
+
+/* ino == NULL records a negative entry */
+void kvsns_dentry_cache_set(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino)
+{
+	struct cache_shard *shard;
+	struct cache_entry *e;
+	unsigned int hash;
+
+	if (!dentry_cache.enabled || strlen(name) > NAME_MAX)
+		return;
+
+	hash = cache_hash(*parent, name);
+	shard = cache_shard(&dentry_cache, hash);
+	pthread_mutex_lock(&shard->lock);
+
+	e = cache_put(&dentry_cache, shard, hash, *parent, name);
+	e->value.ino = ino ? *ino : 0LL;
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void kvsns_dentry_cache_del(kvsns_ino_t *parent, char *name)
+{
+	if (strlen(name) > NAME_MAX)
+		return;
+
+	cache_del(&dentry_cache, *parent, name);
+}
+
+int kvsns_get_cache_stats(kvsns_cache_stats_t *stats)
+{
+	if (!stats)
+		return -EINVAL;
+
+	cache_counters(&stat_cache, &stats->stat_hits, NULL,
+		       &stats->stat_misses);
+	cache_counters(&dentry_cache, &stats->dentry_hits,
+		       &stats->dentry_negative_hits, &stats->dentry_misses);
+	kvsns_page_cache_counters(stats);
+
+	return 0;
+}
@@ -36,104 +36,488 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <kvsns/kvsal.h>
 #include <kvsns/kvsns.h>
 #include <kvsns/extstore.h>
 #include "kvsns_internal.h"
 
-#define BUFFSIZE 40960
+/* Chunks in flight per worker on the buffered path */
+#define KVSNS_CP_DEPTH 4
 
-int kvsns_cp_from(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
-		  int fd_dest, int iolen)
-{
+/* Size of a single in-kernel copy request */
+#define KVSNS_CP_KERNEL_CHUNK (1024LL * 1024 * 1024)
+
+struct cp_window;
+
+struct cp_chunk {
+	struct cp_window *win;
+	char *buff;
 	off_t off;
+	size_t len;		/* 0 if the chunk is free */
+	ssize_t rc;
+	bool inflight;
+};
+
+struct cp_window {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int depth;
+	struct cp_chunk *chunks;
+};
+
+/* The file is cut in stripes of chunk_size bytes, each worker takes the
+ * next stripe to be copied until there is none left */
+struct cp_job {
+	kvsns_file_open_t *kfd;
+	int fd;
+	bool to_kvsns;
+	off_t filesize;
+	kvsns_cp_params_t params;
+	unsigned long long next;
+	unsigned long long nstripes;
+	int rc;			/* first error met by a worker */
+};
+
+static void cp_window_fini(struct cp_window *win)
+{
+	int i;
+
+	for (i = 0; i < win->depth; i++)
+		extstore_buffer_free(win->chunks[i].buff);
+
+	free(win->chunks);
+	pthread_cond_destroy(&win->cond);
+	pthread_mutex_destroy(&win->lock);
+}
+
+static int cp_window_init(struct cp_window *win, unsigned int depth,
+			  size_t iolen)
+{
+	int i;
+
+	memset(win, 0, sizeof(*win));
+	pthread_mutex_init(&win->lock, NULL);
+	pthread_cond_init(&win->cond, NULL);
+
+	win->chunks = calloc(depth, sizeof(*win->chunks));
+	if (!win->chunks) {
+		cp_window_fini(win);
+		return -ENOMEM;
+	}
+	win->depth = depth;
+
+	for (i = 0; i < depth; i++) {
+		win->chunks[i].win = win;
+		win->chunks[i].buff = extstore_buffer_alloc(iolen);
+		if (!win->chunks[i].buff) {
+			cp_window_fini(win);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void cp_chunk_done(void *arg, ssize_t rc)
+{
+	struct cp_chunk *chunk = arg;
+
+	pthread_mutex_lock(&chunk->win->lock);
+	chunk->rc = rc;
+	chunk->inflight = false;
+	pthread_cond_broadcast(&chunk->win->cond);
+	pthread_mutex_unlock(&chunk->win->lock);
+}
+
+/* Waits for the chunk's I/O and frees it, returns the I/O's result */
+static ssize_t cp_chunk_wait(struct cp_chunk *chunk)
+{
+	pthread_mutex_lock(&chunk->win->lock);
+	while (chunk->inflight)
+		pthread_cond_wait(&chunk->win->cond, &chunk->win->lock);
+	pthread_mutex_unlock(&chunk->win->lock);
+
+	chunk->len = 0;
+	return chunk->rc;
+}
+
+/* The chunk was read from KVSNS, writes it to the POSIX fd */
+static int cp_from_retire(struct cp_chunk *chunk, int fd_dest)
+{
+	off_t off = chunk->off;
 	ssize_t rsize, wsize;
-	int rc;
-	int remains;
-	size_t len;
-	char buff[BUFFSIZE];
-	struct stat stat;
-	size_t filesize;
 
-	rc = kvsns_getattr(cred, &kfd->ino, &stat);
-	if (rc < 0)
-		return rc;
+	rsize = cp_chunk_wait(chunk);
+	if (rsize < 0)
+		return rsize;
 
-	filesize = stat.st_size;
-	remains = filesize;
-	off = 0LL;
-	while (off < filesize) {
-		len = (remains > iolen) ? iolen : remains;
+	wsize = pwrite(fd_dest, chunk->buff, rsize, off);
+	if (wsize < 0)
+		return -errno;
+
+	if (wsize != rsize)
+		return -EIO;
+
+	return 0;
+}
+
+/* The chunk was written to KVSNS, checks it went entirely */
+static int cp_to_retire(struct cp_chunk *chunk)
+{
+	size_t len = chunk->len;
+	ssize_t wsize;
+
+	wsize = cp_chunk_wait(chunk);
+	if (wsize < 0)
+		return wsize;
+
+	if (wsize != len)
+		return -EIO;
 
-		rsize = kvsns_read(cred, kfd, buff, len, off);
-		if (rsize < 0)
-			return -1;
+	return 0;
+}
+
+/* Reads [off, end[ from KVSNS, depth chunks ahead of the writes to the
+ * POSIX fd */
+static int cp_from_buffered(struct cp_job *job, off_t off, off_t end)
+{
+	size_t iolen = job->params.iolen;
+	struct cp_window win;
+	struct cp_chunk *chunk;
+	unsigned int i, n;
+	int rc, rc2;
+
+	RC_WRAP(cp_window_init, &win, job->params.depth, iolen);
 
-		wsize = pwrite(fd_dest, buff, rsize, off);
-		if (wsize < 0)
-			return -1;
+	rc = 0;
+	for (i = 0; off < end; i++) {
+		chunk = &win.chunks[i % win.depth];
+		if (chunk->len) {
+			rc = cp_from_retire(chunk, job->fd);
+			if (rc < 0)
+				break;
+		}
 
-		if (wsize != rsize)
-			return -1;
+		chunk->off = off;
+		chunk->len = (end - off > iolen) ? iolen : end - off;
+		chunk->inflight = true;
+		rc = extstore_async_read(&job->kfd->ino, chunk->off, chunk->len,
+					 chunk->buff, cp_chunk_done, chunk);
+		if (rc < 0) {
+			chunk->inflight = false;
+			chunk->len = 0;
+			break;
+		}
+
+		off += chunk->len;
+	}
+
+	/* Retire in order what is left, even after an error. The oldest
+	 * chunk is the one that was to be reused next */
+	for (n = 0; n < win.depth; n++, i++) {
+		chunk = &win.chunks[i % win.depth];
+		if (!chunk->len)
+			continue;
+
+		rc2 = cp_from_retire(chunk, job->fd);
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	cp_window_fini(&win);
+	return rc;
+}
+
+/* Writes [off, end[ to KVSNS, depth chunks at once while reading the
+ * next ones from the POSIX fd */
+static int cp_to_buffered(struct cp_job *job, off_t off, off_t end)
+{
+	size_t iolen = job->params.iolen;
+	struct cp_window win;
+	struct cp_chunk *chunk;
+	ssize_t rsize;
+	unsigned int i;
+	int rc, rc2;
+
+	RC_WRAP(cp_window_init, &win, job->params.depth, iolen);
+
+	rc = 0;
+	for (i = 0; off < end; i++) {
+		chunk = &win.chunks[i % win.depth];
+		if (chunk->len) {
+			rc = cp_to_retire(chunk);
+			if (rc < 0)
+				break;
+		}
+
+		rsize = pread(job->fd, chunk->buff,
+			      (end - off > iolen) ? iolen : end - off, off);
+		if (rsize <= 0) {
+			rc = (rsize < 0) ? -errno : 0;
+			break;
+		}
+
+		/* Made stable at once by the final commit */
+		chunk->off = off;
+		chunk->len = rsize;
+		chunk->inflight = true;
+		rc = extstore_async_write(&job->kfd->ino, off, rsize,
+					  chunk->buff, KVSNS_UNSTABLE,
+					  cp_chunk_done, chunk);
+		if (rc < 0) {
+			chunk->inflight = false;
+			chunk->len = 0;
+			break;
+		}
 
 		off += rsize;
-		remains -= rsize;
 	}
 
-	/* This POC writes on aligned blocks, we should align to real size */
-	/* Useful in this case ?? */
-	rc = ftruncate(fd_dest, filesize);
+	for (i = 0; i < win.depth; i++) {
+		chunk = &win.chunks[i];
+		if (!chunk->len)
+			continue;
+
+		rc2 = cp_to_retire(chunk);
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	cp_window_fini(&win);
+	return rc;
+}
+
+/* Copies [off, end[ in the kernel when the extstore has the data in a
+ * file, through user space otherwise */
+static int cp_stripe(struct cp_job *job, off_t off, off_t end)
+{
+	struct stat wstat;
+	ssize_t csize;
+	size_t len;
+
+	for (; off < end; off += csize) {
+		len = (end - off > KVSNS_CP_KERNEL_CHUNK) ?
+			KVSNS_CP_KERNEL_CHUNK : end - off;
+
+		if (job->to_kvsns)
+			csize = extstore_copy_from_fd(&job->kfd->ino, off,
+						      job->fd, off, len,
+						      &wstat);
+		else
+			csize = extstore_copy_to_fd(&job->kfd->ino, off,
+						    job->fd, off, len);
+		if (csize == 0)
+			break;
+
+		if (csize == -ENOTSUP)
+			return job->to_kvsns ?
+				cp_to_buffered(job, off, end) :
+				cp_from_buffered(job, off, end);
+
+		if (csize < 0)
+			return csize;
+	}
+
+	return 0;
+}
+
+static void *cp_worker(void *arg)
+{
+	struct cp_job *job = arg;
+	unsigned long long stripe;
+	off_t off, end;
+	int rc;
+
+	for (;;) {
+		stripe = __sync_fetch_and_add(&job->next, 1);
+		if (stripe >= job->nstripes ||
+		    __sync_fetch_and_add(&job->rc, 0) != 0)
+			break;
+
+		off = stripe * job->params.chunk_size;
+		end = off + job->params.chunk_size;
+		if (end > job->filesize)
+			end = job->filesize;
+
+		rc = cp_stripe(job, off, end);
+		if (rc < 0) {
+			__sync_bool_compare_and_swap(&job->rc, 0, rc);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int cp_run(struct cp_job *job, kvsns_cp_params_t *params,
+		  kvsns_cp_stats_t *stats)
+{
+	struct timespec start, stop;
+	pthread_t *threads;
+	unsigned int i, started;
+
+	if (!params || params->workers == 0 || params->chunk_size == 0 ||
+	    params->iolen == 0 || params->depth == 0)
+		return -EINVAL;
+
+	job->params = *params;
+	job->next = 0;
+	job->rc = 0;
+	job->nstripes = (job->filesize + params->chunk_size - 1) /
+			params->chunk_size;
+	if (job->nstripes < params->workers)
+		job->params.workers = job->nstripes ? job->nstripes : 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (job->params.workers == 1) {
+		cp_worker(job);
+	} else {
+		threads = calloc(job->params.workers, sizeof(*threads));
+		if (!threads)
+			return -ENOMEM;
+
+		for (started = 0; started < job->params.workers; started++)
+			if (pthread_create(&threads[started], NULL,
+					   cp_worker, job) != 0)
+				break;
+
+		/* Runs with fewer workers if some could not start */
+		if (started == 0)
+			cp_worker(job);
+
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+
+		free(threads);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	if (stats) {
+		stats->bytes = (job->rc == 0) ? job->filesize : 0;
+		stats->seconds = (stop.tv_sec - start.tv_sec) +
+				 (stop.tv_nsec - start.tv_nsec) / 1e9;
+	}
+
+	return job->rc;
+}
+
+int kvsns_cp_from_parallel(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
+			   int fd_dest, kvsns_cp_params_t *params,
+			   kvsns_cp_stats_t *stats)
+{
+	struct cp_job job;
+	struct timespec times[2];
+	struct stat stat;
+	int rc;
+
+	if (!cred || !kfd)
+		return -EINVAL;
+
+	/* The copy reads the store, not the page cache */
+	RC_WRAP(kvsns_page_cache_flush, &kfd->ino);
+	RC_WRAP(kvsns_getattr, cred, &kfd->ino, &stat);
+
+	memset(&job, 0, sizeof(job));
+	job.kfd = kfd;
+	job.fd = fd_dest;
+	job.to_kvsns = false;
+	job.filesize = stat.st_size;
+	RC_WRAP(cp_run, &job, params, stats);
+
+	rc = ftruncate(fd_dest, stat.st_size);
+	if (rc < 0)
+		return -errno;
+
+	/* Like "cp -p", ownership is kept if allowed */
+	if (fchown(fd_dest, stat.st_uid, stat.st_gid) < 0 && errno != EPERM)
+		return -errno;
+
+	rc = fchmod(fd_dest, stat.st_mode & ~S_IFMT);
 	if (rc < 0)
-		return -1;
+		return -errno;
 
-	rc = fchmod(fd_dest, stat.st_mode);
+	times[0] = stat.st_atim;
+	times[1] = stat.st_mtim;
+	rc = futimens(fd_dest, times);
 	if (rc < 0)
-		return -1;
+		return -errno;
 
 	return 0;
 }
 
-int kvsns_cp_to(kvsns_cred_t *cred, int fd_source,
-		kvsns_file_open_t *kfd, int iolen)
+int kvsns_cp_to_parallel(kvsns_cred_t *cred, int fd_source,
+			 kvsns_file_open_t *kfd, kvsns_cp_params_t *params,
+			 kvsns_cp_stats_t *stats)
 {
-	off_t off;
-	ssize_t rsize, wsize;
-	int remains;
-	size_t len;
-	char buff[BUFFSIZE];
-	int rc;
+	struct cp_job job;
 	struct stat srcstat;
-	size_t filesize;
+	int flags;
+	int rc;
+
+	if (!cred || !kfd)
+		return -EINVAL;
 
 	rc = fstat(fd_source, &srcstat);
 	if (rc < 0)
 		return -errno;
 
-	remains = srcstat.st_size;
-	filesize = srcstat.st_size;
-	off = 0LL;
-	while (off < filesize) {
-		len = (remains > iolen) ? iolen : remains;
+	/* The copy writes the store behind the page cache: older cached
+	 * writes go first, then nothing cached may outlive the copy */
+	RC_WRAP(kvsns_page_cache_invalidate, &kfd->ino);
 
-		rsize = pread(fd_source, buff, len, off);
-		if (rsize < 0)
-			return -1;
+	memset(&job, 0, sizeof(job));
+	job.kfd = kfd;
+	job.fd = fd_source;
+	job.to_kvsns = true;
+	job.filesize = srcstat.st_size;
+	RC_WRAP(cp_run, &job, params, stats);
+	RC_WRAP(kvsns_page_cache_invalidate, &kfd->ino);
 
-		wsize = kvsns_write(cred, kfd, buff, rsize, off);
-		if (wsize < 0)
-			return -1;
+	/* A single commit for the whole file */
+	if (kfd->durability != KVSNS_UNSTABLE)
+		RC_WRAP(extstore_commit, &kfd->ino);
 
-		if (wsize != rsize)
-			return -1;
+	/* Setting the size trims a previous, longer content and fixes the
+	 * size if concurrent stripes raced to update it */
+	flags = STAT_SIZE_SET|STAT_MODE_SET|STAT_ATIME_SET|STAT_MTIME_SET;
+	if (cred->uid == 0)
+		flags |= STAT_UID_SET|STAT_GID_SET;
 
-		off += rsize;
-		remains -= rsize;
-	}
+	return kvsns_setattr(cred, &kfd->ino, &srcstat, flags);
+}
 
-	rc = kvsns_setattr(cred, &kfd->ino, &srcstat, STAT_MODE_SET);
-	if (rc < 0)
-		return rc;
+int kvsns_cp_from(kvsns_cred_t *cred, kvsns_file_open_t *kfd,
+		  int fd_dest, int iolen)
+{
+	kvsns_cp_params_t params = {
+		.workers = 1,
+		.chunk_size = KVSNS_CP_KERNEL_CHUNK,
+		.iolen = iolen,
+		.depth = KVSNS_CP_DEPTH,
+	};
 
-	return 0;
+	if (iolen <= 0)
+		return -EINVAL;
+
+	return kvsns_cp_from_parallel(cred, kfd, fd_dest, &params, NULL);
 }
 
+int kvsns_cp_to(kvsns_cred_t *cred, int fd_source,
+		kvsns_file_open_t *kfd, int iolen)
+{
+	kvsns_cp_params_t params = {
+		.workers = 1,
+		.chunk_size = KVSNS_CP_KERNEL_CHUNK,
+		.iolen = iolen,
+		.depth = KVSNS_CP_DEPTH,
+	};
+
+	if (iolen <= 0)
+		return -EINVAL;
+
+	return kvsns_cp_to_parallel(cred, fd_source, kfd, &params, NULL);
+}
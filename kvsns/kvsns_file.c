@@ -36,61 +36,303 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <syscall.h>
+#include <sys/time.h>
 #include <kvsns/kvsal.h>
 #include <kvsns/kvsns.h>
 #include <kvsns/extstore.h>
 #include "kvsns_internal.h"
 
-static int kvsns_str2ownerlist(kvsns_open_owner_t *ownerlist, int *size,
-			        char *str)
+/* Each open is a distinct member of the "openowner" set */
+static unsigned int open_seq;
+
+/* Durability of the writes when open flags do not tell */
+static kvsns_durability_t default_durability = KVSNS_SYNC;
+
+/* "file_attrs = open": a stat asks the extstore while another client has
+ * the file open for write. "close": the inode record is trusted, what
+ * other clients write is seen after they close the file */
+static bool attrs_while_written = true;
+
+/* Files open for write or written in the process. The size, blocks and
+ * mtime of what they write are stored in the inode record at fsync and
+ * close. An entry lives while the file is open for write or not stored */
+#define WFILE_BUCKETS 256
+
+struct wfile {
+	kvsns_ino_t ino;
+	unsigned int refs;	/* opens for write */
+	bool dirty;		/* written since the record was updated */
+	struct timespec mtime;	/* last write, 0 once mtime was set */
+	struct wfile *next;
+};
+
+static struct wfile *wfile_table[WFILE_BUCKETS];
+static pthread_mutex_t wfile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int kvsns_file_init(struct collection_item *cfg_items)
 {
-	char *token;
-	char *rest = str;
-	int maxsize;
-	int pos;
+	struct collection_item *item;
+	const char *how;
+
+	item = NULL;
+	RC_WRAP(get_config_item, "kvsns", "file_attrs", cfg_items, &item);
+	if (item != NULL) {
+		how = get_const_string_config_value(item, NULL);
+		if (!how)
+			return -EINVAL;
+
+		if (!strcmp(how, "open"))
+			attrs_while_written = true;
+		else if (!strcmp(how, "close"))
+			attrs_while_written = false;
+		else
+			return -EINVAL;
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "kvsns", "durability", cfg_items, &item);
+	if (item == NULL)
+		return 0;
 
-	if (!ownerlist || !str || !size)
+	how = get_const_string_config_value(item, NULL);
+	if (!how)
 		return -EINVAL;
 
-	maxsize = *size;
-	pos = 0;
+	if (!strcmp(how, "sync"))
+		default_durability = KVSNS_SYNC;
+	else if (!strcmp(how, "datasync"))
+		default_durability = KVSNS_DATASYNC;
+	else if (!strcmp(how, "unstable"))
+		default_durability = KVSNS_UNSTABLE;
+	else
+		return -EINVAL;
 
-	while((token = strtok_r(rest, "|", &rest))) {
-		sscanf(token, "%u.%u",
-		       &ownerlist[pos].pid,
-		       &ownerlist[pos].tid);
-		pos += 1;
-		if (pos == maxsize)
-			break;
-	}
+	return 0;
+}
+
+static struct wfile **wfile_lookup(kvsns_ino_t ino)
+{
+	struct wfile **slot;
+
+	slot = &wfile_table[ino % WFILE_BUCKETS];
+	while (*slot && (*slot)->ino != ino)
+		slot = &(*slot)->next;
+
+	return slot;
+}
 
-	*size = pos;
+static int wfile_hold(kvsns_ino_t ino)
+{
+	struct wfile **slot;
+	struct wfile *wf;
+
+	pthread_mutex_lock(&wfile_lock);
+	slot = wfile_lookup(ino);
+	wf = *slot;
+	if (!wf) {
+		wf = calloc(1, sizeof(struct wfile));
+		if (!wf) {
+			pthread_mutex_unlock(&wfile_lock);
+			return -ENOMEM;
+		}
+		wf->ino = ino;
+		*slot = wf;
+	}
+	wf->refs += 1;
+	pthread_mutex_unlock(&wfile_lock);
 
 	return 0;
 }
 
-static int kvsns_ownerlist2str(kvsns_open_owner_t *ownerlist, int size,
-			       char *str)
+static void wfile_release(struct wfile **slot)
 {
-	int i;
-	char tmp[VLEN];
+	struct wfile *wf = *slot;
 
-	if (!ownerlist || !str)
-		return -EINVAL;
+	if (wf->refs == 0 && !wf->dirty) {
+		*slot = wf->next;
+		free(wf);
+	}
+}
 
-	strcpy(str, "");
+static void wfile_put(kvsns_ino_t ino)
+{
+	struct wfile **slot;
+	struct wfile *wf;
+
+	pthread_mutex_lock(&wfile_lock);
+	slot = wfile_lookup(ino);
+	wf = *slot;
+	if (wf) {
+		wf->refs -= 1;
+		wfile_release(slot);
+	}
+	pthread_mutex_unlock(&wfile_lock);
+}
 
-	for (i = 0; i < size ; i++)
-		if (ownerlist[i].pid != 0LL) {
-			snprintf(tmp, VLEN, "%u.%u|",
-				 ownerlist[i].pid, ownerlist[i].tid);
-			strcat(str, tmp);
+/* Writes through a descriptor opened read only are accounted too, other
+ * clients just do not know about them */
+static void wfile_written(kvsns_ino_t ino)
+{
+	struct wfile **slot;
+	struct wfile *wf;
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+
+	pthread_mutex_lock(&wfile_lock);
+	slot = wfile_lookup(ino);
+	wf = *slot;
+	if (!wf) {
+		wf = calloc(1, sizeof(struct wfile));
+		if (wf) {
+			wf->ino = ino;
+			*slot = wf;
 		}
-	
+	}
+	if (wf) {
+		wf->dirty = true;
+		wf->mtime.tv_sec = t.tv_sec;
+		wf->mtime.tv_nsec = 1000 * t.tv_usec;
+	}
+	pthread_mutex_unlock(&wfile_lock);
+}
+
+/* Takes what is to be stored in the record, put back with wfile_restore
+ * if that fails */
+static bool wfile_take(kvsns_ino_t ino, struct stat *data)
+{
+	struct wfile **slot;
+	struct wfile *wf;
+	bool dirty = false;
+
+	pthread_mutex_lock(&wfile_lock);
+	slot = wfile_lookup(ino);
+	wf = *slot;
+	if (wf && wf->dirty) {
+		memset(data, 0, sizeof(struct stat));
+		data->st_mtim = wf->mtime;
+		wf->dirty = false;
+		dirty = true;
+		wfile_release(slot);
+	}
+	pthread_mutex_unlock(&wfile_lock);
+
+	return dirty;
+}
+
+static void wfile_restore(kvsns_ino_t ino, struct stat *data)
+{
+	struct wfile **slot;
+	struct wfile *wf;
+
+	pthread_mutex_lock(&wfile_lock);
+	slot = wfile_lookup(ino);
+	wf = *slot;
+	if (!wf) {
+		wf = calloc(1, sizeof(struct wfile));
+		if (!wf) {
+			pthread_mutex_unlock(&wfile_lock);
+			return;
+		}
+		wf->ino = ino;
+		*slot = wf;
+	}
+	wf->dirty = true;
+	if (wf->mtime.tv_sec < data->st_mtim.tv_sec)
+		wf->mtime = data->st_mtim;
+	pthread_mutex_unlock(&wfile_lock);
+}
+
+bool kvsns_file_writing(kvsns_ino_t *ino)
+{
+	bool writing;
+
+	pthread_mutex_lock(&wfile_lock);
+	writing = (*wfile_lookup(*ino) != NULL);
+	pthread_mutex_unlock(&wfile_lock);
+
+	return writing;
+}
+
+bool kvsns_file_attrs_while_written(void)
+{
+	return attrs_while_written;
+}
+
+/* An mtime set explicitly is not to be replaced by the one of writes done
+ * before */
+void kvsns_file_mtime_set(kvsns_ino_t *ino)
+{
+	struct wfile *wf;
+
+	pthread_mutex_lock(&wfile_lock);
+	wf = *wfile_lookup(*ino);
+	if (wf) {
+		wf->mtime.tv_sec = 0;
+		wf->mtime.tv_nsec = 0;
+	}
+	pthread_mutex_unlock(&wfile_lock);
+}
+
+/* Size and blocks of the data written, once all of it is in the store */
+static int kvsns_file_data(kvsns_ino_t *ino, struct stat *data)
+{
+	struct stat extstat;
+
+	RC_WRAP(kvsns_page_cache_flush, ino);
+
+	memset(&extstat, 0, sizeof(extstat));
+
+	/* -ENOENT if there is no data */
+	RC_WRAP(extstore_getattr, ino, &extstat);
+
+	data->st_size = extstat.st_size;
+	data->st_blocks = extstat.st_blocks;
+
 	return 0;
 }
 
+/* Stores the attributes of the data written in the inode record */
+static int kvsns_file_store_attrs(kvsns_ino_t *ino)
+{
+	struct stat data;
+	int rc;
+
+	if (!wfile_take(*ino, &data))
+		return 0;
+
+	rc = kvsns_file_data(ino, &data);
+	if (rc == -ENOENT)
+		return 0;
+	if (rc == 0)
+		rc = kvsns_script_data_attrs(1, ino, &data);
+	if (rc != 0) {
+		wfile_restore(*ino, &data);
+		return rc;
+	}
+
+	kvsns_stat_cache_del(ino);
+	return 0;
+}
+
+static kvsns_durability_t kvsns_flags2durability(int flags)
+{
+	/* O_SYNC contains the O_DSYNC bit */
+	if ((flags & O_SYNC) == O_SYNC)
+		return KVSNS_SYNC;
+
+	if (flags & O_DSYNC)
+		return KVSNS_DATASYNC;
+
+	return default_durability;
+}
+
+static void kvsns_owner2str(kvsns_open_owner_t *owner, char *str)
+{
+	snprintf(str, VLEN, "%d.%d.%u", owner->pid, owner->tid, owner->seq);
+}
 
 int kvsns_creat(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name,
 		mode_t mode, kvsns_ino_t *newfile)
@@ -110,43 +352,55 @@ int kvsns_open(kvsns_cred_t *cred, kvsns_ino_t *ino,
 	       int flags, mode_t mode, kvsns_file_open_t *fd)
 {
 	kvsns_open_owner_t me;
-	kvsns_open_owner_t owners[KVSAL_ARRAY_SIZE];
-	int size = KVSAL_ARRAY_SIZE;
-	char k[KLEN];
 	char v[VLEN];
+	bool writer;
 	int rc;
 
 	if (!cred || !ino || !fd)
 		return -EINVAL;
 
+	writer = ((flags & O_ACCMODE) != O_RDONLY);
+
 	/** @todo Put here the access control base on flags and mode values */
 	me.pid = getpid();
 	me.tid = syscall(SYS_gettid);
+	me.seq = __sync_fetch_and_add(&open_seq, 1);
 
-	/* Manage the list of open owners */
-	snprintf(k, KLEN, "%llu.openowner", *ino);
-	rc = kvsal_get_char(k, v);
-	if (rc == 0) {
-		RC_WRAP(kvsns_str2ownerlist, owners, &size, v);
-		if (size == KVSAL_ARRAY_SIZE)
-			return -EMLINK; /* Too many open files */
-		owners[size].pid = me.pid;
-		owners[size].tid = me.tid;
-		size += 1;
-		RC_WRAP(kvsns_ownerlist2str, owners, size, v);
-	} else if (rc == -ENOENT) {
-		/* Create the key => 1st fd created */
-		snprintf(v, VLEN, "%u.%u|", me.pid, me.tid);
-	} else
+	/* Keep the object's descriptor around until kvsns_close */
+	RC_WRAP(extstore_open, ino);
+
+	rc = kvsns_page_cache_open(ino);
+	if (rc != 0) {
+		extstore_close(ino);
 		return rc;
+	}
 
-	RC_WRAP(kvsal_set_char, k, v);
+	if (writer) {
+		rc = wfile_hold(*ino);
+		if (rc != 0) {
+			kvsns_page_cache_release(ino);
+			extstore_close(ino);
+			return rc;
+		}
+	}
+
+	/* Register in the set of open owners, and in the count of writers
+	 * other clients look at before trusting the record */
+	kvsns_owner2str(&me, v);
+	rc = kvsns_script_open(ino, v, writer);
+	if (rc != 0) {
+		if (writer)
+			wfile_put(*ino);
+		kvsns_page_cache_release(ino);
+		extstore_close(ino);
+		return rc;
+	}
 
 	/** @todo Do not forget store stuffs */
 	fd->ino = *ino;
-	fd->owner.pid = me.pid;
-	fd->owner.tid = me.tid;
+	fd->owner = me;
 	fd->flags = flags;
+	fd->durability = kvsns_flags2durability(flags);
 
 	/* In particular create a key per opened fd */
 
@@ -168,136 +422,159 @@ int kvsns_openat(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name,
 
 int kvsns_close(kvsns_file_open_t *fd)
 {
-	kvsns_open_owner_t owners[KVSAL_ARRAY_SIZE];
-	int size = KVSAL_ARRAY_SIZE;
-	char k[KLEN];
 	char v[VLEN];
-	int i;
-	int rc;
-	bool found = false;
-	bool opened_and_deleted;
+	struct stat data;
+	struct stat *written = NULL;
 	bool delete_object = false;
+	bool writer;
+	int ret = 0;
+	int rc;
 
 	if (!fd)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.openowner", fd->ino);
-	rc = kvsal_get_char(k, v);
-	if (rc != 0) {
-		if (rc == -ENOENT)
-			return -EBADF; /* File not opened */
-		else
-			return rc;
+	writer = ((fd->flags & O_ACCMODE) != O_RDONLY);
+
+	/* The caller frees the descriptor whatever happens: the first error
+	 * is returned, but what the descriptor holds is released anyway */
+
+	/* Write-back data is flushed as the file is closed */
+	if (fd->durability == KVSNS_UNSTABLE) {
+		ret = kvsns_page_cache_flush(&fd->ino);
+		if (ret == 0)
+			ret = extstore_commit(&fd->ino);
 	}
 
-	/* Was the file deleted as it was opened ? */
-	/* The last close should perform actual data deletion */
-	snprintf(k, KLEN, "%llu.opened_and_deleted", fd->ino);
-	rc = kvsal_exists(k);
-	if ((rc != 0) && (rc != -ENOENT))
-		return rc;
-	opened_and_deleted = (rc == -ENOENT) ? false : true;
-
-	RC_WRAP(kvsns_str2ownerlist, owners, &size, v);
-
-	RC_WRAP(kvsal_begin_transaction);
-
-	if (size == 1) {
-		if (fd->owner.pid == owners[0].pid &&
-		    fd->owner.tid == owners[0].tid) {
-			snprintf(k, KLEN, "%llu.openowner", fd->ino);
-			RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-			/* Was the file deleted as it was opened ? */
-			if (opened_and_deleted) {
-				delete_object = true;
-				snprintf(k, KLEN, "%llu.opened_and_deleted",
-					 fd->ino);
-				RC_WRAP_LABEL(rc, aborted,
-					      kvsal_del, k);
-			}
-			RC_WRAP(kvsal_end_transaction);
-
-			if (delete_object)
-				RC_WRAP(extstore_del, &fd->ino);
-
-			return 0;
-		} else {
-			rc = -EBADF;
-			goto aborted;
+	if (wfile_take(fd->ino, &data)) {
+		rc = kvsns_file_data(&fd->ino, &data);
+		if (rc == 0) {
+			written = &data;
+		} else if (rc != -ENOENT) {
+			wfile_restore(fd->ino, &data);
+			if (ret == 0)
+				ret = rc;
 		}
-	} else {
-		found = false;
-		for (i = 0; i < size ; i++)
-			if (owners[i].pid == fd->owner.pid &&
-			    owners[i].tid == fd->owner.tid) {
-				owners[i].pid = 0; /* remove it from list */
-				found = true;
-				break;
-			}
 	}
 
-
-	if (!found) {
-		rc = -EBADF;
-		goto aborted;
+	/* Removing the owner, storing the size of what it wrote and, at
+	 * last close, checking if the file was deleted as it was opened is
+	 * a single atomic operation */
+	kvsns_owner2str(&fd->owner, v);
+	rc = kvsns_script_close(&fd->ino, v, writer, written, &delete_object);
+	if (rc != 0) {
+		if (written)
+			wfile_restore(fd->ino, &data);
+		if (ret == 0)
+			ret = rc;
+	} else if (written) {
+		kvsns_stat_cache_del(&fd->ino);
+	}
+	if (writer)
+		wfile_put(fd->ino);
+
+	/* A failed flush of cached writes keeps their pages in the cache */
+	rc = kvsns_page_cache_release(&fd->ino);
+	if (ret == 0)
+		ret = rc;
+	rc = extstore_close(&fd->ino);
+	if (ret == 0)
+		ret = rc;
+
+	/* The last close performs the actual data deletion */
+	if (delete_object) {
+		rc = extstore_del(&fd->ino);
+		return (ret != 0) ? ret : rc;
 	}
 
-	RC_WRAP_LABEL(rc, aborted, kvsns_ownerlist2str, owners, size, v);
-
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-	RC_WRAP(kvsal_end_transaction);
+	if (ret != 0)
+		return ret;
 
-	/* To be done outside of the previous transaction */
-	if (delete_object)
-		RC_WRAP(extstore_del, &fd->ino);
+	/* Reading a file is an access, counted once per open */
+	if ((fd->flags & O_ACCMODE) != O_WRONLY) {
+		rc = kvsns_atime_update(&fd->ino);
+		if (rc != 0 && rc != -ENOENT)
+			return rc;
+	}
 
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 ssize_t kvsns_write(kvsns_cred_t *cred, kvsns_file_open_t *fd,
 		    void *buf, size_t count, off_t offset)
 {
-	ssize_t write_amount;
+	ssize_t written;
+
+	/** @todo use flags to check correct access */
+	written = kvsns_page_cache_write(&fd->ino, buf, count, offset,
+					 fd->durability);
+	if (written > 0)
+		wfile_written(fd->ino);
+
+	return written;
+}
+
+ssize_t kvsns_read(kvsns_cred_t *cred, kvsns_file_open_t *fd,
+		   void *buf, size_t count, off_t offset)
+{
+	/** @todo use flags to check correct access */
+	return kvsns_page_cache_read(&fd->ino, buf, count, offset);
+}
+
+ssize_t kvsns_writev(kvsns_cred_t *cred, kvsns_file_open_t *fd,
+		     const struct iovec *iov, int iovcnt,
+		     const kvsns_extent_t *ext, int extcnt)
+{
 	bool stable;
 	struct stat wstat;
+	ssize_t written;
+
+	if (!cred || !fd || !iov || !ext)
+		return -EINVAL;
 
 	memset(&wstat, 0, sizeof(wstat));
 
+	/* Vectored I/O bypasses the page cache */
+	RC_WRAP(kvsns_page_cache_invalidate, &fd->ino);
+
 	/** @todo use flags to check correct access */
-	write_amount = extstore_write(&fd->ino,
-				      offset,
-				      count,
-				      buf,
-				      &stable,
-				      &wstat);
-
-	return write_amount;
+	written = extstore_writev(&fd->ino, iov, iovcnt, ext, extcnt,
+				  fd->durability, &stable, &wstat);
+	if (written > 0)
+		wfile_written(fd->ino);
+
+	return written;
 }
 
-ssize_t kvsns_read(kvsns_cred_t *cred, kvsns_file_open_t *fd,
-		   void *buf, size_t count, off_t offset)
+ssize_t kvsns_readv(kvsns_cred_t *cred, kvsns_file_open_t *fd,
+		    const struct iovec *iov, int iovcnt,
+		    const kvsns_extent_t *ext, int extcnt)
 {
-	ssize_t read_amount;
 	bool eof;
 	struct stat stat;
 
+	if (!cred || !fd || !iov || !ext)
+		return -EINVAL;
+
+	memset(&stat, 0, sizeof(stat));
+
+	RC_WRAP(kvsns_page_cache_flush, &fd->ino);
+
 	/** @todo use flags to check correct access */
-	read_amount = extstore_read(&fd->ino,
-				    offset,
-				    count,
-				    buf,
-				    &eof,
-				    &stat);
-
-	return read_amount;
+	return extstore_readv(&fd->ino, iov, iovcnt, ext, extcnt,
+			      &eof, &stat);
 }
 
+int kvsns_fsync(kvsns_cred_t *cred, kvsns_file_open_t *fd)
+{
+	if (!cred || !fd)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_page_cache_flush, &fd->ino);
+	RC_WRAP(extstore_commit, &fd->ino);
+
+	/* The size is as durable as the data */
+	return kvsns_file_store_attrs(&fd->ino);
+}
 
 int kvsns_attach(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name,
 		 char *objid, int objid_len, struct stat *stat, int statflags,
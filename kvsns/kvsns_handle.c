@@ -112,72 +112,43 @@ int kvsns_readlink(kvsns_cred_t *cred, kvsns_ino_t *lnk,
 	strncpy(content, v, *size);
 	*size = strnlen(v, VLEN);
 
-	RC_WRAP(kvsns_update_stat, lnk, STAT_ATIME_SET);
+	RC_WRAP(kvsns_atime_update, lnk);
 
 	return 0;
 }
 
 int kvsns_rmdir(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name)
 {
-	int rc;
-	char k[KLEN];
 	kvsns_ino_t ino = 0LL;
-	struct stat parent_stat;
 
 	if (!cred || !parent || !name)
 		return -EINVAL;
 
-	memset(&parent_stat, 0, sizeof(parent_stat));
-
 	RC_WRAP(kvsns_access, cred, parent, KVSNS_ACCESS_WRITE);
 
-	RC_WRAP(kvsns_lookup, cred, parent, name, &ino);
-
-	RC_WRAP(kvsns_get_stat, parent, &parent_stat);
-
-	snprintf(k, KLEN, "%llu.dentries.*", ino);
-	rc = kvsal_get_list_size(k);
-	if (rc > 0)
-		return -ENOTEMPTY;
-
-	RC_WRAP(kvsal_begin_transaction);
-
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *parent, name);
-	RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-	snprintf(k, KLEN, "%llu.parentdir", ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-	snprintf(k, KLEN, "%llu.stat", ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
+	/* Emptiness is checked in the same step as the removal */
+	RC_WRAP(kvsns_script_rmdir, parent, name, &ino);
 
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &parent_stat,
-		      STAT_CTIME_SET|STAT_MTIME_SET);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, parent, &parent_stat);
-
-	RC_WRAP(kvsal_end_transaction);
+	kvsns_stat_cache_del(&ino);
+	kvsns_stat_cache_del(parent);
+	kvsns_dentry_cache_set(parent, name, NULL);
 
 	/* Remove all associated xattr */
 	RC_WRAP(kvsns_remove_all_xattr, cred, &ino);
 
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 int kvsns_opendir(kvsns_cred_t *cred, kvsns_ino_t *dir, kvsns_dir_t *ddir)
 {
-	char pattern[KLEN];
+	char k[KLEN];
 	if (!cred || ! dir || !ddir)
 		return -EINVAL;
-	
-	snprintf(pattern, KLEN, "%llu.dentries.*", *dir);
+
+	snprintf(k, KLEN, "%llu.dentries", *dir);
 
 	ddir->ino = *dir;
-	return kvsal_fetch_list(pattern , &ddir->list);
+	return kvsal_fetch_entries(k, &ddir->list);
 }
 
 int kvsns_closedir(kvsns_dir_t *dir)
@@ -188,16 +159,199 @@ int kvsns_closedir(kvsns_dir_t *dir)
 	return kvsal_dispose_list(&dir->list);
 }
 
+/* The inode record holds the size, blocks and mtime of a file, stored by
+ * its writers at fsync and close. The extstore is only asked for files
+ * open for write, here or (file_attrs = open) by another client, and for
+ * records written before that, which are updated on the way */
+static bool kvsns_data_in_record(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	if (bufstat->st_blocks == KVSAL_BLOCKS_UNKNOWN)
+		return false;
+
+	return !kvsns_file_writing(ino);
+}
+
+static void kvsns_merge_data(kvsns_ino_t *ino, struct stat *bufstat,
+			     struct stat *data_stat)
+{
+	bufstat->st_size = data_stat->st_size;
+	bufstat->st_blocks = data_stat->st_blocks;
+	if (data_stat->st_mtime > bufstat->st_mtime)
+		bufstat->st_mtim = data_stat->st_mtim;
+	if (data_stat->st_atime > bufstat->st_atime)
+		bufstat->st_atim = data_stat->st_atim;
+
+	/* Data still in the page cache is part of the file */
+	kvsns_page_cache_getattr(ino, bufstat);
+}
+
+static int kvsns_getattr_data(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	struct stat data_stat;
+	char k[KLEN];
+	char v[VLEN];
+	bool legacy;
+	int rc;
+
+	if (!S_ISREG(bufstat->st_mode))
+		return 0;
+
+	if (kvsns_data_in_record(ino, bufstat)) {
+		if (!kvsns_file_attrs_while_written())
+			return 0;
+
+		snprintf(k, KLEN, "%llu.writers", *ino);
+		rc = kvsal_get_char(k, v);
+		if (rc == -ENOENT)
+			return 0; /* nobody writes it */
+		if (rc != 0)
+			return rc;
+	}
+
+	legacy = (bufstat->st_blocks == KVSAL_BLOCKS_UNKNOWN);
+
+	memset(&data_stat, 0, sizeof(data_stat));
+	rc = extstore_getattr(ino, &data_stat);
+	if (rc == -ENOENT) {
+		/* no associated data */
+		memset(&data_stat, 0, sizeof(data_stat));
+		data_stat.st_size = bufstat->st_size;
+	} else if (rc != 0) {
+		return rc;
+	}
+
+	kvsns_merge_data(ino, bufstat, &data_stat);
+
+	if (legacy) {
+		RC_WRAP(kvsns_script_data_attrs, 1, ino, &data_stat);
+		kvsns_stat_cache_del(ino);
+	}
+
+	return 0;
+}
+
+/* Fills the stats of nb entries: one round trip to the KVS for the
+ * records, one for the writers of the files if needed and one batch to
+ * the extstore for the files being written. rcs[i] is the status of
+ * dirent[i] */
+static int kvsns_getattr_many(int nb, kvsns_dentry_t *dirent, int *rcs)
+{
+	char (*keys)[KLEN] = NULL;
+	char (*vals)[VLEN] = NULL;
+	struct stat *stats = NULL;
+	kvsns_ino_t *inos = NULL;
+	int *ask = NULL;
+	int *watch = NULL;
+	int *drcs = NULL;
+	int nask = 0;
+	int nwatch = 0;
+	int nlegacy = 0;
+	int i;
+	int rc;
+
+	if (nb == 0)
+		return 0;
+
+	keys = malloc(nb*sizeof(*keys));
+	vals = malloc(nb*sizeof(*vals));
+	stats = malloc(nb*sizeof(struct stat));
+	inos = malloc(nb*sizeof(kvsns_ino_t));
+	ask = malloc(nb*sizeof(int));
+	watch = malloc(nb*sizeof(int));
+	drcs = malloc(nb*sizeof(int));
+	if (!keys || !vals || !stats || !inos || !ask || !watch || !drcs) {
+		rc = -ENOMEM;
+		goto errout;
+	}
+
+	for (i = 0; i < nb ; i++)
+		snprintf(keys[i], KLEN, "%llu.stat", dirent[i].inode);
+
+	RC_WRAP_LABEL(rc, errout, kvsal_get_stat_many, nb, keys, stats, rcs);
+
+	for (i = 0; i < nb ; i++) {
+		if (rcs[i] != 0)
+			continue;
+
+		memcpy(&dirent[i].stats, &stats[i], sizeof(struct stat));
+		kvsns_stat_cache_set(&dirent[i].inode, &stats[i]);
+		kvsns_atime_getattr(&dirent[i].inode, &dirent[i].stats);
+		if (!S_ISREG(stats[i].st_mode))
+			continue;
+
+		if (!kvsns_data_in_record(&dirent[i].inode, &stats[i])) {
+			ask[nask++] = i;
+		} else if (kvsns_file_attrs_while_written()) {
+			snprintf(keys[nwatch], KLEN, "%llu.writers",
+				 dirent[i].inode);
+			watch[nwatch++] = i;
+		}
+	}
+
+	/* Files written by other clients */
+	RC_WRAP_LABEL(rc, errout, kvsal_mget_char, nwatch, keys, vals, drcs);
+	for (i = 0; i < nwatch ; i++)
+		if (drcs[i] == 0)
+			ask[nask++] = watch[i];
+
+	for (i = 0; i < nask ; i++)
+		inos[i] = dirent[ask[i]].inode;
+	memset(stats, 0, nask*sizeof(struct stat));
+
+	RC_WRAP_LABEL(rc, errout, extstore_getattr_many, nask, inos,
+		      stats, drcs);
+
+	for (i = 0; i < nask ; i++) {
+		struct stat *bufstat = &dirent[ask[i]].stats;
+		bool legacy = (bufstat->st_blocks == KVSAL_BLOCKS_UNKNOWN);
+
+		if (drcs[i] == -ENOENT) {
+			/* no associated data */
+			memset(&stats[i], 0, sizeof(struct stat));
+			stats[i].st_size = bufstat->st_size;
+		} else if (drcs[i] != 0) {
+			rcs[ask[i]] = drcs[i];
+			continue;
+		}
+
+		kvsns_merge_data(&inos[i], bufstat, &stats[i]);
+
+		/* Older records are updated in one more batch */
+		if (legacy) {
+			inos[nlegacy] = inos[i];
+			stats[nlegacy] = stats[i];
+			nlegacy += 1;
+		}
+	}
+
+	if (nlegacy > 0) {
+		RC_WRAP_LABEL(rc, errout, kvsns_script_data_attrs, nlegacy,
+			      inos, stats);
+		for (i = 0; i < nlegacy ; i++)
+			kvsns_stat_cache_del(&inos[i]);
+	}
+
+	rc = 0;
+
+errout:
+	free(keys);
+	free(vals);
+	free(stats);
+	free(inos);
+	free(ask);
+	free(watch);
+	free(drcs);
+
+	return rc;
+}
+
 int kvsns_readdir(kvsns_cred_t *cred, kvsns_dir_t *dir, off_t offset,
 		  kvsns_dentry_t *dirent, int *size)
 {
-	char pattern[KLEN];
-	char v[VLEN];
-	kvsal_item_t *items;
+	kvsal_item_t *items = NULL;
+	int *rcs = NULL;
 	int i;
-	kvsns_ino_t ino = 0LL;
 	int rc;
-	unsigned long long lino;
 
 	if (!cred || !dir || !dirent || !size)
 		return -EINVAL;
@@ -205,36 +359,144 @@ int kvsns_readdir(kvsns_cred_t *cred, kvsns_dir_t *dir, off_t offset,
 	RC_WRAP(kvsns_access, cred, &dir->ino, KVSNS_ACCESS_READ);
 
 	items = (kvsal_item_t *)malloc(*size*sizeof(kvsal_item_t));
-	if (items == NULL)
-		return -ENOMEM;
+	rcs = malloc(*size*sizeof(int));
+	if (!items || !rcs) {
+		rc = -ENOMEM;
+		goto errout;
+	}
 	memset(items, 0, *size*sizeof(kvsal_item_t));
 
-	memcpy(&lino, dir, sizeof(lino)); /* violent cast */
-	snprintf(pattern, KLEN, "%llu.dentries.*", lino);
-	rc = kvsal_get_list(&dir->list, (int)offset, size, items);
+	/* One round trip for names and inodes... */
 	RC_WRAP_LABEL(rc, errout,
 		      kvsal_get_list, &dir->list, (int)offset, size, items);
 
 	for (i = 0; i < *size ; i++) {
-		sscanf(items[i].str, "%llu.dentries.%[^\n]",
-		       &ino, dirent[i].name);
-
-		RC_WRAP_LABEL(rc, errout, kvsal_get_char, items[i].str, v);
+		strncpy(dirent[i].name, items[i].str, NAME_MAX);
+		dirent[i].inode = items[i].value;
+	}
 
-		sscanf(v, "%llu", &dirent[i].inode);
+	/* ... and batches for all the stats of the page */
+	RC_WRAP_LABEL(rc, errout, kvsns_getattr_many, *size, dirent, rcs);
 
-		RC_WRAP_LABEL(rc, errout, kvsns_getattr, cred, &dirent[i].inode,
-			 &dirent[i].stats);
+	for (i = 0; i < *size ; i++) {
+		rc = rcs[i];
+		if (rc != 0)
+			goto errout;
 	}
 
-	RC_WRAP_LABEL(rc, errout, kvsns_update_stat, &dir->ino, STAT_ATIME_SET);
+	/* A listing is one access, not one per page */
+	if (offset == 0)
+		RC_WRAP_LABEL(rc, errout, kvsns_atime_update, &dir->ino);
+
+	rc = 0;
 
+errout:
 	free(items);
-	return 0;
+	free(rcs);
+
+	return rc;
+}
+
+/* A cookie is the inode of the last entry returned, dentries being sorted
+ * by inode, with the number of entries for this inode already returned
+ * (hard links in the same directory) in its low bits. Inodes fit in 53
+ * bits, as kvsal stores them as scores */
+#define COOKIE_SKIP_BITS 11
+#define COOKIE_SKIP_MAX ((1 << COOKIE_SKIP_BITS) - 1)
+
+int kvsns_readdirplus(kvsns_cred_t *cred, kvsns_dir_t *dir,
+		      kvsns_cookie_t cookie, int flags,
+		      kvsns_dentry_t *dirent, kvsns_cookie_t *cookies,
+		      int *size, bool *eof)
+{
+	kvsal_item_t *items = NULL;
+	kvsns_cookie_t *next = NULL;
+	int *rcs = NULL;
+	char k[KLEN];
+	kvsns_cookie_t from;
+	int seen;
+	int nb;
+	int i, j;
+	int rc;
+
+	if (!cred || !dir || !dirent || !size || !eof || *size <= 0)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_access, cred, &dir->ino, KVSNS_ACCESS_READ);
+
+	items = malloc((*size + 1)*sizeof(kvsal_item_t));
+	next = malloc(*size*sizeof(kvsns_cookie_t));
+	rcs = malloc(*size*sizeof(int));
+	if (!items || !next || !rcs) {
+		rc = -ENOMEM;
+		goto errout;
+	}
+
+	snprintf(k, KLEN, "%llu.dentries", dir->ino);
+	from = cookie;
+	do {
+		/* One more entry than asked tells if the end is reached */
+		nb = *size + 1;
+		RC_WRAP_LABEL(rc, errout, kvsal_get_entries_from, k,
+			      from >> COOKIE_SKIP_BITS,
+			      from & COOKIE_SKIP_MAX, &nb, items);
+
+		*eof = (nb <= *size);
+		if (!*eof)
+			nb = *size;
+
+		seen = from & COOKIE_SKIP_MAX;
+		for (i = 0; i < nb ; i++) {
+			if (items[i].value != from >> COOKIE_SKIP_BITS)
+				seen = 0;
+			seen += 1;
+			if (seen > COOKIE_SKIP_MAX) {
+				rc = -EOVERFLOW;
+				goto errout;
+			}
+
+			strncpy(dirent[i].name, items[i].str, NAME_MAX);
+			dirent[i].inode = items[i].value;
+			from = (items[i].value << COOKIE_SKIP_BITS) | seen;
+			next[i] = from;
+		}
+
+		if (!(flags & KVSNS_READDIR_ATTRS))
+			break;
+
+		RC_WRAP_LABEL(rc, errout, kvsns_getattr_many, nb, dirent, rcs);
+
+		/* Entries removed since they were listed are skipped. If
+		 * that empties the page, the next one is read */
+		for (i = 0, j = 0; i < nb ; i++) {
+			if (rcs[i] == -ENOENT)
+				continue;
+			if (rcs[i] != 0) {
+				rc = rcs[i];
+				goto errout;
+			}
+			if (j != i) {
+				dirent[j] = dirent[i];
+				next[j] = next[i];
+			}
+			j += 1;
+		}
+		nb = j;
+	} while (nb == 0 && !*eof);
+
+	/* A listing updates the atime once, not on every page */
+	if ((flags & KVSNS_READDIR_ATIME) && cookie == 0)
+		RC_WRAP_LABEL(rc, errout, kvsns_atime_update, &dir->ino);
+
+	if (cookies)
+		memcpy(cookies, next, nb*sizeof(kvsns_cookie_t));
+	*size = nb;
+	rc = 0;
 
 errout:
-	if (items)
-		free(items);
+	free(items);
+	free(next);
+	free(rcs);
 
 	return rc;
 }
@@ -242,22 +504,18 @@ errout:
 int kvsns_lookup(kvsns_cred_t *cred, kvsns_ino_t *parent, char *name,
 		kvsns_ino_t *ino)
 {
-	char k[KLEN];
-	char v[VLEN];
+	int rc;
 
 	if (!cred || !parent || !name || !ino)
 		return -EINVAL;
 
 	RC_WRAP(kvsns_access, cred, parent, KVSNS_ACCESS_READ);
 
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *parent, name);
-
-	RC_WRAP(kvsal_get_char, k, v);
-
-	sscanf(v, "%llu", ino);
+	rc = kvsns_dentry_cache_get(parent, name, ino);
+	if (rc != -EAGAIN)
+		return rc;
 
-	return 0;
+	return kvsns_get_dentry(parent, name, ino);
 }
 
 int kvsns_lookupp(kvsns_cred_t *cred, kvsns_ino_t *dir, kvsns_ino_t *parent)
@@ -273,49 +531,30 @@ int kvsns_lookupp(kvsns_cred_t *cred, kvsns_ino_t *dir, kvsns_ino_t *parent)
 	snprintf(k, KLEN, "%llu.parentdir",
 		 *dir);
 
-	RC_WRAP(kvsal_get_char, k, v);
+	/* A directory has a single "<parent>/<name>" link */
+	RC_WRAP(kvsal_get_member, k, v);
 
-	sscanf(v, "%llu|", parent);
+	sscanf(v, "%llu/", parent);
 
 	return 0;
 }
 
 int kvsns_getattr(kvsns_cred_t *cred, kvsns_ino_t *ino, struct stat *bufstat)
 {
-	struct stat data_stat;
-	char k[KLEN];
-	int rc;
-
 	if (!cred || !ino || !bufstat)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.stat", *ino);
-	RC_WRAP(kvsal_get_stat, k, bufstat);
-
-	if (S_ISREG(bufstat->st_mode)) {
-		/* for file, information is to be retrieved form extstore */
-		rc = extstore_getattr(ino, &data_stat);
-		if (rc != 0) {
-			if (rc == -ENOENT)
-				return 0; /* no associated data */
-			else
-				return rc;
-		}
+	RC_WRAP(kvsns_get_stat_cached, ino, bufstat);
 
-		/* found associated data and store metadata */
-		bufstat->st_size = data_stat.st_size;
-		bufstat->st_size = data_stat.st_size;
-		bufstat->st_mtime = data_stat.st_mtime;
-		bufstat->st_atime = data_stat.st_atime;
-	}
+	/* An atime not written yet is the one to report */
+	kvsns_atime_getattr(ino, bufstat);
 
-	return 0;
+	return kvsns_getattr_data(ino, bufstat);
 }
 
 int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino,
 		  struct stat *setstat, int statflag)
 {
-	char k[KLEN];
 	struct stat bufstat;
 	struct timeval t;
 	mode_t ifmt;
@@ -331,8 +570,7 @@ int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino,
 
 	RC_WRAP(kvsns_access, cred, ino, KVSNS_ACCESS_WRITE);
 
-	snprintf(k, KLEN, "%llu.stat", *ino);
-	RC_WRAP(kvsal_get_stat, k, &bufstat);
+	RC_WRAP(kvsns_get_stat, ino, &bufstat);
 
 	/* ctime is to be updated if md are changed */
 	bufstat.st_ctim.tv_sec = t.tv_sec;
@@ -349,6 +587,10 @@ int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino,
 	if (statflag & STAT_GID_SET)
 		bufstat.st_gid = setstat->st_gid;
 
+	/* Cached data must not outlive a truncate */
+	if (statflag & (STAT_SIZE_SET|STAT_SIZE_ATTACH))
+		RC_WRAP(kvsns_page_cache_invalidate, ino);
+
 	if (statflag & STAT_SIZE_SET)
 		RC_WRAP(extstore_truncate, ino, setstat->st_size, true,
 			&bufstat);
@@ -360,11 +602,15 @@ int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino,
 	if (statflag & STAT_ATIME_SET) {
 		bufstat.st_atim.tv_sec = setstat->st_atim.tv_sec;
 		bufstat.st_atim.tv_nsec = setstat->st_atim.tv_nsec;
+		/* A deferred atime would overwrite the one set here */
+		kvsns_atime_forget(ino);
 	}
 
 	if (statflag & STAT_MTIME_SET) {
 		bufstat.st_mtim.tv_sec = setstat->st_mtim.tv_sec;
 		bufstat.st_mtim.tv_nsec = setstat->st_mtim.tv_nsec;
+		/* Not to be replaced by the time of the writes at close */
+		kvsns_file_mtime_set(ino);
 	}
 
 	if (statflag & STAT_CTIME_SET) {
@@ -372,76 +618,29 @@ int kvsns_setattr(kvsns_cred_t *cred, kvsns_ino_t *ino,
 		bufstat.st_ctim.tv_nsec = setstat->st_ctim.tv_nsec;
 	}
 
-	return kvsal_set_stat(k, &bufstat);
+	return kvsns_set_stat(ino, &bufstat);
 }
 
 int kvsns_link(kvsns_cred_t *cred, kvsns_ino_t *ino,
 	       kvsns_ino_t *dino, char *dname)
 {
-	int rc;
-	char k[KLEN];
-	char v[VLEN];
-	kvsns_ino_t tmpino = 0LL;
-	struct stat dino_stat;
-	struct stat ino_stat;
-
 	if (!cred || !ino || !dino || !dname)
 		return -EINVAL;
 
 	RC_WRAP(kvsns_access, cred, dino, KVSNS_ACCESS_WRITE);
 
-	rc = kvsns_lookup(cred, dino, dname, &tmpino);
-	if (rc == 0)
-		return -EEXIST;
-
-	RC_WRAP(kvsns_get_stat, dino, &dino_stat);
-	RC_WRAP(kvsns_get_stat, ino, &ino_stat);
-
-
-	snprintf(k, KLEN, "%llu.parentdir", *ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_get_char, k, v);
-
-	snprintf(k, KLEN, "%llu|", *dino);
-	strcat(v, k);
-
-	RC_WRAP(kvsal_begin_transaction);
-
-	snprintf(k, KLEN, "%llu.parentdir", *ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
+	RC_WRAP(kvsns_script_link, ino, dino, dname);
 
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *dino, dname);
-	snprintf(v, VLEN, "%llu", *ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &ino_stat,
-		      STAT_CTIME_SET|STAT_INCR_LINK);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, ino, &ino_stat);
-
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &dino_stat,
-		      STAT_CTIME_SET|STAT_MTIME_SET);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, dino, &dino_stat);
-
-	RC_WRAP(kvsal_end_transaction);
+	kvsns_stat_cache_del(ino);
+	kvsns_stat_cache_del(dino);
+	kvsns_dentry_cache_set(dino, dname, ino);
 
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 int kvsns_unlink(kvsns_cred_t *cred, kvsns_ino_t *dir, char *name)
 {
-	int rc;
-	char k[KLEN];
-	char v[VLEN];
 	kvsns_ino_t ino = 0LL;
-	kvsns_ino_t parent[KVSAL_ARRAY_SIZE];
-	struct stat ino_stat;
-	struct stat dir_stat;
-	int size;
-	int i;
 	bool opened;
 	bool deleted;
 
@@ -451,83 +650,15 @@ int kvsns_unlink(kvsns_cred_t *cred, kvsns_ino_t *dir, char *name)
 	if (!cred || !dir || !name)
 		return -EINVAL;
 
-	memset(parent, 0, KVSAL_ARRAY_SIZE*sizeof(kvsns_ino_t));
-	memset(&ino_stat, 0, sizeof(ino_stat));
-	memset(&dir_stat, 0, sizeof(dir_stat));
-
 	RC_WRAP(kvsns_access, cred, dir, KVSNS_ACCESS_WRITE);
 
-	RC_WRAP(kvsns_lookup, cred, dir, name, &ino);
-
-	RC_WRAP(kvsns_get_stat, dir, &dir_stat);
-	RC_WRAP(kvsns_get_stat, &ino, &ino_stat);
-
-	snprintf(k, KLEN, "%llu.parentdir", ino);
-	RC_WRAP(kvsal_get_char, k, v);
-
-	size = KVSAL_ARRAY_SIZE;
-	RC_WRAP(kvsns_str2parentlist, parent, &size, v);
-
-	/* Check if file is opened */
-	snprintf(k, KLEN, "%llu.openowner", ino);
-	rc = kvsal_exists(k);
-	if ((rc != 0) && (rc != -ENOENT))
-		return rc;
-
-	opened = (rc == -ENOENT) ? false : true;
-
-	RC_WRAP(kvsal_begin_transaction);
-
-	if (size == 1) {
-		/* Last link, try to perform deletion */
-		snprintf(k, KLEN, "%llu.parentdir", ino);
-		RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-		snprintf(k, KLEN, "%llu.stat", ino);
-		RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-		if (opened) {
-			/* File is opened, deleted it at last close */
-			snprintf(k, KLEN, "%llu.opened_and_deleted", ino);
-			snprintf(v, VLEN, "1");
-			RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-		}
-
-		/* Remove all associated xattr */
-		deleted = true;
-	} else {
-		for (i = 0; i < size ; i++)
-			if (parent[i] == *dir) {
-				/* In this list mgmt, setting value 0
-				 * will make it ignored as str is rebuilt */
-				parent[i] = 0;
-				break;
-			}
-		snprintf(k, KLEN, "%llu.parentdir", ino);
-		RC_WRAP_LABEL(rc, aborted, kvsns_parentlist2str,
-			      parent, size, v);
-		RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-		RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &ino_stat,
-			 STAT_CTIME_SET|STAT_DECR_LINK);
-		RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, &ino, &ino_stat);
-	}
-
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *dir, name);
-	RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-	/* if object is a link, delete the link content as well */
-	if ((ino_stat.st_mode & S_IFLNK) == S_IFLNK) {
-		snprintf(k, KLEN, "%llu.link", ino);
-		RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-	}
-
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &dir_stat,
-		      STAT_MTIME_SET|STAT_CTIME_SET);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, dir, &dir_stat);
+	/* The dentry, the parent list and the attributes (or the whole
+	 * inode for the last link) are updated in one atomic operation */
+	RC_WRAP(kvsns_script_unlink, dir, name, &ino, &deleted, &opened);
 
-	RC_WRAP(kvsal_end_transaction);
+	kvsns_stat_cache_del(dir);
+	kvsns_stat_cache_del(&ino);
+	kvsns_dentry_cache_set(dir, name, NULL);
 
 	/* Call to object store : do not mix with metadata transaction */
 	if (!opened)
@@ -536,85 +667,27 @@ int kvsns_unlink(kvsns_cred_t *cred, kvsns_ino_t *dir, char *name)
 	if (deleted)
 		RC_WRAP(kvsns_remove_all_xattr, cred, &ino);
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 int kvsns_rename(kvsns_cred_t *cred,  kvsns_ino_t *sino,
 		 char *sname, kvsns_ino_t *dino, char *dname)
 {
-	int rc = 0;
-	char k[KLEN];
-	char v[VLEN];
 	kvsns_ino_t ino = 0LL;
-	kvsns_ino_t parent[KVSAL_ARRAY_SIZE];
-	struct stat sino_stat;
-	struct stat dino_stat;
-	int size = 0;
-	int i = 0;
 
 	if (!cred || !sino || !sname || !dino || !dname)
 		return -EINVAL;
 
-	memset(parent, 0, KVSAL_ARRAY_SIZE*sizeof(kvsns_ino_t));
-	memset(&sino_stat, 0, sizeof(sino_stat));
-	memset(&dino_stat, 0, sizeof(dino_stat));
-
 	RC_WRAP(kvsns_access, cred, sino, KVSNS_ACCESS_WRITE);
 
 	RC_WRAP(kvsns_access, cred, dino, KVSNS_ACCESS_WRITE);
 
-	rc = kvsns_lookup(cred, dino, dname, &ino);
-	if (rc == 0)
-		return -EEXIST;
-
-	RC_WRAP(kvsns_get_stat, sino, &sino_stat);
-	if (*sino != *dino)
-		RC_WRAP(kvsns_get_stat, dino, &dino_stat);
-
-	RC_WRAP(kvsns_lookup, cred, sino, sname, &ino);
+	RC_WRAP(kvsns_script_rename, sino, sname, dino, dname, &ino);
 
-	snprintf(k, KLEN, "%llu.parentdir", ino);
-	RC_WRAP(kvsal_get_char, k, v);
-
-	size = KVSAL_ARRAY_SIZE;
-	RC_WRAP(kvsns_str2parentlist, parent, &size, v);
-	for (i = 0; i < size ; i++)
-		if (parent[i] == *sino) {
-			parent[i] = *dino;
-			break;
-		}
-
-	RC_WRAP(kvsal_begin_transaction);
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *sino, sname);
-	RC_WRAP_LABEL(rc, aborted, kvsal_del, k);
-
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *dino, dname);
-	snprintf(v, VLEN, "%llu", ino);
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-	snprintf(k, KLEN, "%llu.parentdir", ino);
-	RC_WRAP_LABEL(rc, aborted, kvsns_parentlist2str, parent, size, v);
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &sino_stat,
-		      STAT_CTIME_SET|STAT_MTIME_SET);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, sino, &sino_stat);
-	if (*sino != *dino) {
-		RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &dino_stat,
-			 STAT_CTIME_SET|STAT_MTIME_SET);
-		RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, dino, &dino_stat);
-	}
-	RC_WRAP(kvsal_end_transaction);
+	kvsns_stat_cache_del(sino);
+	kvsns_stat_cache_del(dino);
+	kvsns_dentry_cache_set(sino, sname, NULL);
+	kvsns_dentry_cache_set(dino, dname, &ino);
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 
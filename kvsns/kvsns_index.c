@@ -0,0 +1,305 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* kvsns_index.c
+ * KVSNS: secondary indexes of the inode attributes
+ *
+ * The "indexes" key of the [kvsns] section lists the indexes kept, any
+ * of mtime, size, uid and gid separated by commas (none by default):
+ *	index.mtime     : sorted set of the inodes, scored by mtime (seconds)
+ *	index.size      : sorted set of the inodes, scored by size
+ *	index.uid.<uid> : the inodes of a user, scored by inode number
+ *	index.gid.<gid> : the inodes of a group, scored by inode number
+ * They are updated by the scripts that write the inode records, in the
+ * same atomic step, so every client of a namespace must use the same
+ * list. kvsns_index_rebuild() builds them for an existing namespace.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <ini_config.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include "kvsns_internal.h"
+
+/* Inodes indexed by a single script call during a rebuild */
+#define INDEX_REBUILD_BATCH 128
+
+struct index_desc {
+	const char *name;	/* in the config and the keys */
+	int offset;		/* of the field in the inode record */
+	const char *fmt;	/* of the field, for struct.unpack */
+	bool per_value;		/* one key per value of the field */
+};
+
+static const struct index_desc index_descs[KVSNS_INDEX_MAX] = {
+	[KVSNS_INDEX_MTIME] = { "mtime", KVSAL_RECORD_MTIME, "<I8", false },
+	[KVSNS_INDEX_SIZE] = { "size", KVSAL_RECORD_SIZE, "<I8", false },
+	[KVSNS_INDEX_UID] = { "uid", KVSAL_RECORD_UID, "<I4", true },
+	[KVSNS_INDEX_GID] = { "gid", KVSAL_RECORD_GID, "<I4", true },
+};
+
+static bool index_on[KVSNS_INDEX_MAX];
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static int index_users;
+
+int kvsns_index_init(struct collection_item *cfg_items)
+{
+	struct collection_item *item;
+	bool on[KVSNS_INDEX_MAX];
+	char list[VLEN];
+	char *saveptr;
+	char *name;
+	const char *v;
+	int rc = 0;
+	int i;
+
+	pthread_mutex_lock(&index_lock);
+
+	/* kvsns_start is done by every thread, the first one reads the
+	 * list. It does not change while the library is used, the
+	 * scripts are built from it */
+	if (index_users > 0)
+		goto out;
+
+	memset(on, 0, sizeof(on));
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "indexes", cfg_items,
+		      &item);
+	if (item != NULL) {
+		v = get_const_string_config_value(item, NULL);
+		if (!v) {
+			rc = -EINVAL;
+			goto out;
+		}
+		strncpy(list, v, VLEN - 1);
+		list[VLEN - 1] = '\0';
+
+		for (name = strtok_r(list, ", ", &saveptr); name;
+		     name = strtok_r(NULL, ", ", &saveptr)) {
+			for (i = 0; i < KVSNS_INDEX_MAX; i++)
+				if (!strcmp(name, index_descs[i].name))
+					break;
+			if (i == KVSNS_INDEX_MAX) {
+				rc = -EINVAL;
+				goto out;
+			}
+			on[i] = true;
+		}
+	}
+
+	memcpy(index_on, on, sizeof(index_on));
+
+out:
+	if (rc == 0)
+		index_users += 1;
+	pthread_mutex_unlock(&index_lock);
+	return rc;
+}
+
+int kvsns_index_fini(void)
+{
+	pthread_mutex_lock(&index_lock);
+	if (index_users > 0)
+		index_users -= 1;
+	pthread_mutex_unlock(&index_lock);
+
+	return 0;
+}
+
+bool kvsns_index_enabled(void)
+{
+	int i;
+
+	for (i = 0; i < KVSNS_INDEX_MAX; i++)
+		if (index_on[i])
+			return true;
+
+	return false;
+}
+
+/* The enabled indexes as a Lua table, for the prelude of the scripts:
+ * {{key, offset, format, per_value}, ...} */
+int kvsns_index_lua(char *buf, size_t len)
+{
+	size_t n;
+	int i;
+
+	n = snprintf(buf, len, "{");
+	for (i = 0; i < KVSNS_INDEX_MAX && n < len; i++) {
+		if (!index_on[i])
+			continue;
+		n += snprintf(buf + n, len - n, "{'index.%s', %d, '%s', %s},",
+			      index_descs[i].name, index_descs[i].offset,
+			      index_descs[i].fmt,
+			      index_descs[i].per_value ? "true" : "false");
+	}
+	if (n < len)
+		n += snprintf(buf + n, len - n, "}");
+
+	return (n < len) ? 0 : -ENAMETOOLONG;
+}
+
+int kvsns_index_query(enum kvsns_index index, unsigned long long min,
+		      unsigned long long max, kvsns_index_cursor_t *cursor,
+		      kvsns_ino_t *inos, int *size, bool *eof)
+{
+	kvsal_item_t *items;
+	char k[KLEN];
+	int nb;
+	int i;
+	int rc;
+
+	if (index < 0 || index >= KVSNS_INDEX_MAX || !cursor || !inos ||
+	    !size || !eof || *size <= 0)
+		return -EINVAL;
+
+	if (!index_on[index])
+		return -EOPNOTSUPP;
+
+	/* The inodes of a uid or a gid are scored by their number */
+	if (index_descs[index].per_value) {
+		snprintf(k, KLEN, "index.%s.%llu", index_descs[index].name,
+			 min);
+		min = 0;
+		max = ~0ULL;
+	} else {
+		snprintf(k, KLEN, "index.%s", index_descs[index].name);
+	}
+
+	if (cursor->value < min) {
+		cursor->value = min;
+		cursor->skip = 0;
+	}
+
+	if (cursor->value > max) {
+		*size = 0;
+		*eof = true;
+		return 0;
+	}
+
+	items = malloc((*size + 1) * sizeof(kvsal_item_t));
+	if (!items)
+		return -ENOMEM;
+
+	/* One more inode than asked tells if the end is reached */
+	nb = *size + 1;
+	RC_WRAP_LABEL(rc, out, kvsal_get_entries_from, k, cursor->value,
+		      cursor->skip, &nb, items);
+
+	*eof = (nb <= *size);
+	for (i = 0; i < nb; i++) {
+		if (items[i].value > max) {
+			*eof = true;
+			break;
+		}
+		if (i == *size)
+			break;
+
+		inos[i] = strtoull(items[i].str, NULL, 10);
+
+		/* Inodes of the same value are paged with an offset */
+		if (items[i].value == cursor->value) {
+			cursor->skip += 1;
+		} else {
+			cursor->value = items[i].value;
+			cursor->skip = 1;
+		}
+	}
+	*size = i;
+	rc = 0;
+
+out:
+	free(items);
+	return rc;
+}
+
+struct index_rebuild {
+	pthread_mutex_t lock;
+	kvsns_ino_t inos[INDEX_REBUILD_BATCH];
+	int nb;
+};
+
+static int index_rebuild_entry(void *arg, const char *path,
+			       kvsns_dentry_t *dentry)
+{
+	struct index_rebuild *rebuild = arg;
+	int rc = 0;
+
+	pthread_mutex_lock(&rebuild->lock);
+	rebuild->inos[rebuild->nb++] = dentry->inode;
+	if (rebuild->nb == INDEX_REBUILD_BATCH) {
+		rc = kvsns_script_index(rebuild->nb, rebuild->inos);
+		rebuild->nb = 0;
+	}
+	pthread_mutex_unlock(&rebuild->lock);
+
+	return rc;
+}
+
+int kvsns_index_rebuild(void)
+{
+	struct index_rebuild rebuild;
+	kvsal_item_t items[KVSAL_ARRAY_SIZE];
+	kvsal_list_t list;
+	kvsns_cred_t cred = { .uid = 0, .gid = 0 };
+	kvsns_ino_t root = KVSNS_ROOT_INODE;
+	int size;
+	int i;
+	int rc;
+
+	if (!kvsns_index_enabled())
+		return -EOPNOTSUPP;
+
+	/* Drop the entries of indexes that were off or of inodes gone */
+	RC_WRAP(kvsal_fetch_list, "index.*", &list);
+	do {
+		size = KVSAL_ARRAY_SIZE;
+		RC_WRAP(kvsal_get_list, &list, 0, &size, items);
+
+		for (i = 0; i < size ; i++)
+			RC_WRAP(kvsal_del, items[i].str);
+	} while (size > 0);
+	RC_WRAP(kvsal_dispose_list, &list);
+
+	/* Updates made meanwhile go through the scripts, indexing an inode
+	 * again is harmless */
+	pthread_mutex_init(&rebuild.lock, NULL);
+	rebuild.nb = 0;
+	rc = kvsns_walk(&cred, &root, "", NULL, NULL, index_rebuild_entry,
+			&rebuild, NULL);
+	if (rc == 0 && rebuild.nb > 0)
+		rc = kvsns_script_index(rebuild.nb, rebuild.inos);
+	pthread_mutex_destroy(&rebuild.lock);
+
+	return rc;
+}
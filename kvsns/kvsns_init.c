@@ -43,10 +43,9 @@
 #include <kvsns/extstore.h>
 #include "kvsns_internal.h"
 
-static struct collection_item *cfg_items;
-
 int kvsns_start(const char *configpath)
 {
+	struct collection_item *cfg_items = NULL;
 	struct collection_item *errors = NULL;
 	int rc;
 
@@ -59,19 +58,74 @@ int kvsns_start(const char *configpath)
 		return -rc;
 	}
 
-	RC_WRAP(kvsal_init, cfg_items);
+	/* Every thread starts the library and each step counts its users,
+	 * a failed start gives back the steps already done. The settings
+	 * are copied by the steps, the config is not kept */
+	RC_WRAP_LABEL(rc, out, kvsal_init, cfg_items);
+
+	/* The scripts maintain the indexes */
+	RC_WRAP_LABEL(rc, kvsal, kvsns_index_init, cfg_items);
+
+	RC_WRAP_LABEL(rc, index, kvsns_scripts_init);
+
+	RC_WRAP_LABEL(rc, scripts, extstore_init, cfg_items);
+
+	RC_WRAP_LABEL(rc, extstore, kvsns_file_init, cfg_items);
 
-	RC_WRAP(extstore_init, cfg_items);
+	RC_WRAP_LABEL(rc, extstore, kvsns_cache_init, cfg_items);
+
+	RC_WRAP_LABEL(rc, cache, kvsns_page_cache_init, cfg_items);
+
+	RC_WRAP_LABEL(rc, page_cache, kvsns_atime_init, cfg_items);
+
+	RC_WRAP_LABEL(rc, atime, kvsns_inode_lease_init, cfg_items);
 
 	/** @todo : remove all existing opened FD (crash recovery) */
-	return 0;
+	goto out;
+
+atime:
+	kvsns_atime_fini();
+page_cache:
+	kvsns_page_cache_fini();
+cache:
+	kvsns_cache_fini();
+extstore:
+	extstore_fini();
+scripts:
+	kvsns_scripts_fini();
+index:
+	kvsns_index_fini();
+kvsal:
+	kvsal_fini();
+out:
+	free_ini_config_errors(cfg_items);
+	return rc;
 }
 
+/* Every step is stopped even if one fails, the first error is returned */
 int kvsns_stop(void)
 {
-	RC_WRAP(kvsal_fini);
-	free_ini_config_errors(cfg_items);
-	return 0;
+	int (*fini[])(void) = {
+		kvsns_inode_lease_fini,
+		kvsns_atime_fini,
+		kvsns_page_cache_fini,
+		kvsns_cache_fini,
+		extstore_fini,
+		kvsns_scripts_fini,
+		kvsns_index_fini,
+		kvsal_fini,
+	};
+	int ret = 0;
+	int rc;
+	int i;
+
+	for (i = 0; i < sizeof(fini) / sizeof(fini[0]); i++) {
+		rc = fini[i]();
+		if (ret == 0)
+			ret = rc;
+	}
+
+	return ret;
 }
 
 int kvsns_init_root(int openbar)
@@ -83,9 +137,10 @@ int kvsns_init_root(int openbar)
 
 	ino = KVSNS_ROOT_INODE;
 
+	/* The root is its own parent, with no name */
 	snprintf(k, KLEN, "%llu.parentdir", ino);
-	snprintf(v, VLEN, "%llu|", ino);
-	RC_WRAP(kvsal_set_char, k, v);
+	snprintf(v, VLEN, "%llu/", ino);
+	RC_WRAP(kvsal_add_member, k, v);
 
 	snprintf(k, KLEN, "ino_counter");
 	snprintf(v, VLEN, "3");
@@ -105,8 +160,7 @@ int kvsns_init_root(int openbar)
 	bufstat.st_mtim.tv_sec = 0;
 	bufstat.st_ctim.tv_sec = 0;
 
-	snprintf(k, KLEN, "%llu.stat", ino);
-	RC_WRAP(kvsal_set_stat, k, &bufstat);
+	RC_WRAP(kvsns_set_stat, &ino, &bufstat);
 
 	return 0;
 }
@@ -37,78 +37,154 @@
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <pthread.h>
 #include <kvsns/kvsal.h>
 #include <kvsns/kvsns.h>
 #include "kvsns_internal.h"
 
-int kvsns_next_inode(kvsns_ino_t *ino)
+/* Inode numbers are leased by blocks from "ino_counter" and then handed
+ * out locally. The block size doubles when a lease is used up within
+ * INODE_LEASE_FAST seconds (creation burst) and halves when it lasted
+ * more than INODE_LEASE_SLOW seconds, between inode_lease_size and
+ * inode_lease_max. */
+#define INODE_LEASE_SIZE_DEFAULT 64
+#define INODE_LEASE_MAX_DEFAULT 4096
+#define INODE_LEASE_FAST 1
+#define INODE_LEASE_SLOW 10
+
+static struct inode_lease {
+	pthread_mutex_t lock;
+	kvsns_ino_t next;	/* next inode to hand out */
+	kvsns_ino_t end;	/* last inode of the lease */
+	unsigned int size;
+	unsigned int min;
+	unsigned int max;
+	time_t leased;		/* when the lease was taken */
+	unsigned int users;	/* kvsns_start not yet stopped */
+} lease = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.size = 1,
+	.min = 1,
+	.max = 1,
+};
+
+/* kvsns_start is done by every thread, the lease is shared: the first
+ * one sets it up, the last kvsns_stop gives it back */
+int kvsns_inode_lease_init(struct collection_item *cfg_items)
 {
-	int rc;
-	if (!ino)
-		return -EINVAL;
-
-	rc = kvsal_incr_counter("ino_counter", ino);
-	if (rc != 0)
-		return rc;
+	struct collection_item *item;
+	unsigned int min = INODE_LEASE_SIZE_DEFAULT;
+	unsigned int max = INODE_LEASE_MAX_DEFAULT;
+	int rc = 0;
 
-	return 0;
+	pthread_mutex_lock(&lease.lock);
+	if (lease.users > 0)
+		goto out;
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "inode_lease_size",
+		      cfg_items, &item);
+	if (item != NULL)
+		min = get_unsigned_config_value(item, 0, min, NULL);
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "inode_lease_max",
+		      cfg_items, &item);
+	if (item != NULL)
+		max = get_unsigned_config_value(item, 0, max, NULL);
+
+	if (min == 0)
+		min = 1;
+	if (max < min)
+		max = min;
+
+	lease.min = min;
+	lease.max = max;
+	lease.size = min;
+	lease.next = 0;
+	lease.end = 0;
+
+out:
+	if (rc == 0)
+		lease.users += 1;
+	pthread_mutex_unlock(&lease.lock);
+	return rc;
 }
 
-int kvsns_str2parentlist(kvsns_ino_t *inolist, int *size, char *str)
+int kvsns_inode_lease_fini(void)
 {
-	char *token;
-	char *rest = str;
-	int maxsize = 0;
-	int pos = 0;
+	int rc = 0;
 
-	if (!inolist || !str || !size)
-		return -EINVAL;
+	pthread_mutex_lock(&lease.lock);
+	if (lease.users > 0)
+		lease.users -= 1;
+	if (lease.users > 0)
+		goto out;
 
-	maxsize = *size;
+	/* Give the unused inodes back, if nobody leased after us */
+	if (lease.end != 0 && lease.next <= lease.end)
+		rc = kvsns_script_release_inodes(&lease.next, &lease.end);
+	lease.next = 0;
+	lease.end = 0;
 
-	while ((token = strtok_r(rest, "|", &rest))) {
-		sscanf(token, "%llu", &inolist[pos++]);
+out:
+	pthread_mutex_unlock(&lease.lock);
+	return rc;
+}
 
-		if (pos == maxsize)
-			break;
+static int kvsns_inode_lease_renew(void)
+{
+	struct timespec now;
+	unsigned long long v;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (lease.end != 0) {
+		if (now.tv_sec - lease.leased < INODE_LEASE_FAST)
+			lease.size = (2 * lease.size < lease.max) ?
+				     2 * lease.size : lease.max;
+		else if (now.tv_sec - lease.leased > INODE_LEASE_SLOW)
+			lease.size = (lease.size / 2 > lease.min) ?
+				     lease.size / 2 : lease.min;
 	}
 
-	*size = pos;
+	RC_WRAP(kvsal_incrby_counter, "ino_counter", lease.size, &v);
+
+	lease.end = v;
+	lease.next = v - lease.size + 1;
+	lease.leased = now.tv_sec;
 
 	return 0;
 }
 
-int kvsns_parentlist2str(kvsns_ino_t *inolist, int size, char *str)
+int kvsns_next_inode(kvsns_ino_t *ino)
 {
-	int i;
-	char tmp[VLEN];
+	int rc = 0;
 
-	if (!inolist || !str)
+	if (!ino)
 		return -EINVAL;
 
-	strcpy(str, "");
+	pthread_mutex_lock(&lease.lock);
+	if (lease.end == 0 || lease.next > lease.end)
+		rc = kvsns_inode_lease_renew();
 
-	for (i = 0; i < size ; i++)
-		if (inolist[i] != 0LL) {
-			snprintf(tmp, VLEN, "%llu|", inolist[i]);
-			strcat(str, tmp);
-		}
+	if (rc == 0)
+		*ino = lease.next++;
+	pthread_mutex_unlock(&lease.lock);
 
-	return 0;
+	return rc;
 }
 
 int kvsns_update_stat(kvsns_ino_t *ino, int flags)
 {
-	char k[KLEN];
 	struct stat stat;
 
 	if (!ino)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.stat", *ino);
-	RC_WRAP(kvsal_get_stat, k, &stat);
+	RC_WRAP(kvsns_get_stat, ino, &stat);
 	RC_WRAP(kvsns_amend_stat, &stat, flags);
-	RC_WRAP(kvsal_set_stat, k, &stat);
+	RC_WRAP(kvsns_set_stat, ino, &stat);
 
 	return 0;
 }
@@ -155,10 +231,7 @@ int kvsns_create_entry(kvsns_cred_t *cred, kvsns_ino_t *parent,
 		       kvsns_ino_t *new_entry, enum kvsns_type type)
 {
 	int rc;
-	char k[KLEN];
-	char v[KLEN];
 	struct stat bufstat;
-	struct stat parent_stat;
 	struct timeval t;
 
 	if (!cred || !parent || !name || !new_entry)
@@ -167,25 +240,7 @@ int kvsns_create_entry(kvsns_cred_t *cred, kvsns_ino_t *parent,
 	if ((type == KVSNS_SYMLINK) && (lnk == NULL))
 		return -EINVAL;
 
-	rc = kvsns_lookup(cred, parent, name, new_entry);
-	if (rc == 0)
-		return -EEXIST;
-
 	RC_WRAP(kvsns_next_inode, new_entry);
-	RC_WRAP(kvsns_get_stat, parent, &parent_stat);
-
-	RC_WRAP(kvsal_begin_transaction);
-
-	snprintf(k, KLEN, "%llu.dentries.%s",
-		 *parent, name);
-	snprintf(v, VLEN, "%llu", *new_entry);
-
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
-
-	snprintf(k, KLEN, "%llu.parentdir", *new_entry);
-	snprintf(v, VLEN, "%llu|", *parent);
-
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, v);
 
 	/* Set stat */
 	memset(&bufstat, 0, sizeof(struct stat));
@@ -224,24 +279,22 @@ int kvsns_create_entry(kvsns_cred_t *cred, kvsns_ino_t *parent,
 	default:
 		return -EINVAL;
 	}
-	snprintf(k, KLEN, "%llu.stat", *new_entry);
-	RC_WRAP_LABEL(rc, aborted, kvsal_set_stat, k, &bufstat);
 
-	if (type == KVSNS_SYMLINK) {
-		snprintf(k, KLEN, "%llu.link", *new_entry);
-		RC_WRAP_LABEL(rc, aborted, kvsal_set_char, k, lnk);
+	/* Dentry, parent list, attributes and link content are created,
+	 * and the parent's times updated, in one atomic operation */
+	rc = kvsns_script_create(parent, name, new_entry, &bufstat,
+				 (type == KVSNS_SYMLINK) ? lnk : NULL);
+	if (rc == -EEXIST) {
+		kvsns_get_dentry(parent, name, new_entry);
+		return rc;
 	}
+	if (rc != 0)
+		return rc;
 
-	RC_WRAP_LABEL(rc, aborted, kvsns_amend_stat, &parent_stat,
-		      STAT_CTIME_SET|STAT_MTIME_SET);
-	RC_WRAP_LABEL(rc, aborted, kvsns_set_stat, parent, &parent_stat);
-
-	RC_WRAP(kvsal_end_transaction);
+	kvsns_stat_cache_del(parent);
+	kvsns_stat_cache_set(new_entry, &bufstat);
+	kvsns_dentry_cache_set(parent, name, new_entry);
 	return 0;
-
-aborted:
-	kvsal_discard_transaction();
-	return rc;
 }
 
 
@@ -302,11 +355,15 @@ int kvsns_access(kvsns_cred_t *cred, kvsns_ino_t *ino, int flags)
 	if (!cred || !ino)
 		return -EINVAL;
 
-	RC_WRAP(kvsns_getattr, cred, ino, &stat);
+	/* Only mode and owners matter here, they are not kept by the
+	 * extstore so there is no need for a full kvsns_getattr */
+	RC_WRAP(kvsns_get_stat_cached, ino, &stat);
 
 	return kvsns_access_check(cred, &stat, flags);
 }
 
+/* Reads the stat from the KVS. The cache is refreshed but not used:
+ * this is what read-modify-write sequences must call */
 int kvsns_get_stat(kvsns_ino_t *ino, struct stat *bufstat)
 {
 	char k[KLEN];
@@ -315,7 +372,42 @@ int kvsns_get_stat(kvsns_ino_t *ino, struct stat *bufstat)
 		return -EINVAL;
 
 	snprintf(k, KLEN, "%llu.stat", *ino);
-	return kvsal_get_stat(k, bufstat);
+	RC_WRAP(kvsal_get_stat, k, bufstat);
+
+	kvsns_stat_cache_set(ino, bufstat);
+	return 0;
+}
+
+/* Same as kvsns_get_stat, but may return a cached value */
+int kvsns_get_stat_cached(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	if (!ino || !bufstat)
+		return -EINVAL;
+
+	if (kvsns_stat_cache_get(ino, bufstat) == 0)
+		return 0;
+
+	return kvsns_get_stat(ino, bufstat);
+}
+
+/* Reads a dentry from the KVS and refreshes the dentry cache. Like
+ * kvsns_get_stat, this is to be used before modifying the namespace */
+int kvsns_get_dentry(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino)
+{
+	char k[KLEN];
+	int rc;
+
+	if (!parent || !name || !ino)
+		return -EINVAL;
+
+	snprintf(k, KLEN, "%llu.dentries", *parent);
+	rc = kvsal_get_entry(k, name, ino);
+	if (rc == 0)
+		kvsns_dentry_cache_set(parent, name, ino);
+	else if (rc == -ENOENT)
+		kvsns_dentry_cache_set(parent, name, NULL);
+
+	return rc;
 }
 
 int kvsns_set_stat(kvsns_ino_t *ino, struct stat *bufstat)
@@ -325,8 +417,17 @@ int kvsns_set_stat(kvsns_ino_t *ino, struct stat *bufstat)
 	if (!ino || !bufstat)
 		return -EINVAL;
 
-	snprintf(k, KLEN, "%llu.stat", *ino);
-	return kvsal_set_stat(k, bufstat);
+	/* The script compares the record with the previous one to update
+	 * the indexes */
+	if (kvsns_index_enabled()) {
+		RC_WRAP(kvsns_script_set_stat, ino, bufstat);
+	} else {
+		snprintf(k, KLEN, "%llu.stat", *ino);
+		RC_WRAP(kvsal_set_stat, k, bufstat);
+	}
+
+	kvsns_stat_cache_set(ino, bufstat);
+	return 0;
 }
 
 int kvsns_lookup_path(kvsns_cred_t *cred, kvsns_ino_t *parent, char *path,
@@ -39,6 +39,7 @@
 #include <ini_config.h>
 #include <kvsns/kvsns.h>
 #include <string.h>
+#include <stdbool.h>
 
 #define RC_WRAP(__function, ...) ({\
 	int __rc = __function(__VA_ARGS__);\
@@ -51,16 +52,83 @@
 		goto __label; })
 
 int kvsns_next_inode(kvsns_ino_t *ino);
-int kvsns_str2parentlist(kvsns_ino_t *inolist, int *size, char *str);
-int kvsns_parentlist2str(kvsns_ino_t *inolist, int size, char *str);
+int kvsns_inode_lease_init(struct collection_item *cfg_items);
+int kvsns_inode_lease_fini(void);
 int kvsns_create_entry(kvsns_cred_t *cred, kvsns_ino_t *parent,
 		       char *name, char *lnk, mode_t mode,
 		       kvsns_ino_t *newdir, enum kvsns_type type);
 int kvsns_get_stat(kvsns_ino_t *ino, struct stat *bufstat);
+int kvsns_get_stat_cached(kvsns_ino_t *ino, struct stat *bufstat);
 int kvsns_set_stat(kvsns_ino_t *ino, struct stat *bufstat);
 int kvsns_update_stat(kvsns_ino_t *ino, int flags);
 int kvsns_amend_stat(struct stat *stat, int flags);
 int kvsns_delall_xattr(kvsns_cred_t *cred, kvsns_ino_t *ino);
 
+int kvsns_file_init(struct collection_item *cfg_items);
+bool kvsns_file_writing(kvsns_ino_t *ino);
+bool kvsns_file_attrs_while_written(void);
+void kvsns_file_mtime_set(kvsns_ino_t *ino);
+
+int kvsns_get_dentry(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino);
+
+/* Inode attributes and dentry caches */
+int kvsns_cache_init(struct collection_item *cfg_items);
+int kvsns_cache_fini(void);
+void kvsns_cache_flush(void);
+int kvsns_stat_cache_get(kvsns_ino_t *ino, struct stat *bufstat);
+void kvsns_stat_cache_set(kvsns_ino_t *ino, struct stat *bufstat);
+void kvsns_stat_cache_del(kvsns_ino_t *ino);
+int kvsns_dentry_cache_get(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino);
+void kvsns_dentry_cache_set(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino);
+void kvsns_dentry_cache_del(kvsns_ino_t *parent, char *name);
+
+/* Read-ahead and write-behind cache of file data */
+int kvsns_page_cache_init(struct collection_item *cfg_items);
+int kvsns_page_cache_fini(void);
+int kvsns_page_cache_open(kvsns_ino_t *ino);
+int kvsns_page_cache_release(kvsns_ino_t *ino);
+ssize_t kvsns_page_cache_read(kvsns_ino_t *ino, void *buf, size_t count,
+			      off_t offset);
+ssize_t kvsns_page_cache_write(kvsns_ino_t *ino, void *buf, size_t count,
+			       off_t offset, kvsns_durability_t how);
+int kvsns_page_cache_flush(kvsns_ino_t *ino);
+int kvsns_page_cache_invalidate(kvsns_ino_t *ino);
+void kvsns_page_cache_getattr(kvsns_ino_t *ino, struct stat *bufstat);
+void kvsns_page_cache_counters(kvsns_cache_stats_t *stats);
+
+/* Access time policies */
+int kvsns_atime_init(struct collection_item *cfg_items);
+int kvsns_atime_fini(void);
+int kvsns_atime_update(kvsns_ino_t *ino);
+int kvsns_atime_flush(void);
+void kvsns_atime_getattr(kvsns_ino_t *ino, struct stat *bufstat);
+void kvsns_atime_forget(kvsns_ino_t *ino);
+
+/* Secondary indexes */
+int kvsns_index_init(struct collection_item *cfg_items);
+int kvsns_index_fini(void);
+bool kvsns_index_enabled(void);
+int kvsns_index_lua(char *buf, size_t len);
+
+/* Namespace operations run as server side scripts */
+int kvsns_scripts_init(void);
+int kvsns_scripts_fini(void);
+int kvsns_script_create(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino,
+			struct stat *bufstat, char *lnk);
+int kvsns_script_link(kvsns_ino_t *ino, kvsns_ino_t *dino, char *dname);
+int kvsns_script_unlink(kvsns_ino_t *dir, char *name, kvsns_ino_t *ino,
+			bool *deleted, bool *opened);
+int kvsns_script_rename(kvsns_ino_t *sino, char *sname,
+			kvsns_ino_t *dino, char *dname, kvsns_ino_t *ino);
+int kvsns_script_release_inodes(kvsns_ino_t *next, kvsns_ino_t *end);
+int kvsns_script_open(kvsns_ino_t *ino, char *owner, bool writer);
+int kvsns_script_close(kvsns_ino_t *ino, char *owner, bool writer,
+		       struct stat *data, bool *delete);
+int kvsns_script_data_attrs(int nb, kvsns_ino_t *inos, struct stat *data);
+int kvsns_script_rmdir(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino);
+int kvsns_script_set_stat(kvsns_ino_t *ino, struct stat *bufstat);
+int kvsns_script_index(int nb, kvsns_ino_t *inos);
+int kvsns_script_atime(int nb, kvsns_ino_t *inos, struct timespec *atimes,
+		       int *updated);
 
 #endif
@@ -0,0 +1,1059 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* kvsns_pagecache.c
+ * KVSNS: read-ahead and write-behind cache of file data
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <ini_config.h>
+#include <kvsns/kvsns.h>
+#include <kvsns/extstore.h>
+#include "kvsns_internal.h"
+
+/* The data of open files is cached in pages of page_cache_page_size
+ * bytes, aligned on their size. A page is "loaded" when it holds what the
+ * store holds, zero filled past the end of file. Writes from handles with
+ * KVSNS_UNSTABLE durability are kept in the page as a dirty range; a page
+ * that was only written to is not loaded and holds nothing more than its
+ * dirty range. Dirty pages are sent to the store as one vectored write on
+ * close, fsync, when the file has write_behind dirty bytes or when memory
+ * is needed. The pages of a file are dropped at its last close, so that a
+ * file opened after another client closed it is read again from the
+ * store (close-to-open consistency). */
+#define PC_FILE_BUCKETS 256
+#define PC_PAGE_BUCKETS 64
+
+struct pc_page {
+	unsigned long long index;	/* offset / page_size */
+	char *data;
+	bool loaded;
+	bool pinned;			/* not to be reclaimed yet */
+	size_t dstart;			/* dirty range, empty if equal */
+	size_t dend;
+	struct pc_page *hnext;		/* hash chain */
+	struct pc_page *prev;		/* LRU list, head is MRU */
+	struct pc_page *next;
+};
+
+struct pc_file {
+	kvsns_ino_t ino;
+	unsigned int refs;		/* opens and users, under pc.lock */
+	pthread_mutex_t lock;
+	struct pc_page *buckets[PC_PAGE_BUCKETS];
+	struct pc_page *head;
+	struct pc_page *tail;
+	size_t dirty;			/* bytes in dirty ranges */
+	off_t size;			/* size seen by loads and writes */
+	bool size_exact;		/* a load met the end of file */
+	struct timespec mtime;		/* time of the last cached write */
+	off_t next_read;		/* where a sequential read goes on */
+	unsigned int ra_pages;		/* read-ahead window, in pages */
+	struct pc_file *hnext;
+	struct pc_file *prev;		/* reclaim list */
+	struct pc_file *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct pc_file *buckets[PC_FILE_BUCKETS];
+	struct pc_file *head;
+	struct pc_file *tail;
+	unsigned int nfiles;
+	size_t page_size;
+	unsigned long max_pages;
+	unsigned long used;		/* pages allocated by all files */
+	unsigned int ra_max;		/* in pages */
+	size_t write_behind;
+	bool enabled;
+	unsigned int users;		/* kvsns_start not yet stopped */
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long readahead;
+	unsigned long long flushes;
+} pc = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static inline unsigned int pc_hash(unsigned long long key)
+{
+	return (unsigned int)((key * 11400714819323198485ULL) >> 32);
+}
+
+static inline size_t pc_min(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+/* Page reservations against the memory budget */
+static bool pc_reserve(void)
+{
+	bool ok;
+
+	pthread_mutex_lock(&pc.lock);
+	ok = pc.used < pc.max_pages;
+	if (ok)
+		pc.used += 1;
+	pthread_mutex_unlock(&pc.lock);
+
+	return ok;
+}
+
+static void pc_unreserve(void)
+{
+	pthread_mutex_lock(&pc.lock);
+	pc.used -= 1;
+	pthread_mutex_unlock(&pc.lock);
+}
+
+static struct pc_page *pc_page_find(struct pc_file *f, unsigned long long index)
+{
+	struct pc_page *p;
+
+	p = f->buckets[pc_hash(index) % PC_PAGE_BUCKETS];
+	while (p && p->index != index)
+		p = p->hnext;
+
+	return p;
+}
+
+static void pc_page_unlink(struct pc_file *f, struct pc_page *p)
+{
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		f->head = p->next;
+
+	if (p->next)
+		p->next->prev = p->prev;
+	else
+		f->tail = p->prev;
+}
+
+static void pc_page_touch(struct pc_file *f, struct pc_page *p)
+{
+	if (f->head == p)
+		return;
+
+	pc_page_unlink(f, p);
+	p->prev = NULL;
+	p->next = f->head;
+	if (f->head)
+		f->head->prev = p;
+	f->head = p;
+	if (!f->tail)
+		f->tail = p;
+}
+
+static void pc_page_drop(struct pc_file *f, struct pc_page *p)
+{
+	struct pc_page **slot;
+
+	slot = &f->buckets[pc_hash(p->index) % PC_PAGE_BUCKETS];
+	while (*slot != p)
+		slot = &(*slot)->hnext;
+	*slot = p->hnext;
+
+	pc_page_unlink(f, p);
+	f->dirty -= p->dend - p->dstart;
+	free(p->data);
+	free(p);
+	pc_unreserve();
+}
+
+static unsigned int pc_evict_clean(struct pc_file *f, unsigned int want)
+{
+	struct pc_page *p;
+	struct pc_page *prev;
+	unsigned int n = 0;
+
+	for (p = f->tail; p && n < want; p = prev) {
+		prev = p->prev;
+		if (p->pinned || p->dend > p->dstart)
+			continue;
+
+		pc_page_drop(f, p);
+		n += 1;
+	}
+
+	return n;
+}
+
+static int pc_page_cmp(const void *a, const void *b)
+{
+	const struct pc_page *pa = *(const struct pc_page **)a;
+	const struct pc_page *pb = *(const struct pc_page **)b;
+
+	if (pa->index == pb->index)
+		return 0;
+
+	return pa->index < pb->index ? -1 : 1;
+}
+
+/* Sends all the dirty ranges of a file as a single vectored write, with
+ * the ranges of contiguous pages merged in a single extent. File's lock
+ * is held */
+static int pc_flush_locked(struct pc_file *f)
+{
+	struct pc_page **pages;
+	struct pc_page *p;
+	struct iovec *iov;
+	kvsns_extent_t *ext;
+	struct stat wstat;
+	bool stable;
+	size_t total = 0;
+	off_t off;
+	int n = 0;
+	int next = 0;
+	int i;
+	int rc;
+
+	if (f->dirty == 0)
+		return 0;
+
+	for (p = f->head; p; p = p->next)
+		if (p->dend > p->dstart)
+			n += 1;
+
+	pages = malloc(n * sizeof(*pages));
+	iov = malloc(n * sizeof(*iov));
+	ext = malloc(n * sizeof(*ext));
+	if (!pages || !iov || !ext) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	i = 0;
+	for (p = f->head; p; p = p->next)
+		if (p->dend > p->dstart)
+			pages[i++] = p;
+	qsort(pages, n, sizeof(*pages), pc_page_cmp);
+
+	for (i = 0; i < n; i++) {
+		p = pages[i];
+		off = p->index * pc.page_size + p->dstart;
+		iov[i].iov_base = p->data + p->dstart;
+		iov[i].iov_len = p->dend - p->dstart;
+		total += iov[i].iov_len;
+
+		if (next > 0 &&
+		    ext[next - 1].offset + ext[next - 1].len == off) {
+			ext[next - 1].len += iov[i].iov_len;
+		} else {
+			ext[next].offset = off;
+			ext[next].len = iov[i].iov_len;
+			next += 1;
+		}
+	}
+
+	/* The commit comes with close or fsync */
+	memset(&wstat, 0, sizeof(wstat));
+	rc = extstore_writev(&f->ino, iov, n, ext, next, KVSNS_UNSTABLE,
+			     &stable, &wstat);
+	if (rc >= 0 && (size_t)rc != total)
+		rc = -EIO;
+	if (rc < 0)
+		goto out;
+
+	/* Pages that were only written to are of no use any more */
+	for (i = 0; i < n; i++) {
+		p = pages[i];
+		f->dirty -= p->dend - p->dstart;
+		p->dstart = 0;
+		p->dend = 0;
+		if (!p->loaded)
+			pc_page_drop(f, p);
+	}
+
+	__sync_fetch_and_add(&pc.flushes, 1);
+	rc = 0;
+
+out:
+	free(pages);
+	free(iov);
+	free(ext);
+	return rc;
+}
+
+static void pc_file_destroy(struct pc_file *f)
+{
+	while (f->head) {
+		f->head->dstart = 0;
+		f->head->dend = 0;
+		pc_page_drop(f, f->head);
+	}
+
+	pthread_mutex_destroy(&f->lock);
+	free(f);
+}
+
+static void pc_file_unlink(struct pc_file *f)
+{
+	struct pc_file **slot;
+
+	slot = &pc.buckets[pc_hash(f->ino) % PC_FILE_BUCKETS];
+	while (*slot != f)
+		slot = &(*slot)->hnext;
+	*slot = f->hnext;
+
+	if (f->prev)
+		f->prev->next = f->next;
+	else
+		pc.head = f->next;
+	if (f->next)
+		f->next->prev = f->prev;
+	else
+		pc.tail = f->prev;
+
+	pc.nfiles -= 1;
+}
+
+static void pc_file_append(struct pc_file *f)
+{
+	f->prev = pc.tail;
+	f->next = NULL;
+	if (pc.tail)
+		pc.tail->next = f;
+	else
+		pc.head = f;
+	pc.tail = f;
+}
+
+/* Returns the file with a reference and its lock, NULL if it is not
+ * open. pc_file_put gives both back */
+static struct pc_file *pc_file_get(kvsns_ino_t ino)
+{
+	struct pc_file *f;
+
+	if (!pc.enabled)
+		return NULL;
+
+	pthread_mutex_lock(&pc.lock);
+	f = pc.buckets[pc_hash(ino) % PC_FILE_BUCKETS];
+	while (f && f->ino != ino)
+		f = f->hnext;
+	if (f)
+		f->refs += 1;
+	pthread_mutex_unlock(&pc.lock);
+
+	if (f)
+		pthread_mutex_lock(&f->lock);
+
+	return f;
+}
+
+/* Drops a reference and the lock of the file. The last reference
+ * flushes the file while it can still be found, so that an open racing
+ * with the last close waits for the data to be in the store. If this
+ * flush fails, the file stays in the cache with its dirty pages and the
+ * error is returned: the next flush, close or kvsns_stop tries again */
+static int pc_file_put(struct pc_file *f)
+{
+	bool last;
+	int rc = 0;
+
+	pthread_mutex_lock(&pc.lock);
+	last = (f->refs == 1);
+	pthread_mutex_unlock(&pc.lock);
+
+	if (last)
+		rc = pc_flush_locked(f);
+
+	pthread_mutex_lock(&pc.lock);
+	f->refs -= 1;
+	last = (f->refs == 0 && f->dirty == 0);
+	if (last)
+		pc_file_unlink(f);
+	pthread_mutex_unlock(&pc.lock);
+	pthread_mutex_unlock(&f->lock);
+
+	if (last)
+		pc_file_destroy(f);
+
+	return rc;
+}
+
+/* Makes room for want pages: clean pages of this file first, then the
+ * ones of the other files, flushing them if needed. The lock of the other
+ * files is only tried, the one of this file is held. A file is not freed
+ * while its lock is held, no reference is needed */
+static void pc_reclaim(struct pc_file *self, unsigned int want)
+{
+	struct pc_file *f;
+	unsigned int tries;
+	unsigned int n;
+
+	n = pc_evict_clean(self, want);
+
+	pthread_mutex_lock(&pc.lock);
+	tries = pc.nfiles;
+	pthread_mutex_unlock(&pc.lock);
+
+	for (; n < want && tries > 0; tries--) {
+		/* Take the first file and move it at the end of the list */
+		pthread_mutex_lock(&pc.lock);
+		f = pc.head;
+		if (!f) {
+			pthread_mutex_unlock(&pc.lock);
+			break;
+		}
+		if (f != pc.tail) {
+			pc.head = f->next;
+			pc.head->prev = NULL;
+			pc_file_append(f);
+		}
+		if (f == self || pthread_mutex_trylock(&f->lock) != 0)
+			f = NULL;
+		pthread_mutex_unlock(&pc.lock);
+
+		if (!f)
+			continue;
+
+		n += pc_evict_clean(f, want - n);
+		if (n < want && f->dirty > 0 && pc_flush_locked(f) == 0)
+			n += pc_evict_clean(f, want - n);
+		pthread_mutex_unlock(&f->lock);
+	}
+
+	if (n < want && self->dirty > 0 && pc_flush_locked(self) == 0)
+		pc_evict_clean(self, want - n);
+}
+
+/* Returns a new page, empty and not loaded, or NULL if the budget is
+ * exhausted and nothing can be reclaimed */
+static struct pc_page *pc_page_new(struct pc_file *f, unsigned long long index)
+{
+	struct pc_page **bucket;
+	struct pc_page *p;
+
+	if (!pc_reserve()) {
+		pc_reclaim(f, 1);
+		if (!pc_reserve())
+			return NULL;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (p)
+		p->data = malloc(pc.page_size);
+	if (!p || !p->data) {
+		free(p);
+		pc_unreserve();
+		return NULL;
+	}
+
+	p->index = index;
+	bucket = &f->buckets[pc_hash(index) % PC_PAGE_BUCKETS];
+	p->hnext = *bucket;
+	*bucket = p;
+
+	p->next = f->head;
+	if (f->head)
+		f->head->prev = p;
+	f->head = p;
+	if (!f->tail)
+		f->tail = p;
+
+	return p;
+}
+
+/* Loads the pages from index to last, plus the read-ahead window of a
+ * sequential read, with a single read. The run stops at the first page
+ * already in cache and at the end of file. Returns the number of pages
+ * loaded, 0 if no page could be allocated */
+static int pc_load(struct pc_file *f, unsigned long long index,
+		   unsigned long long last, bool sequential)
+{
+	struct pc_page **run;
+	struct iovec *iov;
+	kvsns_extent_t ext;
+	struct stat stat;
+	unsigned long long wanted = last;
+	unsigned long long end;
+	unsigned int max;
+	bool eof;
+	size_t start;
+	size_t keep;
+	size_t got;
+	int n = 0;
+	int i;
+	int rc;
+
+	if (sequential && pc.ra_max > 0) {
+		if (f->ra_pages == 0)
+			f->ra_pages = 1;
+		else if (f->ra_pages < pc.ra_max)
+			f->ra_pages = pc_min(2 * f->ra_pages, pc.ra_max);
+		last += f->ra_pages;
+	} else {
+		f->ra_pages = 0;
+	}
+
+	if (f->size_exact) {
+		end = (f->size + pc.page_size - 1) / pc.page_size;
+		if (last >= end)
+			last = (end > index) ? end - 1 : index;
+	}
+
+	max = last - index + 1;
+	run = malloc(max * sizeof(*run));
+	iov = malloc(max * sizeof(*iov));
+	if (!run || !iov) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (n = 0; n < max; n++) {
+		if (n > 0 && pc_page_find(f, index + n))
+			break;
+
+		run[n] = pc_page_new(f, index + n);
+		if (!run[n])
+			break;
+		run[n]->pinned = true;
+		iov[n].iov_base = run[n]->data;
+		iov[n].iov_len = pc.page_size;
+	}
+
+	if (n == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	ext.offset = index * pc.page_size;
+	ext.len = n * pc.page_size;
+	memset(&stat, 0, sizeof(stat));
+	rc = extstore_readv(&f->ino, iov, n, &ext, 1, &eof, &stat);
+	if (rc < 0) {
+		for (i = 0; i < n; i++)
+			pc_page_drop(f, run[i]);
+		goto out;
+	}
+
+	/* Past the end of file, pages read as zeros */
+	got = rc;
+	for (i = 0; i < n; i++) {
+		start = i * pc.page_size;
+		if (got < start + pc.page_size) {
+			keep = (got > start) ? got - start : 0;
+			memset(run[i]->data + keep, 0, pc.page_size - keep);
+		}
+		run[i]->loaded = true;
+		run[i]->pinned = false;
+	}
+
+	/* A read that got nothing only says the end is before it */
+	if (got > 0 || ext.offset == 0) {
+		if (ext.offset + (off_t)got > f->size)
+			f->size = ext.offset + got;
+		if (got < ext.len)
+			f->size_exact = true;
+	}
+
+	if (index + n - 1 > wanted)
+		__sync_fetch_and_add(&pc.readahead, index + n - 1 - wanted);
+	rc = n;
+
+out:
+	free(run);
+	free(iov);
+	return rc;
+}
+
+static ssize_t pc_read_locked(struct pc_file *f, char *buf, size_t count,
+			      off_t offset)
+{
+	struct pc_page *p;
+	unsigned long long index;
+	unsigned long long last;
+	bool sequential;
+	size_t done = 0;
+	size_t poff;
+	size_t n;
+	struct stat stat;
+	bool eof;
+	off_t pos;
+	int rc;
+
+	sequential = (offset == f->next_read);
+	last = (offset + count - 1) / pc.page_size;
+
+	while (done < count) {
+		pos = offset + done;
+		if (f->size_exact && pos >= f->size)
+			break;
+
+		index = pos / pc.page_size;
+		poff = pos % pc.page_size;
+
+		/* A page holding only written data is read from the store */
+		p = pc_page_find(f, index);
+		if (p && !p->loaded) {
+			RC_WRAP(pc_flush_locked, f);
+			p = pc_page_find(f, index);
+		}
+
+		if (p) {
+			__sync_fetch_and_add(&pc.hits, 1);
+		} else {
+			__sync_fetch_and_add(&pc.misses, 1);
+			rc = pc_load(f, index, last, sequential);
+			if (rc < 0)
+				return rc;
+			p = pc_page_find(f, index);
+		}
+
+		if (!p) {
+			/* Out of budget, read without caching */
+			RC_WRAP(pc_flush_locked, f);
+			rc = extstore_read(&f->ino, pos, count - done,
+					   buf + done, &eof, &stat);
+			if (rc < 0)
+				return rc;
+			done += rc;
+			break;
+		}
+
+		if (pos >= f->size)
+			break;
+
+		n = pc_min(pc_min(pc.page_size - poff, count - done),
+			   f->size - pos);
+		memcpy(buf + done, p->data + poff, n);
+		pc_page_touch(f, p);
+		done += n;
+	}
+
+	f->next_read = offset + done;
+	return done;
+}
+
+/* Write-behind: the data is kept in pages and flushed later. File's
+ * lock is held */
+static ssize_t pc_write_locked(struct pc_file *f, char *buf, size_t count,
+			       off_t offset)
+{
+	struct pc_page *p;
+	unsigned long long index;
+	size_t done = 0;
+	size_t poff;
+	size_t n;
+	size_t len;
+	struct stat wstat;
+	bool stable;
+	off_t pos;
+	int rc;
+
+	while (done < count) {
+		pos = offset + done;
+		index = pos / pc.page_size;
+		poff = pos % pc.page_size;
+		n = pc_min(pc.page_size - poff, count - done);
+
+		/* The dirty range of a page that is not loaded must stay
+		 * contiguous */
+		p = pc_page_find(f, index);
+		if (p && !p->loaded && p->dend > p->dstart &&
+		    (poff > p->dend || poff + n < p->dstart)) {
+			RC_WRAP(pc_flush_locked, f);
+			p = pc_page_find(f, index);
+		}
+
+		if (!p)
+			p = pc_page_new(f, index);
+
+		if (!p) {
+			/* Out of budget, this page is not cached */
+			memset(&wstat, 0, sizeof(wstat));
+			rc = extstore_write(&f->ino, pos, n, buf + done,
+					    KVSNS_UNSTABLE, &stable, &wstat);
+			if (rc < 0)
+				return rc;
+			done += n;
+			continue;
+		}
+
+		memcpy(p->data + poff, buf + done, n);
+		len = p->dend - p->dstart;
+		if (len == 0) {
+			p->dstart = poff;
+			p->dend = poff + n;
+		} else {
+			p->dstart = pc_min(p->dstart, poff);
+			if (poff + n > p->dend)
+				p->dend = poff + n;
+		}
+		f->dirty += (p->dend - p->dstart) - len;
+
+		if (!p->loaded && p->dstart == 0 && p->dend == pc.page_size)
+			p->loaded = true;
+
+		pc_page_touch(f, p);
+		done += n;
+	}
+
+	if (offset + (off_t)count > f->size)
+		f->size = offset + count;
+	clock_gettime(CLOCK_REALTIME, &f->mtime);
+
+	if (f->dirty >= pc.write_behind)
+		RC_WRAP(pc_flush_locked, f);
+
+	return count;
+}
+
+/* Writes the data through, then updates the loaded pages */
+static ssize_t pc_write_through(struct pc_file *f, char *buf, size_t count,
+				off_t offset, kvsns_durability_t how)
+{
+	struct pc_page *p;
+	unsigned long long index;
+	struct stat wstat;
+	bool stable;
+	size_t done;
+	size_t poff;
+	size_t n;
+	off_t pos;
+	int rc;
+
+	/* Written data must not be overwritten by an older flush */
+	RC_WRAP(pc_flush_locked, f);
+
+	memset(&wstat, 0, sizeof(wstat));
+	rc = extstore_write(&f->ino, offset, count, buf, how, &stable, &wstat);
+	if (rc < 0)
+		return rc;
+
+	for (done = 0; done < (size_t)rc; done += n) {
+		pos = offset + done;
+		index = pos / pc.page_size;
+		poff = pos % pc.page_size;
+		n = pc_min(pc.page_size - poff, rc - done);
+
+		p = pc_page_find(f, index);
+		if (p && p->loaded)
+			memcpy(p->data + poff, buf + done, n);
+	}
+
+	if (offset + (off_t)rc > f->size)
+		f->size = offset + rc;
+
+	return rc;
+}
+
+int kvsns_page_cache_init(struct collection_item *cfg_items)
+{
+	struct collection_item *item;
+	unsigned long size = 0;
+	unsigned int page_size = 1024 * 1024;
+	unsigned long readahead = 8 * 1024 * 1024;
+	unsigned long write_behind = 8 * 1024 * 1024;
+	int rc = 0;
+
+	pthread_mutex_lock(&pc.lock);
+
+	/* kvsns_start is done by every thread, the first one sets the cache
+	 * up. A cache left up by a kvsns_stop that could not empty it is
+	 * kept as it is */
+	if (pc.users > 0 || pc.enabled)
+		goto out;
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "page_cache_size",
+		      cfg_items, &item);
+	if (item != NULL)
+		size = get_ulong_config_value(item, 0, 0, NULL);
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns",
+		      "page_cache_page_size", cfg_items, &item);
+	if (item != NULL)
+		page_size = get_unsigned_config_value(item, 0, 0, NULL);
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "readahead_max",
+		      cfg_items, &item);
+	if (item != NULL)
+		readahead = get_ulong_config_value(item, 0, 0, NULL);
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "kvsns", "write_behind",
+		      cfg_items, &item);
+	if (item != NULL)
+		write_behind = get_ulong_config_value(item, 0, 0, NULL);
+
+	/* No size means no cache */
+	if (size == 0)
+		goto out;
+
+	if (page_size == 0 || size < page_size) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	pc.page_size = page_size;
+	pc.max_pages = size / page_size;
+	pc.ra_max = readahead / page_size;
+	pc.write_behind = write_behind;
+	pc.enabled = true;
+
+out:
+	if (rc == 0)
+		pc.users += 1;
+	pthread_mutex_unlock(&pc.lock);
+	return rc;
+}
+
+/* Only the last kvsns_stop empties the cache. Files still open by an
+ * other thread are flushed and kept, so are the ones whose flush fails:
+ * their error is returned and their pages remain dirty */
+int kvsns_page_cache_fini(void)
+{
+	struct pc_file *f;
+	unsigned int tries;
+	bool last;
+	int rc = 0;
+	int err;
+	int rc2;
+
+	pthread_mutex_lock(&pc.lock);
+	if (pc.users > 0)
+		pc.users -= 1;
+	last = (pc.users == 0 && pc.enabled);
+	tries = pc.nfiles;
+	pthread_mutex_unlock(&pc.lock);
+
+	if (!last)
+		return 0;
+
+	for (; tries > 0; tries--) {
+		/* Take the first file and move it at the end of the list */
+		pthread_mutex_lock(&pc.lock);
+		f = pc.head;
+		if (!f) {
+			pthread_mutex_unlock(&pc.lock);
+			break;
+		}
+		if (f != pc.tail) {
+			pc.head = f->next;
+			pc.head->prev = NULL;
+			pc_file_append(f);
+		}
+		f->refs += 1;
+		pthread_mutex_unlock(&pc.lock);
+
+		pthread_mutex_lock(&f->lock);
+		err = pc_flush_locked(f);
+		rc2 = pc_file_put(f);
+		if (err == 0)
+			err = rc2;
+		if (err != 0 && rc == 0)
+			rc = err;
+	}
+
+	pthread_mutex_lock(&pc.lock);
+	if (pc.users == 0 && pc.nfiles == 0)
+		pc.enabled = false;
+	pthread_mutex_unlock(&pc.lock);
+
+	return rc;
+}
+
+int kvsns_page_cache_open(kvsns_ino_t *ino)
+{
+	struct pc_file *f;
+	struct pc_file *new;
+
+	if (!pc.enabled)
+		return 0;
+
+	new = calloc(1, sizeof(*new));
+	if (!new)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&pc.lock);
+	f = pc.buckets[pc_hash(*ino) % PC_FILE_BUCKETS];
+	while (f && f->ino != *ino)
+		f = f->hnext;
+
+	if (f) {
+		f->refs += 1;
+	} else {
+		new->ino = *ino;
+		new->refs = 1;
+		pthread_mutex_init(&new->lock, NULL);
+		new->hnext = pc.buckets[pc_hash(*ino) % PC_FILE_BUCKETS];
+		pc.buckets[pc_hash(*ino) % PC_FILE_BUCKETS] = new;
+		pc_file_append(new);
+		pc.nfiles += 1;
+		new = NULL;
+	}
+	pthread_mutex_unlock(&pc.lock);
+
+	free(new);
+	return 0;
+}
+
+int kvsns_page_cache_release(kvsns_ino_t *ino)
+{
+	struct pc_file *f;
+
+	f = pc_file_get(*ino);
+	if (!f)
+		return 0;
+
+	/* Drops the reference of the open, then ours */
+	pthread_mutex_lock(&pc.lock);
+	f->refs -= 1;
+	pthread_mutex_unlock(&pc.lock);
+
+	return pc_file_put(f);
+}
+
+ssize_t kvsns_page_cache_read(kvsns_ino_t *ino, void *buf, size_t count,
+			      off_t offset)
+{
+	struct pc_file *f;
+	struct stat stat;
+	bool eof;
+	ssize_t rc;
+
+	f = pc_file_get(*ino);
+	if (!f)
+		return extstore_read(ino, offset, count, buf, &eof, &stat);
+
+	if (count == 0) {
+		pc_file_put(f);
+		return 0;
+	}
+
+	rc = pc_read_locked(f, buf, count, offset);
+
+	pc_file_put(f);
+	return rc;
+}
+
+ssize_t kvsns_page_cache_write(kvsns_ino_t *ino, void *buf, size_t count,
+			       off_t offset, kvsns_durability_t how)
+{
+	struct pc_file *f;
+	struct stat wstat;
+	bool stable;
+	ssize_t rc;
+
+	f = pc_file_get(*ino);
+	if (!f) {
+		memset(&wstat, 0, sizeof(wstat));
+		return extstore_write(ino, offset, count, buf, how,
+				      &stable, &wstat);
+	}
+
+	if (count == 0) {
+		pc_file_put(f);
+		return 0;
+	}
+
+	if (how == KVSNS_UNSTABLE)
+		rc = pc_write_locked(f, buf, count, offset);
+	else
+		rc = pc_write_through(f, buf, count, offset, how);
+
+	pc_file_put(f);
+	return rc;
+}
+
+int kvsns_page_cache_flush(kvsns_ino_t *ino)
+{
+	struct pc_file *f;
+	int rc;
+
+	f = pc_file_get(*ino);
+	if (!f)
+		return 0;
+
+	rc = pc_flush_locked(f);
+
+	pc_file_put(f);
+	return rc;
+}
+
+int kvsns_page_cache_invalidate(kvsns_ino_t *ino)
+{
+	struct pc_file *f;
+	struct pc_page *p;
+	struct pc_page *next;
+	int rc;
+
+	f = pc_file_get(*ino);
+	if (!f)
+		return 0;
+
+	rc = pc_flush_locked(f);
+	if (rc == 0) {
+		for (p = f->head; p; p = next) {
+			next = p->next;
+			pc_page_drop(f, p);
+		}
+		f->size = 0;
+		f->size_exact = false;
+		f->ra_pages = 0;
+	}
+
+	pc_file_put(f);
+	return rc;
+}
+
+/* Size and mtime of data not flushed yet */
+void kvsns_page_cache_getattr(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	struct pc_file *f;
+
+	f = pc_file_get(*ino);
+	if (!f)
+		return;
+
+	if (f->dirty > 0) {
+		if (f->size > bufstat->st_size)
+			bufstat->st_size = f->size;
+		bufstat->st_mtim = f->mtime;
+	}
+
+	pc_file_put(f);
+}
+
+void kvsns_page_cache_counters(kvsns_cache_stats_t *stats)
+{
+	stats->page_hits = __sync_fetch_and_add(&pc.hits, 0);
+	stats->page_misses = __sync_fetch_and_add(&pc.misses, 0);
+	stats->page_readahead = __sync_fetch_and_add(&pc.readahead, 0);
+	stats->page_flushes = __sync_fetch_and_add(&pc.flushes, 0);
+}
@@ -0,0 +1,906 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_scripts.c
+ * KVSNS: namespace operations executed atomically on the KVS side
+ *
+ * Each operation that modifies several inodes (create, link, unlink,
+ * rename) is a single script: existence checks, dentry updates, parent
+ * lists and attributes are done in one round trip, without any window
+ * between the checks and the updates.
+ *
+ * The scripts patch the inode records in place, the offsets of the fields
+ * they touch are written in a prelude generated when they are loaded.
+ *
+ * Access times and the size of the files are written by scripts too, for
+ * many inodes at once. Opening and closing a file maintain the set of its
+ * owners and the count of the ones writing it.
+ *
+ * Every record written, but for an atime update, goes through put() or
+ * drop(), which keep the secondary indexes listed in INDEXES up to date.
+ */
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include "kvsns_internal.h"
+
+#define SCRIPT_PRELUDE_LEN 4096
+
+static const char *prelude_fmt =
+	"local ENOENT, EEXIST, EBADF, ENOTEMPTY = %d, %d, %d, %d\n"
+	"local S_IFMT, S_IFLNK = %d, %d\n"
+	"local ATIM, MTIM, CTIM, NLINK, MODE = %d, %d, %d, %d, %d\n"
+	"local SIZE, BLOCKS, VERSION = %d, %d, %d\n"
+	"local NLINKFMT, MODEFMT = '<I4', '<I4'\n"
+	"local INDEXES = %s\n"
+	"local function patch(s, off, v)\n"
+	"	return string.sub(s, 1, off) .. v ..\n"
+	"	       string.sub(s, off + string.len(v) + 1)\n"
+	"end\n"
+	"local function later(s, off, ts)\n"
+	"	local sec, nsec = struct.unpack('<I8I4', s, off + 1)\n"
+	"	local tsec, tnsec = struct.unpack('<I8I4', ts)\n"
+	"	return tsec > sec or (tsec == sec and tnsec > nsec)\n"
+	"end\n"
+	"local function data_attrs(s, size, blocks, ts)\n"
+	"	s = patch(s, 0, string.char(VERSION))\n"
+	"	s = patch(s, SIZE, struct.pack('<I8', tonumber(size)))\n"
+	"	s = patch(s, BLOCKS, struct.pack('<I8', tonumber(blocks)))\n"
+	"	if later(s, MTIM, ts) then s = patch(s, MTIM, ts) end\n"
+	"	if later(s, CTIM, ts) then s = patch(s, CTIM, ts) end\n"
+	"	return s\n"
+	"end\n"
+	"local function touch(s, ts, mtime)\n"
+	"	s = patch(s, CTIM, ts)\n"
+	"	if mtime then s = patch(s, MTIM, ts) end\n"
+	"	return s\n"
+	"end\n"
+	"local function nlink_add(s, d)\n"
+	"	local n = struct.unpack(NLINKFMT, s, NLINK + 1)\n"
+	"	return patch(s, NLINK, struct.pack(NLINKFMT, n + d))\n"
+	"end\n"
+	"local function mode(s)\n"
+	"	return (struct.unpack(MODEFMT, s, MODE + 1))\n"
+	"end\n"
+	"local function inum(score)\n"
+	"	return string.format('%%.0f', tonumber(score))\n"
+	"end\n"
+	"local function reindex(ino, old, new)\n"
+	"	for _, x in ipairs(INDEXES) do\n"
+	"		local o = old and struct.unpack(x[3], old, x[2] + 1)\n"
+	"		local n = new and struct.unpack(x[3], new, x[2] + 1)\n"
+	"		if o ~= n and x[4] then\n"
+	"			if o then redis.call('ZREM', x[1]..'.'..o, ino) end\n"
+	"			if n then\n"
+	"				redis.call('ZADD', x[1]..'.'..n, ino, ino)\n"
+	"			end\n"
+	"		elseif o ~= n and n then\n"
+	"			redis.call('ZADD', x[1], n, ino)\n"
+	"		elseif o ~= n then\n"
+	"			redis.call('ZREM', x[1], ino)\n"
+	"		end\n"
+	"	end\n"
+	"end\n"
+	"local function put(k, old, new)\n"
+	"	redis.call('SET', k, new)\n"
+	"	reindex(string.sub(k, 1, -6), old, new)\n"
+	"end\n"
+	"local function drop(k, old)\n"
+	"	redis.call('DEL', k)\n"
+	"	if old then reindex(string.sub(k, 1, -6), old, nil) end\n"
+	"end\n";
+
+/* KEYS: parent.dentries parent.stat new.stat new.parentdir new.link
+ * ARGV: name new_ino new_stat parent timestamp [link] */
+static const char *create_script =
+	"local pstat = redis.call('GET', KEYS[2])\n"
+	"if not pstat then return {-ENOENT} end\n"
+	"if redis.call('ZSCORE', KEYS[1], ARGV[1]) then\n"
+	"	return {-EEXIST}\n"
+	"end\n"
+	"redis.call('ZADD', KEYS[1], ARGV[2], ARGV[1])\n"
+	"redis.call('SADD', KEYS[4], ARGV[4] .. '/' .. ARGV[1])\n"
+	"put(KEYS[3], nil, ARGV[3])\n"
+	"if ARGV[6] then redis.call('SET', KEYS[5], ARGV[6]) end\n"
+	"put(KEYS[2], pstat, touch(pstat, ARGV[5], true))\n"
+	"return {0}\n";
+
+/* KEYS: dino.dentries dino.stat ino.stat ino.parentdir
+ * ARGV: dname ino dino timestamp */
+static const char *link_script =
+	"if redis.call('ZSCORE', KEYS[1], ARGV[1]) then\n"
+	"	return {-EEXIST}\n"
+	"end\n"
+	"local dstat = redis.call('GET', KEYS[2])\n"
+	"local istat = redis.call('GET', KEYS[3])\n"
+	"if not dstat or not istat then\n"
+	"	return {-ENOENT}\n"
+	"end\n"
+	"redis.call('SADD', KEYS[4], ARGV[3] .. '/' .. ARGV[1])\n"
+	"redis.call('ZADD', KEYS[1], ARGV[2], ARGV[1])\n"
+	"put(KEYS[3], istat, nlink_add(touch(istat, ARGV[4], false), 1))\n"
+	"if KEYS[2] == KEYS[3] then\n"
+	"	dstat = redis.call('GET', KEYS[2])\n"
+	"end\n"
+	"put(KEYS[2], dstat, touch(dstat, ARGV[4], true))\n"
+	"return {0}\n";
+
+/* KEYS: dir.dentries dir.stat
+ * ARGV: name dir timestamp
+ * Returns {0, ino, deleted, opened} */
+static const char *unlink_script =
+	"local score = redis.call('ZSCORE', KEYS[1], ARGV[1])\n"
+	"if not score then return {-ENOENT} end\n"
+	"local ino = inum(score)\n"
+	"local dstat = redis.call('GET', KEYS[2])\n"
+	"local istat = redis.call('GET', ino .. '.stat')\n"
+	"if not dstat or not istat then\n"
+	"	return {-ENOENT}\n"
+	"end\n"
+	"local opened = redis.call('EXISTS', ino .. '.openowner')\n"
+	"local deleted = 0\n"
+	"if redis.call('SCARD', ino .. '.parentdir') <= 1 then\n"
+	"	redis.call('DEL', ino .. '.parentdir')\n"
+	"	drop(ino .. '.stat', istat)\n"
+	"	if opened == 1 then\n"
+	"		redis.call('SET', ino .. '.opened_and_deleted', '1')\n"
+	"	end\n"
+	"	deleted = 1\n"
+	"else\n"
+	"	redis.call('SREM', ino .. '.parentdir',\n"
+	"		   ARGV[2] .. '/' .. ARGV[1])\n"
+	"	put(ino .. '.stat', istat,\n"
+	"	    nlink_add(touch(istat, ARGV[3], false), -1))\n"
+	"end\n"
+	"redis.call('ZREM', KEYS[1], ARGV[1])\n"
+	"if bit.band(mode(istat), S_IFMT) == S_IFLNK then\n"
+	"	redis.call('DEL', ino .. '.link')\n"
+	"end\n"
+	"put(KEYS[2], dstat, touch(dstat, ARGV[3], true))\n"
+	"return {0, tonumber(ino), deleted, opened}\n";
+
+/* KEYS: sino.dentries sino.stat dino.dentries dino.stat
+ * ARGV: sname dname sino dino timestamp
+ * Returns {0, ino} */
+static const char *rename_script =
+	"if redis.call('ZSCORE', KEYS[3], ARGV[2]) then\n"
+	"	return {-EEXIST}\n"
+	"end\n"
+	"local score = redis.call('ZSCORE', KEYS[1], ARGV[1])\n"
+	"if not score then return {-ENOENT} end\n"
+	"local ino = inum(score)\n"
+	"local sstat = redis.call('GET', KEYS[2])\n"
+	"if not sstat then return {-ENOENT} end\n"
+	"redis.call('ZREM', KEYS[1], ARGV[1])\n"
+	"redis.call('ZADD', KEYS[3], score, ARGV[2])\n"
+	"redis.call('SREM', ino .. '.parentdir', ARGV[3] .. '/' .. ARGV[1])\n"
+	"redis.call('SADD', ino .. '.parentdir', ARGV[4] .. '/' .. ARGV[2])\n"
+	"put(KEYS[2], sstat, touch(sstat, ARGV[5], true))\n"
+	"if ARGV[3] ~= ARGV[4] then\n"
+	"	local dstat = redis.call('GET', KEYS[4])\n"
+	"	if dstat then\n"
+	"		put(KEYS[4], dstat, touch(dstat, ARGV[5], true))\n"
+	"	end\n"
+	"end\n"
+	"return {0, tonumber(ino)}\n";
+
+/* KEYS: ino_counter
+ * ARGV: end of the lease, first unused inode
+ * The counter is rolled back only if no other lease was taken since */
+static const char *release_script =
+	"if redis.call('GET', KEYS[1]) == ARGV[1] then\n"
+	"	redis.call('SET', KEYS[1],\n"
+	"		   string.format('%.0f', tonumber(ARGV[2]) - 1))\n"
+	"end\n"
+	"return {0}\n";
+
+/* KEYS: ino.openowner ino.writers
+ * ARGV: owner writer */
+static const char *open_script =
+	"redis.call('SADD', KEYS[1], ARGV[1])\n"
+	"if ARGV[2] == '1' then redis.call('INCR', KEYS[2]) end\n"
+	"return {0}\n";
+
+/* KEYS: ino.openowner ino.opened_and_deleted ino.writers ino.stat
+ * ARGV: owner writer [size blocks mtime]
+ * Returns {0, delete}, delete is 1 if the data is to be removed */
+static const char *close_script =
+	"if redis.call('SREM', KEYS[1], ARGV[1]) == 0 then\n"
+	"	return {-EBADF}\n"
+	"end\n"
+	"if ARGV[2] == '1' and redis.call('DECR', KEYS[3]) <= 0 then\n"
+	"	redis.call('DEL', KEYS[3])\n"
+	"end\n"
+	"local s = ARGV[3] and redis.call('GET', KEYS[4])\n"
+	"if s then\n"
+	"	put(KEYS[4], s, data_attrs(s, ARGV[3], ARGV[4], ARGV[5]))\n"
+	"end\n"
+	"if redis.call('EXISTS', KEYS[1]) == 0 then\n"
+	"	redis.call('DEL', KEYS[3])\n"
+	"	return {0, redis.call('DEL', KEYS[2])}\n"
+	"end\n"
+	"return {0, 0}\n";
+
+/* KEYS: ino.stat...
+ * ARGV: one atime per key
+ * An atime only moves forward, removed inodes are skipped.
+ * Returns {0, updated} */
+static const char *atime_script =
+	"local n = 0\n"
+	"for i, k in ipairs(KEYS) do\n"
+	"	local s = redis.call('GET', k)\n"
+	"	if s and later(s, ATIM, ARGV[i]) then\n"
+	"		redis.call('SET', k, patch(s, ATIM, ARGV[i]))\n"
+	"		n = n + 1\n"
+	"	end\n"
+	"end\n"
+	"return {0, n}\n";
+
+/* KEYS: ino.stat...
+ * ARGV: size, blocks and mtime for each key
+ * Times only move forward, removed inodes are skipped */
+static const char *data_attrs_script =
+	"for i, k in ipairs(KEYS) do\n"
+	"	local s = redis.call('GET', k)\n"
+	"	if s then\n"
+	"		put(k, s, data_attrs(s, ARGV[3 * i - 2],\n"
+	"		    ARGV[3 * i - 1], ARGV[3 * i]))\n"
+	"	end\n"
+	"end\n"
+	"return {0}\n";
+
+/* KEYS: parent.dentries parent.stat
+ * ARGV: name timestamp
+ * Returns {0, ino} */
+static const char *rmdir_script =
+	"local score = redis.call('ZSCORE', KEYS[1], ARGV[1])\n"
+	"if not score then return {-ENOENT} end\n"
+	"local ino = inum(score)\n"
+	"if redis.call('ZCARD', ino .. '.dentries') > 0 then\n"
+	"	return {-ENOTEMPTY}\n"
+	"end\n"
+	"local pstat = redis.call('GET', KEYS[2])\n"
+	"if not pstat then return {-ENOENT} end\n"
+	"redis.call('ZREM', KEYS[1], ARGV[1])\n"
+	"redis.call('DEL', ino .. '.parentdir')\n"
+	"drop(ino .. '.stat', redis.call('GET', ino .. '.stat'))\n"
+	"put(KEYS[2], pstat, touch(pstat, ARGV[2], true))\n"
+	"return {0, tonumber(ino)}\n";
+
+/* KEYS: ino.stat
+ * ARGV: record */
+static const char *set_stat_script =
+	"put(KEYS[1], redis.call('GET', KEYS[1]), ARGV[1])\n"
+	"return {0}\n";
+
+/* KEYS: ino.stat...
+ * Adds the inodes to the indexes, removed inodes are skipped */
+static const char *index_script =
+	"for i, k in ipairs(KEYS) do\n"
+	"	local s = redis.call('GET', k)\n"
+	"	if s then reindex(string.sub(k, 1, -6), nil, s) end\n"
+	"end\n"
+	"return {0}\n";
+
+enum kvsns_script {
+	SCRIPT_CREATE = 0,
+	SCRIPT_LINK = 1,
+	SCRIPT_UNLINK = 2,
+	SCRIPT_RENAME = 3,
+	SCRIPT_RELEASE = 4,
+	SCRIPT_CLOSE = 5,
+	SCRIPT_ATIME = 6,
+	SCRIPT_OPEN = 7,
+	SCRIPT_DATA_ATTRS = 8,
+	SCRIPT_RMDIR = 9,
+	SCRIPT_SET_STAT = 10,
+	SCRIPT_INDEX = 11,
+	SCRIPT_MAX = 12,
+};
+
+static int script_ids[SCRIPT_MAX];
+static pthread_mutex_t scripts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int scripts_users;
+
+static int kvsns_load_script(char *prelude, const char *body, int *id)
+{
+	char *script;
+	int rc;
+
+	script = malloc(strlen(prelude) + strlen(body) + 1);
+	if (!script)
+		return -ENOMEM;
+
+	strcpy(script, prelude);
+	strcat(script, body);
+
+	rc = kvsal_load_script(script, id);
+	free(script);
+
+	return rc;
+}
+
+static int kvsns_scripts_load(void)
+{
+	char prelude[SCRIPT_PRELUDE_LEN];
+	char indexes[VLEN];
+	int len;
+
+	RC_WRAP(kvsns_index_lua, indexes, VLEN);
+
+	len = snprintf(prelude, SCRIPT_PRELUDE_LEN, prelude_fmt,
+		       ENOENT, EEXIST, EBADF, ENOTEMPTY, S_IFMT, S_IFLNK,
+		       KVSAL_RECORD_ATIME, KVSAL_RECORD_MTIME,
+		       KVSAL_RECORD_CTIME, KVSAL_RECORD_NLINK,
+		       KVSAL_RECORD_MODE, KVSAL_RECORD_SIZE,
+		       KVSAL_RECORD_BLOCKS, KVSAL_RECORD_VERSION, indexes);
+	if (len >= SCRIPT_PRELUDE_LEN)
+		return -ENAMETOOLONG;
+
+	RC_WRAP(kvsns_load_script, prelude, create_script,
+		&script_ids[SCRIPT_CREATE]);
+	RC_WRAP(kvsns_load_script, prelude, link_script,
+		&script_ids[SCRIPT_LINK]);
+	RC_WRAP(kvsns_load_script, prelude, unlink_script,
+		&script_ids[SCRIPT_UNLINK]);
+	RC_WRAP(kvsns_load_script, prelude, rename_script,
+		&script_ids[SCRIPT_RENAME]);
+	RC_WRAP(kvsns_load_script, prelude, release_script,
+		&script_ids[SCRIPT_RELEASE]);
+	RC_WRAP(kvsns_load_script, prelude, close_script,
+		&script_ids[SCRIPT_CLOSE]);
+	RC_WRAP(kvsns_load_script, prelude, atime_script,
+		&script_ids[SCRIPT_ATIME]);
+	RC_WRAP(kvsns_load_script, prelude, open_script,
+		&script_ids[SCRIPT_OPEN]);
+	RC_WRAP(kvsns_load_script, prelude, data_attrs_script,
+		&script_ids[SCRIPT_DATA_ATTRS]);
+	RC_WRAP(kvsns_load_script, prelude, rmdir_script,
+		&script_ids[SCRIPT_RMDIR]);
+	RC_WRAP(kvsns_load_script, prelude, set_stat_script,
+		&script_ids[SCRIPT_SET_STAT]);
+	RC_WRAP(kvsns_load_script, prelude, index_script,
+		&script_ids[SCRIPT_INDEX]);
+
+	return 0;
+}
+
+/* kvsns_start is done by every thread, the first one loads the scripts */
+int kvsns_scripts_init(void)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&scripts_lock);
+	if (scripts_users == 0)
+		rc = kvsns_scripts_load();
+	if (rc == 0)
+		scripts_users += 1;
+	pthread_mutex_unlock(&scripts_lock);
+
+	return rc;
+}
+
+int kvsns_scripts_fini(void)
+{
+	pthread_mutex_lock(&scripts_lock);
+	if (scripts_users > 0)
+		scripts_users -= 1;
+	pthread_mutex_unlock(&scripts_lock);
+
+	return 0;
+}
+
+/* Current time, encoded as in the inode records */
+static int kvsns_timestamp(char *ts)
+{
+	struct timespec now;
+	struct timeval t;
+
+	if (gettimeofday(&t, NULL) != 0)
+		return -errno;
+
+	now.tv_sec = t.tv_sec;
+	now.tv_nsec = 1000 * t.tv_usec;
+	kvsal_encode_time(&now, ts);
+
+	return 0;
+}
+
+static int kvsns_run_script(enum kvsns_script script,
+			    int nkeys, char **keys,
+			    int nargs, char **args, size_t *argslen,
+			    long long *res, int nres)
+{
+	int n = nres;
+
+	RC_WRAP(kvsal_exec_script, script_ids[script],
+		nkeys, keys, nargs, args, argslen, res, &n);
+
+	if (res[0] != 0)
+		return (int)res[0];
+
+	if (n != nres)
+		return -EIO;
+
+	return 0;
+}
+
+int kvsns_script_create(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino,
+			struct stat *bufstat, char *lnk)
+{
+	char keys[5][KLEN];
+	char vino[KLEN];
+	char vparent[VLEN];
+	char record[KVSAL_RECORD_LEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[5];
+	char *args[6];
+	size_t argslen[6];
+	long long res[1];
+	int nargs;
+	int i;
+
+	if (!parent || !name || !ino || !bufstat)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_timestamp, ts);
+
+	snprintf(keys[0], KLEN, "%llu.dentries", *parent);
+	snprintf(keys[1], KLEN, "%llu.stat", *parent);
+	snprintf(keys[2], KLEN, "%llu.stat", *ino);
+	snprintf(keys[3], KLEN, "%llu.parentdir", *ino);
+	snprintf(keys[4], KLEN, "%llu.link", *ino);
+	for (i = 0; i < 5 ; i++)
+		pkeys[i] = keys[i];
+
+	snprintf(vino, KLEN, "%llu", *ino);
+	snprintf(vparent, VLEN, "%llu", *parent);
+
+	args[0] = name;
+	argslen[0] = strlen(name);
+	args[1] = vino;
+	argslen[1] = strlen(vino);
+	kvsal_stat2record(bufstat, record);
+	args[2] = record;
+	argslen[2] = KVSAL_RECORD_LEN;
+	args[3] = vparent;
+	argslen[3] = strlen(vparent);
+	args[4] = ts;
+	argslen[4] = KVSAL_RECORD_TIME_LEN;
+	nargs = 5;
+
+	if (lnk) {
+		args[5] = lnk;
+		argslen[5] = strlen(lnk);
+		nargs = 6;
+	}
+
+	RC_WRAP(kvsns_run_script, SCRIPT_CREATE, 5, pkeys,
+		nargs, args, argslen, res, 1);
+
+	return 0;
+}
+
+int kvsns_script_link(kvsns_ino_t *ino, kvsns_ino_t *dino, char *dname)
+{
+	char keys[4][KLEN];
+	char vino[KLEN];
+	char vdino[KLEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[4];
+	char *args[4];
+	size_t argslen[4];
+	long long res[1];
+	int i;
+
+	if (!ino || !dino || !dname)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_timestamp, ts);
+
+	snprintf(keys[0], KLEN, "%llu.dentries", *dino);
+	snprintf(keys[1], KLEN, "%llu.stat", *dino);
+	snprintf(keys[2], KLEN, "%llu.stat", *ino);
+	snprintf(keys[3], KLEN, "%llu.parentdir", *ino);
+	for (i = 0; i < 4 ; i++)
+		pkeys[i] = keys[i];
+
+	snprintf(vino, KLEN, "%llu", *ino);
+	snprintf(vdino, KLEN, "%llu", *dino);
+
+	args[0] = dname;
+	args[1] = vino;
+	args[2] = vdino;
+	args[3] = ts;
+	for (i = 0; i < 3 ; i++)
+		argslen[i] = strlen(args[i]);
+	argslen[3] = KVSAL_RECORD_TIME_LEN;
+
+	RC_WRAP(kvsns_run_script, SCRIPT_LINK, 4, pkeys,
+		4, args, argslen, res, 1);
+
+	return 0;
+}
+
+int kvsns_script_unlink(kvsns_ino_t *dir, char *name, kvsns_ino_t *ino,
+			bool *deleted, bool *opened)
+{
+	char keys[2][KLEN];
+	char vdir[KLEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[2];
+	char *args[3];
+	size_t argslen[3];
+	long long res[4];
+
+	if (!dir || !name || !ino || !deleted || !opened)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_timestamp, ts);
+
+	snprintf(keys[0], KLEN, "%llu.dentries", *dir);
+	snprintf(keys[1], KLEN, "%llu.stat", *dir);
+	pkeys[0] = keys[0];
+	pkeys[1] = keys[1];
+
+	snprintf(vdir, KLEN, "%llu", *dir);
+
+	args[0] = name;
+	argslen[0] = strlen(name);
+	args[1] = vdir;
+	argslen[1] = strlen(vdir);
+	args[2] = ts;
+	argslen[2] = KVSAL_RECORD_TIME_LEN;
+
+	RC_WRAP(kvsns_run_script, SCRIPT_UNLINK, 2, pkeys,
+		3, args, argslen, res, 4);
+
+	*ino = res[1];
+	*deleted = (res[2] != 0);
+	*opened = (res[3] != 0);
+
+	return 0;
+}
+
+int kvsns_script_rename(kvsns_ino_t *sino, char *sname,
+			kvsns_ino_t *dino, char *dname, kvsns_ino_t *ino)
+{
+	char keys[4][KLEN];
+	char vsino[KLEN];
+	char vdino[KLEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[4];
+	char *args[5];
+	size_t argslen[5];
+	long long res[2];
+	int i;
+
+	if (!sino || !sname || !dino || !dname || !ino)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_timestamp, ts);
+
+	snprintf(keys[0], KLEN, "%llu.dentries", *sino);
+	snprintf(keys[1], KLEN, "%llu.stat", *sino);
+	snprintf(keys[2], KLEN, "%llu.dentries", *dino);
+	snprintf(keys[3], KLEN, "%llu.stat", *dino);
+	for (i = 0; i < 4 ; i++)
+		pkeys[i] = keys[i];
+
+	snprintf(vsino, KLEN, "%llu", *sino);
+	snprintf(vdino, KLEN, "%llu", *dino);
+
+	args[0] = sname;
+	args[1] = dname;
+	args[2] = vsino;
+	args[3] = vdino;
+	args[4] = ts;
+	for (i = 0; i < 4 ; i++)
+		argslen[i] = strlen(args[i]);
+	argslen[4] = KVSAL_RECORD_TIME_LEN;
+
+	RC_WRAP(kvsns_run_script, SCRIPT_RENAME, 4, pkeys,
+		5, args, argslen, res, 2);
+
+	*ino = res[1];
+
+	return 0;
+}
+
+int kvsns_script_release_inodes(kvsns_ino_t *next, kvsns_ino_t *end)
+{
+	char vend[KLEN];
+	char vnext[KLEN];
+	char *keys[1] = { "ino_counter" };
+	char *args[2] = { vend, vnext };
+	long long res[1];
+
+	if (!next || !end)
+		return -EINVAL;
+
+	snprintf(vend, KLEN, "%llu", *end);
+	snprintf(vnext, KLEN, "%llu", *next);
+
+	RC_WRAP(kvsns_run_script, SCRIPT_RELEASE, 1, keys,
+		2, args, NULL, res, 1);
+
+	return 0;
+}
+
+int kvsns_script_open(kvsns_ino_t *ino, char *owner, bool writer)
+{
+	char keys[2][KLEN];
+	char *pkeys[2] = { keys[0], keys[1] };
+	char *args[2] = { owner, writer ? "1" : "0" };
+	long long res[1];
+
+	if (!ino || !owner)
+		return -EINVAL;
+
+	snprintf(keys[0], KLEN, "%llu.openowner", *ino);
+	snprintf(keys[1], KLEN, "%llu.writers", *ino);
+
+	RC_WRAP(kvsns_run_script, SCRIPT_OPEN, 2, pkeys,
+		2, args, NULL, res, 1);
+
+	return 0;
+}
+
+/* Size and blocks of a file as script arguments, mtime as in a record */
+static void kvsns_data_args(struct stat *data, char *size, char *blocks,
+			    char *ts)
+{
+	snprintf(size, KLEN, "%llu", (unsigned long long)data->st_size);
+	snprintf(blocks, KLEN, "%llu", (unsigned long long)data->st_blocks);
+	kvsal_encode_time(&data->st_mtim, ts);
+}
+
+int kvsns_script_close(kvsns_ino_t *ino, char *owner, bool writer,
+		       struct stat *data, bool *delete)
+{
+	char keys[4][KLEN];
+	char size[KLEN];
+	char blocks[KLEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[4] = { keys[0], keys[1], keys[2], keys[3] };
+	char *args[5] = { owner, writer ? "1" : "0", size, blocks, ts };
+	size_t argslen[5];
+	long long res[2];
+	int nargs = 2;
+
+	if (!ino || !owner || !delete)
+		return -EINVAL;
+
+	snprintf(keys[0], KLEN, "%llu.openowner", *ino);
+	snprintf(keys[1], KLEN, "%llu.opened_and_deleted", *ino);
+	snprintf(keys[2], KLEN, "%llu.writers", *ino);
+	snprintf(keys[3], KLEN, "%llu.stat", *ino);
+
+	argslen[0] = strlen(owner);
+	argslen[1] = 1;
+
+	/* The attributes of the data written through this owner */
+	if (data) {
+		kvsns_data_args(data, size, blocks, ts);
+		argslen[2] = strlen(size);
+		argslen[3] = strlen(blocks);
+		argslen[4] = KVSAL_RECORD_TIME_LEN;
+		nargs = 5;
+	}
+
+	RC_WRAP(kvsns_run_script, SCRIPT_CLOSE, 4, pkeys,
+		nargs, args, argslen, res, 2);
+
+	*delete = (res[1] != 0);
+
+	return 0;
+}
+
+int kvsns_script_atime(int nb, kvsns_ino_t *inos, struct timespec *atimes,
+		       int *updated)
+{
+	char (*keys)[KLEN] = NULL;
+	char (*ts)[KVSAL_RECORD_TIME_LEN] = NULL;
+	char **pkeys = NULL;
+	char **args = NULL;
+	size_t *argslen = NULL;
+	long long res[2];
+	int rc;
+	int i;
+
+	if (!inos || !atimes || !updated || nb <= 0)
+		return -EINVAL;
+
+	keys = malloc(nb*sizeof(*keys));
+	ts = malloc(nb*sizeof(*ts));
+	pkeys = malloc(nb*sizeof(char *));
+	args = malloc(nb*sizeof(char *));
+	argslen = malloc(nb*sizeof(size_t));
+	if (!keys || !ts || !pkeys || !args || !argslen) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nb ; i++) {
+		snprintf(keys[i], KLEN, "%llu.stat", inos[i]);
+		pkeys[i] = keys[i];
+		kvsal_encode_time(&atimes[i], ts[i]);
+		args[i] = ts[i];
+		argslen[i] = KVSAL_RECORD_TIME_LEN;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvsns_run_script, SCRIPT_ATIME, nb, pkeys,
+		      nb, args, argslen, res, 2);
+
+	*updated = (int)res[1];
+
+out:
+	free(keys);
+	free(ts);
+	free(pkeys);
+	free(args);
+	free(argslen);
+
+	return rc;
+}
+
+int kvsns_script_data_attrs(int nb, kvsns_ino_t *inos, struct stat *data)
+{
+	char (*keys)[KLEN] = NULL;
+	char (*vals)[KLEN] = NULL;
+	char (*ts)[KVSAL_RECORD_TIME_LEN] = NULL;
+	char **pkeys = NULL;
+	char **args = NULL;
+	size_t *argslen = NULL;
+	long long res[1];
+	int rc;
+	int i;
+
+	if (!inos || !data || nb <= 0)
+		return -EINVAL;
+
+	keys = malloc(nb*sizeof(*keys));
+	vals = malloc(2*nb*sizeof(*vals));
+	ts = malloc(nb*sizeof(*ts));
+	pkeys = malloc(nb*sizeof(char *));
+	args = malloc(3*nb*sizeof(char *));
+	argslen = malloc(3*nb*sizeof(size_t));
+	if (!keys || !vals || !ts || !pkeys || !args || !argslen) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nb ; i++) {
+		snprintf(keys[i], KLEN, "%llu.stat", inos[i]);
+		pkeys[i] = keys[i];
+		kvsns_data_args(&data[i], vals[2*i], vals[2*i+1], ts[i]);
+		args[3*i] = vals[2*i];
+		argslen[3*i] = strlen(vals[2*i]);
+		args[3*i+1] = vals[2*i+1];
+		argslen[3*i+1] = strlen(vals[2*i+1]);
+		args[3*i+2] = ts[i];
+		argslen[3*i+2] = KVSAL_RECORD_TIME_LEN;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvsns_run_script, SCRIPT_DATA_ATTRS, nb, pkeys,
+		      3*nb, args, argslen, res, 1);
+
+out:
+	free(keys);
+	free(vals);
+	free(ts);
+	free(pkeys);
+	free(args);
+	free(argslen);
+
+	return rc;
+}
+
+int kvsns_script_rmdir(kvsns_ino_t *parent, char *name, kvsns_ino_t *ino)
+{
+	char keys[2][KLEN];
+	char ts[KVSAL_RECORD_TIME_LEN];
+	char *pkeys[2] = { keys[0], keys[1] };
+	char *args[2] = { name, ts };
+	size_t argslen[2];
+	long long res[2];
+
+	if (!parent || !name || !ino)
+		return -EINVAL;
+
+	RC_WRAP(kvsns_timestamp, ts);
+
+	snprintf(keys[0], KLEN, "%llu.dentries", *parent);
+	snprintf(keys[1], KLEN, "%llu.stat", *parent);
+
+	argslen[0] = strlen(name);
+	argslen[1] = KVSAL_RECORD_TIME_LEN;
+
+	RC_WRAP(kvsns_run_script, SCRIPT_RMDIR, 2, pkeys,
+		2, args, argslen, res, 2);
+
+	*ino = res[1];
+
+	return 0;
+}
+
+int kvsns_script_set_stat(kvsns_ino_t *ino, struct stat *bufstat)
+{
+	char k[KLEN];
+	char record[KVSAL_RECORD_LEN];
+	char *keys[1] = { k };
+	char *args[1] = { record };
+	size_t argslen[1] = { KVSAL_RECORD_LEN };
+	long long res[1];
+
+	if (!ino || !bufstat)
+		return -EINVAL;
+
+	snprintf(k, KLEN, "%llu.stat", *ino);
+	kvsal_stat2record(bufstat, record);
+
+	RC_WRAP(kvsns_run_script, SCRIPT_SET_STAT, 1, keys,
+		1, args, argslen, res, 1);
+
+	return 0;
+}
+
+int kvsns_script_index(int nb, kvsns_ino_t *inos)
+{
+	char (*keys)[KLEN] = NULL;
+	char **pkeys = NULL;
+	long long res[1];
+	int rc;
+	int i;
+
+	if (!inos || nb <= 0)
+		return -EINVAL;
+
+	keys = malloc(nb*sizeof(*keys));
+	pkeys = malloc(nb*sizeof(char *));
+	if (!keys || !pkeys) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nb ; i++) {
+		snprintf(keys[i], KLEN, "%llu.stat", inos[i]);
+		pkeys[i] = keys[i];
+	}
+
+	RC_WRAP_LABEL(rc, out, kvsns_run_script, SCRIPT_INDEX, nb, pkeys,
+		      0, NULL, NULL, res, 1);
+
+out:
+	free(keys);
+	free(pkeys);
+
+	return rc;
+}
@@ -0,0 +1,529 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_walk.c
+ * KVSNS: parallel walk of a tree of the namespace
+ *
+ * Each worker owns a queue of directories to be listed. It takes the
+ * last one it queued, so that it goes down the tree it is working on,
+ * and an idle worker steals the first one of another worker's queue,
+ * the closest to the root and usually the largest subtree left. The
+ * queues together hold at most queue_max directories: past that, a
+ * worker lists a subdirectory itself before going on with its parent.
+ * Entries come from kvsns_readdirplus, a page of names and their stats
+ * in a few round trips, and are filtered on those stats.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include "kvsns_internal.h"
+
+#define KVSNS_WALK_WORKERS 8
+#define KVSNS_WALK_QUEUE_MAX 4096
+#define KVSNS_WALK_BATCH 128
+
+struct walk_dir {
+	kvsns_ino_t ino;
+	int depth;
+	struct walk_dir *prev;
+	struct walk_dir *next;
+	char path[];
+};
+
+/* Directories queued by a worker, it works on the tail, thieves take
+ * the head */
+struct walk_queue {
+	pthread_mutex_t lock;
+	struct walk_dir *head;
+	struct walk_dir *tail;
+};
+
+struct walk_job {
+	kvsns_cred_t *cred;
+	kvsns_walk_filter_t *filter;
+	kvsns_walk_params_t params;
+	kvsns_walk_cb_t cb;
+	void *arg;
+	struct walk_queue *queues;	/* one per worker */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int queued;	/* directories in the queues */
+	unsigned int pending;	/* directories queued or being listed */
+	unsigned int next_id;
+	bool done;
+	int rc;			/* first error returned by the callback */
+	unsigned long long dirs;
+	unsigned long long entries;
+	unsigned long long matched;
+	unsigned long long errors;
+};
+
+static bool walk_match(kvsns_walk_filter_t *filter, kvsns_dentry_t *dentry)
+{
+	struct stat *stat = &dentry->stats;
+
+	if (!filter)
+		return true;
+
+	if ((filter->mask & KVSNS_FILTER_TYPE) &&
+	    (stat->st_mode & S_IFMT) != filter->type)
+		return false;
+
+	if ((filter->mask & KVSNS_FILTER_SIZE) &&
+	    (stat->st_size < filter->size_min ||
+	     stat->st_size > filter->size_max))
+		return false;
+
+	if ((filter->mask & KVSNS_FILTER_MTIME) &&
+	    (stat->st_mtime < filter->mtime_min ||
+	     stat->st_mtime > filter->mtime_max))
+		return false;
+
+	if ((filter->mask & KVSNS_FILTER_UID) && stat->st_uid != filter->uid)
+		return false;
+
+	if ((filter->mask & KVSNS_FILTER_GID) && stat->st_gid != filter->gid)
+		return false;
+
+	if ((filter->mask & KVSNS_FILTER_NAME) &&
+	    fnmatch(filter->name, dentry->name, 0) != 0)
+		return false;
+
+	return true;
+}
+
+static bool walk_stopped(struct walk_job *job)
+{
+	return __sync_fetch_and_add(&job->rc, 0) != 0;
+}
+
+static void walk_stop(struct walk_job *job, int rc)
+{
+	pthread_mutex_lock(&job->lock);
+	if (job->rc == 0)
+		job->rc = rc;
+	job->done = true;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static struct walk_dir *walk_dir_alloc(kvsns_ino_t ino, int depth,
+				       const char *path, const char *name)
+{
+	struct walk_dir *dir;
+	size_t plen = strlen(path);
+	size_t nlen = name ? strlen(name) : 0;
+	size_t len = plen + 1;
+
+	if (name)
+		len += nlen + 1;
+	if (len > PATH_MAX)
+		return NULL;
+
+	dir = malloc(sizeof(struct walk_dir) + len);
+	if (!dir)
+		return NULL;
+
+	dir->ino = ino;
+	dir->depth = depth;
+	dir->prev = NULL;
+	dir->next = NULL;
+
+	/* "<path>/<name>", the size is exact */
+	memcpy(dir->path, path, plen + 1);
+	if (name) {
+		dir->path[plen] = '/';
+		memcpy(dir->path + plen + 1, name, nlen + 1);
+	}
+
+	return dir;
+}
+
+/* Queues a directory for any worker, false if the queues are full */
+static bool walk_push(struct walk_job *job, unsigned int id,
+		      struct walk_dir *dir)
+{
+	struct walk_queue *q = &job->queues[id];
+	bool queued = false;
+
+	pthread_mutex_lock(&q->lock);
+	pthread_mutex_lock(&job->lock);
+	if (job->queued < job->params.queue_max) {
+		dir->prev = q->tail;
+		dir->next = NULL;
+		if (q->tail)
+			q->tail->next = dir;
+		else
+			q->head = dir;
+		q->tail = dir;
+
+		job->queued += 1;
+		job->pending += 1;
+		pthread_cond_signal(&job->cond);
+		queued = true;
+	}
+	pthread_mutex_unlock(&job->lock);
+	pthread_mutex_unlock(&q->lock);
+
+	return queued;
+}
+
+static struct walk_dir *walk_pop(struct walk_job *job, unsigned int id,
+				 bool steal)
+{
+	struct walk_queue *q = &job->queues[id];
+	struct walk_dir *dir;
+
+	pthread_mutex_lock(&q->lock);
+	dir = steal ? q->head : q->tail;
+	if (dir) {
+		if (dir->prev)
+			dir->prev->next = dir->next;
+		else
+			q->head = dir->next;
+		if (dir->next)
+			dir->next->prev = dir->prev;
+		else
+			q->tail = dir->prev;
+
+		pthread_mutex_lock(&job->lock);
+		job->queued -= 1;
+		pthread_mutex_unlock(&job->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return dir;
+}
+
+static struct walk_dir *walk_take(struct walk_job *job, unsigned int id)
+{
+	struct walk_dir *dir;
+	unsigned int i;
+
+	dir = walk_pop(job, id, false);
+
+	for (i = 1; !dir && i < job->params.workers; i++)
+		dir = walk_pop(job, (id + i) % job->params.workers, true);
+
+	return dir;
+}
+
+static void walk_done(struct walk_job *job)
+{
+	pthread_mutex_lock(&job->lock);
+	job->pending -= 1;
+	if (job->pending == 0) {
+		job->done = true;
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->lock);
+}
+
+static int walk_list(struct walk_job *job, unsigned int id,
+		     struct walk_dir *dir);
+
+/* Reports an entry, then queues it or lists it if it is a directory */
+static int walk_entry(struct walk_job *job, unsigned int id,
+		      struct walk_dir *parent, kvsns_dentry_t *dentry)
+{
+	struct walk_dir *dir;
+	bool prune = false;
+	int rc = 0;
+
+	/* Also holds the path given to the callback */
+	dir = walk_dir_alloc(dentry->inode, parent->depth + 1, parent->path,
+			     dentry->name);
+	if (!dir) {
+		__sync_fetch_and_add(&job->errors, 1);
+		return 0;
+	}
+
+	__sync_fetch_and_add(&job->entries, 1);
+
+	if (walk_match(job->filter, dentry)) {
+		__sync_fetch_and_add(&job->matched, 1);
+		rc = job->cb(job->arg, dir->path, dentry);
+		if (rc < 0)
+			goto out;
+		prune = (rc == KVSNS_WALK_PRUNE);
+		rc = 0;
+	}
+
+	if (!S_ISDIR(dentry->stats.st_mode) || prune ||
+	    (job->params.maxdepth >= 0 && dir->depth >= job->params.maxdepth))
+		goto out;
+
+	if (walk_push(job, id, dir))
+		return 0;
+
+	/* The queues are full, this worker goes down this branch first */
+	rc = walk_list(job, id, dir);
+
+out:
+	free(dir);
+	return rc;
+}
+
+/* Lists a directory. Only errors from the callback stop the walk, a
+ * directory that cannot be read is counted and skipped */
+static int walk_list(struct walk_job *job, unsigned int id,
+		     struct walk_dir *dir)
+{
+	kvsns_dentry_t *dirent;
+	kvsns_cookie_t *cookies;
+	kvsns_cookie_t cookie = 0;
+	kvsns_dir_t ddir;
+	bool eof = false;
+	int size;
+	int i;
+	int rc = 0;
+
+	dirent = malloc(job->params.batch * sizeof(kvsns_dentry_t));
+	cookies = malloc(job->params.batch * sizeof(kvsns_cookie_t));
+	if (!dirent || !cookies) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	memset(&ddir, 0, sizeof(ddir));
+	ddir.ino = dir->ino;
+
+	__sync_fetch_and_add(&job->dirs, 1);
+
+	while (!eof && !walk_stopped(job)) {
+		size = job->params.batch;
+		rc = kvsns_readdirplus(job->cred, &ddir, cookie,
+				       KVSNS_READDIR_ATTRS, dirent, cookies,
+				       &size, &eof);
+		if (rc != 0) {
+			/* Removed while the walk went on */
+			if (rc != -ENOENT)
+				__sync_fetch_and_add(&job->errors, 1);
+			rc = 0;
+			break;
+		}
+
+		for (i = 0; i < size; i++) {
+			rc = walk_entry(job, id, dir, &dirent[i]);
+			if (rc < 0)
+				goto out;
+		}
+
+		if (size > 0)
+			cookie = cookies[size - 1];
+	}
+
+out:
+	free(dirent);
+	free(cookies);
+
+	return rc;
+}
+
+static void *walk_worker(void *arg)
+{
+	struct walk_job *job = arg;
+	struct walk_dir *dir;
+	unsigned int id;
+	bool done;
+	int rc;
+
+	id = __sync_fetch_and_add(&job->next_id, 1);
+
+	while (!walk_stopped(job)) {
+		dir = walk_take(job, id);
+		if (dir) {
+			rc = walk_list(job, id, dir);
+			free(dir);
+			if (rc < 0)
+				walk_stop(job, rc);
+			walk_done(job);
+			continue;
+		}
+
+		pthread_mutex_lock(&job->lock);
+		while (!job->done && job->queued == 0)
+			pthread_cond_wait(&job->cond, &job->lock);
+		done = job->done;
+		pthread_mutex_unlock(&job->lock);
+
+		if (done)
+			break;
+	}
+
+	return NULL;
+}
+
+static void walk_run(struct walk_job *job)
+{
+	pthread_t *threads;
+	unsigned int i, started;
+
+	if (job->params.workers == 1) {
+		walk_worker(job);
+		return;
+	}
+
+	threads = calloc(job->params.workers, sizeof(*threads));
+	if (!threads) {
+		walk_worker(job);
+		return;
+	}
+
+	for (started = 0; started < job->params.workers; started++)
+		if (pthread_create(&threads[started], NULL,
+				   walk_worker, job) != 0)
+			break;
+
+	/* Runs with fewer workers if some could not start, the queues of
+	 * the missing ones stay empty */
+	if (started == 0)
+		walk_worker(job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+int kvsns_walk(kvsns_cred_t *cred, kvsns_ino_t *root, const char *path,
+	       kvsns_walk_filter_t *filter, kvsns_walk_params_t *params,
+	       kvsns_walk_cb_t cb, void *arg, kvsns_walk_stats_t *stats)
+{
+	struct walk_job job;
+	struct walk_dir *dir;
+	struct timespec start, stop;
+	kvsns_dentry_t dentry;
+	const char *name;
+	bool prune = false;
+	unsigned int i;
+	int rc;
+
+	if (!cred || !root || !path || !cb)
+		return -EINVAL;
+
+	if (strlen(path) >= PATH_MAX)
+		return -ENAMETOOLONG;
+
+	if ((filter && (filter->mask & KVSNS_FILTER_NAME) && !filter->name) ||
+	    (params && (params->workers == 0 || params->queue_max == 0 ||
+			params->batch <= 0)))
+		return -EINVAL;
+
+	memset(&job, 0, sizeof(job));
+	job.cred = cred;
+	job.filter = filter;
+	job.cb = cb;
+	job.arg = arg;
+	if (params) {
+		job.params = *params;
+	} else {
+		job.params.workers = KVSNS_WALK_WORKERS;
+		job.params.queue_max = KVSNS_WALK_QUEUE_MAX;
+		job.params.batch = KVSNS_WALK_BATCH;
+		job.params.maxdepth = -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* The root is reported like find(1) does */
+	memset(&dentry, 0, sizeof(dentry));
+	name = strrchr(path, '/');
+	name = (name && name[1] != '\0') ? name + 1 : path;
+	strncpy(dentry.name, name, NAME_MAX - 1);
+	dentry.inode = *root;
+	RC_WRAP(kvsns_getattr, cred, root, &dentry.stats);
+
+	if (walk_match(filter, &dentry)) {
+		job.matched += 1;
+		rc = cb(arg, path, &dentry);
+		if (rc < 0)
+			return rc;
+		prune = (rc == KVSNS_WALK_PRUNE);
+	}
+	job.entries += 1;
+
+	if (S_ISDIR(dentry.stats.st_mode) && !prune &&
+	    job.params.maxdepth != 0) {
+		job.queues = calloc(job.params.workers,
+				    sizeof(struct walk_queue));
+		if (!job.queues)
+			return -ENOMEM;
+
+		for (i = 0; i < job.params.workers; i++)
+			pthread_mutex_init(&job.queues[i].lock, NULL);
+		pthread_mutex_init(&job.lock, NULL);
+		pthread_cond_init(&job.cond, NULL);
+
+		/* Ends once the root and everything queued under it is
+		 * listed */
+		dir = walk_dir_alloc(*root, 0, path, NULL);
+		if (!dir) {
+			rc = -ENOMEM;
+		} else {
+			walk_push(&job, 0, dir);
+			walk_run(&job);
+			rc = job.rc;
+		}
+
+		/* Left over by a stopped walk */
+		for (i = 0; i < job.params.workers; i++)
+			while ((dir = walk_pop(&job, i, true)) != NULL)
+				free(dir);
+
+		for (i = 0; i < job.params.workers; i++)
+			pthread_mutex_destroy(&job.queues[i].lock);
+		pthread_mutex_destroy(&job.lock);
+		pthread_cond_destroy(&job.cond);
+		free(job.queues);
+
+		if (rc != 0)
+			return rc;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	if (stats) {
+		stats->dirs = job.dirs;
+		stats->entries = job.entries;
+		stats->matched = job.matched;
+		stats->errors = job.errors;
+		stats->seconds = (stop.tv_sec - start.tv_sec) +
+				 (stop.tv_nsec - start.tv_nsec) / 1e9;
+	}
+
+	return 0;
+}
@@ -12,9 +12,16 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <libgen.h>
+#include <limits.h>
 #include <kvsns/kvsal.h>
 #include <kvsns/kvsns.h>
 
+static int find_print(void *arg, const char *path, kvsns_dentry_t *dentry)
+{
+	printf("%llu %s\n", dentry->inode, path);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc;
@@ -276,7 +283,9 @@ int main(int argc, char *argv[])
 			return 0;
 		}
 	} else if (!strcmp(exec_name, "ns_ls")) {
-		off_t offset;
+		kvsns_cookie_t cookie;
+		kvsns_cookie_t cookies[10];
+		bool eof;
 		int size;
 		kvsns_dentry_t dirent[10];
 		kvsns_dir_t dirfd;
@@ -289,24 +298,26 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 
-		offset = 0;
+		cookie = 0;
 		do {
 			size = 10;
-			rc = kvsns_readdir(&cred, &dirfd, offset,
-					   dirent, &size);
+			rc = kvsns_readdirplus(&cred, &dirfd, cookie,
+					       KVSNS_READDIR_ATIME, dirent,
+					       cookies, &size, &eof);
 			if (rc != 0) {
 				printf("==> readdir failed rc=%d\n", rc);
 				exit(1);
 			}
 			printf("===> size = %d\n", size);
 			for (i = 0; i < size; i++)
-				printf("%lld %s/%s = %llu\n",
-					(long long)(offset+i), current_path,
+				printf("%llu %s/%s = %llu\n",
+					cookies[i], current_path,
 					dirent[i].name,
 					dirent[i].inode);
 
-			offset += size;
-		} while (size != 0);
+			if (size > 0)
+				cookie = cookies[size - 1];
+		} while (!eof);
 
 		rc = kvsns_closedir(&dirfd);
 		if (rc != 0) {
@@ -604,6 +615,151 @@ int main(int argc, char *argv[])
 		else
 			fprintf(stderr, "%llu/%s => %llu/%s Failed rc=%d\n",
 				sino, argv[2], dino, argv[4], rc);
+	} else if (!strcmp(exec_name, "ns_find")) {
+		kvsns_walk_filter_t filter;
+		kvsns_walk_params_t params;
+		kvsns_walk_stats_t stats;
+		char *path = ".";
+		char *arg;
+		time_t now = time(NULL);
+		long long val;
+		int i;
+
+		memset(&filter, 0, sizeof(filter));
+		params.workers = 8;
+		params.queue_max = 4096;
+		params.batch = 128;
+		params.maxdepth = -1;
+
+		for (i = 1; i < argc; i++) {
+			if (argv[i][0] != '-') {
+				path = argv[i];
+				continue;
+			}
+			if (i + 1 == argc) {
+				fprintf(stderr,
+					"find [path] [-type f|d|l] [-name glob]"
+					" [-size [+-]bytes] [-mtime [+-]days]"
+					" [-uid uid] [-gid gid] [-maxdepth n]"
+					" [-workers n]\n");
+				exit(1);
+			}
+			arg = argv[++i];
+			val = atoll(arg);
+
+			if (!strcmp(argv[i - 1], "-type")) {
+				filter.mask |= KVSNS_FILTER_TYPE;
+				filter.type = (arg[0] == 'd') ? S_IFDIR :
+					      (arg[0] == 'l') ? S_IFLNK :
+					      S_IFREG;
+			} else if (!strcmp(argv[i - 1], "-name")) {
+				filter.mask |= KVSNS_FILTER_NAME;
+				filter.name = arg;
+			} else if (!strcmp(argv[i - 1], "-size")) {
+				filter.mask |= KVSNS_FILTER_SIZE;
+				filter.size_min = (arg[0] == '-') ? 0 :
+					(arg[0] == '+') ? val + 1 : val;
+				filter.size_max = (arg[0] == '-') ? -val - 1 :
+					(arg[0] == '+') ? LLONG_MAX : val;
+			} else if (!strcmp(argv[i - 1], "-mtime")) {
+				/* +days: older than that, -days: newer */
+				filter.mask |= KVSNS_FILTER_MTIME;
+				filter.mtime_min = (arg[0] == '+') ? 0 :
+					now - (val < 0 ? -val : val) * 86400;
+				filter.mtime_max = (arg[0] == '+') ?
+					now - val * 86400 : now;
+			} else if (!strcmp(argv[i - 1], "-uid")) {
+				filter.mask |= KVSNS_FILTER_UID;
+				filter.uid = val;
+			} else if (!strcmp(argv[i - 1], "-gid")) {
+				filter.mask |= KVSNS_FILTER_GID;
+				filter.gid = val;
+			} else if (!strcmp(argv[i - 1], "-maxdepth")) {
+				params.maxdepth = val;
+			} else if (!strcmp(argv[i - 1], "-workers")) {
+				params.workers = (val > 0) ? val : 1;
+			} else {
+				fprintf(stderr, "find: unknown %s\n",
+					argv[i - 1]);
+				exit(1);
+			}
+		}
+
+		if (!strcmp(path, "."))
+			ino = current_inode;
+		else {
+			rc = kvsns_lookup_path(&cred, &current_inode, path,
+					       &ino);
+			if (rc != 0) {
+				fprintf(stderr, "find: %s not found rc=%d\n",
+					path, rc);
+				exit(1);
+			}
+		}
+
+		rc = kvsns_walk(&cred, &ino, path, &filter, &params,
+				find_print, NULL, &stats);
+		if (rc != 0) {
+			fprintf(stderr, "==> find failed rc=%d\n", rc);
+			exit(1);
+		}
+		printf("===> %llu dirs, %llu entries, %llu matched,"
+		       " %llu errors in %.3f s\n",
+		       stats.dirs, stats.entries, stats.matched,
+		       stats.errors, stats.seconds);
+	} else if (!strcmp(exec_name, "ns_index")) {
+		kvsns_index_cursor_t cursor;
+		kvsns_ino_t inos[100];
+		enum kvsns_index index;
+		unsigned long long min, max;
+		bool eof;
+		int size;
+		int i;
+
+		if (argc == 2 && !strcmp(argv[1], "rebuild")) {
+			rc = kvsns_index_rebuild();
+			if (rc != 0) {
+				fprintf(stderr, "==> rebuild failed rc=%d\n", rc);
+				exit(1);
+			}
+			printf("######## OK ########\n");
+			return 0;
+		}
+
+		if (argc < 3 || argc > 4) {
+			fprintf(stderr, "index rebuild | mtime|size <min> <max>"
+				" | uid|gid <id>\n");
+			exit(1);
+		}
+
+		if (!strcmp(argv[1], "mtime"))
+			index = KVSNS_INDEX_MTIME;
+		else if (!strcmp(argv[1], "size"))
+			index = KVSNS_INDEX_SIZE;
+		else if (!strcmp(argv[1], "uid"))
+			index = KVSNS_INDEX_UID;
+		else if (!strcmp(argv[1], "gid"))
+			index = KVSNS_INDEX_GID;
+		else {
+			fprintf(stderr, "index: unknown %s\n", argv[1]);
+			exit(1);
+		}
+
+		min = strtoull(argv[2], NULL, 10);
+		max = (argc == 4) ? strtoull(argv[3], NULL, 10) : min;
+
+		memset(&cursor, 0, sizeof(cursor));
+		do {
+			size = 100;
+			rc = kvsns_index_query(index, min, max, &cursor,
+					       inos, &size, &eof);
+			if (rc != 0) {
+				fprintf(stderr, "==> query failed rc=%d\n", rc);
+				exit(1);
+			}
+			for (i = 0; i < size; i++)
+				printf("%llu\n", inos[i]);
+		} while (!eof);
 	} else if (!strcmp(exec_name, "ns_fsstat")) {
 		kvsns_fsstat_t statfs;
 
@@ -39,7 +39,45 @@
 #include <kvsns/kvsal.h>
 #include <kvsns/kvsns.h>
 
-#define IOLEN 4096
+#define IOLEN (1024 * 1024)
+#define CHUNK_SIZE (64 * 1024 * 1024)
+#define DEPTH 4
+
+static void usage(char *prog)
+{
+	fprintf(stderr,
+		"%s [-w workers] [-c chunk_size] [-b io_size] [-q depth] "
+		"<src> <dest>\n", prog);
+	exit(1);
+}
+
+/* Sizes can be suffixed by k, m or g */
+static size_t parse_size(char *prog, char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'g':
+	case 'G':
+		size *= 1024;
+		/* fallthrough */
+	case 'm':
+	case 'M':
+		size *= 1024;
+		/* fallthrough */
+	case 'k':
+	case 'K':
+		size *= 1024;
+		end++;
+	}
+
+	if (*end != '\0' || size == 0)
+		usage(prog);
+
+	return size;
+}
 
 static void exit_rc(char *msg, int rc)
 {
@@ -66,13 +104,40 @@ int main(int argc, char *argv[])
 	bool kvsns_dest = false;
 	char *src = NULL;
 	char *dest = NULL;
+	kvsns_cp_params_t params = {
+		.workers = 1,
+		.chunk_size = CHUNK_SIZE,
+		.iolen = IOLEN,
+		.depth = DEPTH,
+	};
+	kvsns_cp_stats_t stats;
+	int opt;
 	int rc;
 
-	if (argc != 3) {
-		fprintf(stderr, "%s <src> <dest>\n", argv[0]);
-		exit(1);
+	while ((opt = getopt(argc, argv, "w:c:b:q:")) != -1) {
+		switch (opt) {
+		case 'w':
+			params.workers = atoi(optarg);
+			break;
+		case 'c':
+			params.chunk_size = parse_size(argv[0], optarg);
+			break;
+		case 'b':
+			params.iolen = parse_size(argv[0], optarg);
+			break;
+		case 'q':
+			params.depth = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
 	}
 
+	if (argc - optind != 2 || params.workers == 0 || params.depth == 0)
+		usage(argv[0]);
+
+	argv += optind - 1;
+
 	cred.uid = getuid();
 	cred.gid = getgid();
 
@@ -138,13 +203,20 @@ int main(int argc, char *argv[])
 
 	/* Deal with the copy */
 	if (kvsns_src)
-		rc = kvsns_cp_from(&cred, &kfd, fd, IOLEN);
+		rc = kvsns_cp_from_parallel(&cred, &kfd, fd, &params, &stats);
 
 	if (kvsns_dest)
-		rc = kvsns_cp_to(&cred, fd, &kfd, IOLEN);
+		rc = kvsns_cp_to_parallel(&cred, fd, &kfd, &params, &stats);
 
 	exit_rc("Copy failed", rc);
 
+	printf("%llu bytes in %.3f s", stats.bytes, stats.seconds);
+	if (stats.seconds > 0)
+		printf(", %.1f MB/s",
+		       stats.bytes / stats.seconds / (1024 * 1024));
+	printf(" (%u workers, %zu bytes chunks)\n",
+	       params.workers, params.chunk_size);
+
 	/* The end */
 	rc = close(fd);
 	exit_rc("Can't close POSIX fd, errono", errno);
@@ -0,0 +1,378 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_migrate.c
+ * KVSNS: converts an existing store to the current format:
+ *  - inode attributes kept as raw struct stat become versioned records,
+ *    this must run on the architecture of the clients that created them
+ *  - records of files get the size and blocks of their data, read from
+ *    the extstore
+ *  - dentries kept as "<dir>.dentries.<name>" strings become members of
+ *    the "<dir>.dentries" sorted set
+ *  - "parentdir" lists kept as "a|b|" strings become sets of
+ *    "<parent>/<name>" links, rebuilt from the converted dentries
+ *  - "openowner" lists kept as strings are dropped
+ *  - the secondary indexes enabled in the configuration are rebuilt once
+ *    records were rewritten
+ * No client must be using the store.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+#include <kvsns/extstore.h>
+
+#define MIGRATE_TRUNK 1024
+
+#define RC_WRAP(__function, ...) ({\
+	int __rc = __function(__VA_ARGS__);\
+	if (__rc != 0)        \
+		return __rc; })
+
+static void exit_rc(char *msg, int rc)
+{
+	if (rc >= 0)
+		return;
+
+	fprintf(stderr, "%s |rc=%d\n", msg, rc);
+	exit(1);
+}
+
+/* Lists the keys matching a pattern before they are modified */
+static int collect_keys(char *pattern, kvsal_item_t **keys, int *nb)
+{
+	kvsal_list_t list;
+	int size;
+	int rc;
+
+	size = kvsal_get_list_size(pattern);
+	if (size < 0)
+		return size;
+
+	*nb = size;
+	*keys = malloc((size + 1) * sizeof(kvsal_item_t));
+	if (!*keys)
+		return -ENOMEM;
+
+	RC_WRAP(kvsal_fetch_list, pattern, &list);
+	rc = kvsal_get_list(&list, 0, nb, *keys);
+	kvsal_dispose_list(&list);
+
+	return rc;
+}
+
+/* Deletes the keys of a pattern that are still plain strings */
+static int drop_strings(char *pattern, bool dry_run, int *dropped)
+{
+	kvsal_item_t *keys;
+	char v[VLEN];
+	int nb;
+	int i;
+
+	*dropped = 0;
+	RC_WRAP(collect_keys, pattern, &keys, &nb);
+
+	for (i = 0; i < nb ; i++) {
+		/* Fails on sets, which are already converted */
+		if (kvsal_get_char(keys[i].str, v) != 0)
+			continue;
+
+		if (!dry_run)
+			RC_WRAP(kvsal_del, keys[i].str);
+		*dropped += 1;
+	}
+
+	free(keys);
+	return 0;
+}
+
+/* Moves the "<dir>.dentries.<name>" strings into the sorted set of their
+ * directory, each dentry in a transaction of its own */
+static int convert_dentries(bool dry_run, int *converted)
+{
+	kvsal_item_t *keys;
+	unsigned long long ino;
+	kvsns_ino_t dir;
+	char k[KLEN];
+	char v[VLEN];
+	char *name;
+	int nb;
+	int rc;
+	int i;
+
+	*converted = 0;
+	RC_WRAP(collect_keys, "*.dentries.*", &keys, &nb);
+
+	for (i = 0; i < nb ; i++) {
+		dir = strtoull(keys[i].str, &name, 10);
+		if (name == keys[i].str ||
+		    strncmp(name, ".dentries.", strlen(".dentries.")))
+			continue;
+		name += strlen(".dentries.");
+
+		if (kvsal_get_char(keys[i].str, v) != 0)
+			continue;
+		ino = strtoull(v, NULL, 10);
+
+		if (!dry_run) {
+			snprintf(k, KLEN, "%llu.dentries", dir);
+			rc = kvsal_begin_transaction();
+			if (rc != 0)
+				goto out;
+			rc = kvsal_add_entry(k, name, ino);
+			if (rc == 0)
+				rc = kvsal_del(keys[i].str);
+			if (rc != 0) {
+				kvsal_discard_transaction();
+				goto out;
+			}
+			rc = kvsal_end_transaction();
+			if (rc != 0)
+				goto out;
+		}
+		*converted += 1;
+	}
+	rc = 0;
+
+out:
+	free(keys);
+	return rc;
+}
+
+/* Older records did not keep the size of the files */
+static int data_attrs(kvsns_ino_t ino, struct stat *stat)
+{
+	struct stat data;
+	int rc;
+
+	if (!S_ISREG(stat->st_mode)) {
+		stat->st_blocks = 0;
+		return 0;
+	}
+
+	memset(&data, 0, sizeof(data));
+	rc = extstore_getattr(&ino, &data);
+	if (rc == -ENOENT) {
+		stat->st_blocks = 0; /* no data */
+		return 0;
+	}
+	if (rc != 0)
+		return rc;
+
+	stat->st_size = data.st_size;
+	stat->st_blocks = data.st_blocks;
+	if (data.st_mtime > stat->st_mtime)
+		stat->st_mtim = data.st_mtim;
+
+	return 0;
+}
+
+/* Rebuilds the "parentdir" sets from all the dentries, which must all be
+ * in the "<dir>.dentries" sorted sets (see convert_dentries) */
+static int rebuild_parents(int *links)
+{
+	kvsal_item_t *dirs;
+	kvsal_item_t items[KVSAL_ARRAY_SIZE];
+	kvsal_list_t list;
+	kvsns_ino_t dir;
+	char k[KLEN];
+	char v[VLEN];
+	int offset;
+	int nb;
+	int size;
+	int i;
+	int j;
+
+	*links = 0;
+	RC_WRAP(collect_keys, "*.dentries", &dirs, &nb);
+
+	for (i = 0; i < nb ; i++) {
+		dir = strtoull(dirs[i].str, NULL, 10);
+		RC_WRAP(kvsal_fetch_entries, dirs[i].str, &list);
+
+		offset = 0;
+		do {
+			size = KVSAL_ARRAY_SIZE;
+			RC_WRAP(kvsal_get_list, &list, offset, &size, items);
+
+			for (j = 0; j < size ; j++) {
+				snprintf(k, KLEN, "%llu.parentdir",
+					 items[j].value);
+				snprintf(v, VLEN, "%llu/%s", dir, items[j].str);
+				RC_WRAP(kvsal_add_member, k, v);
+				*links += 1;
+			}
+			offset += size;
+		} while (size > 0);
+
+		kvsal_dispose_list(&list);
+	}
+
+	free(dirs);
+
+	/* The root is its own parent */
+	snprintf(k, KLEN, "%llu.parentdir", KVSNS_ROOT_INODE);
+	snprintf(v, VLEN, "%llu/", KVSNS_ROOT_INODE);
+	return kvsal_add_member(k, v);
+}
+
+int main(int argc, char *argv[])
+{
+	kvsal_item_t *items;
+	kvsal_list_t list;
+	char buf[sizeof(struct stat)];
+	struct stat stat;
+	bool dry_run = false;
+	size_t size;
+	int offset = 0;
+	int migrated = 0;
+	int current = 0;
+	int unknown = 0;
+	int parents = 0;
+	int owners = 0;
+	int dentries = 0;
+	int links = 0;
+	int left = 0;
+	int nb;
+	int rc;
+	int i;
+
+	if (argc == 2 && !strcmp(argv[1], "-n")) {
+		dry_run = true;
+	} else if (argc != 1) {
+		fprintf(stderr, "%s [-n]\n", argv[0]);
+		exit(1);
+	}
+
+	items = malloc(MIGRATE_TRUNK * sizeof(kvsal_item_t));
+	if (!items)
+		exit_rc("Can't allocate list", -ENOMEM);
+
+	rc = kvsns_start(KVSNS_DEFAULT_CONFIG);
+	exit_rc("kvsns_start failed", rc);
+
+	rc = kvsal_fetch_list("*.stat", &list);
+	exit_rc("Can't list the inodes", rc);
+
+	do {
+		nb = MIGRATE_TRUNK;
+		rc = kvsal_get_list(&list, offset, &nb, items);
+		exit_rc("Can't list the inodes", rc);
+
+		for (i = 0; i < nb ; i++) {
+			size = sizeof(buf);
+			rc = kvsal_get_binary(items[i].str, buf, &size);
+			if (rc != 0) {
+				fprintf(stderr, "%s: can't read, rc=%d\n",
+					items[i].str, rc);
+				unknown += 1;
+				continue;
+			}
+
+			rc = kvsal_record2stat(buf, size, &stat);
+			if (rc == 0 && stat.st_blocks != KVSAL_BLOCKS_UNKNOWN) {
+				current += 1;
+				continue;
+			}
+
+			if (rc != 0 && size != sizeof(struct stat)) {
+				fprintf(stderr, "%s: unknown format, %zu bytes\n",
+					items[i].str, size);
+				unknown += 1;
+				continue;
+			}
+
+			if (rc != 0)
+				memcpy(&stat, buf, sizeof(struct stat));
+
+			rc = data_attrs(strtoull(items[i].str, NULL, 10), &stat);
+			if (rc != 0) {
+				fprintf(stderr, "%s: can't read the data, rc=%d\n",
+					items[i].str, rc);
+				unknown += 1;
+				continue;
+			}
+
+			if (!dry_run) {
+				rc = kvsal_set_stat(items[i].str, &stat);
+				exit_rc("Can't write the inode record", rc);
+			}
+			migrated += 1;
+		}
+
+		offset += nb;
+	} while (nb > 0);
+
+	rc = kvsal_dispose_list(&list);
+	exit_rc("Can't dispose the list", rc);
+
+	printf("%s%d migrated, %d already current, %d unknown\n",
+	       dry_run ? "(dry run) " : "", migrated, current, unknown);
+
+	rc = convert_dentries(dry_run, &dentries);
+	exit_rc("Can't convert the dentries", rc);
+
+	printf("%s%d dentries converted\n", dry_run ? "(dry run) " : "",
+	       dentries);
+
+	/* The parent lists are rebuilt from the sorted sets only: they must
+	 * not be dropped while a dentry is left in the former format */
+	if (!dry_run) {
+		rc = convert_dentries(true, &left);
+		if (rc == 0 && left > 0)
+			rc = -EAGAIN;
+		exit_rc("Dentries left unconverted, parent lists kept", rc);
+	}
+
+	rc = drop_strings("*.parentdir", dry_run, &parents);
+	exit_rc("Can't convert the parent lists", rc);
+
+	if (parents > 0 && !dry_run) {
+		rc = rebuild_parents(&links);
+		exit_rc("Can't rebuild the parent sets", rc);
+	}
+
+	rc = drop_strings("*.openowner", dry_run, &owners);
+	exit_rc("Can't drop the open owners", rc);
+
+	printf("%s%d parent lists converted (%d links), %d open owners dropped\n",
+	       dry_run ? "(dry run) " : "", parents, links, owners);
+
+	/* Records were written without going through the indexes */
+	if (migrated > 0 && !dry_run) {
+		rc = kvsns_index_rebuild();
+		if (rc != -EOPNOTSUPP)
+			exit_rc("Can't rebuild the indexes", rc);
+	}
+
+	free(items);
+	return unknown ? 1 : 0;
+}
@@ -38,6 +38,9 @@ Provides: %{name} = %{version}-%{release}
 @BCOND_RADOS@ rados
 %global use_rados %{on_off_switch rados}
 
+@BCOND_POSIX_URING@ posix_uring
+%global use_posix_uring %{on_off_switch posix_uring}
+
 %description
 The libkvsns is a library that allows of a POSIX namespace built on top of
 a Key-Value Store.
@@ -75,6 +78,7 @@ cmake . -DUSE_KVS_REDIS=%{use_kvs_redis}     \
 	-DUSE_POSIX_STORE=%{use_posix_store} \
 	-DUSE_POSIX_OBJ=%{use_posix_obj}     \
 	-DUSE_RADOS=%{use_rados}	     \
+	-DUSE_POSIX_URING=%{use_posix_uring} \
 
 make %{?_smp_mflags} || make %{?_smp_mflags} || make
 
@@ -94,6 +98,7 @@ install -m 644 kvsns/libkvsns.so %{buildroot}%{_libdir}
 install -m 644 libkvsns.pc  %{buildroot}%{_libdir}/pkgconfig
 install -m 755 kvsns_shell/kvsns_busybox %{buildroot}%{_bindir}
 install -m 755 kvsns_shell/kvsns_cp %{buildroot}%{_bindir}
+install -m 755 kvsns_shell/kvsns_migrate %{buildroot}%{_bindir}
 install -m 755 kvsns_attach/kvsns_attach %{buildroot}%{_bindir}
 install -m 644 kvsns.ini %{buildroot}%{_sysconfdir}/kvsns.d
 
@@ -118,6 +123,7 @@ rm -rf $RPM_BUILD_ROOT
 %defattr(-,root,root)
 %{_bindir}/kvsns_busybox
 %{_bindir}/kvsns_cp
+%{_bindir}/kvsns_migrate
 %{_bindir}/kvsns_attach
 
 %changelog
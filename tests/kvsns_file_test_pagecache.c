@@ -0,0 +1,177 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* kvsns_file_test_pagecache.c
+ * KVSNS: small sequential writes and reads, as a NFS server does them
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+
+#define CHUNK 4096
+#define COUNT 1024
+
+static void fill(char *buff, int i)
+{
+	int j;
+
+	for (j = 0; j < CHUNK; j++)
+		buff[j] = (char)(i + j);
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int i;
+	kvsns_ino_t ino = 0LL;
+	kvsns_ino_t parent = 0LL;
+	kvsns_file_open_t fd;
+	kvsns_cred_t cred;
+	kvsns_cache_stats_t stats;
+	struct stat stat;
+	ssize_t size;
+	char expected[CHUNK];
+	char buff[CHUNK];
+
+	cred.uid = getuid();
+	cred.gid = getgid();
+
+	rc = kvsns_start(KVSNS_DEFAULT_CONFIG);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_init_root(1);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init_root: err=%d\n", rc);
+		exit(1);
+	}
+
+	parent = KVSNS_ROOT_INODE;
+	rc = kvsns_creat(&cred, &parent, "fichier_pc", 0755, &ino);
+	if (rc != 0) {
+		if (rc == -EEXIST)
+			fprintf(stderr, "dirent exists\n");
+		else {
+			fprintf(stderr, "kvsns_creat: err=%d\n", rc);
+			exit(1);
+		}
+	}
+
+	rc = kvsns_open(&cred, &ino, O_RDWR, 0755, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_open: err=%d\n", rc);
+		exit(1);
+	}
+
+	/* Unstable writes are kept by the page cache, if enabled */
+	fd.durability = KVSNS_UNSTABLE;
+	for (i = 0; i < COUNT; i++) {
+		fill(buff, i);
+		size = kvsns_write(&cred, &fd, buff, CHUNK, (off_t)i * CHUNK);
+		if (size != CHUNK) {
+			fprintf(stderr, "kvsns_write: err=%lld\n",
+				(long long)size);
+			exit(1);
+		}
+	}
+
+	/* Data not flushed yet is part of the file */
+	rc = kvsns_getattr(&cred, &ino, &stat);
+	if (rc != 0 || stat.st_size != (off_t)COUNT * CHUNK) {
+		fprintf(stderr, "kvsns_getattr: err=%d size=%lld\n",
+			rc, (long long)stat.st_size);
+		exit(1);
+	}
+
+	rc = kvsns_fsync(&cred, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_fsync: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_close(&fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_close: err=%d\n", rc);
+		exit(1);
+	}
+
+	/* Read back after the close, in order then past the end */
+	rc = kvsns_open(&cred, &ino, O_RDONLY, 0755, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_open: err=%d\n", rc);
+		exit(1);
+	}
+
+	for (i = 0; i < COUNT; i++) {
+		fill(expected, i);
+		size = kvsns_read(&cred, &fd, buff, CHUNK, (off_t)i * CHUNK);
+		if (size != CHUNK || memcmp(buff, expected, CHUNK)) {
+			fprintf(stderr, "kvsns_read: bad chunk %d size=%lld\n",
+				i, (long long)size);
+			exit(1);
+		}
+	}
+
+	size = kvsns_read(&cred, &fd, buff, CHUNK, (off_t)COUNT * CHUNK);
+	if (size != 0) {
+		fprintf(stderr, "kvsns_read: read past end=%lld\n",
+			(long long)size);
+		exit(1);
+	}
+
+	rc = kvsns_close(&fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_close: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_get_cache_stats(&stats);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_get_cache_stats: err=%d\n", rc);
+		exit(1);
+	}
+
+	printf("pages: hits=%llu misses=%llu readahead=%llu flushes=%llu\n",
+	       stats.page_hits, stats.page_misses, stats.page_readahead,
+	       stats.page_flushes);
+
+	printf("######## OK ########\n");
+	return 0;
+
+}
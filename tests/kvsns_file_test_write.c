@@ -50,6 +50,7 @@ int main(int argc, char *argv[])
 	kvsns_file_open_t fd;
 	kvsns_cred_t cred;
 	ssize_t written;
+	struct stat stat;
 	char buff[SIZE];
 	size_t count;
 	off_t offset;
@@ -101,12 +102,39 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	/* Same again as write-back, then committed */
+	fd.durability = KVSNS_UNSTABLE;
+	written = kvsns_write(&cred, &fd, buff, count, offset + count);
+	if (written < 0) {
+		fprintf(stderr, "kvsns_write (unstable): err=%lld\n",
+			(long long)written);
+		exit(1);
+	}
+
+	rc = kvsns_fsync(&cred, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_fsync: err=%d\n", rc);
+		exit(1);
+	}
+
 	rc = kvsns_close(&fd);
 	if (rc != 0) {
 		fprintf(stderr, "kvsns_close: err=%d\n", rc);
 		exit(1);
 	}
 
+	/* The size was stored in the inode at close */
+	rc = kvsns_getattr(&cred, &ino, &stat);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_getattr: err=%d\n", rc);
+		exit(1);
+	}
+
+	if (stat.st_size != (off_t)(2 * count)) {
+		fprintf(stderr, "wrong size %lld, expected %zu\n",
+			(long long)stat.st_size, 2 * count);
+		exit(1);
+	}
 
 	printf("######## OK ########\n");
 	return 0;
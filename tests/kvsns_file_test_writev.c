@@ -0,0 +1,145 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+
+/* kvsns_file_test_writev.c
+ * KVSNS: scatter/gather write and read test
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+
+#define SIZE 1024
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	kvsns_ino_t ino = 0LL;
+	kvsns_ino_t parent = 0LL;
+	kvsns_file_open_t fd;
+	kvsns_cred_t cred;
+	ssize_t size;
+	char head[] = "This is ";
+	char tail[] = "a strided content";
+	char buff[SIZE];
+	struct iovec iov[2];
+	struct iovec riov[1];
+	kvsns_extent_t ext[3];
+
+	cred.uid = getuid();
+	cred.gid = getgid();
+
+	rc = kvsns_start(KVSNS_DEFAULT_CONFIG);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_init_root(1);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init_root: err=%d\n", rc);
+		exit(1);
+	}
+
+	parent = KVSNS_ROOT_INODE;
+	rc = kvsns_creat(&cred, &parent, "fichier_v", 0755, &ino);
+	if (rc != 0) {
+		if (rc == -EEXIST)
+			fprintf(stderr, "dirent exists\n");
+		else {
+			fprintf(stderr, "kvsns_creat: err=%d\n", rc);
+			exit(1);
+		}
+	}
+
+	rc = kvsns_open(&cred, &ino, O_RDWR, 0755, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_open: err=%d\n", rc);
+		exit(1);
+	}
+
+	/* Two buffers (8 + 17 bytes) spread over three strided extents */
+	iov[0].iov_base = head;
+	iov[0].iov_len = strlen(head);
+	iov[1].iov_base = tail;
+	iov[1].iov_len = strlen(tail);
+
+	ext[0].offset = 0;
+	ext[0].len = 5;
+	ext[1].offset = 100;
+	ext[1].len = 10;
+	ext[2].offset = 200;
+	ext[2].len = 10;
+
+	size = kvsns_writev(&cred, &fd, iov, 2, ext, 3);
+	if (size != 25) {
+		fprintf(stderr, "kvsns_writev: err=%lld\n", (long long)size);
+		exit(1);
+	}
+
+	/* Read back in a single buffer */
+	riov[0].iov_base = buff;
+	riov[0].iov_len = 25;
+
+	size = kvsns_readv(&cred, &fd, riov, 1, ext, 3);
+	if (size != 25) {
+		fprintf(stderr, "kvsns_readv: err=%lld\n", (long long)size);
+		exit(1);
+	}
+
+	if (memcmp(buff, "This is a strided content", 25)) {
+		fprintf(stderr, "kvsns_readv: bad content\n");
+		exit(1);
+	}
+
+	/* Sizes of buffers and extents must match */
+	riov[0].iov_len = 24;
+	size = kvsns_readv(&cred, &fd, riov, 1, ext, 3);
+	if (size != -EINVAL) {
+		fprintf(stderr, "kvsns_readv: mismatch not detected\n");
+		exit(1);
+	}
+
+	rc = kvsns_close(&fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_close: err=%d\n", rc);
+		exit(1);
+	}
+
+	printf("######## OK ########\n");
+	return 0;
+
+}
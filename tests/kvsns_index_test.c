@@ -0,0 +1,182 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_index_test.c
+ * KVSNS: test for the secondary indexes
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+
+#define MTIME 1000000000LL
+#define SIZE 128
+
+/* Tells if ino is among the inodes of index matching [min, max] */
+static bool indexed(enum kvsns_index index, unsigned long long min,
+		    unsigned long long max, kvsns_ino_t ino)
+{
+	kvsns_index_cursor_t cursor;
+	kvsns_ino_t inos[4];
+	bool found = false;
+	bool eof;
+	int size;
+	int rc;
+	int i;
+
+	/* Small pages to go through the cursor */
+	memset(&cursor, 0, sizeof(cursor));
+	do {
+		size = 4;
+		rc = kvsns_index_query(index, min, max, &cursor, inos,
+				       &size, &eof);
+		if (rc != 0) {
+			fprintf(stderr, "kvsns_index_query: err=%d\n", rc);
+			exit(1);
+		}
+		for (i = 0; i < size; i++)
+			if (inos[i] == ino)
+				found = true;
+	} while (!eof);
+
+	return found;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	kvsns_ino_t ino = 0LL;
+	kvsns_ino_t parent = 0LL;
+	kvsns_cred_t cred;
+	kvsns_index_cursor_t cursor;
+	kvsns_file_open_t fd;
+	struct stat stat;
+	char buff[SIZE];
+	ssize_t written;
+	bool eof;
+	int size;
+
+	cred.uid = getuid();
+	cred.gid = getgid();
+
+	rc = kvsns_start(KVSNS_DEFAULT_CONFIG);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_init_root(1);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init_root: err=%d\n", rc);
+		exit(1);
+	}
+
+	/* Nothing to test without the indexes in the configuration */
+	memset(&cursor, 0, sizeof(cursor));
+	size = 1;
+	rc = kvsns_index_query(KVSNS_INDEX_MTIME, 0, 0, &cursor, &ino,
+			       &size, &eof);
+	if (rc == -EOPNOTSUPP) {
+		printf("indexes are not enabled, skipped\n");
+		printf("######## OK ########\n");
+		return 0;
+	}
+
+	parent = KVSNS_ROOT_INODE;
+	rc = kvsns_creat(&cred, &parent, "indexed", 0644, &ino);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_creat: err=%d\n", rc);
+		exit(1);
+	}
+
+	if (!indexed(KVSNS_INDEX_UID, cred.uid, 0, ino) ||
+	    !indexed(KVSNS_INDEX_GID, cred.gid, 0, ino) ||
+	    !indexed(KVSNS_INDEX_SIZE, 0, 0, ino)) {
+		fprintf(stderr, "%llu is not indexed at creation\n", ino);
+		exit(1);
+	}
+
+	/* The size is stored at close */
+	rc = kvsns_open(&cred, &ino, O_WRONLY, 0644, &fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_open: err=%d\n", rc);
+		exit(1);
+	}
+
+	memset(buff, 'a', SIZE);
+	written = kvsns_write(&cred, &fd, buff, SIZE, 0);
+	if (written != SIZE) {
+		fprintf(stderr, "kvsns_write: err=%lld\n",
+			(long long)written);
+		exit(1);
+	}
+
+	rc = kvsns_close(&fd);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_close: err=%d\n", rc);
+		exit(1);
+	}
+
+	memset(&stat, 0, sizeof(stat));
+	stat.st_mtim.tv_sec = MTIME;
+	rc = kvsns_setattr(&cred, &ino, &stat, STAT_MTIME_SET);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_setattr: err=%d\n", rc);
+		exit(1);
+	}
+
+	if (!indexed(KVSNS_INDEX_MTIME, MTIME, MTIME, ino) ||
+	    indexed(KVSNS_INDEX_MTIME, MTIME + 1, ~0ULL, ino) ||
+	    !indexed(KVSNS_INDEX_SIZE, SIZE, SIZE, ino) ||
+	    indexed(KVSNS_INDEX_SIZE, 0, SIZE - 1, ino)) {
+		fprintf(stderr, "%llu is not indexed after close\n", ino);
+		exit(1);
+	}
+
+	rc = kvsns_unlink(&cred, &parent, "indexed");
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_unlink: err=%d\n", rc);
+		exit(1);
+	}
+
+	if (indexed(KVSNS_INDEX_MTIME, MTIME, MTIME, ino) ||
+	    indexed(KVSNS_INDEX_UID, cred.uid, 0, ino)) {
+		fprintf(stderr, "%llu is still indexed after unlink\n", ino);
+		exit(1);
+	}
+
+	printf("######## OK ########\n");
+	return 0;
+}
@@ -49,9 +49,9 @@ int main(int argc, char *argv[])
 	kvsns_ino_t ino2 = 0LL;
 	kvsns_ino_t parent = 0LL;
 	char val[VLEN];
-	char tmp[VLEN];
 	kvsns_cred_t cred;
 	kvsal_item_t items[10];
+	kvsal_list_t list;
 
 	cred.uid = getuid();
 	cred.gid = getgid();
@@ -119,20 +119,20 @@ int main(int argc, char *argv[])
 		printf("==> LIST: %s\n", items[i].str);
 
 	printf("+++++++++++++++\n");
-	end = 10;
-	rc = kvsal_get_list_pattern("2.dentries.*", 0, &end, items);
+	rc = kvsal_fetch_entries("2.dentries", &list);
 	if (rc != 0) {
-		fprintf(stderr, "kvsns_get_list_pattern: err=%d\n", rc);
+		fprintf(stderr, "kvsal_fetch_entries: err=%d\n", rc);
 		exit(1);
 	}
-	for (i = 0 ; i < end ; i++) {
-		printf("==> LIST: %s\n", items[i].str);
-		if (sscanf(items[i].str,
-			   "%llu.dentries.%s",
-			    &ino, tmp) == EOF)
-			exit(1);
-		printf("+++> LIST: %llu %s\n", ino, tmp);
+	end = 10;
+	rc = kvsal_get_list(&list, 0, &end, items);
+	if (rc != 0) {
+		fprintf(stderr, "kvsal_get_list: err=%d\n", rc);
+		exit(1);
 	}
+	for (i = 0 ; i < end ; i++)
+		printf("+++> LIST: %llu %s\n", items[i].value, items[i].str);
+	kvsal_dispose_list(&list);
 	printf("+++++++++++++++\n");
 
 
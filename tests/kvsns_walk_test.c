@@ -0,0 +1,209 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) CEA, 2016
+ * Author: Philippe Deniel  philippe.deniel@cea.fr
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/* kvsns_walk_test.c
+ * KVSNS: test for the parallel tree walk
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <kvsns/kvsal.h>
+#include <kvsns/kvsns.h>
+
+#define NB_DIRS 10
+#define NB_FILES 20
+
+static unsigned long long reported;
+
+static int count_entry(void *arg, const char *path, kvsns_dentry_t *dentry)
+{
+	__sync_fetch_and_add(&reported, 1);
+
+	/* Do not go into the directory named by arg */
+	if (arg && !strcmp(dentry->name, arg))
+		return KVSNS_WALK_PRUNE;
+
+	return 0;
+}
+
+static void walk(kvsns_cred_t *cred, kvsns_ino_t *root,
+		 kvsns_walk_filter_t *filter, kvsns_walk_params_t *params,
+		 char *prune, unsigned long long expected)
+{
+	kvsns_walk_stats_t stats;
+	int rc;
+
+	reported = 0;
+	rc = kvsns_walk(cred, root, "walk", filter, params, count_entry,
+			prune, &stats);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_walk: err=%d\n", rc);
+		exit(1);
+	}
+
+	printf("dirs=%llu entries=%llu matched=%llu errors=%llu\n",
+	       stats.dirs, stats.entries, stats.matched, stats.errors);
+
+	if (reported != expected || stats.matched != expected ||
+	    stats.errors != 0) {
+		fprintf(stderr, "kvsns_walk: %llu entries, expected %llu\n",
+			reported, expected);
+		exit(1);
+	}
+}
+
+/* A tree left by a run that failed is used again */
+static void mkdir_or_lookup(kvsns_cred_t *cred, kvsns_ino_t *parent,
+			    char *name, kvsns_ino_t *dir)
+{
+	int rc;
+
+	rc = kvsns_mkdir(cred, parent, name, 0755, dir);
+	if (rc == -EEXIST)
+		rc = kvsns_lookup(cred, parent, name, dir);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_mkdir: err=%d\n", rc);
+		exit(1);
+	}
+}
+
+static void remove_tree(kvsns_cred_t *cred, kvsns_ino_t *root)
+{
+	kvsns_ino_t parent = KVSNS_ROOT_INODE;
+	kvsns_ino_t dir;
+	char name[NAME_MAX];
+	int rc;
+	int i, j;
+
+	for (i = 0; i < NB_DIRS; i++) {
+		snprintf(name, NAME_MAX, "dir%d", i);
+		rc = kvsns_lookup(cred, root, name, &dir);
+		if (rc != 0) {
+			fprintf(stderr, "kvsns_lookup: err=%d\n", rc);
+			exit(1);
+		}
+
+		for (j = 0; j < NB_FILES; j++) {
+			snprintf(name, NAME_MAX, "file%d", j);
+			rc = kvsns_unlink(cred, &dir, name);
+			if (rc != 0) {
+				fprintf(stderr, "kvsns_unlink: err=%d\n", rc);
+				exit(1);
+			}
+		}
+
+		snprintf(name, NAME_MAX, "dir%d", i);
+		rc = kvsns_rmdir(cred, root, name);
+		if (rc != 0) {
+			fprintf(stderr, "kvsns_rmdir: err=%d\n", rc);
+			exit(1);
+		}
+	}
+
+	rc = kvsns_rmdir(cred, &parent, "walk");
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_rmdir: err=%d\n", rc);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	kvsns_ino_t root = 0LL;
+	kvsns_ino_t dir = 0LL;
+	kvsns_ino_t ino = 0LL;
+	kvsns_ino_t parent = 0LL;
+	kvsns_cred_t cred;
+	kvsns_walk_filter_t filter;
+	kvsns_walk_params_t params;
+	char name[NAME_MAX];
+	int i, j;
+
+	cred.uid = getuid();
+	cred.gid = getgid();
+
+	rc = kvsns_start(KVSNS_DEFAULT_CONFIG);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init: err=%d\n", rc);
+		exit(1);
+	}
+
+	rc = kvsns_init_root(1);
+	if (rc != 0) {
+		fprintf(stderr, "kvsns_init_root: err=%d\n", rc);
+		exit(1);
+	}
+
+	parent = KVSNS_ROOT_INODE;
+	mkdir_or_lookup(&cred, &parent, "walk", &root);
+
+	for (i = 0; i < NB_DIRS; i++) {
+		snprintf(name, NAME_MAX, "dir%d", i);
+		mkdir_or_lookup(&cred, &root, name, &dir);
+
+		for (j = 0; j < NB_FILES; j++) {
+			snprintf(name, NAME_MAX, "file%d", j);
+			rc = kvsns_creat(&cred, &dir, name, 0644, &ino);
+			if (rc != 0 && rc != -EEXIST) {
+				fprintf(stderr, "kvsns_creat: err=%d\n", rc);
+				exit(1);
+			}
+		}
+	}
+
+	/* Small queue and pages: workers steal and list branches inline */
+	params.workers = 4;
+	params.queue_max = 2;
+	params.batch = 7;
+	params.maxdepth = -1;
+
+	walk(&cred, &root, NULL, &params, NULL,
+	     1 + NB_DIRS + NB_DIRS * NB_FILES);
+	walk(&cred, &root, NULL, NULL, "dir3",
+	     1 + NB_DIRS + (NB_DIRS - 1) * NB_FILES);
+
+	params.maxdepth = 1;
+	walk(&cred, &root, NULL, &params, NULL, 1 + NB_DIRS);
+
+	memset(&filter, 0, sizeof(filter));
+	filter.mask = KVSNS_FILTER_TYPE | KVSNS_FILTER_NAME;
+	filter.type = S_IFREG;
+	filter.name = "file1*";
+	walk(&cred, &root, &filter, NULL, NULL, NB_DIRS * 11);
+
+	remove_tree(&cred, &root);
+
+	printf("######## OK ########\n");
+	return 0;
+}